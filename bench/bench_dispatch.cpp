@@ -0,0 +1,254 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_dispatch.cpp
+    @brief Measures the cost of the event VM's opcode dispatch
+
+    Usage: bench_dispatch [events] [repeats]
+
+    Drives a single machine with a pseudo-random mix of events that run,
+    push, pop, transition and bubble unhandled through the stack, so that
+    the VM's dispatch is not trivially predictable.  Built twice - as
+    bench_dispatch, with the interpreter the compiler supports by default,
+    and as bench_dispatch_switch, with STATE_MACHINE_THREADED=0.
+
+    Reports the best ns/event over the repeated runs as CSV, alongside the
+    instructions and branch mispredictions per event counted by the CPU's
+    performance counters (Linux only; reported as -1 where unavailable).
+*/
+#include "state_machine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace Mark3;
+
+namespace
+{
+enum class BenchOp : uint8_t {
+    run,        // Handle the event in the current state
+    transition, // Transition to the other state at the same level
+    push,       // Push a state
+    pop,        // Pop the current state
+    bubble      // Leave the event unhandled in every state
+};
+
+typedef struct {
+    BenchOp eOp;
+} BenchEvent_t;
+
+// Two states per stack level, so transitions stay at the same level
+const uint16_t kStateCount = MAX_STATE_STACK_DEPTH * 2;
+
+volatile uint32_t g_u32Sink; // Keeps handler side-effects observable
+
+//---------------------------------------------------------------------------
+StateReturn RunState(StateMachine* pclSM_, const void* pvEvent_)
+{
+    switch (static_cast<const BenchEvent_t*>(pvEvent_)->eOp) {
+        case BenchOp::run: {
+            g_u32Sink = g_u32Sink + 1;
+            return StateReturn::ok;
+        }
+        case BenchOp::transition: {
+            pclSM_->TransitionState(pclSM_->GetCurrentState() ^ 1);
+            return StateReturn::transition;
+        }
+        case BenchOp::push: {
+            pclSM_->PushState(pclSM_->GetStackDepth() * 2);
+            return StateReturn::transition;
+        }
+        case BenchOp::pop: {
+            pclSM_->PopState();
+            return StateReturn::transition;
+        }
+        default: break;
+    }
+    return StateReturn::unhandled;
+}
+
+//---------------------------------------------------------------------------
+// Event sequence that keeps the stack between 1 and the maximum depth
+std::vector<BenchEvent_t> BuildEvents(uint32_t u32Events_)
+{
+    std::vector<BenchEvent_t> clEvents(u32Events_);
+    uint32_t                  u32Seed  = 0x2545F491;
+    uint16_t                  u16Depth = 1;
+
+    for (auto& stEvent : clEvents) {
+        u32Seed  = (u32Seed * 1103515245) + 12345;
+        auto eOp = static_cast<BenchOp>((u32Seed >> 16) % 5);
+        if ((eOp == BenchOp::push) && (u16Depth == MAX_STATE_STACK_DEPTH)) {
+            eOp = BenchOp::pop;
+        } else if ((eOp == BenchOp::pop) && (u16Depth == 1)) {
+            eOp = BenchOp::push;
+        }
+        if (eOp == BenchOp::push) {
+            u16Depth++;
+        } else if (eOp == BenchOp::pop) {
+            u16Depth--;
+        }
+        stEvent.eOp = eOp;
+    }
+    return clEvents;
+}
+
+//---------------------------------------------------------------------------
+/**
+ * Per-process hardware counters - instructions retired and branches
+ * mispredicted, in user space only.
+ */
+class BenchCounters
+{
+public:
+    BenchCounters() : m_iInstructions{-1}, m_iBranchMisses{-1}
+    {
+#if defined(__linux__)
+        m_iInstructions = Open(PERF_COUNT_HW_INSTRUCTIONS);
+        m_iBranchMisses = Open(PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+    }
+
+    ~BenchCounters()
+    {
+#if defined(__linux__)
+        if (m_iInstructions >= 0) {
+            close(m_iInstructions);
+        }
+        if (m_iBranchMisses >= 0) {
+            close(m_iBranchMisses);
+        }
+#endif
+    }
+
+    bool IsAvailable() const { return (m_iInstructions >= 0) && (m_iBranchMisses >= 0); }
+
+    void Start()
+    {
+#if defined(__linux__)
+        if (IsAvailable()) {
+            ioctl(m_iInstructions, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_iBranchMisses, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_iInstructions, PERF_EVENT_IOC_ENABLE, 0);
+            ioctl(m_iBranchMisses, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void Stop(uint64_t* pu64Instructions_, uint64_t* pu64BranchMisses_)
+    {
+        *pu64Instructions_ = 0;
+        *pu64BranchMisses_ = 0;
+#if defined(__linux__)
+        if (IsAvailable()) {
+            ioctl(m_iInstructions, PERF_EVENT_IOC_DISABLE, 0);
+            ioctl(m_iBranchMisses, PERF_EVENT_IOC_DISABLE, 0);
+            if ((read(m_iInstructions, pu64Instructions_, sizeof(uint64_t)) != sizeof(uint64_t))
+                || (read(m_iBranchMisses, pu64BranchMisses_, sizeof(uint64_t)) != sizeof(uint64_t))) {
+                *pu64Instructions_ = 0;
+                *pu64BranchMisses_ = 0;
+            }
+        }
+#endif
+    }
+
+private:
+#if defined(__linux__)
+    static int Open(uint64_t u64Config_)
+    {
+        struct perf_event_attr stAttr;
+        memset(&stAttr, 0, sizeof(stAttr));
+        stAttr.type           = PERF_TYPE_HARDWARE;
+        stAttr.size           = sizeof(stAttr);
+        stAttr.config         = u64Config_;
+        stAttr.disabled       = 1;
+        stAttr.exclude_kernel = 1;
+        stAttr.exclude_hv     = 1;
+        return static_cast<int>(syscall(SYS_perf_event_open, &stAttr, 0, -1, -1, 0));
+    }
+#endif
+
+    int m_iInstructions;
+    int m_iBranchMisses;
+};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    uint32_t u32Events  = (argc > 1) ? static_cast<uint32_t>(atoi(argv[1])) : 1000000;
+    uint16_t u16Repeats = (argc > 2) ? static_cast<uint16_t>(atoi(argv[2])) : 5;
+    if ((u32Events == 0) || (u16Repeats == 0)) {
+        fprintf(stderr, "usage: bench_dispatch [events] [repeats]\n");
+        return 1;
+    }
+
+    State_t astStates[kStateCount];
+    for (auto& stState : astStates) {
+        stState = {nullptr, RunState, nullptr};
+    }
+
+    auto          clEvents = BuildEvents(u32Events);
+    StateMachine  clSM;
+    BenchCounters clCounters;
+    clSM.SetStates(astStates, kStateCount);
+
+    double   dBest           = 0.0;
+    uint64_t u64Instructions = 0;
+    uint64_t u64BranchMisses = 0;
+    for (uint16_t i = 0; i < u16Repeats; i++) {
+        clSM.Begin();
+        uint64_t u64RunInstructions;
+        uint64_t u64RunBranchMisses;
+
+        auto clStart = std::chrono::steady_clock::now();
+        clCounters.Start();
+        for (const auto& stEvent : clEvents) {
+            clSM.HandleEvent(&stEvent);
+        }
+        clCounters.Stop(&u64RunInstructions, &u64RunBranchMisses);
+        auto dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - clStart).count();
+
+        if ((i == 0) || (dSeconds < dBest)) {
+            dBest = dSeconds;
+        }
+        if ((i == 0) || (u64RunInstructions < u64Instructions)) {
+            u64Instructions = u64RunInstructions;
+        }
+        if ((i == 0) || (u64RunBranchMisses < u64BranchMisses)) {
+            u64BranchMisses = u64RunBranchMisses;
+        }
+    }
+
+    printf("interpreter,events,ns_per_event,instructions_per_event,branch_misses_per_event\n");
+    printf("%s,%u,%.2f,", STATE_MACHINE_THREADED ? "threaded" : "switch", u32Events, (dBest * 1e9) / u32Events);
+    if (clCounters.IsAvailable()) {
+        printf("%.2f,%.4f\n",
+               static_cast<double>(u64Instructions) / u32Events,
+               static_cast<double>(u64BranchMisses) / u32Events);
+    } else {
+        printf("-1,-1\n");
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_dispatcher.cpp
+    @brief Measures the wakeup latency and idle cost of FleetDispatcher
+
+    Usage: bench_dispatcher [threads] [samples]
+
+    Runs a FleetExecutor on FleetDispatcher threads, configured to either:
+
+      busy_poll    - spin forever looking for work, never blocking
+      spin_park    - spin for the default number of rounds, then block
+
+    and reports, for each configuration:
+
+      idle_cpu_pct      - CPU used by the dispatcher while it has no work,
+                          as a percentage of one core
+      wake_median_ns    - time from posting an event to an idle machine, to
+      wake_p99_ns         its handler running, after the dispatcher has been
+                          idle long enough to block
+      wakes_per_burst   - wakeup system calls made for a burst of posts to
+                          every machine
+
+    Linux only.  Results are written to stdout as CSV.
+*/
+#include "fleet_dispatcher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace Mark3;
+
+namespace
+{
+const uint16_t kMachines = 16;
+const uint16_t kBursts   = 50;
+
+typedef FleetStateMachine<MpscEventQueue<16>> BenchMachine;
+typedef std::chrono::steady_clock::time_point TimePoint_t;
+
+uint32_t    g_u32Handled;
+TimePoint_t g_clHandledAt;
+
+//---------------------------------------------------------------------------
+StateReturn RunState(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/)
+{
+    g_clHandledAt = std::chrono::steady_clock::now();
+    __atomic_fetch_add(&g_u32Handled, 1, __ATOMIC_RELEASE);
+    return StateReturn::ok;
+}
+
+const State_t g_astStates[] = {{nullptr, RunState, nullptr}};
+
+//---------------------------------------------------------------------------
+double ProcessCpuSeconds()
+{
+    struct timespec stTime;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stTime);
+    return stTime.tv_sec + (stTime.tv_nsec / 1e9);
+}
+
+//---------------------------------------------------------------------------
+void WaitHandled(uint32_t u32Count_)
+{
+    while (__atomic_load_n(&g_u32Handled, __ATOMIC_ACQUIRE) < u32Count_) {
+        sched_yield();
+    }
+}
+
+//---------------------------------------------------------------------------
+void RunCase(const char*    szName_,
+             uint32_t       u32SpinRounds_,
+             FleetExecutor* pclExecutor_,
+             BenchMachine*  paclMachines_,
+             uint16_t       u16Samples_)
+{
+    std::vector<FleetDispatcherThread> clThreads(pclExecutor_->GetWorkerCount());
+    FleetDispatcher                    clDispatcher;
+    clDispatcher.SetSpinRounds(u32SpinRounds_);
+    clDispatcher.Start(pclExecutor_, clThreads.data());
+
+    // CPU used while idle - the calling thread sleeps throughout
+    usleep(50000);
+    auto dCpuStart = ProcessCpuSeconds();
+    auto clStart   = std::chrono::steady_clock::now();
+    usleep(500000);
+    auto dCpu  = ProcessCpuSeconds() - dCpuStart;
+    auto dWall = std::chrono::duration<double>(std::chrono::steady_clock::now() - clStart).count();
+
+    // Wakeup latency, posting once the dispatcher has gone idle
+    int                 iEvent = 0;
+    std::vector<double> clSamples;
+    for (uint16_t i = 0; i < u16Samples_; i++) {
+        usleep(2000);
+        auto u32Handled = __atomic_load_n(&g_u32Handled, __ATOMIC_ACQUIRE);
+        auto clPosted   = std::chrono::steady_clock::now();
+        paclMachines_[i % kMachines].Post(&iEvent);
+        WaitHandled(u32Handled + 1);
+        clSamples.push_back(std::chrono::duration<double, std::nano>(g_clHandledAt - clPosted).count());
+    }
+    std::sort(clSamples.begin(), clSamples.end());
+
+    // Wakeup calls made for bursts of posts to every machine
+    auto u32WakeCalls = clDispatcher.GetWakeCallCount();
+    for (uint16_t i = 0; i < kBursts; i++) {
+        usleep(2000);
+        auto u32Handled = __atomic_load_n(&g_u32Handled, __ATOMIC_ACQUIRE);
+        for (uint16_t j = 0; j < kMachines; j++) {
+            paclMachines_[j].Post(&iEvent);
+        }
+        WaitHandled(u32Handled + kMachines);
+    }
+    u32WakeCalls = clDispatcher.GetWakeCallCount() - u32WakeCalls;
+    clDispatcher.Stop();
+
+    printf("%s,%u,%.1f,%.0f,%.0f,%.2f\n",
+           szName_,
+           pclExecutor_->GetWorkerCount(),
+           (dCpu * 100.0) / dWall,
+           clSamples[clSamples.size() / 2],
+           clSamples[(clSamples.size() * 99) / 100],
+           static_cast<double>(u32WakeCalls) / kBursts);
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    uint16_t u16Threads = (argc > 1) ? static_cast<uint16_t>(atoi(argv[1])) : 2;
+    uint16_t u16Samples = (argc > 2) ? static_cast<uint16_t>(atoi(argv[2])) : 200;
+    if ((u16Threads == 0) || (u16Samples == 0)) {
+        fprintf(stderr, "usage: bench_dispatcher [threads] [samples]\n");
+        return 1;
+    }
+
+    std::vector<FleetWorker> clWorkers(u16Threads);
+    FleetExecutor            clExecutor;
+    clExecutor.Init(clWorkers.data(), u16Threads);
+
+    std::vector<BenchMachine> clMachines(kMachines);
+    for (auto& clMachine : clMachines) {
+        clMachine.SetStates(g_astStates, 1);
+        clMachine.Begin();
+        clMachine.SetExecutor(&clExecutor);
+    }
+
+    printf("case,threads,idle_cpu_pct,wake_median_ns,wake_p99_ns,wakes_per_burst\n");
+    RunCase("busy_poll", UINT32_MAX, &clExecutor, clMachines.data(), u16Samples);
+    RunCase("spin_park", FLEET_DISPATCHER_SPIN_ROUNDS, &clExecutor, clMachines.data(), u16Samples);
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_fleet.cpp
+    @brief Measures FleetExecutor throughput as the number of workers grows
+
+    Usage: bench_fleet [max_workers] [machines] [events_per_machine]
+
+    Each machine is seeded with a fixed number of in-flight events; every
+    event does a small amount of work and re-posts itself to its machine
+    until the machine's event quota is used up.  Results are written to
+    stdout as CSV, one row per worker count.
+*/
+#include "fleet_executor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace Mark3;
+
+namespace
+{
+const uint16_t kInFlight = 8;  // Events posted to each machine up-front
+const uint32_t kWork     = 64; // Iterations of synthetic work per event
+
+typedef FleetStateMachine<MpscEventQueue<16>> BenchMachine;
+
+struct BenchContext {
+    BenchMachine* pclSM;
+    uint32_t      u32Remaining;
+    uint32_t      u32Hash;
+};
+
+uint32_t g_u32Pending; // Events left to process across the whole fleet
+
+//---------------------------------------------------------------------------
+StateReturn RunState(StateMachine* pclSM_, const void* pvEvent_)
+{
+    auto pstContext = static_cast<BenchContext*>(pclSM_->GetContext());
+
+    auto u32Hash = pstContext->u32Hash;
+    for (uint32_t i = 0; i < kWork; i++) {
+        u32Hash ^= u32Hash << 13;
+        u32Hash ^= u32Hash >> 17;
+        u32Hash ^= u32Hash << 5;
+    }
+    pstContext->u32Hash = u32Hash;
+
+    if (pstContext->u32Remaining > kInFlight) {
+        pstContext->pclSM->Post(pvEvent_);
+    }
+    pstContext->u32Remaining--;
+    __atomic_fetch_sub(&g_u32Pending, 1, __ATOMIC_RELEASE);
+    return StateReturn::ok;
+}
+
+const State_t astBenchStates[] = { { nullptr, RunState, nullptr } };
+
+//---------------------------------------------------------------------------
+void Idle(uint16_t /*u16WorkerId_*/, uint32_t /*u32IdleRounds_*/)
+{
+    std::this_thread::yield();
+}
+
+//---------------------------------------------------------------------------
+double RunFleet(uint16_t u16Workers_, uint32_t u32Machines_, uint32_t u32Events_, uint32_t* pu32Steals_)
+{
+    FleetExecutor            clExecutor;
+    std::vector<FleetWorker> aclWorkers(u16Workers_);
+    clExecutor.Init(aclWorkers.data(), u16Workers_);
+    clExecutor.SetIdleHandler(Idle);
+
+    std::vector<BenchMachine> aclMachines(u32Machines_);
+    std::vector<BenchContext> astContexts(u32Machines_);
+    int                       iEvent = 0;
+
+    g_u32Pending = u32Machines_ * u32Events_;
+    for (uint32_t i = 0; i < u32Machines_; i++) {
+        astContexts[i].pclSM        = &aclMachines[i];
+        astContexts[i].u32Remaining = u32Events_;
+        astContexts[i].u32Hash      = i + 1;
+        aclMachines[i].SetStates(astBenchStates, 1);
+        aclMachines[i].SetContext(&astContexts[i]);
+        aclMachines[i].SetExecutor(&clExecutor);
+        aclMachines[i].Begin();
+    }
+
+    bool bStop  = false;
+    auto clStart = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> aclThreads;
+    for (uint16_t i = 0; i < u16Workers_; i++) {
+        aclThreads.emplace_back([&clExecutor, &bStop, i]() { clExecutor.Run(i, &bStop); });
+    }
+    for (uint32_t i = 0; i < u32Machines_; i++) {
+        for (uint16_t j = 0; j < kInFlight; j++) {
+            aclMachines[i].Post(&iEvent);
+        }
+    }
+    while (__atomic_load_n(&g_u32Pending, __ATOMIC_ACQUIRE) != 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    auto clEnd = std::chrono::steady_clock::now();
+
+    __atomic_store_n(&bStop, true, __ATOMIC_RELEASE);
+    for (auto& clThread : aclThreads) {
+        clThread.join();
+    }
+
+    *pu32Steals_ = 0;
+    for (auto& clWorker : aclWorkers) {
+        *pu32Steals_ += clWorker.GetStealCount();
+    }
+    return std::chrono::duration<double>(clEnd - clStart).count();
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    auto u16MaxWorkers = static_cast<uint16_t>(std::thread::hardware_concurrency());
+    if (argc > 1) {
+        u16MaxWorkers = static_cast<uint16_t>(atoi(argv[1]));
+    }
+    if (u16MaxWorkers == 0) {
+        u16MaxWorkers = 1;
+    }
+    uint32_t u32Machines = (argc > 2) ? static_cast<uint32_t>(atoi(argv[2])) : 16384;
+    uint32_t u32Events   = (argc > 3) ? static_cast<uint32_t>(atoi(argv[3])) : 64;
+    if (u32Events < kInFlight) {
+        u32Events = kInFlight;
+    }
+
+    printf("workers,machines,events,seconds,events_per_sec,speedup,steals\n");
+    double dBaseline = 0.0;
+    for (uint16_t u16Workers = 1; u16Workers <= u16MaxWorkers; u16Workers++) {
+        uint32_t u32Steals;
+        double   dSeconds = RunFleet(u16Workers, u32Machines, u32Events, &u32Steals);
+        double   dRate    = static_cast<double>(u32Machines) * u32Events / dSeconds;
+        if (u16Workers == 1) {
+            dBaseline = dRate;
+        }
+        printf("%u,%u,%u,%.6f,%.0f,%.2f,%u\n",
+               u16Workers,
+               u32Machines,
+               u32Events,
+               dSeconds,
+               dRate,
+               dRate / dBaseline,
+               u32Steals);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_pairs.cpp
+    @brief Measures batched dispatch of events to many machines
+
+    Usage: bench_pairs [repeats]
+
+    Events are dispatched to machines chosen at random from fleets of
+    increasing size.  Machines share a large state table, each sitting in a
+    random state, so that at large fleet sizes both the machine objects and
+    their state table entries miss in cache.  For each fleet size, reports
+    the best ns per event over the repeats for:
+
+      loop       - calling each machine's HandleEvent() in turn
+      pairs      - StateMachine::HandleEventPairs(), which prefetches the
+                   machines and state table entries of the events ahead
+
+    Results are written to stdout as CSV.
+*/
+#include "state_machine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+using namespace Mark3;
+
+namespace
+{
+// States in the shared table - as many as the state index type allows, up to 8192
+const uint32_t kStates    = (STATE_INDEX_NONE < 8192u) ? STATE_INDEX_NONE : 8192u;
+const uint32_t kEvents    = 1 << 20; // Events dispatched per repeat
+const uint32_t kBatchSize = 1024;    // Pairs passed to each HandleEventPairs() call
+
+volatile uint32_t g_u32Sink; // Keeps handler side-effects observable
+
+//---------------------------------------------------------------------------
+StateReturn MoveState(StateMachine* pclSM_, const void* pvEvent_)
+{
+    pclSM_->TransitionState(*static_cast<const StateIndex_t*>(pvEvent_));
+    return StateReturn::transition;
+}
+
+//---------------------------------------------------------------------------
+StateReturn RunState(StateMachine* /*pclSM_*/, const void* pvEvent_)
+{
+    g_u32Sink = g_u32Sink + *static_cast<const uint32_t*>(pvEvent_);
+    return StateReturn::ok;
+}
+
+State_t g_astStates[kStates];
+
+//---------------------------------------------------------------------------
+uint32_t Random(uint32_t* pu32State_)
+{
+    auto u32State = *pu32State_;
+    u32State ^= u32State << 13;
+    u32State ^= u32State >> 17;
+    u32State ^= u32State << 5;
+    *pu32State_ = u32State;
+    return u32State;
+}
+
+//---------------------------------------------------------------------------
+// Best ns per event, dispatching either one event at a time or in batches
+double RunCase(const std::vector<StateEventPair_t>& clPairs_, bool bPairs_, uint16_t u16Repeats_)
+{
+    double dBest = 0.0;
+    for (uint16_t i = 0; i < u16Repeats_; i++) {
+        auto clStart = std::chrono::steady_clock::now();
+        if (bPairs_) {
+            for (uint32_t j = 0; j < kEvents; j += kBatchSize) {
+                StateMachine::HandleEventPairs(&clPairs_[j], kBatchSize);
+            }
+        } else {
+            for (auto& stPair : clPairs_) {
+                stPair.pclSM->HandleEvent(stPair.pvEvent);
+            }
+        }
+        auto dNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - clStart).count();
+        if ((i == 0) || (dNs < dBest)) {
+            dBest = dNs;
+        }
+    }
+    return dBest / kEvents;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    uint16_t u16Repeats = (argc > 1) ? static_cast<uint16_t>(atoi(argv[1])) : 5;
+    if (u16Repeats == 0) {
+        fprintf(stderr, "usage: bench_pairs [repeats]\n");
+        return 1;
+    }
+
+    // State 0 moves each machine to the state given by its first event
+    g_astStates[0] = {nullptr, MoveState, nullptr};
+    for (uint32_t i = 1; i < kStates; i++) {
+        g_astStates[i] = {nullptr, RunState, nullptr};
+    }
+
+    uint32_t u32Random = 0x12345678;
+    uint32_t u32Value  = 1;
+
+    printf("machines,loop_ns,pairs_ns,speedup\n");
+    const uint32_t au32Fleets[] = {16, 256, 4096, 65536, 262144};
+    for (auto u32Machines : au32Fleets) {
+        std::vector<StateMachine> clMachines(u32Machines);
+        for (auto& clMachine : clMachines) {
+            StateIndex_t uXState = static_cast<StateIndex_t>(1 + (Random(&u32Random) % (kStates - 1)));
+            clMachine.SetStates(g_astStates, static_cast<StateIndex_t>(kStates));
+            clMachine.Begin();
+            clMachine.HandleEvent(&uXState);
+        }
+
+        std::vector<StateEventPair_t> clPairs(kEvents);
+        for (auto& stPair : clPairs) {
+            stPair = {&clMachines[Random(&u32Random) % u32Machines], &u32Value};
+        }
+
+        auto dLoop  = RunCase(clPairs, false, u16Repeats);
+        auto dPairs = RunCase(clPairs, true, u16Repeats);
+        printf("%u,%.2f,%.2f,%.2f\n", u32Machines, dLoop, dPairs, dLoop / dPairs);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_priority.cpp
+    @brief Measures the latency of control events queued behind data events
+
+    Usage: bench_priority [repeats]
+
+    A queued machine is given a backlog of low-priority data events, and a
+    single control event is then posted.  The latency reported is the time
+    from posting the control event to its handler running, as the machine
+    drains its queue, for:
+
+      fifo       - all events in a single MpscEventQueue
+      priority   - data events at level 0 and the control event at level 1
+                   of a PriorityEventQueue
+
+    Also reports the cost of a post/pop pair on each queue type.  Results
+    are written to stdout as CSV, with the median latency over the repeats.
+*/
+#include "event_queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace Mark3;
+
+namespace
+{
+const uint16_t kQueueSize = 4096;
+
+typedef MpscEventQueue<kQueueSize>            FifoQueue;
+typedef PriorityEventQueue<FifoQueue, 2>      PriorityQueue;
+typedef std::chrono::steady_clock::time_point TimePoint_t;
+
+typedef struct {
+    bool bControl;
+} BenchEvent_t;
+
+TimePoint_t       g_clHandled;
+volatile uint32_t g_u32Sink; // Keeps handler side-effects observable
+
+//---------------------------------------------------------------------------
+StateReturn RunState(StateMachine* /*pclSM_*/, const void* pvEvent_)
+{
+    if (static_cast<const BenchEvent_t*>(pvEvent_)->bControl) {
+        g_clHandled = std::chrono::steady_clock::now();
+        return StateReturn::ok;
+    }
+
+    // A data event does a small amount of work
+    for (int i = 0; i < 16; i++) {
+        g_u32Sink = g_u32Sink + 1;
+    }
+    return StateReturn::ok;
+}
+
+const State_t g_astStates[] = {{nullptr, RunState, nullptr}};
+
+const BenchEvent_t g_stData    = {false};
+const BenchEvent_t g_stControl = {true};
+
+//---------------------------------------------------------------------------
+bool PostControl(QueuedStateMachine<FifoQueue>* pclSM_)
+{
+    return pclSM_->Post(&g_stControl);
+}
+
+//---------------------------------------------------------------------------
+bool PostControl(QueuedStateMachine<PriorityQueue>* pclSM_)
+{
+    return pclSM_->Post(1, &g_stControl);
+}
+
+//---------------------------------------------------------------------------
+// Median latency of the control event, in ns, behind a backlog of data
+template <typename Queue>
+double ControlLatency(QueuedStateMachine<Queue>* pclSM_, uint16_t u16Backlog_, uint16_t u16Repeats_)
+{
+    std::vector<double> clSamples;
+    for (uint16_t i = 0; i < u16Repeats_; i++) {
+        for (uint16_t j = 0; j < u16Backlog_; j++) {
+            pclSM_->Post(&g_stData);
+        }
+
+        auto clPosted = std::chrono::steady_clock::now();
+        if (!PostControl(pclSM_)) {
+            fprintf(stderr, "queue full\n");
+            exit(1);
+        }
+        pclSM_->Drain();
+        clSamples.push_back(std::chrono::duration<double, std::nano>(g_clHandled - clPosted).count());
+    }
+    std::sort(clSamples.begin(), clSamples.end());
+    return clSamples[clSamples.size() / 2];
+}
+
+//---------------------------------------------------------------------------
+// Best ns per post/pop pair, through a queue kept at a fixed depth
+template <typename Queue>
+double PostPopCost(Queue* pclQueue_, uint16_t u16Repeats_)
+{
+    const uint32_t u32Ops = 1000000;
+    const void*    pvEvent;
+    double         dBest = 0.0;
+
+    for (uint16_t i = 0; i < 64; i++) {
+        pclQueue_->Post(&g_stData);
+    }
+    for (uint16_t i = 0; i < u16Repeats_; i++) {
+        auto clStart = std::chrono::steady_clock::now();
+        for (uint32_t j = 0; j < u32Ops; j++) {
+            pclQueue_->Post(&g_stData);
+            pclQueue_->Pop(&pvEvent);
+        }
+        auto dNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - clStart).count();
+        if ((i == 0) || (dNs < dBest)) {
+            dBest = dNs;
+        }
+    }
+    return dBest / u32Ops;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    uint16_t u16Repeats = (argc > 1) ? static_cast<uint16_t>(atoi(argv[1])) : 101;
+    if (u16Repeats == 0) {
+        fprintf(stderr, "usage: bench_priority [repeats]\n");
+        return 1;
+    }
+
+    // Static storage - the queues hold several thousand slots each
+    static QueuedStateMachine<FifoQueue>     clFifoSM;
+    static QueuedStateMachine<PriorityQueue> clPrioritySM;
+    clFifoSM.SetStates(g_astStates, 1);
+    clPrioritySM.SetStates(g_astStates, 1);
+    clFifoSM.Begin();
+    clPrioritySM.Begin();
+
+    printf("case,backlog,control_latency_ns\n");
+    const uint16_t au16Backlogs[] = {0, 16, 256, kQueueSize - 1};
+    for (auto u16Backlog : au16Backlogs) {
+        printf("fifo,%u,%.1f\n", u16Backlog, ControlLatency(&clFifoSM, u16Backlog, u16Repeats));
+        printf("priority,%u,%.1f\n", u16Backlog, ControlLatency(&clPrioritySM, u16Backlog, u16Repeats));
+    }
+
+    static FifoQueue     clFifo;
+    static PriorityQueue clPriority;
+    printf("\ncase,post_pop_ns\n");
+    printf("fifo,%.2f\n", PostPopCost(&clFifo, 5));
+    printf("priority,%.2f\n", PostPopCost(&clPriority, 5));
+    return 0;
+}
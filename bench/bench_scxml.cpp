@@ -0,0 +1,276 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_scxml.cpp
+    @brief Compares generated SCXML tables against hand-written handlers
+
+    Usage: bench_scxml [events] [repeats]
+
+    Drives the session protocol in bench_scxml.scxml with the same sequence
+    of events through three implementations, and reports the best ns/event
+    of each as CSV:
+
+      switch        - hand-written pfRun switch statements, StateMachine
+      switch_static - the same handlers, bound at compile-time with
+                      StaticStateMachine
+      generated     - handlers and event maps generated by
+                      tools/scxml_gen.py
+*/
+#include "bench_scxml_model.h"
+#include "static_state_machine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+using namespace Mark3;
+
+typedef struct {
+    uint16_t u16Id;     // BenchSession::EventId
+    uint16_t u16Window; // Non-zero if the receive window is open
+} SessionEvent_t;
+
+volatile uint32_t g_u32Data; // Keeps handler side-effects observable
+
+//---------------------------------------------------------------------------
+// Guard and action referenced by the model
+namespace BenchSession
+{
+bool benchWindowOpen(StateMachine* /*pclSM_*/, const void* pvEvent_)
+{
+    return static_cast<const SessionEvent_t*>(pvEvent_)->u16Window != 0;
+}
+
+void benchCountData(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/)
+{
+    g_u32Data = g_u32Data + 1;
+}
+} // namespace BenchSession
+
+namespace
+{
+using namespace BenchSession;
+
+//---------------------------------------------------------------------------
+// The same protocol, written by hand
+StateReturn SessionCommon(StateMachine* pclSM_, const SessionEvent_t* pstEvent_)
+{
+    switch (pstEvent_->u16Id) {
+        case BenchSession::reset:
+        case BenchSession::timeout: {
+            pclSM_->TransitionState(idle);
+            return StateReturn::transition;
+        }
+        default: break;
+    }
+    return StateReturn::unhandled;
+}
+
+//---------------------------------------------------------------------------
+StateReturn IdleRun(StateMachine* pclSM_, const void* pvEvent_)
+{
+    auto pstEvent = static_cast<const SessionEvent_t*>(pvEvent_);
+    if (pstEvent->u16Id == BenchSession::open) {
+        pclSM_->TransitionState(syn_sent);
+        return StateReturn::transition;
+    }
+    return StateReturn::unhandled;
+}
+
+//---------------------------------------------------------------------------
+StateReturn SynSentRun(StateMachine* pclSM_, const void* pvEvent_)
+{
+    auto pstEvent = static_cast<const SessionEvent_t*>(pvEvent_);
+    if (pstEvent->u16Id == BenchSession::ack) {
+        pclSM_->TransitionState(key_exchange);
+        return StateReturn::transition;
+    }
+    return SessionCommon(pclSM_, pstEvent);
+}
+
+//---------------------------------------------------------------------------
+StateReturn KeyExchangeRun(StateMachine* pclSM_, const void* pvEvent_)
+{
+    auto pstEvent = static_cast<const SessionEvent_t*>(pvEvent_);
+    if (pstEvent->u16Id == BenchSession::ack) {
+        pclSM_->TransitionState(established);
+        return StateReturn::transition;
+    }
+    return SessionCommon(pclSM_, pstEvent);
+}
+
+//---------------------------------------------------------------------------
+StateReturn EstablishedRun(StateMachine* pclSM_, const void* pvEvent_)
+{
+    auto pstEvent = static_cast<const SessionEvent_t*>(pvEvent_);
+    switch (pstEvent->u16Id) {
+        case BenchSession::data: {
+            if (pstEvent->u16Window != 0) {
+                g_u32Data = g_u32Data + 1;
+                return StateReturn::ok;
+            }
+            pclSM_->TransitionState(draining);
+            return StateReturn::transition;
+        }
+        case BenchSession::close: {
+            pclSM_->TransitionState(closing);
+            return StateReturn::transition;
+        }
+        default: break;
+    }
+    return SessionCommon(pclSM_, pstEvent);
+}
+
+//---------------------------------------------------------------------------
+StateReturn DrainingRun(StateMachine* pclSM_, const void* pvEvent_)
+{
+    auto pstEvent = static_cast<const SessionEvent_t*>(pvEvent_);
+    switch (pstEvent->u16Id) {
+        case BenchSession::ack: {
+            pclSM_->TransitionState(established);
+            return StateReturn::transition;
+        }
+        case BenchSession::close: {
+            pclSM_->TransitionState(closing);
+            return StateReturn::transition;
+        }
+        default: break;
+    }
+    return SessionCommon(pclSM_, pstEvent);
+}
+
+//---------------------------------------------------------------------------
+StateReturn ClosingRun(StateMachine* pclSM_, const void* pvEvent_)
+{
+    auto pstEvent = static_cast<const SessionEvent_t*>(pvEvent_);
+    if (pstEvent->u16Id == BenchSession::ack) {
+        pclSM_->TransitionState(idle);
+        return StateReturn::transition;
+    }
+    return SessionCommon(pclSM_, pstEvent);
+}
+
+// Indexed by the generated StateId, so both machines number states alike
+constexpr State_t g_astSwitchStates[state_count] = {
+    {nullptr, IdleRun, nullptr},
+    {nullptr, EstablishedRun, nullptr},
+    {nullptr, SynSentRun, nullptr},
+    {nullptr, KeyExchangeRun, nullptr},
+    {nullptr, DrainingRun, nullptr},
+    {nullptr, ClosingRun, nullptr},
+};
+
+static_assert((idle == 0) && (established == 1) && (syn_sent == 2) && (key_exchange == 3) && (draining == 4)
+                  && (closing == 5),
+              "Hand-written table must match the generated state order");
+
+//---------------------------------------------------------------------------
+// One session: handshake, four windows of data, then close.
+const uint16_t kPatternLength = 3 + (4 * 9) + 2;
+SessionEvent_t g_astPattern[kPatternLength];
+
+void BuildPattern()
+{
+    uint16_t u16Event = 0;
+    g_astPattern[u16Event++] = {BenchSession::open, 0};
+    g_astPattern[u16Event++] = {BenchSession::ack, 0};
+    g_astPattern[u16Event++] = {BenchSession::ack, 0};
+    for (uint16_t u16Window = 0; u16Window < 4; u16Window++) {
+        for (uint16_t i = 0; i < 7; i++) {
+            g_astPattern[u16Event++] = {BenchSession::data, 1};
+        }
+        g_astPattern[u16Event++] = {BenchSession::data, 0};
+        g_astPattern[u16Event++] = {BenchSession::ack, 0};
+    }
+    g_astPattern[u16Event++] = {BenchSession::close, 0};
+    g_astPattern[u16Event++] = {BenchSession::ack, 0};
+}
+
+//---------------------------------------------------------------------------
+// Run whole sessions through a machine, returning the best ns/event
+template <typename Machine, typename Dispatch>
+double RunCase(Machine* pclSM_, Dispatch fnDispatch_, uint32_t u32Events_, uint16_t u16Repeats_)
+{
+    pclSM_->Begin();
+
+    auto   u32Sessions = (u32Events_ + kPatternLength - 1) / kPatternLength;
+    double dBest       = 0.0;
+    for (uint16_t u16Repeat = 0; u16Repeat < u16Repeats_; u16Repeat++) {
+        auto clStart = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < u32Sessions; i++) {
+            for (uint16_t j = 0; j < kPatternLength; j++) {
+                fnDispatch_(pclSM_, &g_astPattern[j]);
+            }
+        }
+        auto clEnd = std::chrono::steady_clock::now();
+
+        auto dNs = std::chrono::duration<double, std::nano>(clEnd - clStart).count() / (u32Sessions * kPatternLength);
+        if ((u16Repeat == 0) || (dNs < dBest)) {
+            dBest = dNs;
+        }
+    }
+
+    if ((pclSM_->GetCurrentState() != idle) || (pclSM_->GetUnhandledCount() != 0)) {
+        fprintf(stderr, "machine did not follow the protocol\n");
+        exit(1);
+    }
+    return dBest;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    uint32_t u32Events  = (argc > 1) ? static_cast<uint32_t>(atoi(argv[1])) : 1000000;
+    uint16_t u16Repeats = (argc > 2) ? static_cast<uint16_t>(atoi(argv[2])) : 5;
+    if ((u32Events == 0) || (u16Repeats == 0)) {
+        fprintf(stderr, "usage: bench_scxml [events] [repeats]\n");
+        return 1;
+    }
+    BuildPattern();
+
+    StateMachine clSwitch;
+    clSwitch.SetStates(g_astSwitchStates, state_count);
+    auto dSwitch = RunCase(&clSwitch,
+                           [](StateMachine* pclSM_, const SessionEvent_t* pstEvent_) { pclSM_->HandleEvent(pstEvent_); },
+                           u32Events,
+                           u16Repeats);
+
+    StaticStateMachine<state_count, g_astSwitchStates> clStatic;
+    auto dStatic = RunCase(&clStatic,
+                           [](StaticStateMachine<state_count, g_astSwitchStates>* pclSM_,
+                              const SessionEvent_t*                                 pstEvent_) {
+                               pclSM_->HandleEvent(pstEvent_);
+                           },
+                           u32Events,
+                           u16Repeats);
+
+    StateMachine clGenerated;
+    if (!Bind(&clGenerated)) {
+        fprintf(stderr, "failed to bind generated tables\n");
+        return 1;
+    }
+    auto dGenerated = RunCase(&clGenerated,
+                              [](StateMachine* pclSM_, const SessionEvent_t* pstEvent_) {
+                                  pclSM_->HandleEvent(pstEvent_->u16Id, pstEvent_);
+                              },
+                              u32Events,
+                              u16Repeats);
+
+    printf("variant,events,ns_per_event\n");
+    printf("switch,%u,%.3f\n", u32Events, dSwitch);
+    printf("switch_static,%u,%.3f\n", u32Events, dStatic);
+    printf("generated,%u,%.3f\n", u32Events, dGenerated);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_snapshot.cpp
+    @brief Measures fleet snapshot/restore throughput
+
+    Usage: bench_snapshot [machines] [repeats]
+
+    Snapshots a fleet of machines into memory and restores it, reporting
+    the best throughput seen for each direction as CSV, alongside a plain
+    memcpy of the same number of bytes for reference.
+*/
+#include "state_machine_fleet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+using namespace Mark3;
+
+namespace
+{
+typedef struct {
+    uint8_t* pu8Data;
+    size_t   uOffset;
+} Stream_t;
+
+//---------------------------------------------------------------------------
+bool WriteStream(void* pvArg_, const void* pvData_, uint32_t u32Size_)
+{
+    auto pstStream = static_cast<Stream_t*>(pvArg_);
+    memcpy(&pstStream->pu8Data[pstStream->uOffset], pvData_, u32Size_);
+    pstStream->uOffset += u32Size_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool ReadStream(void* pvArg_, void* pvData_, uint32_t u32Size_)
+{
+    auto pstStream = static_cast<Stream_t*>(pvArg_);
+    memcpy(pvData_, &pstStream->pu8Data[pstStream->uOffset], u32Size_);
+    pstStream->uOffset += u32Size_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+StateReturn RunState(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/)
+{
+    return StateReturn::ok;
+}
+
+const State_t g_astStates[] = {{nullptr, RunState, nullptr}};
+
+//---------------------------------------------------------------------------
+template <typename Function>
+double BestSeconds(uint16_t u16Repeats_, Function fnRun_)
+{
+    double dBest = 0.0;
+    for (uint16_t i = 0; i < u16Repeats_; i++) {
+        auto clStart = std::chrono::steady_clock::now();
+        fnRun_();
+        auto dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - clStart).count();
+        if ((i == 0) || (dSeconds < dBest)) {
+            dBest = dSeconds;
+        }
+    }
+    return dBest;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    uint32_t u32Machines = (argc > 1) ? static_cast<uint32_t>(atoi(argv[1])) : 4000000;
+    uint16_t u16Repeats  = (argc > 2) ? static_cast<uint16_t>(atoi(argv[2])) : 5;
+    if ((u32Machines == 0) || (u16Repeats == 0)) {
+        fprintf(stderr, "usage: bench_snapshot [machines] [repeats]\n");
+        return 1;
+    }
+
+    std::vector<uint8_t>      clDepths(u32Machines);
+    std::vector<StateIndex_t> clStacks(static_cast<size_t>(u32Machines) * MAX_STATE_STACK_DEPTH);
+
+    StateMachineFleet clFleet;
+    clFleet.SetStates(g_astStates, 1);
+    clFleet.SetStorage(u32Machines, clDepths.data(), clStacks.data(), nullptr);
+    for (uint32_t i = 0; i < u32Machines; i++) {
+        clFleet.Begin(i);
+    }
+
+    auto uBytes = sizeof(StateFleetSnapshotHeader_t) + clDepths.size() + (clStacks.size() * sizeof(StateIndex_t));
+    std::vector<uint8_t> clImage(uBytes);
+    std::vector<uint8_t> clCopy(uBytes);
+
+    Stream_t stStream = {clImage.data(), 0};
+    auto     dSnapshot = BestSeconds(u16Repeats, [&]() {
+        stStream.uOffset = 0;
+        if (!clFleet.Snapshot(WriteStream, &stStream)) {
+            fprintf(stderr, "snapshot failed\n");
+            exit(1);
+        }
+    });
+    auto dRestore = BestSeconds(u16Repeats, [&]() {
+        stStream.uOffset = 0;
+        if (!clFleet.Restore(ReadStream, &stStream)) {
+            fprintf(stderr, "restore failed\n");
+            exit(1);
+        }
+    });
+    auto dMemcpy = BestSeconds(u16Repeats, [&]() { memcpy(clCopy.data(), clImage.data(), uBytes); });
+
+    printf("operation,machines,bytes,seconds,gb_per_sec\n");
+    printf("snapshot,%u,%zu,%.6f,%.3f\n", u32Machines, uBytes, dSnapshot, (uBytes / dSnapshot) / 1e9);
+    printf("restore,%u,%zu,%.6f,%.3f\n", u32Machines, uBytes, dRestore, (uBytes / dRestore) / 1e9);
+    printf("memcpy,%u,%zu,%.6f,%.3f\n", u32Machines, uBytes, dMemcpy, (uBytes / dMemcpy) / 1e9);
+    return 0;
+}
@@ -0,0 +1,336 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file bench_state.cpp
+    @brief Measures the cost of StateMachine::HandleEvent() on its hot paths
+
+    Usage: bench_state [--json] [events] [repeats]
+
+    Each case drives a single machine with a fixed sequence of events, and
+    reports the best ns/event over a number of repeated runs.  Cases are
+    run against state tables with and without entry/exit handlers:
+
+      run          - event handled by the current state, no state change
+      transition   - every event transitions between two states
+      push_pop     - events alternately push and pop a state
+      unhandled    - event bubbles unhandled through a stack of 1-8 states
+      unwind       - the bottom state transitions, exiting a full stack,
+                     which is then rebuilt by pushing a state per event
+      coroutine    - event resumes a coroutine state (see StateCoroutine),
+                     when built with STATE_MACHINE_COROUTINES
+
+    Results are written to stdout as CSV (default) or JSON, one record per
+    case, along with the tracing/profiling configuration the library was
+    built with, so results can be compared across releases.
+*/
+#include "state_machine.h"
+#include "state_coroutine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+using namespace Mark3;
+
+namespace
+{
+enum class BenchOp : uint8_t {
+    run,        // Handle the event in the current state
+    transition, // Transition to the other state at the same level
+    push,       // Push the next state
+    pop,        // Pop the current state
+    bubble,     // Leave the event unhandled in every state
+    unwind      // Transition from the bottom state, exiting all above it
+};
+
+typedef struct {
+    BenchOp eOp;
+} BenchEvent_t;
+
+const uint16_t kStateCount = MAX_STATE_STACK_DEPTH + 1;
+
+volatile uint32_t g_u32Sink; // Keeps handler side-effects observable
+
+//---------------------------------------------------------------------------
+void EntryState(StateMachine* /*pclSM_*/)
+{
+    g_u32Sink = g_u32Sink + 1;
+}
+
+//---------------------------------------------------------------------------
+void ExitState(StateMachine* /*pclSM_*/)
+{
+    g_u32Sink = g_u32Sink + 1;
+}
+
+//---------------------------------------------------------------------------
+StateReturn RunState(StateMachine* pclSM_, const void* pvEvent_)
+{
+    auto pstEvent = static_cast<const BenchEvent_t*>(pvEvent_);
+    switch (pstEvent->eOp) {
+        case BenchOp::run: {
+            g_u32Sink = g_u32Sink + 1;
+            return StateReturn::ok;
+        }
+        case BenchOp::transition: {
+            auto u16State = pclSM_->GetCurrentState();
+            pclSM_->TransitionState(u16State ^ 1);
+            return StateReturn::transition;
+        }
+        case BenchOp::push: {
+            pclSM_->PushState(pclSM_->GetCurrentState() + 1);
+            return StateReturn::transition;
+        }
+        case BenchOp::pop: {
+            pclSM_->PopState();
+            return StateReturn::transition;
+        }
+        default: break;
+    }
+    return StateReturn::unhandled;
+}
+
+//---------------------------------------------------------------------------
+StateReturn RunBottomState(StateMachine* pclSM_, const void* pvEvent_)
+{
+    if (static_cast<const BenchEvent_t*>(pvEvent_)->eOp == BenchOp::unwind) {
+        pclSM_->TransitionState(0);
+        return StateReturn::transition;
+    }
+    return RunState(pclSM_, pvEvent_);
+}
+
+#if STATE_MACHINE_COROUTINES
+//---------------------------------------------------------------------------
+struct BenchFrame_t : StateCoroutineFrame {
+    uint32_t u32Resumes;
+};
+
+//---------------------------------------------------------------------------
+StateReturn CoroutineBody(StateMachine* /*pclSM_*/, BenchFrame_t* pclFrame_, const void* /*pvEvent_*/)
+{
+    STATE_CO_BEGIN(pclFrame_);
+    while (true) {
+        pclFrame_->u32Resumes++;
+        g_u32Sink = g_u32Sink + 1;
+        STATE_CO_AWAIT(pclFrame_);
+    }
+    STATE_CO_END(pclFrame_);
+}
+
+typedef StateCoroutine<BenchFrame_t, CoroutineBody> BenchCoroutine;
+
+uint64_t           g_au64Frames[(sizeof(BenchFrame_t) + 7) / 8];
+StateCoroutinePool g_clPool;
+#endif
+
+//---------------------------------------------------------------------------
+#define BENCH_STATE_PLAIN {nullptr, RunState, nullptr}
+#define BENCH_STATE_FULL {EntryState, RunState, ExitState}
+
+const State_t g_astPlainStates[kStateCount] = {{nullptr, RunBottomState, nullptr},
+                                               BENCH_STATE_PLAIN,
+                                               BENCH_STATE_PLAIN,
+                                               BENCH_STATE_PLAIN,
+                                               BENCH_STATE_PLAIN,
+                                               BENCH_STATE_PLAIN,
+                                               BENCH_STATE_PLAIN,
+                                               BENCH_STATE_PLAIN,
+                                               BENCH_STATE_PLAIN};
+
+const State_t g_astFullStates[kStateCount] = {{EntryState, RunBottomState, ExitState},
+                                              BENCH_STATE_FULL,
+                                              BENCH_STATE_FULL,
+                                              BENCH_STATE_FULL,
+                                              BENCH_STATE_FULL,
+                                              BENCH_STATE_FULL,
+                                              BENCH_STATE_FULL,
+                                              BENCH_STATE_FULL,
+                                              BENCH_STATE_FULL};
+
+#if STATE_MACHINE_COROUTINES
+const State_t g_astCoroutineStates[kStateCount] = {{nullptr, BenchCoroutine::Run, BenchCoroutine::Exit},
+                                                   BENCH_STATE_PLAIN,
+                                                   BENCH_STATE_PLAIN,
+                                                   BENCH_STATE_PLAIN,
+                                                   BENCH_STATE_PLAIN,
+                                                   BENCH_STATE_PLAIN,
+                                                   BENCH_STATE_PLAIN,
+                                                   BENCH_STATE_PLAIN,
+                                                   BENCH_STATE_PLAIN};
+#endif
+
+static_assert(sizeof(g_astPlainStates) / sizeof(State_t) == kStateCount, "State table size mismatch");
+
+//---------------------------------------------------------------------------
+typedef struct {
+    const char* szCase;    // Case name
+    uint16_t    u16Depth;  // Stack depth the events are dispatched at
+    bool        bHandlers; // Whether states have entry/exit handlers
+    uint32_t    u32Events; // Events dispatched per repeat
+    double      dNsPerEvent;
+} BenchResult_t;
+
+//---------------------------------------------------------------------------
+// Dispatch a repeating pattern of events to a freshly-initialized machine at
+// the given depth, and return the best ns/event seen over all repeats.
+double RunCase(const State_t*       pstStates_,
+               uint16_t             u16Depth_,
+               const BenchEvent_t*  pstPattern_,
+               uint16_t             u16PatternLength_,
+               uint32_t             u32Events_,
+               uint16_t             u16Repeats_)
+{
+    StateMachine clSM;
+    clSM.SetStates(pstStates_, kStateCount);
+#if STATE_MACHINE_COROUTINES
+    clSM.SetCoroutinePool(&g_clPool);
+#endif
+    clSM.Begin();
+
+    BenchEvent_t stPush = {BenchOp::push};
+    for (uint16_t i = 1; i < u16Depth_; i++) {
+        clSM.HandleEvent(&stPush);
+    }
+    if (clSM.GetStackDepth() != u16Depth_) {
+        fprintf(stderr, "failed to reach depth %u\n", u16Depth_);
+        exit(1);
+    }
+
+    double dBest = 0.0;
+    for (uint16_t u16Repeat = 0; u16Repeat < u16Repeats_; u16Repeat++) {
+        auto clStart = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < u32Events_; i++) {
+            clSM.HandleEvent(&pstPattern_[i % u16PatternLength_]);
+        }
+        auto clEnd = std::chrono::steady_clock::now();
+
+        auto dNs = std::chrono::duration<double, std::nano>(clEnd - clStart).count() / u32Events_;
+        if ((u16Repeat == 0) || (dNs < dBest)) {
+            dBest = dNs;
+        }
+    }
+
+    if (clSM.GetStackDepth() != u16Depth_) {
+        fprintf(stderr, "machine left depth %u\n", u16Depth_);
+        exit(1);
+    }
+    return dBest;
+}
+
+//---------------------------------------------------------------------------
+void PrintResults(const BenchResult_t* pastResults_, uint16_t u16Count_, bool bJson_)
+{
+    if (bJson_) {
+        printf("[\n");
+        for (uint16_t i = 0; i < u16Count_; i++) {
+            auto pstResult = &pastResults_[i];
+            printf("  {\"case\": \"%s\", \"depth\": %u, \"entry_exit\": %s, \"trace\": %u, \"profile\": %u, "
+                   "\"events\": %u, \"ns_per_event\": %.3f}%s\n",
+                   pstResult->szCase,
+                   pstResult->u16Depth,
+                   pstResult->bHandlers ? "true" : "false",
+                   STATE_MACHINE_TRACE,
+                   STATE_MACHINE_PROFILE,
+                   pstResult->u32Events,
+                   pstResult->dNsPerEvent,
+                   (i + 1 < u16Count_) ? "," : "");
+        }
+        printf("]\n");
+        return;
+    }
+
+    printf("case,depth,entry_exit,trace,profile,events,ns_per_event\n");
+    for (uint16_t i = 0; i < u16Count_; i++) {
+        auto pstResult = &pastResults_[i];
+        printf("%s,%u,%u,%u,%u,%u,%.3f\n",
+               pstResult->szCase,
+               pstResult->u16Depth,
+               pstResult->bHandlers ? 1 : 0,
+               STATE_MACHINE_TRACE,
+               STATE_MACHINE_PROFILE,
+               pstResult->u32Events,
+               pstResult->dNsPerEvent);
+    }
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    auto bJson = false;
+    if ((argc > 1) && (strcmp(argv[1], "--json") == 0)) {
+        bJson = true;
+        argc--;
+        argv++;
+    }
+    uint32_t u32Events  = (argc > 1) ? static_cast<uint32_t>(atoi(argv[1])) : 1000000;
+    uint16_t u16Repeats = (argc > 2) ? static_cast<uint16_t>(atoi(argv[2])) : 5;
+    if ((u32Events == 0) || (u16Repeats == 0)) {
+        fprintf(stderr, "usage: bench_state [--json] [events] [repeats]\n");
+        return 1;
+    }
+
+    static const BenchEvent_t astRun[]        = {{BenchOp::run}};
+    static const BenchEvent_t astTransition[] = {{BenchOp::transition}};
+    static const BenchEvent_t astPushPop[]    = {{BenchOp::push}, {BenchOp::pop}};
+    static const BenchEvent_t astBubble[]     = {{BenchOp::bubble}};
+
+    BenchEvent_t astUnwind[MAX_STATE_STACK_DEPTH];
+    astUnwind[0] = {BenchOp::unwind};
+    for (uint16_t i = 1; i < MAX_STATE_STACK_DEPTH; i++) {
+        astUnwind[i] = {BenchOp::push};
+    }
+
+#if STATE_MACHINE_COROUTINES
+    g_clPool.SetStorage(g_au64Frames, sizeof(BenchFrame_t), 1);
+#endif
+
+    BenchResult_t astResults[(2 * (4 + MAX_STATE_STACK_DEPTH)) + 1];
+    uint16_t      u16Results = 0;
+
+    for (uint16_t u16Handlers = 0; u16Handlers < 2; u16Handlers++) {
+        auto bHandlers = (u16Handlers != 0);
+        auto pstStates = bHandlers ? g_astFullStates : g_astPlainStates;
+
+        astResults[u16Results++]
+            = {"run", 1, bHandlers, u32Events, RunCase(pstStates, 1, astRun, 1, u32Events, u16Repeats)};
+        astResults[u16Results++]
+            = {"transition", 1, bHandlers, u32Events, RunCase(pstStates, 1, astTransition, 1, u32Events, u16Repeats)};
+        astResults[u16Results++]
+            = {"push_pop", 1, bHandlers, u32Events, RunCase(pstStates, 1, astPushPop, 2, u32Events, u16Repeats)};
+        for (uint16_t u16Depth = 1; u16Depth <= MAX_STATE_STACK_DEPTH; u16Depth++) {
+            astResults[u16Results++] = {
+                "unhandled", u16Depth, bHandlers, u32Events, RunCase(pstStates, u16Depth, astBubble, 1, u32Events, u16Repeats)};
+        }
+        astResults[u16Results++] = {"unwind",
+                                    MAX_STATE_STACK_DEPTH,
+                                    bHandlers,
+                                    u32Events,
+                                    RunCase(pstStates,
+                                            MAX_STATE_STACK_DEPTH,
+                                            astUnwind,
+                                            MAX_STATE_STACK_DEPTH,
+                                            u32Events - (u32Events % MAX_STATE_STACK_DEPTH),
+                                            u16Repeats)};
+    }
+#if STATE_MACHINE_COROUTINES
+    astResults[u16Results++] = {
+        "coroutine", 1, false, u32Events, RunCase(g_astCoroutineStates, 1, astRun, 1, u32Events, u16Repeats)};
+#endif
+
+    PrintResults(astResults, u16Results, bJson);
+    return 0;
+}
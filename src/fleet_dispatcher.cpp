@@ -0,0 +1,208 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file fleet_dispatcher.cpp
+    @brief Hosted (Linux) dispatcher threads for a FleetExecutor
+*/
+#include "fleet_dispatcher.h"
+
+#if defined(__linux__)
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Mark3
+{
+namespace
+{
+//---------------------------------------------------------------------------
+void FutexWait(uint32_t* pu32Word_, uint32_t u32Expected_)
+{
+    syscall(SYS_futex, pu32Word_, FUTEX_WAIT_PRIVATE, u32Expected_, nullptr, nullptr, 0);
+}
+
+//---------------------------------------------------------------------------
+void FutexWake(uint32_t* pu32Word_, int iCount_)
+{
+    syscall(SYS_futex, pu32Word_, FUTEX_WAKE_PRIVATE, iCount_, nullptr, nullptr, 0);
+}
+
+//---------------------------------------------------------------------------
+// Hint to the CPU that we're spinning
+void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+FleetDispatcherThread::FleetDispatcherThread()
+    : m_pclDispatcher{nullptr}
+    , m_clThread{}
+    , m_u16WorkerId{0}
+    , m_u32Parks{0}
+    , m_u32Wakes{0}
+{
+}
+
+//---------------------------------------------------------------------------
+FleetDispatcher::FleetDispatcher()
+    : m_pclExecutor{nullptr}
+    , m_paclThreads{nullptr}
+    , m_u16Started{0}
+    , m_u32SpinRounds{FLEET_DISPATCHER_SPIN_ROUNDS}
+    , m_u32Tokens{0}
+    , m_u16Parked{0}
+    , m_bWakePending{false}
+    , m_bStop{false}
+    , m_u32WakeCalls{0}
+{
+}
+
+//---------------------------------------------------------------------------
+bool FleetDispatcher::Start(FleetExecutor* pclExecutor_, FleetDispatcherThread* paclThreads_)
+{
+    if ((pclExecutor_ == nullptr) || (paclThreads_ == nullptr) || (m_u16Started != 0)
+        || (pclExecutor_->GetWorkerCount() == 0)) {
+        return false;
+    }
+
+    m_pclExecutor  = pclExecutor_;
+    m_paclThreads  = paclThreads_;
+    m_u32Tokens    = 0;
+    m_u16Parked    = 0;
+    m_bWakePending = false;
+    m_bStop        = false;
+    m_pclExecutor->SetWakeHandler(WakeHandler, this);
+
+    for (uint16_t i = 0; i < m_pclExecutor->GetWorkerCount(); i++) {
+        auto pclThread             = &m_paclThreads[i];
+        pclThread->m_pclDispatcher = this;
+        pclThread->m_u16WorkerId   = i;
+        if (pthread_create(&pclThread->m_clThread, nullptr, ThreadMain, pclThread) != 0) {
+            Stop();
+            return false;
+        }
+        m_u16Started++;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void FleetDispatcher::Stop()
+{
+    __atomic_store_n(&m_bStop, true, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&m_u32Tokens, m_u16Started, __ATOMIC_RELEASE);
+    FutexWake(&m_u32Tokens, INT_MAX);
+
+    for (uint16_t i = 0; i < m_u16Started; i++) {
+        pthread_join(m_paclThreads[i].m_clThread, nullptr);
+    }
+    m_u16Started = 0;
+    if (m_pclExecutor != nullptr) {
+        m_pclExecutor->SetWakeHandler(nullptr, nullptr);
+    }
+}
+
+//---------------------------------------------------------------------------
+void FleetDispatcher::Wake()
+{
+    // Pairs with the fence in Park() - either we see the parked thread, or
+    // it sees the machine that was just scheduled.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&m_u16Parked, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+
+    // Coalesce - the thread already being woken will find this work too
+    if (__atomic_exchange_n(&m_bWakePending, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    __atomic_fetch_add(&m_u32Tokens, 1, __ATOMIC_RELEASE);
+    FutexWake(&m_u32Tokens, 1);
+    __atomic_fetch_add(&m_u32WakeCalls, 1, __ATOMIC_RELAXED);
+}
+
+//---------------------------------------------------------------------------
+void FleetDispatcher::WakeHandler(void* pvContext_)
+{
+    static_cast<FleetDispatcher*>(pvContext_)->Wake();
+}
+
+//---------------------------------------------------------------------------
+void* FleetDispatcher::ThreadMain(void* pvThread_)
+{
+    auto pclThread = static_cast<FleetDispatcherThread*>(pvThread_);
+    pclThread->m_pclDispatcher->Dispatch(pclThread);
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------
+void FleetDispatcher::Dispatch(FleetDispatcherThread* pclThread_)
+{
+    uint32_t u32IdleRounds = 0;
+    while (!__atomic_load_n(&m_bStop, __ATOMIC_ACQUIRE)) {
+        if (m_pclExecutor->RunOnce(pclThread_->m_u16WorkerId)) {
+            u32IdleRounds = 0;
+        } else if (u32IdleRounds < m_u32SpinRounds) {
+            u32IdleRounds++;
+            CpuRelax();
+        } else {
+            Park(pclThread_);
+            u32IdleRounds = 0;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+void FleetDispatcher::Park(FleetDispatcherThread* pclThread_)
+{
+    __atomic_fetch_add(&m_u16Parked, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // Check for work scheduled before we were counted as parked
+    if (m_pclExecutor->RunOnce(pclThread_->m_u16WorkerId)) {
+        __atomic_fetch_sub(&m_u16Parked, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_fetch_add(&pclThread_->m_u32Parks, 1, __ATOMIC_RELAXED);
+    auto bWoken = false;
+    while (!bWoken && !__atomic_load_n(&m_bStop, __ATOMIC_ACQUIRE)) {
+        auto u32Tokens = __atomic_load_n(&m_u32Tokens, __ATOMIC_ACQUIRE);
+        if (u32Tokens == 0) {
+            FutexWait(&m_u32Tokens, 0);
+        } else {
+            bWoken = __atomic_compare_exchange_n(
+                &m_u32Tokens, &u32Tokens, u32Tokens - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (bWoken) {
+        // Allow the next wakeup, and synchronize with the posts that were
+        // coalesced into this one, so that their work is found
+        (void)__atomic_exchange_n(&m_bWakePending, false, __ATOMIC_ACQ_REL);
+        __atomic_fetch_add(&pclThread_->m_u32Wakes, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&m_u16Parked, 1, __ATOMIC_RELAXED);
+}
+} // namespace Mark3
+
+#endif // defined(__linux__)
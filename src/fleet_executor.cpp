@@ -0,0 +1,331 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file fleet_executor.cpp
+    @brief Work-stealing executor for large numbers of state machines
+*/
+#include "fleet_executor.h"
+
+namespace Mark3
+{
+static_assert((FLEET_WORKER_DEQUE_SIZE & (FLEET_WORKER_DEQUE_SIZE - 1)) == 0,
+              "FLEET_WORKER_DEQUE_SIZE must be a power of two");
+
+#if FLEET_WORKER_LOCAL_SCHEDULE
+namespace
+{
+// Executor and worker whose machine is running on the calling thread, if any
+thread_local FleetExecutor* tl_pclRunningExecutor;
+thread_local uint16_t       tl_u16RunningWorker;
+} // anonymous namespace
+#endif
+
+//---------------------------------------------------------------------------
+FleetNode::FleetNode()
+    : m_pclExecutor{nullptr}
+    , m_pclNext{nullptr}
+    , m_u8State{IDLE}
+{
+}
+
+//---------------------------------------------------------------------------
+void FleetNode::Notify()
+{
+    // Pairs with the fence in FleetExecutor::RunOnce - either the worker sees
+    // the event we just posted, or we see that the worker is running.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    auto u8State = __atomic_load_n(&m_u8State, __ATOMIC_RELAXED);
+    while (true) {
+        if (u8State == IDLE) {
+            if (__atomic_compare_exchange_n(
+                    &m_u8State, &u8State, SCHEDULED, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                m_pclExecutor->Schedule(this);
+                return;
+            }
+        } else if (u8State == RUNNING) {
+            // The worker running the node will reschedule it once done
+            if (__atomic_compare_exchange_n(
+                    &m_u8State, &u8State, NOTIFIED, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                return;
+            }
+        } else {
+            // Already queued, or already flagged for rescheduling
+            return;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+FleetWorkQueue::FleetWorkQueue()
+    : m_u32Top{0}
+    , m_u32Bottom{0}
+{
+}
+
+//---------------------------------------------------------------------------
+bool FleetWorkQueue::Push(FleetNode* pclNode_)
+{
+    auto u32Bottom = __atomic_load_n(&m_u32Bottom, __ATOMIC_RELAXED);
+    auto u32Top    = __atomic_load_n(&m_u32Top, __ATOMIC_ACQUIRE);
+    if ((u32Bottom - u32Top) >= FLEET_WORKER_DEQUE_SIZE) {
+        return false;
+    }
+    __atomic_store_n(&m_apclNodes[u32Bottom & (FLEET_WORKER_DEQUE_SIZE - 1)], pclNode_, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&m_u32Bottom, u32Bottom + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+FleetNode* FleetWorkQueue::Pop()
+{
+    auto u32Bottom = __atomic_load_n(&m_u32Bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&m_u32Bottom, u32Bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    auto u32Top = __atomic_load_n(&m_u32Top, __ATOMIC_RELAXED);
+
+    // Indices wrap, so compare using their signed difference
+    auto i32Size = static_cast<int32_t>(u32Bottom - u32Top);
+    if (i32Size < 0) {
+        // Empty - restore the bottom index
+        __atomic_store_n(&m_u32Bottom, u32Bottom + 1, __ATOMIC_RELAXED);
+        return nullptr;
+    }
+
+    auto pclNode = __atomic_load_n(&m_apclNodes[u32Bottom & (FLEET_WORKER_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (i32Size == 0) {
+        // Last node in the deque - race any thieves for it
+        if (!__atomic_compare_exchange_n(
+                &m_u32Top, &u32Top, u32Top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            pclNode = nullptr;
+        }
+        __atomic_store_n(&m_u32Bottom, u32Bottom + 1, __ATOMIC_RELAXED);
+    }
+    return pclNode;
+}
+
+//---------------------------------------------------------------------------
+FleetNode* FleetWorkQueue::Steal()
+{
+    auto u32Top = __atomic_load_n(&m_u32Top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    auto u32Bottom = __atomic_load_n(&m_u32Bottom, __ATOMIC_ACQUIRE);
+
+    if (static_cast<int32_t>(u32Bottom - u32Top) <= 0) {
+        return nullptr;
+    }
+
+    auto pclNode = __atomic_load_n(&m_apclNodes[u32Top & (FLEET_WORKER_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&m_u32Top, &u32Top, u32Top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return nullptr;
+    }
+    return pclNode;
+}
+
+//---------------------------------------------------------------------------
+FleetInjectQueue::FleetInjectQueue()
+    : m_pclHead{&m_clStub}
+    , m_pclTail{&m_clStub}
+    , m_bConsuming{false}
+{
+}
+
+//---------------------------------------------------------------------------
+void FleetInjectQueue::Push(FleetNode* pclNode_)
+{
+    __atomic_store_n(&pclNode_->m_pclNext, nullptr, __ATOMIC_RELAXED);
+    auto pclPrev = __atomic_exchange_n(&m_pclHead, pclNode_, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&pclPrev->m_pclNext, pclNode_, __ATOMIC_RELEASE);
+}
+
+//---------------------------------------------------------------------------
+FleetNode* FleetInjectQueue::TryPop()
+{
+    if (__atomic_exchange_n(&m_bConsuming, true, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+    auto pclNode = Pop();
+    __atomic_store_n(&m_bConsuming, false, __ATOMIC_RELEASE);
+    return pclNode;
+}
+
+//---------------------------------------------------------------------------
+FleetNode* FleetInjectQueue::Pop()
+{
+    auto pclTail = m_pclTail;
+    auto pclNext = __atomic_load_n(&pclTail->m_pclNext, __ATOMIC_ACQUIRE);
+
+    // Skip over the stub node
+    if (pclTail == &m_clStub) {
+        if (pclNext == nullptr) {
+            return nullptr;
+        }
+        m_pclTail = pclNext;
+        pclTail   = pclNext;
+        pclNext   = __atomic_load_n(&pclNext->m_pclNext, __ATOMIC_ACQUIRE);
+    }
+
+    if (pclNext != nullptr) {
+        m_pclTail = pclNext;
+        return pclTail;
+    }
+
+    // The tail is the last linked node.  If a producer is midway through
+    // adding a node after it, try again later.
+    if (pclTail != __atomic_load_n(&m_pclHead, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+
+    // Re-insert the stub so the tail node can be detached
+    Push(&m_clStub);
+    pclNext = __atomic_load_n(&pclTail->m_pclNext, __ATOMIC_ACQUIRE);
+    if (pclNext != nullptr) {
+        m_pclTail = pclNext;
+        return pclTail;
+    }
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------
+FleetWorker::FleetWorker()
+    : m_u32Runs{0}
+    , m_u32Events{0}
+    , m_u32Steals{0}
+{
+}
+
+//---------------------------------------------------------------------------
+FleetExecutor::FleetExecutor()
+    : m_paclWorkers{nullptr}
+    , m_u16WorkerCount{0}
+    , m_u16Budget{FLEET_DEFAULT_BUDGET}
+    , m_pfIdle{nullptr}
+    , m_pfWake{nullptr}
+    , m_pvWakeContext{nullptr}
+{
+}
+
+//---------------------------------------------------------------------------
+bool FleetExecutor::Init(FleetWorker* paclWorkers_, uint16_t u16WorkerCount_)
+{
+    if ((paclWorkers_ == nullptr) || (u16WorkerCount_ == 0)) {
+        return false;
+    }
+    m_paclWorkers    = paclWorkers_;
+    m_u16WorkerCount = u16WorkerCount_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void FleetExecutor::Schedule(FleetNode* pclNode_)
+{
+#if FLEET_WORKER_LOCAL_SCHEDULE
+    // Posted to from one of our own workers' handlers - keep the machine on
+    // that worker, where only its owner and thieves contend for it
+    if ((tl_pclRunningExecutor != this) || !m_paclWorkers[tl_u16RunningWorker].m_clQueue.Push(pclNode_)) {
+        m_clInjectQueue.Push(pclNode_);
+    }
+#else
+    m_clInjectQueue.Push(pclNode_);
+#endif
+    if (m_pfWake != nullptr) {
+        m_pfWake(m_pvWakeContext);
+    }
+}
+
+//---------------------------------------------------------------------------
+FleetNode* FleetExecutor::FindWork(uint16_t u16WorkerId_)
+{
+    auto pclWorker = &m_paclWorkers[u16WorkerId_];
+
+    auto pclNode = pclWorker->m_clQueue.Pop();
+    if (pclNode != nullptr) {
+        return pclNode;
+    }
+
+    pclNode = m_clInjectQueue.TryPop();
+    if (pclNode != nullptr) {
+        return pclNode;
+    }
+
+    // Steal from the other workers, starting with our neighbor so that
+    // thieves spread out across the victims.
+    for (uint16_t i = 1; i < m_u16WorkerCount; i++) {
+        auto u16Victim = static_cast<uint16_t>((u16WorkerId_ + i) % m_u16WorkerCount);
+        pclNode        = m_paclWorkers[u16Victim].m_clQueue.Steal();
+        if (pclNode != nullptr) {
+            pclWorker->m_u32Steals++;
+            return pclNode;
+        }
+    }
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------
+bool FleetExecutor::RunOnce(uint16_t u16WorkerId_)
+{
+    auto pclNode = FindWork(u16WorkerId_);
+    if (pclNode == nullptr) {
+        return false;
+    }
+
+    // Pairs with the fence in FleetNode::Notify()
+    __atomic_store_n(&pclNode->m_u8State, FleetNode::RUNNING, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    auto pclWorker = &m_paclWorkers[u16WorkerId_];
+    pclWorker->m_u32Runs++;
+#if FLEET_WORKER_LOCAL_SCHEDULE
+    auto pclOuterExecutor = tl_pclRunningExecutor;
+    auto u16OuterWorker   = tl_u16RunningWorker;
+    tl_pclRunningExecutor = this;
+    tl_u16RunningWorker   = u16WorkerId_;
+    pclWorker->m_u32Events += pclNode->RunEvents(m_u16Budget);
+    tl_pclRunningExecutor = pclOuterExecutor;
+    tl_u16RunningWorker   = u16OuterWorker;
+#else
+    pclWorker->m_u32Events += pclNode->RunEvents(m_u16Budget);
+#endif
+
+    // Go idle, unless events are still pending (budget exhausted) or were
+    // posted while the node was running.
+    auto u8State = FleetNode::RUNNING;
+    if (pclNode->HasPendingEvents()
+        || !__atomic_compare_exchange_n(
+               &pclNode->m_u8State, &u8State, FleetNode::IDLE, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&pclNode->m_u8State, FleetNode::SCHEDULED, __ATOMIC_RELAXED);
+        if (!pclWorker->m_clQueue.Push(pclNode)) {
+            m_clInjectQueue.Push(pclNode);
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void FleetExecutor::Run(uint16_t u16WorkerId_, const bool* pbStop_)
+{
+    uint32_t u32IdleRounds = 0;
+    while (!__atomic_load_n(pbStop_, __ATOMIC_ACQUIRE)) {
+        if (RunOnce(u16WorkerId_)) {
+            u32IdleRounds = 0;
+        } else {
+            u32IdleRounds++;
+            if (m_pfIdle != nullptr) {
+                m_pfIdle(u16WorkerId_, u32IdleRounds);
+            }
+        }
+    }
+}
+} // namespace Mark3
@@ -0,0 +1,485 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file event_queue.h
+    @brief Bounded lock-free event queues, and a state machine driven by them
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_bits.h"
+#include "state_machine.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The SpscEventQueue class
+ *
+ * Bounded, lock-free, single-producer/single-consumer queue of event
+ * pointers.  Exactly one thread (or interrupt context) may post events, and
+ * exactly one thread may pop them.  The queue only stores the pointers -
+ * event objects must remain valid until they have been popped.
+ *
+ * Head and tail are free-running 32-bit positions, masked down to slot
+ * indices, so that they only wrap after 2^32 events.
+ *
+ * Requires the target to support the compiler's __atomic builtins on 32-bit
+ * values.
+ *
+ * @tparam u16Size_ Queue capacity, must be a power of two
+ */
+template <uint16_t u16Size_>
+class SpscEventQueue
+{
+public:
+    static_assert((u16Size_ != 0) && ((u16Size_ & (u16Size_ - 1)) == 0), "Queue size must be a power of two");
+    static_assert(u16Size_ <= 32768, "Queue size must be well below half of the 32-bit position range");
+
+    SpscEventQueue() : m_u32Head{0}, m_u32Tail{0} {}
+
+    /**
+     * @brief Post
+     *
+     * Add an event to the tail of the queue.  Must only be called from the
+     * producer context.
+     *
+     * @param pvEvent_ Event to add to the queue
+     * @return true on success, false if the queue is full
+     */
+    bool Post(const void* pvEvent_)
+    {
+        auto u32Tail = __atomic_load_n(&m_u32Tail, __ATOMIC_RELAXED);
+        auto u32Head = __atomic_load_n(&m_u32Head, __ATOMIC_ACQUIRE);
+        if ((u32Tail - u32Head) == u16Size_) {
+            return false;
+        }
+        m_apvEvents[u32Tail & (u16Size_ - 1)] = pvEvent_;
+        __atomic_store_n(&m_u32Tail, u32Tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @brief Pop
+     *
+     * Remove the event at the head of the queue.  Must only be called from
+     * the consumer context.
+     *
+     * @param ppvEvent_ [out] Event removed from the queue
+     * @return true on success, false if the queue is empty
+     */
+    bool Pop(const void** ppvEvent_)
+    {
+        auto u32Head = __atomic_load_n(&m_u32Head, __ATOMIC_RELAXED);
+        auto u32Tail = __atomic_load_n(&m_u32Tail, __ATOMIC_ACQUIRE);
+        if (u32Head == u32Tail) {
+            return false;
+        }
+        *ppvEvent_ = m_apvEvents[u32Head & (u16Size_ - 1)];
+        __atomic_store_n(&m_u32Head, u32Head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @brief IsEmpty
+     *
+     * @return true if the queue held no events at the time of the call
+     */
+    bool IsEmpty() const
+    {
+        return __atomic_load_n(&m_u32Head, __ATOMIC_ACQUIRE) == __atomic_load_n(&m_u32Tail, __ATOMIC_ACQUIRE);
+    }
+
+private:
+    uint32_t    m_u32Head;             //!< Position of the next event to pop (consumer-owned)
+    uint32_t    m_u32Tail;             //!< Position of the next free slot (producer-owned)
+    const void* m_apvEvents[u16Size_]; //!< Event storage
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The MpscEventQueue class
+ *
+ * Bounded, lock-free, multi-producer/single-consumer queue of event
+ * pointers.  Any number of threads may post events concurrently, while
+ * exactly one thread may pop them.  Each slot carries a sequence number,
+ * so producers claim slots with a single compare-and-swap, and never
+ * block one another or the consumer.
+ *
+ * Positions and sequence numbers are free-running 32-bit counters, so a
+ * producer stalled between reading a slot's sequence and claiming it would
+ * need 2^32 events to pass before it could claim a stale position.
+ *
+ * Requires the target to support the compiler's __atomic builtins on 32-bit
+ * values.
+ *
+ * @tparam u16Size_ Queue capacity, must be a power of two
+ */
+template <uint16_t u16Size_>
+class MpscEventQueue
+{
+public:
+    static_assert((u16Size_ != 0) && ((u16Size_ & (u16Size_ - 1)) == 0), "Queue size must be a power of two");
+    static_assert(u16Size_ <= 32768, "Queue size must be well below half of the 32-bit position range");
+
+    MpscEventQueue() : m_u32Head{0}, m_u32Tail{0}
+    {
+        for (uint32_t i = 0; i < u16Size_; i++) {
+            m_astSlots[i].u32Sequence = i;
+        }
+    }
+
+    /**
+     * @brief Post
+     *
+     * Add an event to the tail of the queue.  May be called concurrently
+     * from any number of producers.
+     *
+     * @param pvEvent_ Event to add to the queue
+     * @return true on success, false if the queue is full
+     */
+    bool Post(const void* pvEvent_)
+    {
+        auto    u32Tail = __atomic_load_n(&m_u32Tail, __ATOMIC_RELAXED);
+        Slot_t* pstSlot;
+        while (true) {
+            pstSlot          = &m_astSlots[u32Tail & (u16Size_ - 1)];
+            auto u32Sequence = __atomic_load_n(&pstSlot->u32Sequence, __ATOMIC_ACQUIRE);
+            auto i32Diff     = static_cast<int32_t>(u32Sequence - u32Tail);
+            if (i32Diff == 0) {
+                // Slot is free for this lap - try to claim it.
+                if (__atomic_compare_exchange_n(
+                        &m_u32Tail, &u32Tail, u32Tail + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    break;
+                }
+            } else if (i32Diff < 0) {
+                // Slot still holds an event from the previous lap - full
+                return false;
+            } else {
+                // Another producer claimed this slot, retry from the new tail
+                u32Tail = __atomic_load_n(&m_u32Tail, __ATOMIC_RELAXED);
+            }
+        }
+
+        pstSlot->pvEvent = pvEvent_;
+        __atomic_store_n(&pstSlot->u32Sequence, u32Tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @brief Pop
+     *
+     * Remove the event at the head of the queue.  Must only be called from
+     * the consumer context.
+     *
+     * @param ppvEvent_ [out] Event removed from the queue
+     * @return true on success, false if the queue is empty (or the producer
+     * that claimed the head slot has not yet published its event)
+     */
+    bool Pop(const void** ppvEvent_)
+    {
+        auto pstSlot     = &m_astSlots[m_u32Head & (u16Size_ - 1)];
+        auto u32Sequence = __atomic_load_n(&pstSlot->u32Sequence, __ATOMIC_ACQUIRE);
+        if (u32Sequence != (m_u32Head + 1)) {
+            return false;
+        }
+        *ppvEvent_ = pstSlot->pvEvent;
+        __atomic_store_n(&pstSlot->u32Sequence, m_u32Head + u16Size_, __ATOMIC_RELEASE);
+        m_u32Head++;
+        return true;
+    }
+
+    /**
+     * @brief IsEmpty
+     *
+     * Must only be called from the consumer context.
+     *
+     * @return true if no published event is waiting at the head of the queue
+     */
+    bool IsEmpty() const
+    {
+        auto pstSlot = &m_astSlots[m_u32Head & (u16Size_ - 1)];
+        return __atomic_load_n(&pstSlot->u32Sequence, __ATOMIC_ACQUIRE) != (m_u32Head + 1);
+    }
+
+private:
+    typedef struct {
+        uint32_t    u32Sequence; //!< Lap/sequence number used to arbitrate slot ownership
+        const void* pvEvent;     //!< Event held in the slot
+    } Slot_t;
+
+    uint32_t m_u32Head;            //!< Position of the next event to pop (consumer-owned)
+    uint32_t m_u32Tail;            //!< Position of the next slot to be claimed by a producer
+    Slot_t   m_astSlots[u16Size_]; //!< Event storage
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The PriorityEventQueue class
+ *
+ * Event queue with a number of priority levels, each held in its own
+ * bounded queue.  Events are popped from the highest non-empty level first
+ * (level u8Levels_ - 1 being the highest), and in the order they were posted
+ * within a level - so that control events can overtake a backlog of data
+ * events.  As with the Mark3 scheduler's priority map, a bitmap records
+ * which levels hold events, and the highest is found by counting leading
+ * zeros; posting and popping are both O(1).
+ *
+ * The producer model is that of the per-level queue type.  The bitmap is
+ * only a hint: a producer sets a level's bit after posting to it, and the
+ * consumer clears it when the level is found empty, re-checking the level
+ * afterwards in case an event was posted in between.
+ *
+ * Requires the target to support the compiler's __atomic builtins on 16-bit
+ * and 32-bit values.
+ *
+ * @tparam Queue Queue type used for each level (SpscEventQueue or
+ * MpscEventQueue), setting the maximum number of events per level
+ * @tparam u8Levels_ Number of priority levels, 1-32
+ */
+template <typename Queue, uint8_t u8Levels_>
+class PriorityEventQueue
+{
+public:
+    static_assert((u8Levels_ != 0) && (u8Levels_ <= 32), "Priority levels must fit in a 32-bit map");
+
+    PriorityEventQueue() : m_u32LevelMap{0}
+    {
+        for (uint8_t i = 0; i < u8Levels_; i++) {
+            m_au16Limits[i] = 0;
+            m_au16Counts[i] = 0;
+        }
+    }
+
+    /**
+     * @brief SetLimit
+     *
+     * Limit the number of events held by a priority level to fewer than the
+     * level's queue can hold, i.e. to bound the backlog of low-priority
+     * events.  Must be set before events are posted to the level.
+     *
+     * @param u8Priority_ Priority level to limit
+     * @param u16Limit_ Maximum number of events held by the level, or 0 for
+     * no limit beyond the queue's capacity
+     * @return true on success, false if the priority level is invalid
+     */
+    bool SetLimit(uint8_t u8Priority_, uint16_t u16Limit_)
+    {
+        if (u8Priority_ >= u8Levels_) {
+            return false;
+        }
+        m_au16Limits[u8Priority_] = u16Limit_;
+        return true;
+    }
+
+    /**
+     * @brief Post
+     *
+     * Add an event to the tail of a priority level.
+     *
+     * @param u8Priority_ Priority level of the event
+     * @param pvEvent_ Event to add to the queue
+     * @return true on success, false if the level is full or invalid
+     */
+    bool Post(uint8_t u8Priority_, const void* pvEvent_)
+    {
+        if (u8Priority_ >= u8Levels_) {
+            return false;
+        }
+
+        auto u16Limit = m_au16Limits[u8Priority_];
+        if (u16Limit != 0) {
+            if (__atomic_fetch_add(&m_au16Counts[u8Priority_], 1, __ATOMIC_RELAXED) >= u16Limit) {
+                __atomic_fetch_sub(&m_au16Counts[u8Priority_], 1, __ATOMIC_RELAXED);
+                return false;
+            }
+        }
+        if (!m_aclLevels[u8Priority_].Post(pvEvent_)) {
+            if (u16Limit != 0) {
+                __atomic_fetch_sub(&m_au16Counts[u8Priority_], 1, __ATOMIC_RELAXED);
+            }
+            return false;
+        }
+        __atomic_fetch_or(&m_u32LevelMap, static_cast<uint32_t>(1) << u8Priority_, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * @brief Post
+     *
+     * Add an event to the tail of the lowest priority level.
+     *
+     * @param pvEvent_ Event to add to the queue
+     * @return true on success, false if the level is full
+     */
+    bool Post(const void* pvEvent_) { return Post(0, pvEvent_); }
+
+    /**
+     * @brief Pop
+     *
+     * Remove the event at the head of the highest non-empty priority level.
+     * Must only be called from the consumer context.
+     *
+     * @param ppvEvent_ [out] Event removed from the queue
+     * @param pu8Priority_ [out] (optional) Priority level of the event
+     * @return true on success, false if the queue is empty
+     */
+    bool Pop(const void** ppvEvent_, uint8_t* pu8Priority_ = nullptr)
+    {
+        auto u32Map = __atomic_load_n(&m_u32LevelMap, __ATOMIC_ACQUIRE);
+        while (u32Map != 0) {
+            auto u8Priority = StateBits::HighestSet(u32Map);
+            if (m_aclLevels[u8Priority].Pop(ppvEvent_)) {
+                if (m_au16Limits[u8Priority] != 0) {
+                    __atomic_fetch_sub(&m_au16Counts[u8Priority], 1, __ATOMIC_RELAXED);
+                }
+                if (pu8Priority_ != nullptr) {
+                    *pu8Priority_ = u8Priority;
+                }
+                return true;
+            }
+
+            // Level drained - clear its bit, restoring it if a producer
+            // posted to the level before it was cleared
+            auto u32Bit = static_cast<uint32_t>(1) << u8Priority;
+            u32Map      = __atomic_and_fetch(&m_u32LevelMap, ~u32Bit, __ATOMIC_ACQ_REL);
+            if (!m_aclLevels[u8Priority].IsEmpty()) {
+                u32Map = __atomic_or_fetch(&m_u32LevelMap, u32Bit, __ATOMIC_ACQ_REL);
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief IsEmpty
+     *
+     * Must only be called from the consumer context.
+     *
+     * @return true if no events were waiting at any priority level
+     */
+    bool IsEmpty() const
+    {
+        auto u32Map = __atomic_load_n(&m_u32LevelMap, __ATOMIC_ACQUIRE);
+        while (u32Map != 0) {
+            auto u8Priority = StateBits::HighestSet(u32Map);
+            if (!m_aclLevels[u8Priority].IsEmpty()) {
+                return false;
+            }
+            u32Map &= ~(static_cast<uint32_t>(1) << u8Priority);
+        }
+        return true;
+    }
+
+private:
+    uint32_t m_u32LevelMap;           //!< Bit N set when level N may hold events
+    uint16_t m_au16Limits[u8Levels_]; //!< Per-level event limits, 0 if unlimited
+    uint16_t m_au16Counts[u8Levels_]; //!< Events held by each limited level
+    Queue    m_aclLevels[u8Levels_];  //!< Event storage, one queue per level
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The QueuedStateMachine class
+ *
+ * State machine with an attached event queue.  Producers hand events to the
+ * machine using Post(), which never blocks, and the thread that owns the
+ * machine calls Drain() to run each queued event to completion through
+ * HandleEvent(), in the order they were posted.
+ *
+ * Handlers may Post() to their own machine while it is being drained (the
+ * event is run after the current one completes), provided this does not
+ * violate the queue's producer model - i.e. an SpscEventQueue must then not
+ * also be posted to from another thread.
+ *
+ * @tparam Queue Event queue type (SpscEventQueue, MpscEventQueue or
+ * PriorityEventQueue)
+ */
+template <typename Queue>
+class QueuedStateMachine : public StateMachine
+{
+public:
+    /**
+     * @brief Post
+     *
+     * Queue an event for processing by the state machine.  The event object
+     * must remain valid until it has been processed by Drain().
+     *
+     * @param pvEvent_ Event to queue
+     * @return true on success, false if the queue is full
+     */
+    bool Post(const void* pvEvent_) { return m_clQueue.Post(pvEvent_); }
+
+    /**
+     * @brief Post
+     *
+     * Queue an event at a priority level, for a machine using a
+     * PriorityEventQueue.  Higher priority events are processed first.
+     *
+     * @param u8Priority_ Priority level of the event
+     * @param pvEvent_ Event to queue
+     * @return true on success, false if the level is full or invalid
+     */
+    bool Post(uint8_t u8Priority_, const void* pvEvent_) { return m_clQueue.Post(u8Priority_, pvEvent_); }
+
+    /**
+     * @brief Drain
+     *
+     * Process queued events until the queue is empty.  Must only be called
+     * from the thread that owns the state machine.
+     *
+     * @return Number of events processed
+     */
+    uint32_t Drain()
+    {
+        uint32_t    u32Count = 0;
+        const void* pvEvent;
+        while (m_clQueue.Pop(&pvEvent)) {
+            HandleEvent(pvEvent);
+            u32Count++;
+        }
+        return u32Count;
+    }
+
+    /**
+     * @brief Drain
+     *
+     * Process up to a fixed number of queued events, bounding the time
+     * spent in a single call when producers continuously post events.
+     *
+     * @param u32MaxEvents_ Maximum number of events to process
+     * @return Number of events processed
+     */
+    uint32_t Drain(uint32_t u32MaxEvents_)
+    {
+        uint32_t    u32Count = 0;
+        const void* pvEvent;
+        while ((u32Count < u32MaxEvents_) && m_clQueue.Pop(&pvEvent)) {
+            HandleEvent(pvEvent);
+            u32Count++;
+        }
+        return u32Count;
+    }
+
+    /**
+     * @brief HasPendingEvents
+     *
+     * @return true if events are waiting to be drained
+     */
+    bool HasPendingEvents() const { return !m_clQueue.IsEmpty(); }
+
+private:
+    Queue m_clQueue; //!< Events waiting to be processed
+};
+} // namespace Mark3
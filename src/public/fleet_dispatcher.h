@@ -0,0 +1,158 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file fleet_dispatcher.h
+    @brief Hosted (Linux) dispatcher threads for a FleetExecutor
+*/
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <stdint.h>
+#include <pthread.h>
+#include "fleet_executor.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Default number of consecutive rounds a dispatcher thread spins looking for
+// work before it blocks.
+#ifndef FLEET_DISPATCHER_SPIN_ROUNDS
+#define FLEET_DISPATCHER_SPIN_ROUNDS (2000)
+#endif
+
+//---------------------------------------------------------------------------
+// Forward declarations
+class FleetDispatcher;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FleetDispatcherThread class
+ *
+ * A thread owned by a FleetDispatcher, running one of its executor's
+ * workers, and statistics about the time it spent idle.
+ */
+class FleetDispatcherThread
+{
+public:
+    FleetDispatcherThread();
+
+    uint32_t GetParkCount() const { return __atomic_load_n(&m_u32Parks, __ATOMIC_RELAXED); }
+    uint32_t GetWakeCount() const { return __atomic_load_n(&m_u32Wakes, __ATOMIC_RELAXED); }
+
+private:
+    friend class FleetDispatcher;
+
+    FleetDispatcher* m_pclDispatcher; //!< Dispatcher that owns the thread
+    pthread_t        m_clThread;      //!< Thread handle
+    uint16_t         m_u16WorkerId;   //!< Executor worker run by the thread
+    uint32_t         m_u32Parks;      //!< Number of times the thread blocked waiting for work
+    uint32_t         m_u32Wakes;      //!< Number of times the thread was woken to run work
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FleetDispatcher class
+ *
+ * Runs a FleetExecutor's workers on POSIX threads, one thread per worker.
+ * A thread that finds no work spins briefly, in case work arrives soon, and
+ * then blocks on a futex until a machine is scheduled - so idle dispatchers
+ * use no CPU.
+ *
+ * Wakeups are coalesced: scheduling a machine only makes a system call when
+ * a thread is blocked and no wakeup is already on its way, so a burst of
+ * posts wakes a single thread, which then runs (or leaves for the other
+ * running threads to steal) all of the work in the burst.
+ *
+ * Linux only - the rest of the library remains usable without it.
+ */
+class FleetDispatcher
+{
+public:
+    FleetDispatcher();
+
+    /**
+     * @brief SetSpinRounds
+     *
+     * Set the number of consecutive rounds a thread spins looking for work
+     * before it blocks.  Must be set before Start().
+     *
+     * @param u32SpinRounds_ Rounds to spin, or 0 to block immediately
+     */
+    void SetSpinRounds(uint32_t u32SpinRounds_) { m_u32SpinRounds = u32SpinRounds_; }
+
+    /**
+     * @brief Start
+     *
+     * Start one thread for each of the executor's workers.  The thread
+     * objects must exist until Stop() returns.
+     *
+     * @param pclExecutor_ Executor whose workers are run
+     * @param paclThreads_ Array of thread objects, one per worker
+     * @return true on success, false on invalid parameters, if already
+     * started, or if the threads could not be created
+     */
+    bool Start(FleetExecutor* pclExecutor_, FleetDispatcherThread* paclThreads_);
+
+    /**
+     * @brief Stop
+     *
+     * Stop the dispatcher's threads, waking any that are blocked, and wait
+     * for them to exit.  Machines may still have events pending.
+     */
+    void Stop();
+
+    /**
+     * @brief Wake
+     *
+     * Wake a blocked thread, if any are blocked and none is already being
+     * woken.  Called by the executor when a machine is scheduled.
+     */
+    void Wake();
+
+    /**
+     * @brief GetParkedCount
+     *
+     * @return Number of threads blocked waiting for work
+     */
+    uint16_t GetParkedCount() const { return __atomic_load_n(&m_u16Parked, __ATOMIC_ACQUIRE); }
+
+    /**
+     * @brief GetWakeCallCount
+     *
+     * @return Number of wakeup system calls made
+     */
+    uint32_t GetWakeCallCount() const { return __atomic_load_n(&m_u32WakeCalls, __ATOMIC_RELAXED); }
+
+private:
+    static void  WakeHandler(void* pvContext_);
+    static void* ThreadMain(void* pvThread_);
+
+    void Dispatch(FleetDispatcherThread* pclThread_);
+    void Park(FleetDispatcherThread* pclThread_);
+
+    FleetExecutor*         m_pclExecutor;   //!< Executor whose workers are run
+    FleetDispatcherThread* m_paclThreads;   //!< Thread objects, one per worker
+    uint16_t               m_u16Started;    //!< Number of threads started
+    uint32_t               m_u32SpinRounds; //!< Idle rounds spun before blocking
+    uint32_t               m_u32Tokens;     //!< Futex word - wakeups posted and not yet consumed
+    uint16_t               m_u16Parked;     //!< Threads blocked, or about to block
+    bool                   m_bWakePending;  //!< Set while a wakeup is on its way to a thread
+    bool                   m_bStop;         //!< Set to make the threads exit
+    uint32_t               m_u32WakeCalls;  //!< Number of wakeup system calls made
+};
+} // namespace Mark3
+
+#endif // defined(__linux__)
@@ -0,0 +1,428 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file fleet_executor.h
+    @brief Work-stealing executor for large numbers of state machines
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_machine.h"
+#include "event_queue.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Capacity of each worker's deque of runnable machines.  Must be a power of
+// two.  Machines that do not fit are placed in the executor's shared queue.
+#ifndef FLEET_WORKER_DEQUE_SIZE
+#define FLEET_WORKER_DEQUE_SIZE (1024)
+#endif
+
+//---------------------------------------------------------------------------
+// Default maximum number of events processed each time a machine is run,
+// before it is rescheduled to give other machines a turn.
+#ifndef FLEET_DEFAULT_BUDGET
+#define FLEET_DEFAULT_BUDGET (32)
+#endif
+
+//---------------------------------------------------------------------------
+// Set to 1 to place machines posted to by a handler running on a worker in
+// that worker's own deque, rather than the executor's shared queue.  Needs
+// thread-local storage, so defaults to 1 on hosted builds only.
+#ifndef FLEET_WORKER_LOCAL_SCHEDULE
+#if defined(__linux__)
+#define FLEET_WORKER_LOCAL_SCHEDULE (1)
+#else
+#define FLEET_WORKER_LOCAL_SCHEDULE (0)
+#endif
+#endif
+
+//---------------------------------------------------------------------------
+// Forward declarations
+class FleetExecutor;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FleetNode class
+ *
+ * Scheduling state of a machine managed by a FleetExecutor.  A node is held
+ * in at most one run queue at a time, and is only ever run by one worker at
+ * a time, so the machine it represents keeps the single-threaded semantics
+ * of StateMachine::HandleEvent().
+ */
+class FleetNode
+{
+public:
+    FleetNode();
+
+    /**
+     * @brief SetExecutor
+     *
+     * Attach the node to the executor responsible for running it.  Must be
+     * called before any events are posted.
+     *
+     * @param pclExecutor_ Executor which will run the machine
+     */
+    void SetExecutor(FleetExecutor* pclExecutor_) { m_pclExecutor = pclExecutor_; }
+
+protected:
+    /**
+     * @brief Notify
+     *
+     * Signal that new events are pending on the node, scheduling it with
+     * the executor if it is not already queued or running.  Safe to call
+     * from any thread.
+     */
+    void Notify();
+
+    /**
+     * @brief RunEvents
+     *
+     * Process the events pending on the node.  Only called by the executor.
+     *
+     * @param u16Budget_ Maximum number of events to process
+     * @return Number of events processed
+     */
+    virtual uint16_t RunEvents(uint16_t u16Budget_) = 0;
+
+    /**
+     * @brief HasPendingEvents
+     *
+     * @return true if further events are waiting to be processed
+     */
+    virtual bool HasPendingEvents() const = 0;
+
+private:
+    friend class FleetExecutor;
+    friend class FleetInjectQueue;
+
+    // Node scheduling states
+    static const uint8_t IDLE      = 0; //!< Not queued, not running
+    static const uint8_t SCHEDULED = 1; //!< Held in exactly one run queue
+    static const uint8_t RUNNING   = 2; //!< Being run by a worker
+    static const uint8_t NOTIFIED  = 3; //!< Being run, with new events posted since it started
+
+    FleetExecutor* m_pclExecutor; //!< Executor that runs this node
+    FleetNode*     m_pclNext;     //!< Link used by the executor's shared queue
+    uint8_t        m_u8State;     //!< Scheduling state (see above)
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FleetStateMachine class
+ *
+ * State machine with an attached event queue, run by a FleetExecutor.
+ * Events may be posted from any thread (or any other machine's handlers)
+ * when using an MpscEventQueue; posting schedules the machine on the
+ * executor, which drains it on one of its workers.
+ *
+ * @tparam Queue Event queue type (SpscEventQueue or MpscEventQueue)
+ */
+template <typename Queue>
+class FleetStateMachine : public QueuedStateMachine<Queue>, public FleetNode
+{
+public:
+    /**
+     * @brief Post
+     *
+     * Queue an event for processing by the state machine, and schedule the
+     * machine to run on the executor.  Never blocks.
+     *
+     * @param pvEvent_ Event to queue.  Must remain valid until processed.
+     * @return true on success, false if the queue is full
+     */
+    bool Post(const void* pvEvent_)
+    {
+        if (!QueuedStateMachine<Queue>::Post(pvEvent_)) {
+            return false;
+        }
+        Notify();
+        return true;
+    }
+
+protected:
+    uint16_t RunEvents(uint16_t u16Budget_) override
+    {
+        // Never more than the budget
+        return static_cast<uint16_t>(QueuedStateMachine<Queue>::Drain(u16Budget_));
+    }
+    bool     HasPendingEvents() const override { return QueuedStateMachine<Queue>::HasPendingEvents(); }
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FleetWorkQueue class
+ *
+ * Bounded work-stealing deque of runnable nodes, owned by a single worker.
+ * The owner pushes and pops nodes at the bottom of the deque, while idle
+ * workers steal the oldest nodes from the top.
+ */
+class FleetWorkQueue
+{
+public:
+    FleetWorkQueue();
+
+    /**
+     * @brief Push
+     *
+     * Add a node to the bottom of the deque.  Owner only.
+     *
+     * @param pclNode_ Node to add
+     * @return true on success, false if the deque is full
+     */
+    bool Push(FleetNode* pclNode_);
+
+    /**
+     * @brief Pop
+     *
+     * Remove the most recently pushed node from the deque.  Owner only.
+     *
+     * @return Node removed from the deque, or nullptr if empty
+     */
+    FleetNode* Pop();
+
+    /**
+     * @brief Steal
+     *
+     * Remove the oldest node from the deque.  May be called from any
+     * worker.
+     *
+     * @return Node removed from the deque, or nullptr if the deque was empty
+     * or the node was claimed by another worker.
+     */
+    FleetNode* Steal();
+
+private:
+    uint32_t   m_u32Top;                             //!< Index of the oldest node (stolen from)
+    uint32_t   m_u32Bottom;                          //!< Index of the next free slot (owner end)
+    FleetNode* m_apclNodes[FLEET_WORKER_DEQUE_SIZE]; //!< Node storage
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FleetInjectQueue class
+ *
+ * Unbounded, intrusive queue of nodes scheduled from outside the executor's
+ * workers.  Producers never block; workers take turns consuming from the
+ * queue, and skip it in favor of stealing when another worker is already
+ * consuming.
+ */
+class FleetInjectQueue
+{
+public:
+    FleetInjectQueue();
+
+    /**
+     * @brief Push
+     *
+     * Add a node to the queue.  May be called from any thread.
+     *
+     * @param pclNode_ Node to add
+     */
+    void Push(FleetNode* pclNode_);
+
+    /**
+     * @brief TryPop
+     *
+     * Remove the oldest node from the queue.
+     *
+     * @return Node removed from the queue, or nullptr if the queue was empty
+     * or being consumed by another worker.
+     */
+    FleetNode* TryPop();
+
+private:
+    // Placeholder node that keeps the list non-empty - never run
+    class StubNode : public FleetNode
+    {
+    protected:
+        uint16_t RunEvents(uint16_t /*u16Budget_*/) override { return 0; }
+        bool     HasPendingEvents() const override { return false; }
+    };
+
+    FleetNode* Pop();
+
+    StubNode   m_clStub;     //!< Placeholder node
+    FleetNode* m_pclHead;    //!< Most recently pushed node (producer end)
+    FleetNode* m_pclTail;    //!< Oldest node (consumer end)
+    bool       m_bConsuming; //!< Set while a worker holds the consumer end
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FleetWorker class
+ *
+ * Per-worker state of a FleetExecutor: the worker's deque of runnable
+ * machines, and statistics about the work it has done.
+ */
+class FleetWorker
+{
+public:
+    FleetWorker();
+
+    uint32_t GetRunCount() const { return m_u32Runs; }
+    uint32_t GetEventCount() const { return m_u32Events; }
+    uint32_t GetStealCount() const { return m_u32Steals; }
+
+private:
+    friend class FleetExecutor;
+
+    FleetWorkQueue m_clQueue;   //!< Machines runnable on this worker
+    uint32_t       m_u32Runs;   //!< Number of times a machine was run
+    uint32_t       m_u32Events; //!< Number of events processed
+    uint32_t       m_u32Steals; //!< Number of machines stolen from other workers
+};
+
+//---------------------------------------------------------------------------
+// Function called by a worker when it found no work to do.  Receives the
+// worker's index and the number of consecutive idle rounds.
+typedef void (*FleetIdleHandler_t)(uint16_t u16WorkerId_, uint32_t u32IdleRounds_);
+
+//---------------------------------------------------------------------------
+// Function called when a machine is scheduled from outside the workers, so
+// that workers blocked waiting for work can be woken (see FleetDispatcher).
+typedef void (*FleetWakeHandler_t)(void* pvContext_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The FleetExecutor class
+ *
+ * Runs a fleet of FleetStateMachine objects on a fixed set of workers.  The
+ * executor does not create threads itself: the application starts one
+ * thread per worker (i.e. a Mark3 Thread, or a pthread on a hosted system),
+ * each of which calls Run() or RunOnce() with its worker index.
+ *
+ * Each worker keeps a deque of machines that have pending events: those
+ * it rescheduled, and (with FLEET_WORKER_LOCAL_SCHEDULE) those posted to by
+ * the handlers it runs.  A worker runs machines from its own deque first,
+ * then from the executor's shared queue (where machines posted to from
+ * outside the workers are placed), and finally steals machines from the
+ * other workers.  A machine is only held
+ * by one worker at a time, so handlers for a given machine never run
+ * concurrently.
+ */
+class FleetExecutor
+{
+public:
+    FleetExecutor();
+
+    /**
+     * @brief Init
+     *
+     * Initialize the executor with the storage for its workers.  The worker
+     * objects must exist for the lifespan of the executor.
+     *
+     * @param paclWorkers_ Array of worker objects
+     * @param u16WorkerCount_ Number of workers in the array
+     * @return true on success, false on invalid parameters
+     */
+    bool Init(FleetWorker* paclWorkers_, uint16_t u16WorkerCount_);
+
+    /**
+     * @brief SetBudget
+     *
+     * Set the maximum number of events processed each time a machine is
+     * run, before it is rescheduled.
+     *
+     * @param u16Budget_ Maximum number of events per run
+     */
+    void SetBudget(uint16_t u16Budget_) { m_u16Budget = u16Budget_; }
+
+    /**
+     * @brief SetIdleHandler
+     *
+     * Set the function called by Run() when a worker finds no work, i.e.
+     * to yield or sleep the worker's thread.
+     *
+     * @param pfIdle_ Idle handler, or nullptr to spin
+     */
+    void SetIdleHandler(FleetIdleHandler_t pfIdle_) { m_pfIdle = pfIdle_; }
+
+    /**
+     * @brief SetWakeHandler
+     *
+     * Set the function called by Schedule() after a machine is added to a
+     * run queue.  Must be set before any events are posted.
+     *
+     * @param pfWake_ Wake handler, or nullptr for none
+     * @param pvContext_ Argument passed to the wake handler
+     */
+    void SetWakeHandler(FleetWakeHandler_t pfWake_, void* pvContext_)
+    {
+        m_pfWake        = pfWake_;
+        m_pvWakeContext = pvContext_;
+    }
+
+    /**
+     * @brief Schedule
+     *
+     * Add a machine to the executor's run queues.  Called when events are
+     * posted to an idle machine.  When called from a handler running on one
+     * of the executor's workers, the machine goes in that worker's own deque
+     * (see FLEET_WORKER_LOCAL_SCHEDULE); otherwise, or if the deque is full,
+     * in the shared queue.
+     *
+     * @param pclNode_ Machine to schedule
+     */
+    void Schedule(FleetNode* pclNode_);
+
+    /**
+     * @brief RunOnce
+     *
+     * Find one runnable machine and process its pending events.
+     *
+     * @param u16WorkerId_ Index of the calling worker
+     * @return true if a machine was run, false if no work was found
+     */
+    bool RunOnce(uint16_t u16WorkerId_);
+
+    /**
+     * @brief Run
+     *
+     * Run machines on the calling worker until the stop flag is set.
+     *
+     * @param u16WorkerId_ Index of the calling worker
+     * @param pbStop_ Flag set (from any thread) to make the worker return
+     */
+    void Run(uint16_t u16WorkerId_, const bool* pbStop_);
+
+    /**
+     * @brief GetWorker
+     *
+     * @param u16WorkerId_ Index of the worker
+     * @return Pointer to the worker object
+     */
+    FleetWorker* GetWorker(uint16_t u16WorkerId_) { return &m_paclWorkers[u16WorkerId_]; }
+
+    /**
+     * @brief GetWorkerCount
+     *
+     * @return Number of workers running the executor's machines
+     */
+    uint16_t GetWorkerCount() const { return m_u16WorkerCount; }
+
+private:
+    FleetNode* FindWork(uint16_t u16WorkerId_);
+
+    FleetWorker*       m_paclWorkers;    //!< Worker state, one per worker thread
+    uint16_t           m_u16WorkerCount; //!< Number of workers
+    uint16_t           m_u16Budget;      //!< Maximum events processed per machine run
+    FleetIdleHandler_t m_pfIdle;         //!< Called when a worker is idle
+    FleetWakeHandler_t m_pfWake;         //!< Called when a machine is scheduled from outside the workers
+    void*              m_pvWakeContext;  //!< Argument passed to the wake handler
+    FleetInjectQueue   m_clInjectQueue;  //!< Machines scheduled from outside the workers
+};
+} // namespace Mark3
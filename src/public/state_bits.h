@@ -0,0 +1,85 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_bits.h
+    @brief Bit-scan helper shared by the state machine's bitmaps
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateBits class
+ *
+ * Finds the highest set bit in a 32-bit map.  Uses the compiler's
+ * count-leading-zeros builtin on the long type where available, since int
+ * is only 16 bits wide on some Mark3 targets (i.e. AVR and MSP430);
+ * elsewhere, the map is narrowed by a binary search.
+ */
+class StateBits
+{
+public:
+    /**
+     * @brief HighestSet
+     *
+     * @param u32Bits_ Map to scan; must not be zero
+     * @return Index of the highest set bit (0-31)
+     */
+    static uint8_t HighestSet(uint32_t u32Bits_)
+    {
+#if defined(__GNUC__)
+        return static_cast<uint8_t>((sizeof(unsigned long) * 8) - 1 - __builtin_clzl(u32Bits_));
+#else
+        return HighestSetPortable(u32Bits_);
+#endif
+    }
+
+    /**
+     * @brief HighestSetPortable
+     *
+     * Builtin-free version of HighestSet().
+     *
+     * @param u32Bits_ Map to scan; must not be zero
+     * @return Index of the highest set bit (0-31)
+     */
+    static uint8_t HighestSetPortable(uint32_t u32Bits_)
+    {
+        uint8_t u8Bit = 0;
+        if ((u32Bits_ & 0xFFFF0000u) != 0) {
+            u32Bits_ >>= 16;
+            u8Bit += 16;
+        }
+        if ((u32Bits_ & 0xFF00u) != 0) {
+            u32Bits_ >>= 8;
+            u8Bit += 8;
+        }
+        if ((u32Bits_ & 0xF0u) != 0) {
+            u32Bits_ >>= 4;
+            u8Bit += 4;
+        }
+        if ((u32Bits_ & 0xCu) != 0) {
+            u32Bits_ >>= 2;
+            u8Bit += 2;
+        }
+        if ((u32Bits_ & 0x2u) != 0) {
+            u8Bit += 1;
+        }
+        return u8Bit;
+    }
+};
+} // namespace Mark3
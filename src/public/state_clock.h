@@ -0,0 +1,70 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_clock.h
+    @brief Timestamp source used by the state machine instrumentation
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Function returning the current value of a free-running counter
+typedef uint64_t (*StateClockSource_t)();
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateClock class
+ *
+ * Provides the timestamps recorded by the state machine trace and profiling
+ * instrumentation.  By default, the CPU's cycle counter is used on x86
+ * targets; other targets must register a source (i.e. a hardware timer or
+ * the Cortex-M DWT cycle counter), otherwise timestamps read as zero.
+ */
+class StateClock
+{
+public:
+    /**
+     * @brief SetSource
+     *
+     * Register the function used to read the current timestamp.
+     *
+     * @param pfSource_ Timestamp source, or nullptr to use the default
+     */
+    static void SetSource(StateClockSource_t pfSource_) { m_pfSource = pfSource_; }
+
+    /**
+     * @brief Now
+     *
+     * @return Current timestamp, in units of the registered source
+     */
+    static uint64_t Now()
+    {
+        if (m_pfSource != nullptr) {
+            return m_pfSource();
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+private:
+    static StateClockSource_t m_pfSource;
+};
+} // namespace Mark3
@@ -0,0 +1,263 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_coroutine.h
+    @brief Resumable states, written as a sequence awaiting successive events
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_machine.h"
+
+#if STATE_MACHINE_COROUTINES
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Resume point of a coroutine that has run to the end of its body.  Resume
+// points are the source lines of the awaits in the body, so at most one
+// STATE_CO_YIELD/AWAIT/AWAIT_UNTIL may be used on each line - a second is
+// rejected by the compiler as a duplicate case value.
+#define STATE_COROUTINE_FINISHED (0xFFFFFFFFu)
+
+// Check that a line number can be used as a resume point
+#define STATE_CO_CHECK_LINE()                                                                                          \
+    static_assert((__LINE__ > 0) && (static_cast<uint32_t>(__LINE__) < STATE_COROUTINE_FINISHED),                      \
+                  "Coroutine resume point out of range")
+
+//---------------------------------------------------------------------------
+// Start the body of a coroutine state.  Resumes execution from the point at
+// which the coroutine last awaited an event.
+#define STATE_CO_BEGIN(frame)                                                                                          \
+    switch ((frame)->m_u32Resume) {                                                                                    \
+        case 0:
+
+//---------------------------------------------------------------------------
+// Return from the coroutine with the given result, resuming from this point
+// when the next event is delivered to it.
+#define STATE_CO_YIELD(frame, result)                                                                                  \
+    do {                                                                                                               \
+        STATE_CO_CHECK_LINE();                                                                                         \
+        (frame)->m_u32Resume = __LINE__;                                                                               \
+        return (result);                                                                                               \
+        case __LINE__:;                                                                                                \
+    } while (0)
+
+//---------------------------------------------------------------------------
+// Consume the current event and wait for the next one.
+#define STATE_CO_AWAIT(frame) STATE_CO_YIELD(frame, StateReturn::ok)
+
+//---------------------------------------------------------------------------
+// Consume the current event and wait for one that satisfies a condition.
+// Events that don't are returned as unhandled, so that they are passed on to
+// the states below on the stack.
+#define STATE_CO_AWAIT_UNTIL(frame, condition)                                                                         \
+    do {                                                                                                               \
+        STATE_CO_CHECK_LINE();                                                                                         \
+        (frame)->m_u32Resume = __LINE__;                                                                               \
+        return StateReturn::ok;                                                                                        \
+        case __LINE__:                                                                                                 \
+            if (!(condition)) {                                                                                        \
+                return StateReturn::unhandled;                                                                         \
+            }                                                                                                          \
+    } while (0)
+
+//---------------------------------------------------------------------------
+// End the body of a coroutine state.  Once the body has run to completion,
+// further events are returned as unhandled until the state exits.
+#define STATE_CO_END(frame)                                                                                            \
+    (frame)->m_u32Resume = STATE_COROUTINE_FINISHED;                                                                   \
+    return StateReturn::ok;                                                                                            \
+    default: break;                                                                                                    \
+    }                                                                                                                  \
+    return StateReturn::unhandled
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateCoroutineFrame class
+ *
+ * Header of a coroutine state's frame.  Each coroutine state defines its
+ * frame as a struct derived from this class, holding every variable that
+ * must persist across the points where the coroutine awaits an event -
+ * local variables of the body do not.  Frames are zero-initialized when the
+ * coroutine starts, rather than constructed, so a frame must be a trivial
+ * type: no constructors, destructor, virtual functions or members that
+ * have them (checked by StateCoroutine where the compiler allows).
+ */
+class StateCoroutineFrame
+{
+public:
+    StateCoroutineFrame* m_pclNext;   //!< Next frame owned by the same machine, or in the pool's free list
+    StateHandler_t       m_pfRun;     //!< Run handler of the coroutine state owning the frame
+    uint32_t             m_u32Resume; //!< Point in the body from which the coroutine resumes
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateCoroutinePool class
+ *
+ * Fixed-size pool of coroutine frames, carved from storage supplied by the
+ * application, so that no memory is allocated as coroutine states are
+ * entered and exited.  A pool can be shared by any number of machines (see
+ * StateMachine::SetCoroutinePool()), provided they are all run from the
+ * same thread; it needs one frame for each coroutine state active at once.
+ * Coroutine states are only available when the library is built with
+ * STATE_MACHINE_COROUTINES enabled.
+ */
+class StateCoroutinePool
+{
+public:
+    StateCoroutinePool();
+
+    /**
+     * @brief SetStorage
+     *
+     * Set the memory from which frames are allocated.  The memory must exist
+     * for the lifespan of the pool, and be aligned for the frame types that
+     * use it (i.e. an array of uint64_t).  Must not be called while any
+     * frames are in use.
+     *
+     * @param pvStorage_ Memory holding the frames
+     * @param u16FrameSize_ Size of each frame, in bytes - at least the size
+     * of the largest frame type allocated from the pool
+     * @param u16FrameCount_ Number of frames held in the memory
+     * @return true on success, false on invalid parameters
+     */
+    bool SetStorage(void* pvStorage_, uint16_t u16FrameSize_, uint16_t u16FrameCount_);
+
+    /**
+     * @brief GetFreeCount
+     *
+     * @return Number of frames available for allocation
+     */
+    uint16_t GetFreeCount() const { return m_u16FreeCount; }
+
+    /**
+     * @brief Acquire
+     *
+     * Find the frame of a coroutine state running on a machine, allocating
+     * it from the machine's pool when the state runs for the first time.
+     * Failure to allocate is reported to the machine's error handler.
+     *
+     * @param pclSM_ Machine running the coroutine state
+     * @param pfRun_ Run handler of the coroutine state
+     * @param u16Size_ Size of the coroutine's frame type
+     * @return Frame of the coroutine, or nullptr if none could be allocated
+     */
+    static StateCoroutineFrame* Acquire(StateMachine* pclSM_, StateHandler_t pfRun_, uint16_t u16Size_)
+    {
+        // Events are almost always delivered to the innermost coroutine
+        auto pclFrame = pclSM_->m_pclCoroutineFrames;
+        if ((pclFrame != nullptr) && (pclFrame->m_pfRun == pfRun_)) {
+            return pclFrame;
+        }
+        return Allocate(pclSM_, pfRun_, u16Size_);
+    }
+
+    /**
+     * @brief Release
+     *
+     * Return the frame of a coroutine state to its machine's pool, if it
+     * has one.
+     *
+     * @param pclSM_ Machine running the coroutine state
+     * @param pfRun_ Run handler of the coroutine state
+     */
+    static void Release(StateMachine* pclSM_, StateHandler_t pfRun_);
+
+    /**
+     * @brief ReleaseAll
+     *
+     * Return every frame held by a machine to its pool.
+     *
+     * @param pclSM_ Machine owning the frames
+     */
+    static void ReleaseAll(StateMachine* pclSM_);
+
+private:
+    static StateCoroutineFrame* Allocate(StateMachine* pclSM_, StateHandler_t pfRun_, uint16_t u16Size_);
+
+    void Free(StateCoroutineFrame* pclFrame_);
+
+    StateCoroutineFrame* m_pclFree;      //!< Frames available for allocation
+    uint16_t             m_u16FrameSize; //!< Size of each frame
+    uint16_t             m_u16FreeCount; //!< Number of frames available
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateCoroutine class
+ *
+ * Adapter turning a coroutine body into the handlers of a state, allowing a
+ * long sequence of steps - i.e. a protocol handshake - to be written as a
+ * single function rather than one state per step.  The body is a function
+ * of the form:
+ *
+ * @code
+ * StateReturn Body(StateMachine* pclSM_, Frame* pclFrame_, const void* pvEvent_)
+ * {
+ *     STATE_CO_BEGIN(pclFrame_);
+ *     ...
+ *     STATE_CO_AWAIT(pclFrame_);
+ *     ...
+ *     STATE_CO_END(pclFrame_);
+ * }
+ * @endcode
+ *
+ * which receives each event delivered to the state in pvEvent_.  The body
+ * starts with the first event delivered after the state is entered, and
+ * may push, pop and transition as with a normal run handler.  Its frame is
+ * allocated from the machine's coroutine pool at that point, and returned
+ * when the state exits.
+ *
+ * The state is declared in a state table as:
+ *
+ * @code
+ * {nullptr, StateCoroutine<Frame, Body>::Run, StateCoroutine<Frame, Body>::Exit}
+ * @endcode
+ *
+ * A coroutine state may only appear once on a machine's stack at a time.
+ * Coroutine states are not supported by StateMachineFleet, and their
+ * progress is not captured by StateMachine::Snapshot() - a restored
+ * coroutine starts again from the beginning of its body.
+ *
+ * @tparam Frame Frame type of the coroutine, a trivial type derived from
+ * StateCoroutineFrame
+ * @tparam pfBody Body of the coroutine
+ */
+template <typename Frame, StateReturn (*pfBody)(StateMachine*, Frame*, const void*)>
+class StateCoroutine
+{
+public:
+    static_assert(sizeof(Frame) <= 0xFFFF, "Coroutine frame must be smaller than 64KiB");
+#if defined(__GNUC__)
+    static_assert(__is_base_of(StateCoroutineFrame, Frame), "Coroutine frame must derive from StateCoroutineFrame");
+    static_assert(__is_trivial(Frame), "Coroutine frame must be a trivial type - it is zeroed, not constructed");
+#endif
+
+    static StateReturn Run(StateMachine* pclSM_, const void* pvEvent_)
+    {
+        auto pclFrame = StateCoroutinePool::Acquire(pclSM_, Run, sizeof(Frame));
+        if (pclFrame == nullptr) {
+            return StateReturn::unhandled;
+        }
+        return pfBody(pclSM_, static_cast<Frame*>(pclFrame), pvEvent_);
+    }
+
+    static void Exit(StateMachine* pclSM_) { StateCoroutinePool::Release(pclSM_, Run); }
+};
+} // namespace Mark3
+
+#endif // STATE_MACHINE_COROUTINES
@@ -19,9 +19,32 @@ See license.txt for more information
 #pragma once
 
 #include <stdint.h>
+#include "state_bits.h"
+#include "state_trace.h"
+#include "state_profile.h"
+#include "state_snapshot.h"
 
 namespace Mark3
 {
+//---------------------------------------------------------------------------
+// Unsigned integer type used to index states in a state table: uint8_t,
+// uint16_t or uint32_t.  Sets the maximum number of states in a table (one
+// less than the type's maximum value), and the size of each entry on a state
+// machine's stack.  Must be set consistently for the library and all code
+// using it.
+#ifndef STATE_MACHINE_INDEX_TYPE
+#define STATE_MACHINE_INDEX_TYPE uint16_t
+#endif
+
+typedef STATE_MACHINE_INDEX_TYPE StateIndex_t;
+
+static_assert((static_cast<StateIndex_t>(-1) > 0)
+                  && ((sizeof(StateIndex_t) == 1) || (sizeof(StateIndex_t) == 2) || (sizeof(StateIndex_t) == 4)),
+              "State index type must be uint8_t, uint16_t or uint32_t");
+
+// Reserved state index, used where no state applies
+#define STATE_INDEX_NONE (static_cast<StateIndex_t>(-1))
+
 //---------------------------------------------------------------------------
 /**
  * Possible state handler return codes
@@ -32,6 +55,21 @@ enum class StateReturn : uint8_t{
     transition //!< Event handling resulted in state transition
 };
 
+//---------------------------------------------------------------------------
+/**
+ * @brief StateReturnMask
+ *
+ * Convert a state handler return code into a bitmask value, used to build
+ * the stop conditions passed to StateMachine::HandleEventBatch().
+ *
+ * @param eReturn_ Return code to convert
+ * @return Bitmask corresponding to the return code
+ */
+constexpr uint8_t StateReturnMask(StateReturn eReturn_)
+{
+    return static_cast<uint8_t>(1 << static_cast<uint8_t>(eReturn_));
+}
+
 //---------------------------------------------------------------------------
 /**
  * Possible state machine operations
@@ -46,8 +84,24 @@ enum class StateOpcode : uint8_t {
 };
 
 //---------------------------------------------------------------------------
-// Forward declaration
+/**
+ * History restored when a state is entered by a push or transition (see
+ * StateMachine::SetHistory())
+ */
+enum class StateHistory : uint8_t {
+    none,    //!< Enter the state only
+    shallow, //!< Also re-enter the state last active above it on the stack
+    deep     //!< Re-enter every state that was active above it on the stack
+};
+
+//---------------------------------------------------------------------------
+// Forward declarations
 class StateMachine;
+class StateTimer;
+class StateTimerWheel;
+class StateCoroutineFrame;
+class StateCoroutinePool;
+class StateTransitionTable;
 
 //---------------------------------------------------------------------------
 // Function pointer type used for implementing state entry/exit functions
@@ -61,7 +115,8 @@ enum class StateErrorType : uint8_t {
     ambiguous_operation,
     invalid_state,
     state_stack_overflow,
-    state_stack_underflow
+    state_stack_underflow,
+    coroutine_frame_unavailable
 };
 
 // Struct that defines error event data
@@ -69,16 +124,16 @@ typedef struct {
     StateErrorType eType;
     union {
         struct {
-            StateOpcode eInitialOp;
-            StateOpcode eAmbiguousOp;
-            uint16_t u16StartState;
-            uint16_t u16CurrentState;
+            StateOpcode  eInitialOp;
+            StateOpcode  eAmbiguousOp;
+            StateIndex_t uXStartState;
+            StateIndex_t uXCurrentState;
         } ambiguousOperation;
         struct {
-            uint16_t u16InvalidState;
+            StateIndex_t uXInvalidState;
         } invalidState;
         struct {
-            uint16_t u16FailedState;
+            StateIndex_t uXFailedState;
         } stateStackOverflow;
     };
 } StateErrorData_t;
@@ -94,7 +149,354 @@ typedef struct {
 } State_t;
 
 //---------------------------------------------------------------------------
+// Event addressed to a specific machine, used with StateMachine::HandleEventPairs()
+typedef struct {
+    StateMachine* pclSM;   //!< Machine that handles the event
+    const void*   pvEvent; //!< Stimulus object passed to the machine
+} StateEventPair_t;
+
+//---------------------------------------------------------------------------
+// Handler registered against a specific event ID
+typedef struct {
+    uint16_t       u16EventId; //!< ID of the event handled
+    StateHandler_t pfHandler;  //!< Function called to handle the event
+} StateEventHandler_t;
+
+//---------------------------------------------------------------------------
+// Per-state event dispatch table, used with typed (ID-tagged) events.
+typedef struct {
+    const StateHandler_t*      apfDense;       //!< (optional) Handlers indexed by event ID, null if unhandled
+    uint16_t                   u16DenseCount;  //!< Number of entries in apfDense
+    const StateEventHandler_t* astSparse;      //!< (optional) Handlers sorted by ascending event ID
+    uint16_t                   u16SparseCount; //!< Number of entries in astSparse
+    StateHandler_t             pfDefault;      //!< (optional) Handler for IDs not found in either table
+} StateEventMap_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief StateEventMapLookup
+ *
+ * Find the handler registered for an event ID in a state's event map.  The
+ * dense table is checked first, then the sparse table (by binary search),
+ * before falling back to the default handler.
+ *
+ * @param pstMap_ Event map to search
+ * @param u16EventId_ ID of the event
+ * @return Handler for the event, or nullptr if the state does not handle it
+ */
+inline StateHandler_t StateEventMapLookup(const StateEventMap_t* pstMap_, uint16_t u16EventId_)
+{
+    if (u16EventId_ < pstMap_->u16DenseCount) {
+        auto pfHandler = pstMap_->apfDense[u16EventId_];
+        if (pfHandler != nullptr) {
+            return pfHandler;
+        }
+    }
+
+    uint16_t u16Low  = 0;
+    uint16_t u16High = pstMap_->u16SparseCount;
+    while (u16Low < u16High) {
+        uint16_t u16Mid = u16Low + ((u16High - u16Low) / 2);
+        auto     u16Id  = pstMap_->astSparse[u16Mid].u16EventId;
+        if (u16Id == u16EventId_) {
+            return pstMap_->astSparse[u16Mid].pfHandler;
+        }
+        if (u16Id < u16EventId_) {
+            u16Low = u16Mid + 1;
+        } else {
+            u16High = u16Mid;
+        }
+    }
+    return pstMap_->pfDefault;
+}
+
+//---------------------------------------------------------------------------
+// Maximum number of states on a state machine's stack.  Each machine reserves
+// this many state indices, so flat machines that never push can set it as low
+// as 1.  Must be set consistently for the library and all code using it.
+#ifndef MAX_STATE_STACK_DEPTH
 #define MAX_STATE_STACK_DEPTH (8)
+#endif
+
+static_assert((MAX_STATE_STACK_DEPTH >= 1) && (MAX_STATE_STACK_DEPTH <= 255),
+              "State stack depth must be between 1 and 255");
+
+// Number of 32-bit words in a machine's mask of stack frames with exit work
+#define STATE_EXIT_FRAME_WORDS ((MAX_STATE_STACK_DEPTH + 31) / 32)
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateHandle class
+ *
+ * Compile-time handle to a state, used with the templated PushState(),
+ * PopState() and TransitionState() overloads so that the bounds checks made
+ * at runtime by their index-based counterparts are done by static_assert
+ * instead, i.e.
+ *
+ * @code
+ * enum { kIdle, kMenu, kSubMenu, kStateCount };
+ * typedef StateHandle<kStateCount, kIdle>        Idle;
+ * typedef StateHandle<kStateCount, kMenu, 1>     Menu;
+ * typedef StateHandle<kStateCount, kSubMenu, 2>  SubMenu;
+ *
+ * pclSM_->TransitionState<Idle>();
+ * pclSM_->PushState<Menu, SubMenu>();
+ * pclSM_->PopState<SubMenu>();
+ * @endcode
+ *
+ * The state count must match the size of the state table the machine runs,
+ * i.e. by checking it with a static_assert where the table is defined.  A
+ * state may optionally declare the depth on the stack at which it always
+ * runs (1 for the bottom of the stack, 0 if it is not fixed), which lets
+ * push and pop operations made by its own handlers be checked as well.
+ *
+ * @tparam uXStateCount_ Number of states in the state table
+ * @tparam uXIndex_ Index of the state in the state table
+ * @tparam u8Depth_ Depth on the stack at which the state runs, or 0 if unknown
+ */
+template <StateIndex_t uXStateCount_, StateIndex_t uXIndex_, uint8_t u8Depth_ = 0>
+class StateHandle
+{
+public:
+    static_assert(uXIndex_ < uXStateCount_, "State index is outside of the state table");
+    static_assert(u8Depth_ <= MAX_STATE_STACK_DEPTH, "State depth exceeds the maximum stack depth");
+
+    static constexpr StateIndex_t uXStateCount = uXStateCount_;
+    static constexpr StateIndex_t uXIndex      = uXIndex_;
+    static constexpr uint8_t      u8Depth      = u8Depth_;
+};
+
+//---------------------------------------------------------------------------
+// Set to 1 to build the state machine with support for recording its
+// operations into a StateTraceBuffer.  Must be set consistently for the
+// library and all code using it.
+#ifndef STATE_MACHINE_TRACE
+#define STATE_MACHINE_TRACE (0)
+#endif
+
+#if STATE_MACHINE_TRACE
+#define STATE_MACHINE_TRACE_RECORD(op, from, to)                                                                       \
+    do {                                                                                                               \
+        if (m_pclTrace != nullptr) {                                                                                   \
+            m_pclTrace->Record((op), (from), (to), m_u8StackDepth);                                                   \
+        }                                                                                                              \
+    } while (0)
+#else
+#define STATE_MACHINE_TRACE_RECORD(op, from, to)
+#endif
+
+//---------------------------------------------------------------------------
+// Set to 1 to build the state machine with support for recording the latency
+// of each state's handlers into StateProfile histograms.  Must be set
+// consistently for the library and all code using it.
+#ifndef STATE_MACHINE_PROFILE
+#define STATE_MACHINE_PROFILE (0)
+#endif
+
+#if STATE_MACHINE_PROFILE
+#define STATE_MACHINE_PROFILE_CALL(hist, state, call)                                                                  \
+    do {                                                                                                               \
+        if (m_pclProfile != nullptr) {                                                                                 \
+            auto uXProfileState = (state);                                                                            \
+            auto u64ProfileStart = StateClock::Now();                                                                  \
+            call;                                                                                                      \
+            m_pclProfile[uXProfileState].hist.Record(StateClock::Now() - u64ProfileStart);                            \
+        } else {                                                                                                       \
+            call;                                                                                                      \
+        }                                                                                                              \
+    } while (0)
+#else
+#define STATE_MACHINE_PROFILE_CALL(hist, state, call)                                                                  \
+    do {                                                                                                               \
+        call;                                                                                                          \
+    } while (0)
+#endif
+
+//---------------------------------------------------------------------------
+// Set to 1 to build the state machine with support for each of the optional
+// features below.  Each one adds its own members to every StateMachine
+// object, so they are left out of machines built without them.  Must be set
+// consistently for the library and all code using it.
+//
+//  STATE_MACHINE_TIMERS        - state timeouts (see StateTimerWheel)
+//  STATE_MACHINE_COROUTINES    - coroutine states (see StateCoroutine)
+//  STATE_MACHINE_TYPED_EVENTS  - typed events, dispatched through per-state
+//                                event maps or a transition table
+//  STATE_MACHINE_EVENT_CLASSES - event classes (see HandleClassEvent())
+//  STATE_MACHINE_HISTORY       - shallow and deep state history
+//  STATE_MACHINE_STATS         - unhandled event and skipped state counters
+#ifndef STATE_MACHINE_TIMERS
+#define STATE_MACHINE_TIMERS (0)
+#endif
+
+#ifndef STATE_MACHINE_COROUTINES
+#define STATE_MACHINE_COROUTINES (0)
+#endif
+
+#ifndef STATE_MACHINE_TYPED_EVENTS
+#define STATE_MACHINE_TYPED_EVENTS (0)
+#endif
+
+#ifndef STATE_MACHINE_EVENT_CLASSES
+#define STATE_MACHINE_EVENT_CLASSES (0)
+#endif
+
+#ifndef STATE_MACHINE_HISTORY
+#define STATE_MACHINE_HISTORY (0)
+#endif
+
+#ifndef STATE_MACHINE_STATS
+#define STATE_MACHINE_STATS (0)
+#endif
+
+#if STATE_MACHINE_STATS
+#define STATE_MACHINE_STATS_COUNT(counter) ((counter)++)
+#else
+#define STATE_MACHINE_STATS_COUNT(counter)
+#endif
+
+//---------------------------------------------------------------------------
+// Set to 1 to build the event VM as a direct-threaded interpreter, where each
+// operation jumps straight to the next through a table of label addresses
+// (computed goto).  Defaults to 1 on compilers that support it; elsewhere,
+// each dispatch point gets its own switch instead of sharing a single loop.
+#ifndef STATE_MACHINE_THREADED
+#if defined(__GNUC__)
+#define STATE_MACHINE_THREADED (1)
+#else
+#define STATE_MACHINE_THREADED (0)
+#endif
+#endif
+
+#if STATE_MACHINE_THREADED
+#define STATE_MACHINE_VM_TABLE()                                                                                       \
+    static void* const apvOps[] = {                                                                                    \
+        &&op_returned, &&op_run, &&op_push, &&op_pop, &&op_transition, &&op_unhandled}
+#define STATE_MACHINE_VM_DISPATCH(op) goto* apvOps[static_cast<uint8_t>(op)]
+#else
+#define STATE_MACHINE_VM_TABLE()
+#define STATE_MACHINE_VM_DISPATCH(op)                                                                                  \
+    do {                                                                                                               \
+        switch (op) {                                                                                                  \
+            case StateOpcode::run: goto op_run;                                                                        \
+            case StateOpcode::push: goto op_push;                                                                      \
+            case StateOpcode::pop: goto op_pop;                                                                        \
+            case StateOpcode::transition: goto op_transition;                                                          \
+            case StateOpcode::unhandled: goto op_unhandled;                                                            \
+            default: goto op_returned;                                                                                 \
+        }                                                                                                              \
+    } while (0)
+#endif
+
+//---------------------------------------------------------------------------
+// Number of pairs ahead of the one being handled whose state table entries
+// StateMachine::HandleEventPairs() prefetches; the machine objects and events
+// are prefetched twice as far ahead.  Set to 0 to disable prefetching.
+#ifndef STATE_MACHINE_PREFETCH_DISTANCE
+#define STATE_MACHINE_PREFETCH_DISTANCE (4)
+#endif
+
+#if defined(__GNUC__)
+#define STATE_MACHINE_PREFETCH(addr, rw) __builtin_prefetch((addr), (rw), 3)
+#else
+#define STATE_MACHINE_PREFETCH(addr, rw) ((void)(addr))
+#endif
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateTableRef class
+ *
+ * State table accessor used by the state machine VM to invoke the handlers
+ * held in a state table supplied at runtime.  Entry and exit handlers are
+ * optional, and are checked for null before being called.
+ */
+class StateTableRef
+{
+public:
+    explicit StateTableRef(const State_t* pstStates_) : m_pstStates{pstStates_} {}
+
+    bool Handles(StateIndex_t /*uXState_*/) const { return true; }
+
+    StateReturn Run(StateMachine* pclSM_, StateIndex_t uXState_, const void* pvEvent_) const
+    {
+        return m_pstStates[uXState_].pfRun(pclSM_, pvEvent_);
+    }
+
+    void Entry(StateMachine* pclSM_, StateIndex_t uXState_) const
+    {
+        if (m_pstStates[uXState_].pfEntry) {
+            m_pstStates[uXState_].pfEntry(pclSM_);
+        }
+    }
+
+    void Exit(StateMachine* pclSM_, StateIndex_t uXState_) const
+    {
+        if (m_pstStates[uXState_].pfExit) {
+            m_pstStates[uXState_].pfExit(pclSM_);
+        }
+    }
+
+protected:
+    const State_t* m_pstStates;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateEventClassRef class
+ *
+ * State table accessor used to dispatch events tagged with an event class.
+ * Each state declares a bitmask of the event classes it handles; states that
+ * do not handle the event's class are skipped by the VM without calling
+ * their pfRun handler.
+ */
+class StateEventClassRef : public StateTableRef
+{
+public:
+    StateEventClassRef(const State_t* pstStates_, const uint32_t* pu32ClassMasks_, uint8_t u8EventClass_)
+        : StateTableRef(pstStates_)
+        , m_pu32ClassMasks{pu32ClassMasks_}
+        , m_u32ClassMask{static_cast<uint32_t>(1) << u8EventClass_}
+    {
+    }
+
+    bool Handles(StateIndex_t uXState_) const { return (m_pu32ClassMasks[uXState_] & m_u32ClassMask) != 0; }
+
+private:
+    const uint32_t* m_pu32ClassMasks;
+    uint32_t        m_u32ClassMask;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateEventMapRef class
+ *
+ * State table accessor used to dispatch typed events.  Rather than calling
+ * each state's pfRun handler, the handler for the event's ID is looked up in
+ * the state's event map; states with no handler for the ID are skipped
+ * without making a call, and the event passes directly to the next state on
+ * the stack.
+ */
+class StateEventMapRef : public StateTableRef
+{
+public:
+    StateEventMapRef(const State_t* pstStates_, const StateEventMap_t* pstMaps_, uint16_t u16EventId_)
+        : StateTableRef(pstStates_), m_pstMaps{pstMaps_}, m_u16EventId{u16EventId_}
+    {
+    }
+
+    StateReturn Run(StateMachine* pclSM_, StateIndex_t uXState_, const void* pvEvent_) const
+    {
+        auto pfHandler = StateEventMapLookup(&m_pstMaps[uXState_], m_u16EventId);
+        if (pfHandler == nullptr) {
+            return StateReturn::unhandled;
+        }
+        return pfHandler(pclSM_, pvEvent_);
+    }
+
+private:
+    const StateEventMap_t* m_pstMaps;
+    uint16_t               m_u16EventId;
+};
 
 //---------------------------------------------------------------------------
 /**
@@ -124,10 +526,10 @@ public:
      * be set once per instance.
      *
      * @param pstStates_ pointer to the state machine table
-     * @param u16StateCount_ number of states held in the table
+     * @param uXStateCount_ number of states held in the table
      * @return true on success, false if called multiple times
      */
-    bool SetStates(const State_t* pstStates_, uint16_t u16StateCount_);
+    bool SetStates(const State_t* pstStates_, StateIndex_t uXStateCount_);
 
     /**
      * @brief SetContext
@@ -174,17 +576,240 @@ public:
      */
     StateReturn HandleEvent(const void* pvEvent_);
 
+    /**
+     * @brief HandleEventBatch
+     *
+     * Pass a sequence of events to the state machine for processing, in
+     * order.  Each event is handled exactly as if it were passed to
+     * HandleEvent(), but the per-call setup is amortized across the batch.
+     *
+     * @param ppvEvents_ Array of stimulus objects to process
+     * @param u32Count_ Number of events in the array
+     * @param peResults_ [out] (optional) Array receiving the result of each
+     * processed event.  Must hold at least u32Count_ entries.
+     * @param u8StopMask_ Mask of StateReturn values (see StateReturnMask())
+     * that stop the batch after the event producing them is processed.
+     * @return Number of events processed
+     */
+    uint32_t HandleEventBatch(const void* const* ppvEvents_,
+                              uint32_t           u32Count_,
+                              StateReturn*       peResults_  = nullptr,
+                              uint8_t            u8StopMask_ = 0);
+
+    /**
+     * @brief HandleEventPairs
+     *
+     * Pass a sequence of events, each addressed to its own machine, to the
+     * machines for processing, in order.  Each event is handled exactly as
+     * if it were passed to its machine's HandleEvent().  While each event is
+     * handled, the machine objects, events and current state table entries
+     * of the pairs that follow are prefetched (see
+     * STATE_MACHINE_PREFETCH_DISTANCE), so that the cache misses of
+     * dispatching to many different machines overlap rather than stalling
+     * one after another.  A machine may appear in any number of pairs;
+     * events addressed to a machine that has not been started are not
+     * handled, and report StateReturn::unhandled.
+     * Intended for fleets too large to stay in cache; for a few machines
+     * that do, calling HandleEvent() directly is slightly cheaper.
+     *
+     * Machines are run through their runtime state table, so tables bound
+     * at compile-time (see StaticStateMachine) are not inlined.
+     *
+     * @param pastPairs_ Array of machine/event pairs to process
+     * @param u32Count_ Number of pairs in the array
+     * @param peResults_ [out] (optional) Array receiving the result of each
+     * event.  Must hold at least u32Count_ entries.
+     * @return Number of events processed
+     */
+    static uint32_t
+    HandleEventPairs(const StateEventPair_t* pastPairs_, uint32_t u32Count_, StateReturn* peResults_ = nullptr);
+
+#if STATE_MACHINE_TYPED_EVENTS
+    /**
+     * @brief SetEventMaps
+     *
+     * Set the per-state event maps used to dispatch typed events (see
+     * HandleEvent(uint16_t, const void*)).  The array holds one map per
+     * entry in the state table, and must exist for the lifespan of the
+     * state machine.
+     *
+     * @param pstMaps_ Array of event maps, indexed by state
+     */
+    void SetEventMaps(const StateEventMap_t* pstMaps_);
+
+    /**
+     * @brief SetTransitionTable
+     *
+     * Set the compiled transition table used to dispatch typed events (see
+     * HandleEvent(uint16_t, const void*)).  The table must have been
+     * compiled for the machine's state table, and must exist for the
+     * lifespan of the state machine.
+     *
+     * @param pclTable_ Transition table, or nullptr to stop using one
+     */
+    void SetTransitionTable(const StateTransitionTable* pclTable_);
+
+    /**
+     * @brief HandleEvent
+     *
+     * Pass a typed event to the state machine for processing.  If a
+     * transition table is set, each state on the stack, starting from the
+     * current state, applies its first matching row in the table.
+     * Otherwise, each state is checked for a handler registered against the
+     * event's ID in its event map; states without a handler are skipped.  If
+     * neither is set, the event is passed to the states' pfRun handlers as
+     * with HandleEvent(const void*).
+     *
+     * @param u16EventId_ ID of the event
+     * @param pvEvent_ Stimulus object passed to the event handler
+     * @return Result of the event handling
+     */
+    StateReturn HandleEvent(uint16_t u16EventId_, const void* pvEvent_);
+#endif
+
+#if STATE_MACHINE_EVENT_CLASSES
+    /**
+     * @brief SetEventClasses
+     *
+     * Set the per-state masks of event classes handled by each state, used
+     * when dispatching events with HandleClassEvent().  The array holds one
+     * mask per entry in the state table (bit N set if the state handles
+     * class N), and must exist for the lifespan of the state machine.
+     *
+     * @param pu32ClassMasks_ Array of event class masks, indexed by state
+     */
+    void SetEventClasses(const uint32_t* pu32ClassMasks_);
+
+    /**
+     * @brief HandleClassEvent
+     *
+     * Pass an event belonging to an event class to the state machine for
+     * processing.  States on the stack that do not handle the class are
+     * skipped, and the event is passed straight to the first state that
+     * does.  If no class masks are set, the event is passed to every state
+     * as with HandleEvent(const void*).
+     *
+     * @param u8EventClass_ Class of the event (0-31)
+     * @param pvEvent_ Stimulus object passed to the state handlers
+     * @return Result of the event handling
+     */
+    StateReturn HandleClassEvent(uint8_t u8EventClass_, const void* pvEvent_);
+#endif
+
+#if STATE_MACHINE_STATS
+    /**
+     * @brief GetUnhandledCount
+     *
+     * @return Number of events not handled by any state on the stack
+     */
+    uint32_t GetUnhandledCount() { return m_u32UnhandledCount; }
+
+    /**
+     * @brief GetSkippedFrameCount
+     *
+     * @return Number of times a state was skipped during event dispatch,
+     * because it did not handle the event's class
+     */
+    uint32_t GetSkippedFrameCount() { return m_u32SkippedFrameCount; }
+
+    /**
+     * @brief ResetStats
+     *
+     * Reset the unhandled event and skipped frame counters.
+     */
+    void ResetStats();
+#endif
+
+    /**
+     * @brief Snapshot
+     *
+     * Serialize the machine's state stack, and optionally its context, into
+     * a buffer (see state_snapshot.h for the format).  The snapshot can be
+     * restored into any machine using the same state table.  Must not be
+     * called from within a state handler.
+     *
+     * @param pu8Buffer_ Buffer receiving the snapshot
+     * @param u32Size_ Size of the buffer, in bytes.  The state stack needs
+     * at most STATE_SNAPSHOT_HEADER_SIZE + (MAX_STATE_STACK_DEPTH *
+     * sizeof(StateIndex_t)) bytes, plus the space used by the context.
+     * @param pfSaver_ (optional) Function used to serialize the context
+     * @return Number of bytes written, or 0 if the buffer is too small, the
+     * machine has not been started, or the context could not be saved
+     */
+    uint32_t Snapshot(uint8_t* pu8Buffer_, uint32_t u32Size_, StateContextSaver_t pfSaver_ = nullptr);
+
+    /**
+     * @brief Restore
+     *
+     * Restore the machine's state stack, and optionally its context, from
+     * a snapshot.  The machine resumes in the snapshot's state without
+     * running any entry handlers, and need not have been started with
+     * Begin().  Any timers armed by the machine's states are cancelled,
+     * and its coroutine states start again from the beginning.  Must not be
+     * called from within a state handler.
+     *
+     * @param pu8Buffer_ Buffer holding the snapshot
+     * @param u32Size_ Size of the snapshot, in bytes
+     * @param pfLoader_ (optional) Function used to restore the context
+     * @return true on success, false if no state table is set, or the
+     * snapshot is invalid or does not match the state table.  The machine
+     * is not modified on failure, unless the context loader fails.
+     */
+    bool Restore(const uint8_t* pu8Buffer_, uint32_t u32Size_, StateContextLoader_t pfLoader_ = nullptr);
+
+#if STATE_MACHINE_COROUTINES
+    /**
+     * @brief SetCoroutinePool
+     *
+     * Set the pool from which frames are allocated for the machine's
+     * coroutine states (see StateCoroutine).  Must be set before any
+     * coroutine state runs, and not changed while one is active.
+     *
+     * @param pclPool_ Pool of coroutine frames
+     */
+    void SetCoroutinePool(StateCoroutinePool* pclPool_) { m_pclCoroutinePool = pclPool_; }
+#endif
+
+#if STATE_MACHINE_TRACE
+    /**
+     * @brief SetTraceBuffer
+     *
+     * Attach a trace buffer to the state machine, into which each push,
+     * pop, transition and unhandled event is recorded.  A buffer may be
+     * shared by several machines, provided they are all run from the same
+     * thread.
+     *
+     * @param pclTrace_ Trace buffer, or nullptr to disable tracing
+     */
+    void SetTraceBuffer(StateTraceBuffer* pclTrace_) { m_pclTrace = pclTrace_; }
+#endif
+
+#if STATE_MACHINE_PROFILE
+    /**
+     * @brief SetProfile
+     *
+     * Attach latency histograms to the state machine, into which the time
+     * spent in each state's entry, run and exit handlers is recorded.  The
+     * histograms may be read and reset from another thread while the state
+     * machine is running.
+     *
+     * @param pclProfile_ Array of profiles, one per state in the state table,
+     * or nullptr to disable profiling
+     */
+    void SetProfile(StateProfile* pclProfile_) { m_pclProfile = pclProfile_; }
+#endif
+
     /**
      * @brief PushState
      *
      * Push the current state to the stack, and enter a new state specified by the
      * index in the state table.
      *
-     * @param u16StateIdx_ Index of the new state to be run
+     * @param uXStateIdx_ Index of the new state to be run
      * @return true on success, false if operation is ambiguous (i.e. other transitions
      * or push/pop operations take place within the same handler call)
      */
-    bool PushState(uint16_t u16StateIdx_);
+    bool PushState(StateIndex_t uXStateIdx_);
 
     /**
      * @brief PopState
@@ -203,11 +828,143 @@ public:
      * Transition the execution of the state machine from its current state to the state
      * specified by its index in the state table
      *
-     * @param u16StateIdx_ Index corresponding to the state to be entered
+     * @param uXStateIdx_ Index corresponding to the state to be entered
      * @return true on success, false if operation is ambiguous (i.e. other transitions
      * or push/pop operations take place within the same context)
      */
-    bool TransitionState(uint16_t u16StateIdx_);
+    bool TransitionState(StateIndex_t uXStateIdx_);
+
+    /**
+     * @brief PushState
+     *
+     * Push a state known at compile-time.  Its index is checked against the
+     * state table by static_assert, so only the stack overflow check remains
+     * at runtime.
+     *
+     * @tparam Target StateHandle of the state to be pushed
+     * @return true on success, false on overflow or ambiguous operation
+     */
+    template <typename Target>
+    bool PushState()
+    {
+        static_assert(Target::uXIndex < Target::uXStateCount, "Invalid state handle");
+        if (m_u8StackDepth >= MAX_STATE_STACK_DEPTH) {
+            return PushState(Target::uXIndex);
+        }
+        return SetNextState(StateOpcode::push, Target::uXIndex);
+    }
+
+    /**
+     * @brief PushState
+     *
+     * Push a state known at compile-time from a handler of a state at a
+     * fixed depth on the stack, checking both the target and the stack depth
+     * by static_assert rather than at runtime.
+     *
+     * @tparam Source StateHandle of the state whose handler makes the call
+     * @tparam Target StateHandle of the state to be pushed
+     * @return true on success, false if the operation is ambiguous
+     */
+    template <typename Source, typename Target>
+    bool PushState()
+    {
+        static_assert(Target::uXIndex < Target::uXStateCount, "Invalid state handle");
+        static_assert(Source::u8Depth != 0, "Pushing state must declare its stack depth");
+        static_assert(Source::u8Depth < MAX_STATE_STACK_DEPTH, "Push would overflow the state stack");
+        static_assert((Target::u8Depth == 0) || (Target::u8Depth == Source::u8Depth + 1),
+                      "Pushed state is declared at a different stack depth");
+        return SetNextState(StateOpcode::push, Target::uXIndex);
+    }
+
+    /**
+     * @brief PopState
+     *
+     * Pop a state from one of its own handlers, where the state runs at a
+     * fixed depth above the bottom of the stack, so that the stack underflow
+     * check is done by static_assert rather than at runtime.
+     *
+     * @tparam Source StateHandle of the state whose handler makes the call
+     * @return true on success, false if the operation is ambiguous
+     */
+    template <typename Source>
+    bool PopState()
+    {
+        static_assert(Source::u8Depth != 0, "Popping state must declare its stack depth");
+        static_assert(Source::u8Depth > 1, "Pop would underflow the state stack");
+        return SetOpcode(StateOpcode::pop);
+    }
+
+    /**
+     * @brief TransitionState
+     *
+     * Transition to a state known at compile-time.  Its index is checked
+     * against the state table by static_assert rather than at runtime.
+     *
+     * @tparam Target StateHandle of the state to be entered
+     * @return true on success, false if the operation is ambiguous
+     */
+    template <typename Target>
+    bool TransitionState()
+    {
+        static_assert(Target::uXIndex < Target::uXStateCount, "Invalid state handle");
+        return SetNextState(StateOpcode::transition, Target::uXIndex);
+    }
+
+#if STATE_MACHINE_HISTORY
+    /**
+     * @brief PushState
+     *
+     * Push a state, restoring the states that were last active above it on
+     * the stack (see SetHistory()).
+     *
+     * @param uXStateIdx_ Index of the new state to be run
+     * @param eHistory_ History to restore once the state is entered
+     * @return true on success, false on invalid state, overflow or ambiguous
+     * operation
+     */
+    bool PushState(StateIndex_t uXStateIdx_, StateHistory eHistory_);
+
+    /**
+     * @brief TransitionState
+     *
+     * Transition to a state, restoring the states that were last active
+     * above it on the stack (see SetHistory()).
+     *
+     * @param uXStateIdx_ Index corresponding to the state to be entered
+     * @param eHistory_ History to restore once the state is entered
+     * @return true on success, false on invalid state or ambiguous operation
+     */
+    bool TransitionState(StateIndex_t uXStateIdx_, StateHistory eHistory_);
+
+    /**
+     * @brief SetHistory
+     *
+     * Set the storage used to record the history of each state: the state
+     * that was directly above it on the stack when it last exited, or
+     * STATE_INDEX_NONE.  Histories are recorded as states exit during pop
+     * and transition (and push) operations, and are restored by the
+     * PushState() and TransitionState() overloads taking a StateHistory.
+     * A deep history re-enters the whole chain of recorded states within
+     * the same operation, up to the maximum stack depth.  Histories are not
+     * included in snapshots.
+     *
+     * @param puXHistory_ Array with one entry per state in the state table,
+     * or nullptr to stop recording history.  Must be set after SetStates().
+     */
+    void SetHistory(StateIndex_t* puXHistory_);
+
+    /**
+     * @brief GetHistory
+     *
+     * @param uXState_ Index of the state
+     * @return State directly above the given state on the stack when it
+     * last exited, or STATE_INDEX_NONE
+     */
+    StateIndex_t GetHistory(StateIndex_t uXState_) const
+    {
+        return (m_puXHistory != nullptr) ? m_puXHistory[uXState_] : STATE_INDEX_NONE;
+    }
+#endif
 
     /**
      * @brief GetCurrentState
@@ -216,7 +973,7 @@ public:
      *
      * @return index of the current state machine's running state
      */
-    uint16_t GetCurrentState();
+    StateIndex_t GetCurrentState();
 
     /**
      * @brief GetStackDepth
@@ -238,7 +995,226 @@ public:
      */
     void SetErrorHandler(StateErrorHandler_t pfHandler_);
 
-private:
+protected:
+#if STATE_MACHINE_TIMERS
+    friend class StateTimerWheel;
+#endif
+#if STATE_MACHINE_COROUTINES
+    friend class StateCoroutinePool;
+#endif
+#if STATE_MACHINE_TYPED_EVENTS
+    friend class StateTransitionTable;
+#endif
+
+    /**
+     * @brief RunBegin
+     *
+     * Common implementation of Begin(), parameterized on the object used to
+     * invoke state handlers.
+     *
+     * @param clTable_ State table accessor (see StateTableRef)
+     * @return true if successfully initialized, false otherwise
+     */
+    template <typename StateTable>
+    bool RunBegin(const StateTable& clTable_);
+
+    /**
+     * @brief RunEvent
+     *
+     * Common implementation of the state machine VM used by HandleEvent().
+     * The state table accessor determines how the entry/run/exit handlers
+     * are invoked, allowing the same VM to be used with runtime tables and
+     * with tables known at compile-time.
+     *
+     * @param clTable_ State table accessor (see StateTableRef)
+     * @param pvEvent_ Stimulus object passed to the state handlers
+     * @return Result of the event handling
+     */
+    template <typename StateTable>
+    StateReturn RunEvent(const StateTable& clTable_, const void* pvEvent_);
+
+    /**
+     * @brief RunEventBatch
+     *
+     * Common implementation of HandleEventBatch(), parameterized on the
+     * state table accessor.
+     *
+     * @sa HandleEventBatch
+     */
+    template <typename StateTable>
+    uint32_t RunEventBatch(const StateTable&  clTable_,
+                           const void* const* ppvEvents_,
+                           uint32_t           u32Count_,
+                           StateReturn*       peResults_,
+                           uint8_t            u8StopMask_);
+
+    /**
+     * @brief RunExit
+     *
+     * Exit a state: run its exit handler, cancel any timers it owns, and
+     * record its history.
+     *
+     * @param clTable_ State table accessor (see StateTableRef)
+     * @param uXState_ Index of the state being exited
+     * @param uXAbove_ State exited from directly above it on the stack by
+     * the same operation, or STATE_INDEX_NONE
+     */
+    template <typename StateTable>
+    void RunExit(const StateTable& clTable_, StateIndex_t uXState_, StateIndex_t uXAbove_);
+
+    /**
+     * @brief RunUnwind
+     *
+     * Exit every state above a level of the stack, from the top down.  When
+     * nothing but exit handlers observes states exiting (no timers, history
+     * or profiling), only the frames marked as holding a state with an exit
+     * handler are visited, and runs of frames without one are discarded in a
+     * single step.
+     *
+     * @param clTable_ State table accessor (see StateTableRef)
+     * @param u8StackPtr_ Stack depth to unwind to
+     * @return Last state exited, or STATE_INDEX_NONE if none were
+     */
+    template <typename StateTable>
+    StateIndex_t RunUnwind(const StateTable& clTable_, uint8_t u8StackPtr_);
+
+#if STATE_MACHINE_HISTORY
+    /**
+     * @brief RunHistory
+     *
+     * Re-enter the history of the state at the top of the stack, as
+     * requested by the pending push or transition.
+     *
+     * @param clTable_ State table accessor (see StateTableRef)
+     */
+    template <typename StateTable>
+    void RunHistory(const StateTable& clTable_);
+#endif
+
+#if STATE_MACHINE_TIMERS
+    /**
+     * @brief CancelTimers
+     *
+     * Cancel all timers armed by a state of this machine.
+     *
+     * @param uXState_ Index of the state owning the timers
+     */
+    void CancelTimers(StateIndex_t uXState_);
+#endif
+
+#if STATE_MACHINE_COROUTINES
+    /**
+     * @brief ReleaseCoroutines
+     *
+     * Return the frames of all of the machine's coroutine states to its
+     * pool, without running any exit handlers.
+     */
+    void ReleaseCoroutines();
+#endif
+
+    /**
+     * @brief BindStates
+     *
+     * Set the state table used by the machine, without validation, and
+     * note whether any of its states have exit handlers.
+     *
+     * @param pstStates_ pointer to the state machine table
+     * @param uXStateCount_ number of states held in the table
+     */
+    void BindStates(const State_t* pstStates_, StateIndex_t uXStateCount_);
+
+    /**
+     * @brief MarkExitFrame
+     *
+     * Note whether the state entered at a stack frame has an exit handler,
+     * so that frames with nothing to run can be skipped when unwinding.
+     *
+     * @param u8Frame_ Stack frame the state was entered at
+     * @param uXState_ Index of the state entered
+     */
+    void MarkExitFrame(uint8_t u8Frame_, StateIndex_t uXState_)
+    {
+        auto u32Bit = static_cast<uint32_t>(1) << (u8Frame_ % 32);
+        if (m_pstStateList[uXState_].pfExit != nullptr) {
+            m_au32ExitFrames[u8Frame_ / 32] |= u32Bit;
+        } else {
+            m_au32ExitFrames[u8Frame_ / 32] &= ~u32Bit;
+        }
+    }
+
+    /**
+     * @brief ResetExitFrames
+     *
+     * Mark every frame of a stack loaded as a whole - by a fleet or region
+     * cursor - as possibly having exit work, unless no state in the table
+     * has an exit handler.  This avoids a table lookup per frame on every
+     * load; frames marked this way are simply visited when unwinding.
+     */
+    void ResetExitFrames()
+    {
+        for (uint8_t i = 0; i < STATE_EXIT_FRAME_WORDS; i++) {
+            m_au32ExitFrames[i] = m_bExitHandlers ? 0xFFFFFFFFu : 0;
+        }
+    }
+
+    /**
+     * @brief GetExitFrameDepth
+     *
+     * Find the topmost frame above a level of the stack holding a state with
+     * exit work, skipping whole words of frames at a time.
+     *
+     * @param u8StackPtr_ Stack depth being unwound to
+     * @return Stack depth with that frame on top, or u8StackPtr_ if no
+     * frame above it has exit work
+     */
+    uint8_t GetExitFrameDepth(uint8_t u8StackPtr_) const
+    {
+        auto u8Depth = m_u8StackDepth;
+        while (u8Depth > u8StackPtr_) {
+            auto u8Frame = static_cast<uint8_t>(u8Depth - 1);
+            auto u8Base  = static_cast<uint8_t>(u8Frame & ~31u);
+            auto u32Bits = m_au32ExitFrames[u8Frame / 32] & (0xFFFFFFFFu >> (31 - (u8Frame % 32)));
+            if (u32Bits != 0) {
+                auto u8Top = static_cast<uint8_t>(u8Base + StateBits::HighestSet(u32Bits));
+                return (u8Top >= u8StackPtr_) ? static_cast<uint8_t>(u8Top + 1) : u8StackPtr_;
+            }
+            u8Depth = u8Base;
+        }
+        return u8StackPtr_;
+    }
+
+    /**
+     * @brief PrefetchMachine
+     *
+     * Prefetch the parts of the machine object read and written when it
+     * handles an event.
+     */
+    void PrefetchMachine() const
+    {
+        STATE_MACHINE_PREFETCH(this, 1);
+        STATE_MACHINE_PREFETCH(&m_auXStateStack[0], 1);
+        STATE_MACHINE_PREFETCH(&m_u8StackDepth, 1);
+    }
+
+    /**
+     * @brief PrefetchState
+     *
+     * Prefetch the state table entry of the machine's current state.  Reads
+     * the machine's stack, which should already have been prefetched, so
+     * only does so for a machine that has been started.
+     */
+    void PrefetchState() const
+    {
+        auto u8Depth = m_u8StackDepth;
+        if ((u8Depth == 0) || (u8Depth > MAX_STATE_STACK_DEPTH) || (m_pstStateList == nullptr)) {
+            return;
+        }
+        auto uXState = m_auXStateStack[u8Depth - 1];
+        if (uXState < m_uXStateCount) {
+            STATE_MACHINE_PREFETCH(&m_pstStateList[uXState], 0);
+        }
+    }
+
     /**
      * @brief SetOpcode
      *
@@ -249,6 +1225,25 @@ private:
      */
     bool SetOpcode(StateOpcode eOpcode_);
 
+    /**
+     * @brief SetNextState
+     *
+     * Set a pending push or transition opcode, along with its target state,
+     * whose index has already been validated.
+     *
+     * @param eOpcode_ next opcode to run
+     * @param uXStateIdx_ Index of the state to be entered
+     * @return true on success, false if opcode already pending
+     */
+    bool SetNextState(StateOpcode eOpcode_, StateIndex_t uXStateIdx_)
+    {
+        if (SetOpcode(eOpcode_)) {
+            m_uXNextState = uXStateIdx_;
+            return true;
+        }
+        return false;
+    }
+
     /**
      * @brief GetOpcode
      *
@@ -259,21 +1254,330 @@ private:
      */
     bool GetOpcode(StateOpcode* peOpcode_);
 
-    bool m_bStatesSet; //!< Wheter or not states are configured
+    // Members are ordered by decreasing alignment so the object has no
+    // internal padding, whichever state index type and features are
+    // configured.
+    void*               m_pvContext;      //!< User context, passed in via SetContext()
+    const State_t*      m_pstStateList;   //!< Pointer to the state handler array used by this state machine
+    StateErrorHandler_t m_pfErrorHandler; //!< Function called on state machine ambiguity.
+
+#if STATE_MACHINE_TYPED_EVENTS
+    const StateEventMap_t*      m_pstEventMaps;       //!< (optional) Per-state typed event handlers
+    const StateTransitionTable* m_pclTransitionTable; //!< (optional) Compiled transitions for typed events
+#endif
+
+#if STATE_MACHINE_EVENT_CLASSES
+    const uint32_t* m_pu32ClassMasks; //!< (optional) Per-state masks of handled event classes
+#endif
 
-    StateOpcode   m_eOpcode;      //!< Pending state machine
+#if STATE_MACHINE_TIMERS
+    StateTimer* m_pclTimers; //!< Timers armed by the machine's states
+#endif
 
-    bool          m_bOpcodeSet;   //!< Indicates the state machine has a pending opcode
-    uint16_t      m_u16NextState; //!< Next state to run
+#if STATE_MACHINE_COROUTINES
+    StateCoroutinePool*  m_pclCoroutinePool;   //!< (optional) Pool of coroutine frames
+    StateCoroutineFrame* m_pclCoroutineFrames; //!< Frames of the machine's active coroutine states, innermost first
+#endif
 
-    void*          m_pvContext;     //!< User context, passed in via SetContext()
-    const State_t* m_pstStateList;  //!< Pointer to the state handler array used by this state machine
-    uint16_t       m_u16StateCount; //!< Number of states in the state array
+#if STATE_MACHINE_HISTORY
+    StateIndex_t* m_puXHistory; //!< (optional) Per-state history
+#endif
 
-    uint16_t m_u16StackDepth;                         //!< Current stack level in the state machine
-    uint16_t m_au16StateStack[MAX_STATE_STACK_DEPTH]; //!< State stack
+#if STATE_MACHINE_TRACE
+    StateTraceBuffer* m_pclTrace; //!< (optional) Trace of the machine's operations
+#endif
 
-    StateErrorHandler_t m_pfErrorHandler;    //!< Function called on state machine ambiguity.
-    uint16_t m_u16OpSetState;
+#if STATE_MACHINE_PROFILE
+    StateProfile* m_pclProfile; //!< (optional) Per-state handler latency histograms
+#endif
+
+#if STATE_MACHINE_STATS
+    uint32_t m_u32UnhandledCount;    //!< Events not handled by any state
+    uint32_t m_u32SkippedFrameCount; //!< States skipped when dispatching class events
+#endif
+
+    uint32_t m_au32ExitFrames[STATE_EXIT_FRAME_WORDS]; //!< Stack frames whose state has an exit handler
+
+    StateIndex_t m_uXStateCount;                         //!< Number of states in the state array
+    StateIndex_t m_uXNextState;                          //!< Next state to run
+    StateIndex_t m_uXOpSetState;                         //!< State that set the pending opcode
+    StateIndex_t m_auXStateStack[MAX_STATE_STACK_DEPTH]; //!< State stack
+
+    uint8_t      m_u8StackDepth;  //!< Current stack level in the state machine
+    StateOpcode  m_eOpcode;       //!< Pending state machine
+#if STATE_MACHINE_HISTORY
+    StateHistory m_eHistory;      //!< History restored by the pending push or transition
+#endif
+    bool         m_bOpcodeSet;    //!< Indicates the state machine has a pending opcode
+    bool         m_bStatesSet;    //!< Wheter or not states are configured
+    bool         m_bExitHandlers; //!< Whether any state in the table has an exit handler
+    bool         m_bCursor;       //!< Set on working machines shared by many (fleets, regions)
 };
+
+//---------------------------------------------------------------------------
+template <typename StateTable>
+bool StateMachine::RunBegin(const StateTable& clTable_)
+{
+    if (!m_bStatesSet) {
+        return false;
+    }
+
+#if STATE_MACHINE_COROUTINES
+    if (m_pclCoroutineFrames != nullptr) {
+        ReleaseCoroutines();
+    }
+#endif
+
+    m_u8StackDepth      = 1;
+    m_bOpcodeSet        = false;
+#if STATE_MACHINE_HISTORY
+    m_eHistory          = StateHistory::none;
+#endif
+    m_auXStateStack[0]  = 0;
+    MarkExitFrame(0, 0);
+
+    STATE_MACHINE_PROFILE_CALL(clEntry, 0, clTable_.Entry(this, 0));
+    return true;
+}
+
+//---------------------------------------------------------------------------
+template <typename StateTable>
+inline StateReturn StateMachine::RunEvent(const StateTable& clTable_, const void* pvEvent_)
+{
+    STATE_MACHINE_VM_TABLE();
+
+    auto         u8StackPtr  = m_u8StackDepth;
+    auto         eReturnCode = StateReturn::ok;
+    auto         eOpcode     = StateOpcode::run;
+    StateIndex_t uXState;
+    StateReturn  eResult;
+
+    // The VM's own opcodes are kept local - only operations requested by a
+    // handler go through m_eOpcode.  One left pending from outside of the VM
+    // is ambiguous, and runs in place of the event.
+    if (m_bOpcodeSet) {
+        SetOpcode(StateOpcode::run);
+        GetOpcode(&eOpcode);
+    }
+    STATE_MACHINE_VM_DISPATCH(eOpcode);
+
+op_run : {
+    // Skip straight past states that can't handle the event
+    uXState       = m_auXStateStack[u8StackPtr - 1];
+    auto bHandles = clTable_.Handles(uXState);
+    while (!bHandles && (u8StackPtr > 1)) {
+        STATE_MACHINE_STATS_COUNT(m_u32SkippedFrameCount);
+        u8StackPtr--;
+        uXState  = m_auXStateStack[u8StackPtr - 1];
+        bHandles = clTable_.Handles(uXState);
+    }
+    if (!bHandles) {
+        STATE_MACHINE_STATS_COUNT(m_u32SkippedFrameCount);
+        goto op_unhandled;
+    }
+
+    // Must have a run handler...
+    STATE_MACHINE_PROFILE_CALL(clRun, uXState, eResult = clTable_.Run(this, uXState, pvEvent_));
+    if (eResult == StateReturn::unhandled) {
+        eOpcode = StateOpcode::unhandled;
+        if (u8StackPtr > 1) {
+            u8StackPtr--;
+            eOpcode = StateOpcode::run;
+        }
+    } else {
+        eOpcode = StateOpcode::returned;
+    }
+
+    if (m_bOpcodeSet) {
+        // The handler requested an operation - also returning a result other
+        // than a transition is ambiguous, and reported as such.
+        if (eResult != StateReturn::transition) {
+            SetOpcode(eOpcode);
+        }
+        GetOpcode(&eOpcode);
+        STATE_MACHINE_VM_DISPATCH(eOpcode);
+    }
+    if (eOpcode == StateOpcode::run) {
+        goto op_run;
+    }
+    if (eOpcode == StateOpcode::unhandled) {
+        goto op_unhandled;
+    }
+    goto op_returned;
+}
+
+op_push : {
+    // Operations requested by the entry/exit handlers are ambiguous
+    m_eOpcode    = StateOpcode::returned;
+    m_bOpcodeSet = true;
+    uXState      = m_auXStateStack[u8StackPtr - 1];
+
+    RunUnwind(clTable_, u8StackPtr);
+
+    STATE_MACHINE_PROFILE_CALL(clEntry, m_uXNextState, clTable_.Entry(this, m_uXNextState));
+    m_auXStateStack[m_u8StackDepth] = m_uXNextState;
+    MarkExitFrame(m_u8StackDepth, m_uXNextState);
+    m_u8StackDepth++;
+    STATE_MACHINE_TRACE_RECORD(StateTraceOp::push, uXState, m_uXNextState);
+#if STATE_MACHINE_HISTORY
+    if (m_eHistory != StateHistory::none) {
+        RunHistory(clTable_);
+    }
+#endif
+    m_bOpcodeSet = false;
+    goto op_returned;
+}
+
+op_pop : {
+    m_eOpcode    = StateOpcode::returned;
+    m_bOpcodeSet = true;
+
+    auto uXAbove = RunUnwind(clTable_, u8StackPtr);
+
+    StateIndex_t uXTempState = m_auXStateStack[m_u8StackDepth - 1];
+    m_u8StackDepth--;
+    RunExit(clTable_, uXTempState, uXAbove);
+    STATE_MACHINE_TRACE_RECORD(
+        StateTraceOp::pop, uXTempState, m_u8StackDepth ? m_auXStateStack[m_u8StackDepth - 1] : uXTempState);
+    m_bOpcodeSet = false;
+    goto op_returned;
+}
+
+op_transition : {
+    uXState      = m_auXStateStack[u8StackPtr - 1];
+    auto uXAbove = RunUnwind(clTable_, u8StackPtr);
+
+    RunExit(clTable_, uXState, uXAbove);
+    STATE_MACHINE_PROFILE_CALL(clEntry, m_uXNextState, clTable_.Entry(this, m_uXNextState));
+    m_auXStateStack[m_u8StackDepth - 1] = m_uXNextState;
+    MarkExitFrame(m_u8StackDepth - 1, m_uXNextState);
+    STATE_MACHINE_TRACE_RECORD(StateTraceOp::transition, uXState, m_uXNextState);
+#if STATE_MACHINE_HISTORY
+    if (m_eHistory != StateHistory::none) {
+        RunHistory(clTable_);
+    }
+#endif
+    return StateReturn::transition;
+}
+
+op_unhandled:
+    STATE_MACHINE_TRACE_RECORD(
+        StateTraceOp::unhandled, m_auXStateStack[m_u8StackDepth - 1], m_auXStateStack[m_u8StackDepth - 1]);
+    STATE_MACHINE_STATS_COUNT(m_u32UnhandledCount);
+    eReturnCode = StateReturn::unhandled;
+
+op_returned:
+    // Done processing the event
+    return eReturnCode;
+}
+
+//---------------------------------------------------------------------------
+template <typename StateTable>
+inline void StateMachine::RunExit(const StateTable& clTable_, StateIndex_t uXState_, StateIndex_t uXAbove_)
+{
+    STATE_MACHINE_PROFILE_CALL(clExit, uXState_, clTable_.Exit(this, uXState_));
+#if STATE_MACHINE_TIMERS
+    if (m_pclTimers != nullptr) {
+        CancelTimers(uXState_);
+    }
+#endif
+#if STATE_MACHINE_HISTORY
+    if (m_puXHistory != nullptr) {
+        m_puXHistory[uXState_] = uXAbove_;
+    }
+#else
+    (void)uXAbove_;
+#endif
+}
+
+//---------------------------------------------------------------------------
+template <typename StateTable>
+inline StateIndex_t StateMachine::RunUnwind(const StateTable& clTable_, uint8_t u8StackPtr_)
+{
+    if (m_u8StackDepth == u8StackPtr_) {
+        return STATE_INDEX_NONE;
+    }
+
+    auto uXAbove   = STATE_INDEX_NONE;
+    auto bObserved = false;
+#if STATE_MACHINE_TIMERS
+    bObserved = bObserved || (m_pclTimers != nullptr);
+#endif
+#if STATE_MACHINE_HISTORY
+    bObserved = bObserved || (m_puXHistory != nullptr);
+#endif
+#if STATE_MACHINE_PROFILE
+    bObserved = bObserved || (m_pclProfile != nullptr);
+#endif
+    if (!bObserved) {
+        // Only exit handlers run - frames without one are dropped unvisited
+        m_u8StackDepth = GetExitFrameDepth(u8StackPtr_);
+        while (m_u8StackDepth != u8StackPtr_) {
+            StateIndex_t uXTempState = m_auXStateStack[m_u8StackDepth - 1];
+            m_u8StackDepth--;
+            clTable_.Exit(this, uXTempState);
+            uXAbove        = uXTempState;
+            m_u8StackDepth = GetExitFrameDepth(u8StackPtr_);
+        }
+        return uXAbove;
+    }
+
+    while (m_u8StackDepth != u8StackPtr_) {
+        StateIndex_t uXTempState = m_auXStateStack[m_u8StackDepth - 1];
+        m_u8StackDepth--;
+        RunExit(clTable_, uXTempState, uXAbove);
+        uXAbove = uXTempState;
+    }
+    return uXAbove;
+}
+
+#if STATE_MACHINE_HISTORY
+//---------------------------------------------------------------------------
+template <typename StateTable>
+void StateMachine::RunHistory(const StateTable& clTable_)
+{
+    auto eHistory = m_eHistory;
+    m_eHistory    = StateHistory::none;
+    if (m_puXHistory == nullptr) {
+        return;
+    }
+
+    // Enter the recorded chain directly, without running intermediate
+    // opcodes - bounded by the stack, in case the chain refers to itself
+    auto uXState = m_puXHistory[m_auXStateStack[m_u8StackDepth - 1]];
+    while ((uXState != STATE_INDEX_NONE) && (m_u8StackDepth < MAX_STATE_STACK_DEPTH)) {
+        STATE_MACHINE_PROFILE_CALL(clEntry, uXState, clTable_.Entry(this, uXState));
+        STATE_MACHINE_TRACE_RECORD(StateTraceOp::push, m_auXStateStack[m_u8StackDepth - 1], uXState);
+        m_auXStateStack[m_u8StackDepth] = uXState;
+        MarkExitFrame(m_u8StackDepth, uXState);
+        m_u8StackDepth++;
+        if (eHistory != StateHistory::deep) {
+            break;
+        }
+        uXState = m_puXHistory[uXState];
+    }
+}
+#endif
+
+//---------------------------------------------------------------------------
+template <typename StateTable>
+uint32_t StateMachine::RunEventBatch(const StateTable&  clTable_,
+                                     const void* const* ppvEvents_,
+                                     uint32_t           u32Count_,
+                                     StateReturn*       peResults_,
+                                     uint8_t            u8StopMask_)
+{
+    uint32_t u32Processed = 0;
+    while (u32Processed < u32Count_) {
+        auto eResult = RunEvent(clTable_, ppvEvents_[u32Processed]);
+        if (peResults_ != nullptr) {
+            peResults_[u32Processed] = eResult;
+        }
+        u32Processed++;
+        if ((StateReturnMask(eResult) & u8StopMask_) != 0) {
+            break;
+        }
+    }
+    return u32Processed;
+}
 } // namespace Mark3
@@ -0,0 +1,240 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_machine_fleet.h
+    @brief Dense storage for large numbers of machines sharing a state table
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_machine.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateMachineFleet class
+ *
+ * Stores a large number of state machines that share a single state table,
+ * error handler and (optionally) context.  Rather than one StateMachine
+ * object per machine, the per-machine state is held in parallel arrays
+ * supplied by the application:
+ *
+ * - stack depths: 1 byte per machine
+ * - state stacks: MAX_STATE_STACK_DEPTH entries per machine
+ * - contexts: 1 pointer per machine (optional)
+ *
+ * Events are dispatched to a machine by its index, with the same semantics
+ * as StateMachine::HandleEvent().  The machine's stack is loaded into a
+ * working StateMachine object for the duration of the event, which is the
+ * object passed to the state handlers; handlers therefore use the same
+ * PushState/PopState/TransitionState/GetContext API as normal.  An
+ * operation an entry or exit handler leaves pending is run before the
+ * machine is stored, rather than with the machine's next event.
+ *
+ * Every handler sees the same working object, rather than one per machine,
+ * so state timers cannot be armed for fleet machines (StateTimerWheel::Arm()
+ * fails), and coroutine states and history are not supported.
+ *
+ * A fleet must only be used from one thread at a time.
+ */
+class StateMachineFleet
+{
+public:
+    StateMachineFleet();
+
+    /**
+     * @brief SetStates
+     *
+     * Set the state table shared by all machines in the fleet.  This table
+     * must exist for the lifespan of the fleet.  Must only be set once.
+     *
+     * @param pstStates_ pointer to the state machine table
+     * @param uXStateCount_ number of states held in the table
+     * @return true on success, false on invalid parameters or if called
+     * multiple times
+     */
+    bool SetStates(const State_t* pstStates_, StateIndex_t uXStateCount_);
+
+    /**
+     * @brief SetStorage
+     *
+     * Set the arrays holding the per-machine state.  The arrays must exist
+     * for the lifespan of the fleet.
+     *
+     * @param u32MachineCount_ Number of machines in the fleet
+     * @param pu8StackDepths_ Array of u32MachineCount_ stack depths
+     * @param pauXStacks_ Array of (u32MachineCount_ * MAX_STATE_STACK_DEPTH)
+     * state indices
+     * @param ppvContexts_ (optional) Array of u32MachineCount_ context
+     * pointers.  If null, all machines share the context set by SetContext().
+     * @return true on success, false on invalid parameters
+     */
+    bool SetStorage(uint32_t      u32MachineCount_,
+                    uint8_t*      pu8StackDepths_,
+                    StateIndex_t* pauXStacks_,
+                    void**        ppvContexts_);
+
+    /**
+     * @brief SetErrorHandler
+     *
+     * Register an error handler function, shared by all machines in the
+     * fleet.
+     *
+     * @param pfHandler_ State error-handler function pointer
+     */
+    void SetErrorHandler(StateErrorHandler_t pfHandler_);
+
+    /**
+     * @brief SetContext
+     *
+     * Set the context of a single machine.  Requires per-machine context
+     * storage.
+     *
+     * @param u32MachineId_ Index of the machine
+     * @param pvContext_ Context to set
+     */
+    void SetContext(uint32_t u32MachineId_, void* pvContext_);
+
+    /**
+     * @brief SetContext
+     *
+     * Set the context shared by all machines, when no per-machine context
+     * storage is used.
+     *
+     * @param pvContext_ Context to set
+     */
+    void SetContext(void* pvContext_);
+
+    /**
+     * @brief GetContext
+     *
+     * @param u32MachineId_ Index of the machine
+     * @return Context object of the machine
+     */
+    void* GetContext(uint32_t u32MachineId_);
+
+    /**
+     * @brief Begin
+     *
+     * Initialize a machine by resetting its stack and entering the first
+     * state in the table.
+     *
+     * @param u32MachineId_ Index of the machine
+     * @return true on success, false if the fleet is not configured or the
+     * index is invalid
+     */
+    bool Begin(uint32_t u32MachineId_);
+
+    /**
+     * @brief HandleEvent
+     *
+     * Pass an event to a machine for processing.
+     *
+     * @param u32MachineId_ Index of the machine
+     * @param pvEvent_ Stimulus object, which the state machine interprets
+     * and processes.
+     * @return Result of the event handling, or StateReturn::unhandled if the
+     * index is invalid or the machine has not been started with Begin()
+     */
+    StateReturn HandleEvent(uint32_t u32MachineId_, const void* pvEvent_);
+
+    /**
+     * @brief GetCurrentState
+     *
+     * @param u32MachineId_ Index of the machine
+     * @return index of the machine's running state
+     */
+    StateIndex_t GetCurrentState(uint32_t u32MachineId_);
+
+    /**
+     * @brief GetStackDepth
+     *
+     * @param u32MachineId_ Index of the machine
+     * @return current stack depth of the machine
+     */
+    uint16_t GetStackDepth(uint32_t u32MachineId_);
+
+    /**
+     * @brief GetActiveMachine
+     *
+     * Retrieve the index of the machine currently handling an event.  Only
+     * valid when called from within a state handler.
+     *
+     * @return Index of the machine handling the current event
+     */
+    uint32_t GetActiveMachine() { return m_u32ActiveMachine; }
+
+    /**
+     * @brief GetMachineCount
+     *
+     * @return Number of machines in the fleet
+     */
+    uint32_t GetMachineCount() { return m_u32MachineCount; }
+
+    /**
+     * @brief Snapshot
+     *
+     * Write the state of every machine in the fleet through a writer
+     * function, i.e. to a file (see state_snapshot.h for the format).  The
+     * per-machine arrays are written directly in a few large blocks, so the
+     * cost is bounded by the writer rather than the number of machines.
+     * Contexts are not included.
+     *
+     * @param pfWriter_ Function called to write each block of the snapshot
+     * @param pvArg_ Argument passed to the writer
+     * @return true on success, false if the fleet has no storage or the
+     * writer failed
+     */
+    bool Snapshot(StateSnapshotWriter_t pfWriter_, void* pvArg_);
+
+    /**
+     * @brief Restore
+     *
+     * Restore the state of every machine in the fleet from a snapshot, read
+     * through a reader function.  Machines resume in their saved states
+     * without running any entry handlers.  The snapshot must have been
+     * taken from a fleet with the same number of machines and the same
+     * state index type and stack depth.
+     *
+     * @param pfReader_ Function called to read each block of the snapshot
+     * @param pvArg_ Argument passed to the reader
+     * @return true on success, false if the snapshot is invalid or does not
+     * match the fleet.  If the snapshot's contents are invalid, every
+     * machine is left un-started, and must be started with Begin().
+     */
+    bool Restore(StateSnapshotReader_t pfReader_, void* pvArg_);
+
+private:
+    // Working state machine, loaded from the arrays for each operation
+    class Cursor : public StateMachine
+    {
+    public:
+        Cursor() { m_bCursor = true; }
+
+        void Load(const StateIndex_t* pauXStack_, uint8_t u8Depth_, void* pvContext_);
+        void Store(StateIndex_t* pauXStack_, uint8_t* pu8Depth_);
+        StateIndex_t GetStateCount() const { return m_uXStateCount; }
+    };
+
+    Cursor        m_clCursor;         //!< Working state machine
+    uint32_t      m_u32MachineCount;  //!< Number of machines in the fleet
+    uint32_t      m_u32ActiveMachine; //!< Machine currently being processed
+    uint8_t*      m_pu8StackDepths;   //!< Per-machine stack depth
+    StateIndex_t* m_pauXStacks;       //!< Per-machine state stack
+    void**        m_ppvContexts;      //!< Per-machine context (optional)
+    void*         m_pvContext;        //!< Shared context
+};
+} // namespace Mark3
@@ -0,0 +1,158 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_profile.h
+    @brief Per-state latency histograms for state handler profiling
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_bits.h"
+#include "state_clock.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Number of linear sub-buckets per power of two in the latency histograms,
+// expressed in bits.  Each bucket spans at most 1/(2^bits) of its value.
+#ifndef STATE_PROFILE_SUB_BUCKET_BITS
+#define STATE_PROFILE_SUB_BUCKET_BITS (3)
+#endif
+
+#define STATE_PROFILE_SUB_BUCKETS (1 << STATE_PROFILE_SUB_BUCKET_BITS)
+#define STATE_PROFILE_BUCKETS ((32 - STATE_PROFILE_SUB_BUCKET_BITS + 1) * STATE_PROFILE_SUB_BUCKETS)
+
+//---------------------------------------------------------------------------
+// Copy of a latency histogram's contents
+typedef struct {
+    uint32_t au32Buckets[STATE_PROFILE_BUCKETS]; //!< Samples recorded in each bucket
+    uint32_t u32Count;                           //!< Total number of samples
+} StateLatencySnapshot_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateLatencyHistogram class
+ *
+ * Log-linear histogram of latencies, measured in StateClock ticks.  Values
+ * below STATE_PROFILE_SUB_BUCKETS are recorded exactly; larger values are
+ * grouped into STATE_PROFILE_SUB_BUCKETS buckets per power of two.  Values
+ * that do not fit in 32 bits are recorded in the last bucket.
+ *
+ * Samples are recorded with atomic increments, so a histogram may be read
+ * or reset from another thread while the state machine is running.
+ */
+class StateLatencyHistogram
+{
+public:
+    StateLatencyHistogram();
+
+    /**
+     * @brief Record
+     *
+     * Add a sample to the histogram
+     *
+     * @param u64Ticks_ Latency to record
+     */
+    void Record(uint64_t u64Ticks_)
+    {
+        auto u32Ticks = (u64Ticks_ > 0xFFFFFFFF) ? 0xFFFFFFFF : static_cast<uint32_t>(u64Ticks_);
+        __atomic_fetch_add(&m_au32Buckets[BucketIndex(u32Ticks)], 1, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * @brief Snapshot
+     *
+     * Copy the contents of the histogram, optionally resetting it.  When
+     * resetting, each bucket is read and cleared atomically, so no sample
+     * recorded concurrently is lost.
+     *
+     * @param pstSnapshot_ [out] Copy of the histogram
+     * @param bReset_ true to reset the histogram
+     */
+    void Snapshot(StateLatencySnapshot_t* pstSnapshot_, bool bReset_);
+
+    /**
+     * @brief Reset
+     *
+     * Discard all samples recorded in the histogram.
+     */
+    void Reset();
+
+    /**
+     * @brief BucketIndex
+     *
+     * @param u32Ticks_ Latency value
+     * @return Index of the bucket the value is recorded in
+     */
+    static uint16_t BucketIndex(uint32_t u32Ticks_)
+    {
+        if (u32Ticks_ < STATE_PROFILE_SUB_BUCKETS) {
+            return static_cast<uint16_t>(u32Ticks_);
+        }
+        auto u8Shift = static_cast<uint8_t>(StateBits::HighestSet(u32Ticks_) - STATE_PROFILE_SUB_BUCKET_BITS);
+        return static_cast<uint16_t>(((u8Shift + 1) * STATE_PROFILE_SUB_BUCKETS)
+                                     + ((u32Ticks_ >> u8Shift) & (STATE_PROFILE_SUB_BUCKETS - 1)));
+    }
+
+    /**
+     * @brief BucketLowerBound
+     *
+     * @param u16Bucket_ Bucket index
+     * @return Smallest value recorded in the bucket
+     */
+    static uint32_t BucketLowerBound(uint16_t u16Bucket_);
+
+    /**
+     * @brief BucketUpperBound
+     *
+     * @param u16Bucket_ Bucket index
+     * @return Largest value recorded in the bucket
+     */
+    static uint32_t BucketUpperBound(uint16_t u16Bucket_);
+
+    /**
+     * @brief GetPercentile
+     *
+     * Estimate a percentile of the latencies held in a snapshot.
+     *
+     * @param pstSnapshot_ Histogram snapshot
+     * @param u16Permille_ Percentile to find, in tenths of a percent (i.e.
+     * 500 for the median, 999 for the 99.9th percentile)
+     * @return Upper bound of the bucket holding the percentile, or 0 if the
+     * snapshot holds no samples
+     */
+    static uint32_t GetPercentile(const StateLatencySnapshot_t* pstSnapshot_, uint16_t u16Permille_);
+
+private:
+    uint32_t m_au32Buckets[STATE_PROFILE_BUCKETS]; //!< Samples recorded in each bucket
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateProfile class
+ *
+ * Latency histograms for the entry, run and exit handlers of one state.
+ * Attached to a state machine as an array (one per state) using
+ * StateMachine::SetProfile(), which is only available when the library is
+ * built with STATE_MACHINE_PROFILE enabled.
+ */
+class StateProfile
+{
+public:
+    StateLatencyHistogram clEntry; //!< Latency of the state's pfEntry handler
+    StateLatencyHistogram clRun;   //!< Latency of the state's pfRun handler
+    StateLatencyHistogram clExit;  //!< Latency of the state's pfExit handler
+};
+} // namespace Mark3
@@ -0,0 +1,361 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_region_machine.h
+    @brief State machine composed of orthogonal regions sharing a state table
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_machine.h"
+#include "fleet_executor.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Minimum number of regions for which an event is split across workers, when
+// more than one worker is set (see StateRegionMachine::SetWorkers()).  Below
+// this, the cost of waking and joining the workers outweighs the work.
+#ifndef STATE_REGIONS_PARALLEL_MIN
+#define STATE_REGIONS_PARALLEL_MIN (16)
+#endif
+
+//---------------------------------------------------------------------------
+// Event class used internally for events delivered to every region
+#define STATE_REGIONS_NO_CLASS (0xFF)
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateRegionWorker class
+ *
+ * Per-worker state of a StateRegionMachine: the working state machine into
+ * which each region is loaded while it handles an event, and statistics
+ * about the work done.
+ */
+class StateRegionWorker
+{
+public:
+    StateRegionWorker();
+
+    uint32_t GetEventCount() const { return m_u32Events; }
+    uint32_t GetSkipCount() const { return m_u32Skips; }
+
+private:
+    friend class StateRegionMachine;
+
+    // Working state machine, loaded from the region arrays for each event
+    class Cursor : public StateMachine
+    {
+    public:
+        Cursor() { m_bCursor = true; }
+
+        void Configure(const State_t*      pstStates_,
+                       StateIndex_t        uXStateCount_,
+                       const uint32_t*     pu32ClassMasks_,
+                       StateErrorHandler_t pfErrorHandler_,
+                       void*               pvContext_);
+        void Load(const StateIndex_t* pauXStack_, uint8_t u8Depth_, uint16_t u16Region_);
+        void Store(StateIndex_t* pauXStack_, uint8_t* pu8Depth_);
+        void Enter(StateIndex_t uXState_);
+
+        uint16_t m_u16Region; //!< Region currently loaded
+    };
+
+    Cursor      m_clCursor;      //!< Working state machine
+    uint32_t    m_u32Generation; //!< Last event dispatched to this worker
+    uint32_t    m_u32Events;     //!< Number of region events processed
+    uint32_t    m_u32Skips;      //!< Number of regions skipped by event class
+    StateReturn m_eResult;       //!< Joined result of the worker's regions
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateRegionMachine class
+ *
+ * State machine composed of a number of orthogonal regions: independent,
+ * concurrently-active state stacks that share a single state table, error
+ * handler and context.  Each region starts in its own initial state, and
+ * every event is delivered to all regions with a single call, in order of
+ * region index.
+ *
+ * As with StateMachineFleet, the per-region state is held in arrays
+ * supplied by the application, and each region is loaded into a working
+ * StateMachine object while it handles an event.  Handlers therefore use
+ * the usual PushState/PopState/TransitionState/GetContext API, and can find
+ * the region they are running in with GetRegion().
+ *
+ * When event classes are set (see SetEventClasses(), available when the
+ * library is built with STATE_MACHINE_EVENT_CLASSES enabled), events
+ * dispatched with HandleClassEvent() skip every region with no state on its
+ * stack that handles the event's class, without loading it.
+ *
+ * Large numbers of regions may be dispatched in parallel, by setting more
+ * than one worker with SetWorkers().  The thread calling HandleEvent() acts
+ * as worker 0; the application starts a thread for each other worker, each
+ * of which calls Run() or RunOnce() with its worker index.  Each worker
+ * always handles the same contiguous slice of regions, and HandleEvent()
+ * returns once every slice has been handled, so the resulting region states
+ * and results are the same as for serial dispatch.  In this mode, handlers
+ * must not access the state of regions other than their own.
+ *
+ * The machine must be fully configured before Begin() is called.  State
+ * timers (StateTimerWheel::Arm() fails), coroutine states and transition
+ * tables are not supported within regions.
+ */
+class StateRegionMachine
+{
+public:
+    StateRegionMachine();
+
+    /**
+     * @brief SetStates
+     *
+     * Set the state table shared by all regions.  This table must exist for
+     * the lifespan of the machine.
+     *
+     * @param pstStates_ pointer to the state machine table
+     * @param uXStateCount_ number of states held in the table
+     * @return true on success, false on invalid parameters or if called
+     * multiple times
+     */
+    bool SetStates(const State_t* pstStates_, StateIndex_t uXStateCount_);
+
+    /**
+     * @brief SetStorage
+     *
+     * Set the arrays holding the per-region state.  The arrays must exist
+     * for the lifespan of the machine.
+     *
+     * @param u16RegionCount_ Number of regions
+     * @param puXInitialStates_ Array of u16RegionCount_ states, entered by
+     * each region when the machine begins
+     * @param pu8StackDepths_ Array of u16RegionCount_ stack depths
+     * @param pauXStacks_ Array of (u16RegionCount_ * MAX_STATE_STACK_DEPTH)
+     * state indices
+     * @return true on success, false on invalid parameters
+     */
+    bool SetStorage(uint16_t            u16RegionCount_,
+                    const StateIndex_t* puXInitialStates_,
+                    uint8_t*            pu8StackDepths_,
+                    StateIndex_t*       pauXStacks_);
+
+    /**
+     * @brief SetWorkers
+     *
+     * Set the workers across which events are dispatched, when the machine
+     * has at least STATE_REGIONS_PARALLEL_MIN regions.  The worker objects
+     * must exist for the lifespan of the machine.  Must be called before
+     * Begin().
+     *
+     * @param paclWorkers_ Array of worker objects
+     * @param u16WorkerCount_ Number of workers in the array
+     * @return true on success, false on invalid parameters
+     */
+    bool SetWorkers(StateRegionWorker* paclWorkers_, uint16_t u16WorkerCount_);
+
+    /**
+     * @brief SetIdleHandler
+     *
+     * Set the function called by Run() when a worker has no work, and by
+     * HandleEvent() while waiting for the other workers to finish.
+     *
+     * @param pfIdle_ Idle handler, or nullptr to spin
+     */
+    void SetIdleHandler(FleetIdleHandler_t pfIdle_) { m_pfIdle = pfIdle_; }
+
+#if STATE_MACHINE_EVENT_CLASSES
+    /**
+     * @brief SetEventClasses
+     *
+     * Set the per-state masks of event classes used by HandleClassEvent().
+     *
+     * @sa StateMachine::SetEventClasses
+     */
+    void SetEventClasses(const uint32_t* pu32ClassMasks_) { m_pu32ClassMasks = pu32ClassMasks_; }
+#endif
+
+    /**
+     * @brief SetErrorHandler
+     *
+     * Register an error handler function, shared by all regions.
+     *
+     * @param pfHandler_ State error-handler function pointer
+     */
+    void SetErrorHandler(StateErrorHandler_t pfHandler_) { m_pfErrorHandler = pfHandler_; }
+
+    /**
+     * @brief SetContext
+     *
+     * Set the context shared by all regions.
+     *
+     * @param pvContext_ Context to set
+     */
+    void SetContext(void* pvContext_) { m_pvContext = pvContext_; }
+
+    /**
+     * @brief GetContext
+     *
+     * @return Context object shared by all regions
+     */
+    void* GetContext() { return m_pvContext; }
+
+    /**
+     * @brief Begin
+     *
+     * Initialize the machine by resetting the stack of each region and
+     * entering its initial state, in order of region index.  An operation
+     * requested by an initial state's entry handler is reported to the error
+     * handler as ambiguous, and run before the next region is entered.
+     *
+     * @return true on success, false if the machine is not configured or an
+     * initial state is invalid
+     */
+    bool Begin();
+
+    /**
+     * @brief HandleEvent
+     *
+     * Deliver an event to every region.  As in Begin(), an operation an
+     * entry or exit handler leaves pending is reported as ambiguous, and run
+     * before the region is stored.
+     *
+     * @param pvEvent_ Stimulus object, which the regions interpret and
+     * process
+     * @param peResults_ (optional) Array receiving the result of each region
+     * @return Joined result: transition if any region transitioned, ok if
+     * any region handled the event, unhandled otherwise
+     */
+    StateReturn HandleEvent(const void* pvEvent_, StateReturn* peResults_ = nullptr)
+    {
+        return Dispatch(STATE_REGIONS_NO_CLASS, pvEvent_, peResults_);
+    }
+
+#if STATE_MACHINE_EVENT_CLASSES
+    /**
+     * @brief HandleClassEvent
+     *
+     * Deliver an event belonging to a class to every region with a state
+     * handling that class.  Regions that are skipped return unhandled.
+     *
+     * @param u8EventClass_ Class of the event (0-31)
+     * @param pvEvent_ Stimulus object
+     * @param peResults_ (optional) Array receiving the result of each region
+     * @return Joined result, as for HandleEvent()
+     */
+    StateReturn HandleClassEvent(uint8_t u8EventClass_, const void* pvEvent_, StateReturn* peResults_ = nullptr)
+    {
+        return Dispatch(u8EventClass_, pvEvent_, peResults_);
+    }
+#endif
+
+    /**
+     * @brief RunOnce
+     *
+     * Handle the worker's slice of the event being dispatched, if it has
+     * not already done so.
+     *
+     * @param u16WorkerId_ Index of the calling worker (1 or above)
+     * @return true if the worker handled an event, false if there was none
+     */
+    bool RunOnce(uint16_t u16WorkerId_);
+
+    /**
+     * @brief Run
+     *
+     * Handle events on the calling worker until the stop flag is set.
+     *
+     * @param u16WorkerId_ Index of the calling worker (1 or above)
+     * @param pbStop_ Flag set (from any thread) to make the worker return
+     */
+    void Run(uint16_t u16WorkerId_, const bool* pbStop_);
+
+    /**
+     * @brief GetCurrentState
+     *
+     * @param u16Region_ Index of the region
+     * @return index of the region's running state
+     */
+    StateIndex_t GetCurrentState(uint16_t u16Region_) const
+    {
+        return m_pauXStacks[(u16Region_ * MAX_STATE_STACK_DEPTH) + m_pu8StackDepths[u16Region_] - 1];
+    }
+
+    /**
+     * @brief GetStackDepth
+     *
+     * @param u16Region_ Index of the region
+     * @return current stack depth of the region
+     */
+    uint16_t GetStackDepth(uint16_t u16Region_) const { return m_pu8StackDepths[u16Region_]; }
+
+    /**
+     * @brief GetRegionCount
+     *
+     * @return Number of regions in the machine
+     */
+    uint16_t GetRegionCount() const { return m_u16RegionCount; }
+
+    /**
+     * @brief GetWorker
+     *
+     * @param u16WorkerId_ Index of the worker
+     * @return Pointer to the worker object
+     */
+    StateRegionWorker* GetWorker(uint16_t u16WorkerId_) { return &m_paclWorkers[u16WorkerId_]; }
+
+    /**
+     * @brief GetRegion
+     *
+     * Retrieve the region whose handler is running.  Only valid when called
+     * from within a handler of a StateRegionMachine, with the machine passed
+     * to the handler.
+     *
+     * @param pclSM_ Machine passed to the handler
+     * @return Index of the region handling the event
+     */
+    static uint16_t GetRegion(const StateMachine* pclSM_)
+    {
+        return static_cast<const StateRegionWorker::Cursor*>(pclSM_)->m_u16Region;
+    }
+
+private:
+    StateReturn Dispatch(uint8_t u8EventClass_, const void* pvEvent_, StateReturn* peResults_);
+    void        RunRegions(StateRegionWorker* pclWorker_, uint16_t u16First_, uint16_t u16Last_);
+    uint16_t    GetSliceStart(uint16_t u16WorkerId_) const;
+    bool        Handles(const StateIndex_t* pauXStack_, uint8_t u8Depth_, uint32_t u32ClassMask_) const;
+
+    StateRegionWorker   m_clLocalWorker;    //!< Worker used when none are set
+    StateRegionWorker*  m_paclWorkers;      //!< Worker state, worker 0 being the dispatching thread
+    uint16_t            m_u16WorkerCount;   //!< Number of workers
+    FleetIdleHandler_t  m_pfIdle;           //!< Called when a worker is idle
+    const State_t*      m_pstStates;        //!< Shared state table
+    StateIndex_t        m_uXStateCount;     //!< Number of states in the table
+    const uint32_t*     m_pu32ClassMasks;   //!< (optional) Per-state masks of handled event classes
+    StateErrorHandler_t m_pfErrorHandler;   //!< Shared error handler
+    void*               m_pvContext;        //!< Shared context
+    uint16_t            m_u16RegionCount;   //!< Number of regions
+    const StateIndex_t* m_puXInitialStates; //!< Per-region initial state
+    uint8_t*            m_pu8StackDepths;   //!< Per-region stack depth
+    StateIndex_t*       m_pauXStacks;       //!< Per-region state stack
+
+    // Event being dispatched across the workers
+    const void*  m_pvJobEvent;     //!< Event object
+    uint32_t     m_u32JobMask;     //!< Class mask of the event, 0 for all regions
+    uint8_t      m_u8JobClass;     //!< Class of the event
+    StateReturn* m_peJobResults;   //!< (optional) Per-region results
+    uint32_t     m_u32Generation;  //!< Incremented for each event dispatched to the workers
+    uint16_t     m_u16JobPending;  //!< Number of workers yet to finish the event
+};
+} // namespace Mark3
@@ -0,0 +1,79 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_snapshot.h
+    @brief Binary snapshot formats used to checkpoint and restore machines
+
+    Single machine (StateMachine::Snapshot()), all fields little-endian:
+
+        uint8_t   version          (STATE_SNAPSHOT_VERSION)
+        uint8_t   index size       (sizeof(StateIndex_t))
+        uint8_t   stack depth      (N)
+        uint8_t   reserved         (0)
+        uint16_t  context size     (C)
+        index     stack[N]         (bottom of stack first)
+        uint8_t   context[C]       (written by the context saver, if any)
+
+    Fleet (StateMachineFleet::Snapshot()), in the byte order of the host
+    that wrote it:
+
+        StateFleetSnapshotHeader_t
+        uint8_t   depths[machine count]
+        index     stacks[machine count * max stack depth]
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+#define STATE_SNAPSHOT_VERSION (1)              //!< Version of both snapshot formats
+#define STATE_SNAPSHOT_HEADER_SIZE (6)          //!< Size of a single-machine snapshot header
+#define STATE_FLEET_SNAPSHOT_MAGIC (0x46534D33) //!< "3MSF" - identifies a fleet snapshot
+
+//---------------------------------------------------------------------------
+// Header written at the start of a fleet snapshot
+typedef struct {
+    uint32_t u32Magic;        //!< Always STATE_FLEET_SNAPSHOT_MAGIC
+    uint8_t  u8Version;       //!< STATE_SNAPSHOT_VERSION
+    uint8_t  u8IndexSize;     //!< Size of a state index, in bytes
+    uint8_t  u8MaxDepth;      //!< Stack entries stored per machine
+    uint8_t  u8Reserved;      //!< Always 0
+    uint32_t u32MachineCount; //!< Number of machines in the snapshot
+} StateFleetSnapshotHeader_t;
+
+//---------------------------------------------------------------------------
+// Function called to serialize a machine's context into a snapshot.  Writes
+// at most u16Size_ bytes to pu8Buffer_, and sets *pu16Written_ to the number
+// of bytes written.  Returns false if the context could not be saved.
+typedef bool (*StateContextSaver_t)(const void* pvContext_,
+                                    uint8_t*    pu8Buffer_,
+                                    uint16_t    u16Size_,
+                                    uint16_t*   pu16Written_);
+
+// Function called to restore a machine's context from the bytes written by
+// the matching StateContextSaver_t.  Returns false if the data is invalid.
+typedef bool (*StateContextLoader_t)(void* pvContext_, const uint8_t* pu8Buffer_, uint16_t u16Size_);
+
+//---------------------------------------------------------------------------
+// Function called to write a block of a fleet snapshot, i.e. to a file.
+// Returns false if the data could not be written.
+typedef bool (*StateSnapshotWriter_t)(void* pvArg_, const void* pvData_, uint32_t u32Size_);
+
+// Function called to read a block of a fleet snapshot.  Returns false if
+// exactly u32Size_ bytes could not be read.
+typedef bool (*StateSnapshotReader_t)(void* pvArg_, void* pvData_, uint32_t u32Size_);
+} // namespace Mark3
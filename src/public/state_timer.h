@@ -0,0 +1,229 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_timer.h
+    @brief Hierarchical timing wheel delivering state timeouts as events
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_machine.h"
+
+#if STATE_MACHINE_TIMERS
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Number of slots in each level of the timing wheel, expressed in bits.
+#ifndef STATE_TIMER_WHEEL_SLOT_BITS
+#define STATE_TIMER_WHEEL_SLOT_BITS (6)
+#endif
+
+//---------------------------------------------------------------------------
+// Number of levels in the timing wheel.  Timers up to
+// 2^(STATE_TIMER_WHEEL_SLOT_BITS * STATE_TIMER_WHEEL_LEVELS) ticks away are
+// placed directly; longer timers are re-filed as the wheel turns.
+#ifndef STATE_TIMER_WHEEL_LEVELS
+#define STATE_TIMER_WHEEL_LEVELS (4)
+#endif
+
+#define STATE_TIMER_WHEEL_SLOTS (1 << STATE_TIMER_WHEEL_SLOT_BITS)
+
+static_assert((STATE_TIMER_WHEEL_SLOT_BITS * STATE_TIMER_WHEEL_LEVELS) <= 31,
+              "Timing wheel range must fit in 31 bits");
+
+//---------------------------------------------------------------------------
+// Forward declarations
+class StateTimer;
+class StateTimerWheel;
+
+//---------------------------------------------------------------------------
+// Function called to deliver an expired timer, in place of the default of
+// passing the timer's event to its machine's HandleEvent().
+typedef void (*StateTimerHandler_t)(StateTimer* pclTimer_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateTimerNode class
+ *
+ * Link in one of a timing wheel's slot lists.
+ */
+class StateTimerNode
+{
+protected:
+    friend class StateTimerWheel;
+
+    StateTimerNode() : m_pclNext{this}, m_pclPrev{this} {}
+
+    StateTimerNode* m_pclNext; //!< Next node in the list
+    StateTimerNode* m_pclPrev; //!< Previous node in the list
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateTimer class
+ *
+ * Timeout owned by a state of a state machine.  Timers are allocated by the
+ * application (typically one or more per state in the machine's context)
+ * and armed on a StateTimerWheel; when a timer expires, its event is
+ * delivered to its machine.  A timer is cancelled automatically when the
+ * state that owns it exits.
+ */
+class StateTimer : public StateTimerNode
+{
+public:
+    StateTimer();
+
+    /**
+     * @brief Cancel
+     *
+     * Stop the timer, if it is armed.
+     *
+     * @return true if the timer was armed, false otherwise
+     */
+    bool Cancel();
+
+    /**
+     * @brief IsArmed
+     *
+     * @return true if the timer is waiting to expire
+     */
+    bool IsArmed() const { return m_pclWheel != nullptr; }
+
+    /**
+     * @brief GetMachine
+     *
+     * @return Machine the timer was last armed for
+     */
+    StateMachine* GetMachine() const { return m_pclSM; }
+
+    /**
+     * @brief GetEvent
+     *
+     * @return Event delivered when the timer expires
+     */
+    const void* GetEvent() const { return m_pvEvent; }
+
+private:
+    friend class StateTimerWheel;
+    friend class StateMachine;
+
+    StateTimerWheel* m_pclWheel;        //!< Wheel the timer is armed on, null if not armed
+    StateMachine*    m_pclSM;           //!< Machine the event is delivered to
+    const void*      m_pvEvent;         //!< Event delivered on expiry
+    StateTimer*      m_pclMachineNext;  //!< Next timer armed for the same machine
+    StateTimer**     m_ppclMachinePrev; //!< Link pointing to this timer in the machine's list
+    uint32_t         m_u32Expiry;       //!< Wheel time at which the timer expires
+    StateIndex_t     m_uXState;         //!< State owning the timer
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateTimerWheel class
+ *
+ * Hierarchical timing wheel for state timeouts.  Arming and cancelling a
+ * timer are O(1), and the wheel holds no storage of its own for timers, so
+ * the number of concurrent timers is limited only by the memory the
+ * application dedicates to them.
+ *
+ * The wheel's time is a tick count, moved forward by Advance() - i.e. from
+ * a periodic kernel timer on target, or directly by a test acting as a
+ * simulated clock.  All timers expiring on a tick are detached from the
+ * wheel together and delivered in the order they were armed, each through
+ * its machine's HandleEvent() (or the handler set with SetHandler()).
+ * Handlers may arm and cancel timers, including ones due on the same tick.
+ *
+ * A wheel, and the machines whose timers it holds, must only be used from
+ * one thread at a time.  Only available when the library is built with
+ * STATE_MACHINE_TIMERS enabled.
+ */
+class StateTimerWheel
+{
+public:
+    StateTimerWheel();
+
+    /**
+     * @brief Arm
+     *
+     * Start a timer owned by a state of a machine.  If the timer is already
+     * armed, it is restarted.  The timer is cancelled automatically when
+     * the owning state exits.  Handlers typically arm timers from the
+     * owning state's pfEntry handler.
+     *
+     * @param pclTimer_ Timer to arm
+     * @param pclSM_ Machine the timer's event is delivered to
+     * @param uXState_ Index of the state that owns the timer
+     * @param u32Ticks_ Ticks until the timer expires (0 is treated as 1)
+     * @param pvEvent_ Event delivered to the machine on expiry.  Must remain
+     * valid until the timer expires or is cancelled.
+     * @return true on success, false on invalid parameters, or if the
+     * machine is the working machine of a StateMachineFleet or
+     * StateRegionMachine, which is shared by many machines
+     */
+    bool Arm(StateTimer* pclTimer_, StateMachine* pclSM_, StateIndex_t uXState_, uint32_t u32Ticks_, const void* pvEvent_);
+
+    /**
+     * @brief SetHandler
+     *
+     * Set a function used to deliver expired timers, i.e. to post the
+     * timer's event to a machine's queue rather than handling it directly.
+     *
+     * @param pfHandler_ Delivery function, or nullptr to call HandleEvent()
+     */
+    void SetHandler(StateTimerHandler_t pfHandler_) { m_pfHandler = pfHandler_; }
+
+    /**
+     * @brief Advance
+     *
+     * Move the wheel's time forward, delivering every timer that expires.
+     *
+     * @param u32Ticks_ Number of ticks to advance by
+     * @return Number of timers delivered
+     */
+    uint32_t Advance(uint32_t u32Ticks_);
+
+    /**
+     * @brief GetTime
+     *
+     * @return Number of ticks the wheel has advanced by
+     */
+    uint32_t GetTime() const { return m_u32Now; }
+
+    /**
+     * @brief GetArmedCount
+     *
+     * @return Number of timers currently armed on the wheel
+     */
+    uint32_t GetArmedCount() const { return m_u32Count; }
+
+private:
+    friend class StateTimer;
+
+    void Insert(StateTimer* pclTimer_);
+    void Remove(StateTimer* pclTimer_);
+    void Cascade(uint8_t u8Level_);
+
+    static void Append(StateTimerNode* pclList_, StateTimerNode* pclNode_);
+    static void Splice(StateTimerNode* pclDst_, StateTimerNode* pclSrc_);
+
+    StateTimerNode      m_aclSlots[STATE_TIMER_WHEEL_LEVELS][STATE_TIMER_WHEEL_SLOTS]; //!< Timers, by level and slot
+    StateTimerNode      m_clExpiring; //!< Timers expired on the current tick, not yet delivered
+    StateTimerHandler_t m_pfHandler;  //!< (optional) Function used to deliver expired timers
+    uint32_t            m_u32Now;     //!< Current wheel time
+    uint32_t            m_u32Count;   //!< Number of armed timers
+};
+} // namespace Mark3
+
+#endif // STATE_MACHINE_TIMERS
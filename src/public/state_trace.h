@@ -0,0 +1,189 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_trace.h
+    @brief Binary ring-buffer trace of state machine operations
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_clock.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * Operations recorded in the trace
+ */
+enum class StateTraceOp : uint8_t {
+    push,       //!< A state was pushed onto the stack
+    pop,        //!< A state was popped from the stack
+    transition, //!< The state at the handling level was replaced
+    unhandled   //!< An event was not handled by any state on the stack
+};
+
+//---------------------------------------------------------------------------
+// Fixed-size trace record
+typedef struct {
+    uint64_t u64Timestamp; //!< Time of the operation (see StateClock)
+    uint16_t u16From;      //!< State the operation started from
+    uint16_t u16To;        //!< State the operation ended in
+    uint8_t  u8Op;         //!< Operation (StateTraceOp)
+    uint8_t  u8Depth;      //!< Stack depth after the operation
+    uint16_t u16Reserved;  //!< Padding, always zero
+} StateTraceRecord_t;
+
+//---------------------------------------------------------------------------
+// Header describing a binary trace dump, followed by u32Capacity records
+typedef struct {
+    uint32_t u32Magic;      //!< STATE_TRACE_MAGIC
+    uint16_t u16Version;    //!< STATE_TRACE_VERSION
+    uint16_t u16RecordSize; //!< sizeof(StateTraceRecord_t)
+    uint32_t u32Capacity;   //!< Number of records in the ring buffer
+    uint32_t u32Head;       //!< Total number of records written (see StateTraceBuffer::Record())
+} StateTraceHeader_t;
+
+#define STATE_TRACE_MAGIC (0x54534D33) //!< "3MST"
+#define STATE_TRACE_VERSION (1)
+
+//---------------------------------------------------------------------------
+// Function called for each record when decoding a trace, oldest first
+typedef void (*StateTraceCallback_t)(void* pvArg_, const StateTraceRecord_t* pstRecord_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateTraceBuffer class
+ *
+ * Ring buffer of fixed-size records describing the operations performed by
+ * one or more state machines.  Records are written by a single context (the
+ * thread owning the machines attached to the buffer) without locking; once
+ * full, the oldest records are overwritten.
+ *
+ * Machines are attached using StateMachine::SetTraceBuffer(), which is only
+ * available when the library is built with STATE_MACHINE_TRACE enabled.
+ * Otherwise, the trace hooks are compiled out of the state machine
+ * entirely.
+ */
+class StateTraceBuffer
+{
+public:
+    StateTraceBuffer();
+
+    /**
+     * @brief Init
+     *
+     * Set the storage for the trace records.  The storage must exist for
+     * the lifespan of the trace buffer.
+     *
+     * @param pastRecords_ Array of trace records
+     * @param u32Capacity_ Number of records in the array (power of two)
+     * @return true on success, false on invalid parameters
+     */
+    bool Init(StateTraceRecord_t* pastRecords_, uint32_t u32Capacity_);
+
+    /**
+     * @brief Record
+     *
+     * Append a record to the trace.
+     *
+     * @param eOp_ Operation performed
+     * @param u16From_ State the operation started from
+     * @param u16To_ State the operation ended in
+     * @param u16Depth_ Stack depth after the operation
+     *
+     * State indices wider than 16 bits (see STATE_MACHINE_INDEX_TYPE) are
+     * truncated to their low 16 bits.  Nothing is recorded until the buffer
+     * has been initialized.
+     *
+     * The record count wraps back to the capacity rather than to 0, which
+     * refers to the same slot, so that a count below the capacity always
+     * means the buffer has not yet filled.
+     */
+    void Record(StateTraceOp eOp_, uint16_t u16From_, uint16_t u16To_, uint16_t u16Depth_)
+    {
+        if (m_u32Capacity == 0) {
+            return;
+        }
+
+        auto u32Head   = m_u32Head;
+        auto pstRecord = &m_pastRecords[u32Head & (m_u32Capacity - 1)];
+
+        pstRecord->u64Timestamp = StateClock::Now();
+        pstRecord->u16From      = u16From_;
+        pstRecord->u16To        = u16To_;
+        pstRecord->u8Op         = static_cast<uint8_t>(eOp_);
+        pstRecord->u8Depth      = static_cast<uint8_t>(u16Depth_);
+        pstRecord->u16Reserved  = 0;
+
+        u32Head++;
+        if (u32Head == 0) {
+            u32Head = m_u32Capacity;
+        }
+        __atomic_store_n(&m_u32Head, u32Head, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief GetDump
+     *
+     * Retrieve the header and record storage making up a binary dump of the
+     * trace.  The dump is the header followed by the record array, which
+     * can be written out as-is (i.e. to a file or a serial port) and read
+     * back with Decode().
+     *
+     * @param pstHeader_ [out] Header describing the trace
+     * @return Pointer to the record array
+     */
+    const StateTraceRecord_t* GetDump(StateTraceHeader_t* pstHeader_) const;
+
+    /**
+     * @brief Decode
+     *
+     * Walk the records held in the trace, from oldest to newest.
+     *
+     * @param pfCallback_ Function called for each record
+     * @param pvArg_ Argument passed to the callback
+     * @return Number of records visited
+     */
+    uint32_t Decode(StateTraceCallback_t pfCallback_, void* pvArg_) const;
+
+    /**
+     * @brief Decode
+     *
+     * Walk the records held in a binary dump, from oldest to newest.
+     *
+     * @param pstHeader_ Header of the dump
+     * @param pastRecords_ Record array following the header
+     * @param pfCallback_ Function called for each record
+     * @param pvArg_ Argument passed to the callback
+     * @return Number of records visited, or 0 if the header is invalid
+     */
+    static uint32_t Decode(const StateTraceHeader_t* pstHeader_,
+                           const StateTraceRecord_t* pastRecords_,
+                           StateTraceCallback_t      pfCallback_,
+                           void*                     pvArg_);
+
+    /**
+     * @brief Reset
+     *
+     * Discard all records held in the trace.
+     */
+    void Reset() { __atomic_store_n(&m_u32Head, 0, __ATOMIC_RELEASE); }
+
+private:
+    StateTraceRecord_t* m_pastRecords; //!< Record storage
+    uint32_t            m_u32Capacity; //!< Number of records in the storage
+    uint32_t            m_u32Head;     //!< Total number of records written
+};
+} // namespace Mark3
@@ -0,0 +1,188 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_transition_table.h
+    @brief Data-driven state transitions, compiled into a dense lookup table
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_machine.h"
+
+#if STATE_MACHINE_TYPED_EVENTS
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+// Number of uint16_t elements of storage needed to compile a transition
+// table (see StateTransitionTable::Compile())
+#define STATE_TRANSITION_TABLE_STORAGE(states, events, rows) (((states) * ((events) + 1)) + (rows))
+
+//---------------------------------------------------------------------------
+/**
+ * Operation performed by a row of a transition table
+ */
+enum class StateTransitionKind : uint8_t {
+    transition, //!< Transition to the target state
+    push,       //!< Push the target state
+    pop,        //!< Pop the current state
+    internal    //!< Run the action only, without changing state
+};
+
+//---------------------------------------------------------------------------
+// Function pointer type used to decide whether a row applies to an event
+typedef bool (*StateGuard_t)(StateMachine* pclSM_, const void* pvEvent_);
+
+// Function pointer type used to implement the action taken by a row
+typedef void (*StateAction_t)(StateMachine* pclSM_, const void* pvEvent_);
+
+//---------------------------------------------------------------------------
+// Row of a transition table, describing the response of a state to an event
+typedef struct {
+    StateIndex_t        uXSource;   //!< State handling the event
+    uint16_t            u16EventId; //!< ID of the event handled
+    StateGuard_t        pfGuard;    //!< (optional) Row applies only if this returns true
+    StateAction_t       pfAction;   //!< (optional) Function called when the row applies
+    StateIndex_t        uXTarget;   //!< State entered by transition and push rows
+    StateTransitionKind eKind;      //!< Operation performed
+} StateTransitionRow_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateTransitionTable class
+ *
+ * Data-driven alternative to hand-written pfRun handlers.  The application
+ * declares rows of (source, event, guard, action, target, kind), which are
+ * compiled into a dense array indexed by state and event ID, so finding the
+ * rows for an event costs a single indexed load.  Rows for event IDs beyond
+ * the dense range are chained per state, and found by a linear search.
+ *
+ * Where several rows share a source and event, their guards are checked in
+ * the order the rows are declared, and the first row whose guard passes
+ * (or that has no guard) applies.  If no row applies, the event is passed
+ * to the state's pfRun handler, or returned as unhandled if it has none -
+ * in which case it continues to the next state on the stack, as usual.
+ *
+ * An action may request an operation itself (i.e. TransitionState()) only
+ * on internal rows.  On any other row, the request is reported to the
+ * machine's error handler as ambiguous, and the row's own operation runs.
+ *
+ * Events are dispatched through the table with StateMachine::HandleEvent(
+ * uint16_t, const void*), once it is set with
+ * StateMachine::SetTransitionTable().  A compiled table may be shared by any
+ * number of machines using the same state table.  Only available when the
+ * library is built with STATE_MACHINE_TYPED_EVENTS enabled.
+ */
+class StateTransitionTable
+{
+public:
+    StateTransitionTable();
+
+    /**
+     * @brief Compile
+     *
+     * Build the lookup table for a set of rows.  The rows and storage must
+     * exist for the lifespan of the table.
+     *
+     * @param pstRows_ Rows of the table
+     * @param u16RowCount_ Number of rows (at most 0xFFFE)
+     * @param uXStateCount_ Number of states in the state table
+     * @param u16EventCount_ Number of event IDs looked up directly; rows for
+     * IDs at or above this are searched for instead
+     * @param pu16Storage_ Storage for the lookup table
+     * @param u32StorageSize_ Number of elements of storage - at least
+     * STATE_TRANSITION_TABLE_STORAGE(uXStateCount_, u16EventCount_,
+     * u16RowCount_)
+     * @return true on success, false if the storage is too small or a row
+     * refers to an invalid state
+     */
+    bool Compile(const StateTransitionRow_t* pstRows_,
+                 uint16_t                    u16RowCount_,
+                 StateIndex_t                uXStateCount_,
+                 uint16_t                    u16EventCount_,
+                 uint16_t*                   pu16Storage_,
+                 uint32_t                    u32StorageSize_);
+
+    /**
+     * @brief Dispatch
+     *
+     * Apply the first row matching a state and event, falling back to the
+     * state's pfRun handler if no row applies.
+     *
+     * @param pclSM_ Machine handling the event
+     * @param pstState_ Handlers of the state
+     * @param uXState_ Index of the state
+     * @param u16EventId_ ID of the event
+     * @param pvEvent_ Stimulus object passed to guards, actions and handlers
+     * @return Result of the event handling
+     */
+    StateReturn Dispatch(StateMachine*  pclSM_,
+                         const State_t* pstState_,
+                         StateIndex_t   uXState_,
+                         uint16_t       u16EventId_,
+                         const void*    pvEvent_) const
+    {
+        auto u16Column = (u16EventId_ < m_u16EventCount) ? u16EventId_ : m_u16EventCount;
+        auto u16Row    = m_pu16Cells[(static_cast<uint32_t>(uXState_) * (m_u16EventCount + 1)) + u16Column];
+        while (u16Row != 0) {
+            auto pstRow = &m_pstRows[u16Row - 1];
+            if ((pstRow->u16EventId == u16EventId_) && (!pstRow->pfGuard || pstRow->pfGuard(pclSM_, pvEvent_))) {
+                return Apply(pclSM_, pstRow, pvEvent_);
+            }
+            u16Row = m_pu16Next[u16Row - 1];
+        }
+
+        if (pstState_->pfRun == nullptr) {
+            return StateReturn::unhandled;
+        }
+        return pstState_->pfRun(pclSM_, pvEvent_);
+    }
+
+private:
+    static StateReturn Apply(StateMachine* pclSM_, const StateTransitionRow_t* pstRow_, const void* pvEvent_);
+
+    const StateTransitionRow_t* m_pstRows;       //!< Rows of the table
+    const uint16_t*             m_pu16Cells;     //!< First row (+1) for each state and event column, 0 if none
+    const uint16_t*             m_pu16Next;      //!< Next row (+1) in the same cell, 0 if none
+    uint16_t                    m_u16EventCount; //!< Number of event IDs looked up directly
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StateTransitionTableRef class
+ *
+ * State table accessor used to dispatch typed events through a compiled
+ * transition table.
+ */
+class StateTransitionTableRef : public StateTableRef
+{
+public:
+    StateTransitionTableRef(const State_t* pstStates_, const StateTransitionTable* pclTable_, uint16_t u16EventId_)
+        : StateTableRef(pstStates_), m_pclTable{pclTable_}, m_u16EventId{u16EventId_}
+    {
+    }
+
+    StateReturn Run(StateMachine* pclSM_, StateIndex_t uXState_, const void* pvEvent_) const
+    {
+        return m_pclTable->Dispatch(pclSM_, &m_pstStates[uXState_], uXState_, m_u16EventId, pvEvent_);
+    }
+
+private:
+    const StateTransitionTable* m_pclTable;
+    uint16_t                    m_u16EventId;
+};
+} // namespace Mark3
+
+#endif // STATE_MACHINE_TYPED_EVENTS
@@ -0,0 +1,268 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file static_state_machine.h
+    @brief State machine specialized on a state table known at compile-time
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_machine.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The StaticStateTable class
+ *
+ * State table accessor for a table that is bound as a template argument.
+ * Handler lookups are resolved by a compile-time binary search over the
+ * table indices, so each state's handlers are called directly (and may be
+ * inlined), and the null checks on optional entry/exit handlers are folded
+ * away by the compiler.
+ */
+template <StateIndex_t uXStateCount_, const State_t (&astStates_)[uXStateCount_]>
+class StaticStateTable
+{
+public:
+    bool Handles(StateIndex_t /*uXState_*/) const { return true; }
+
+    StateReturn Run(StateMachine* pclSM_, StateIndex_t uXState_, const void* pvEvent_) const
+    {
+        return Select<0, uXStateCount_>::Run(pclSM_, uXState_, pvEvent_);
+    }
+
+    void Entry(StateMachine* pclSM_, StateIndex_t uXState_) const
+    {
+        Select<0, uXStateCount_>::Entry(pclSM_, uXState_);
+    }
+
+    void Exit(StateMachine* pclSM_, StateIndex_t uXState_) const
+    {
+        Select<0, uXStateCount_>::Exit(pclSM_, uXState_);
+    }
+
+private:
+    // Null check that stays quiet when the table is constexpr, and the
+    // handler's address is known to be non-null
+    static constexpr bool IsSet(StateChangeHandler_t pfHandler_) { return pfHandler_ != nullptr; }
+
+    // Selects the handlers for a state in the range [uXLow_, uXHigh_)
+    template <StateIndex_t uXLow_, StateIndex_t uXHigh_, bool bLeaf_ = (uXHigh_ - uXLow_ == 1)>
+    struct Select {
+        static const StateIndex_t uXMid = uXLow_ + ((uXHigh_ - uXLow_) / 2);
+
+        static StateReturn Run(StateMachine* pclSM_, StateIndex_t uXState_, const void* pvEvent_)
+        {
+            if (uXState_ < uXMid) {
+                return Select<uXLow_, uXMid>::Run(pclSM_, uXState_, pvEvent_);
+            }
+            return Select<uXMid, uXHigh_>::Run(pclSM_, uXState_, pvEvent_);
+        }
+
+        static void Entry(StateMachine* pclSM_, StateIndex_t uXState_)
+        {
+            if (uXState_ < uXMid) {
+                Select<uXLow_, uXMid>::Entry(pclSM_, uXState_);
+            } else {
+                Select<uXMid, uXHigh_>::Entry(pclSM_, uXState_);
+            }
+        }
+
+        static void Exit(StateMachine* pclSM_, StateIndex_t uXState_)
+        {
+            if (uXState_ < uXMid) {
+                Select<uXLow_, uXMid>::Exit(pclSM_, uXState_);
+            } else {
+                Select<uXMid, uXHigh_>::Exit(pclSM_, uXState_);
+            }
+        }
+    };
+
+    // A single state - call its handlers directly
+    template <StateIndex_t uXLow_, StateIndex_t uXHigh_>
+    struct Select<uXLow_, uXHigh_, true> {
+        static StateReturn Run(StateMachine* pclSM_, StateIndex_t /*uXState_*/, const void* pvEvent_)
+        {
+            return astStates_[uXLow_].pfRun(pclSM_, pvEvent_);
+        }
+
+        static void Entry(StateMachine* pclSM_, StateIndex_t /*uXState_*/)
+        {
+            if (IsSet(astStates_[uXLow_].pfEntry)) {
+                astStates_[uXLow_].pfEntry(pclSM_);
+            }
+        }
+
+        static void Exit(StateMachine* pclSM_, StateIndex_t /*uXState_*/)
+        {
+            if (IsSet(astStates_[uXLow_].pfExit)) {
+                astStates_[uXLow_].pfExit(pclSM_);
+            }
+        }
+    };
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StaticStateEventClassTable class
+ *
+ * Accessor for a table bound as a template argument, used to dispatch events
+ * tagged with an event class (see StateEventClassRef).  States that do not
+ * handle the event's class are skipped; the handlers of those that do are
+ * called directly, as with StaticStateTable.
+ */
+template <StateIndex_t uXStateCount_, const State_t (&astStates_)[uXStateCount_]>
+class StaticStateEventClassTable : public StaticStateTable<uXStateCount_, astStates_>
+{
+public:
+    StaticStateEventClassTable(const uint32_t* pu32ClassMasks_, uint8_t u8EventClass_)
+        : m_pu32ClassMasks{pu32ClassMasks_}, m_u32ClassMask{static_cast<uint32_t>(1) << u8EventClass_}
+    {
+    }
+
+    bool Handles(StateIndex_t uXState_) const { return (m_pu32ClassMasks[uXState_] & m_u32ClassMask) != 0; }
+
+private:
+    const uint32_t* m_pu32ClassMasks;
+    uint32_t        m_u32ClassMask;
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The StaticStateMachine class
+ *
+ * State machine whose state table is bound at compile-time, rather than
+ * through SetStates().  The table must be a const (ideally constexpr) array
+ * with static storage duration, i.e.
+ *
+ * @code
+ * static constexpr State_t astStates[] = { ... };
+ * StaticStateMachine<sizeof(astStates) / sizeof(State_t), astStates> clSM;
+ * @endcode
+ *
+ * The VM semantics are identical to StateMachine; only the way handlers are
+ * invoked differs.  Handlers still receive a StateMachine pointer, and use
+ * the same PushState/PopState/TransitionState API.
+ *
+ * Note that Begin(), HandleEvent(), HandleEventBatch() and HandleClassEvent()
+ * hide the base-class methods, and must be called through the
+ * StaticStateMachine type to get the specialized dispatch.  The following
+ * remain dispatched through the runtime table (bound to the same states,
+ * so the behavior is the same, but handlers are called indirectly):
+ *
+ * - calls made through a StateMachine pointer or reference
+ * - HandleEvent(uint16_t, const void*) when event maps or a transition
+ *   table are set, as their handlers are looked up per event
+ * - StateMachine::HandleEventPairs(), which accepts any machine
+ *
+ * StaticStateMachine::State<> declares StateHandle types whose state count
+ * is taken from the bound table, for use with the compile-time checked
+ * PushState<>(), PopState<>() and TransitionState<>() overloads.
+ */
+template <StateIndex_t uXStateCount_, const State_t (&astStates_)[uXStateCount_]>
+class StaticStateMachine : public StateMachine
+{
+public:
+    static_assert(uXStateCount_ > 0, "State table must not be empty");
+
+    // Handle to a state in the bound table (see StateHandle)
+    template <StateIndex_t uXIndex_, uint8_t u8Depth_ = 0>
+    using State = StateHandle<uXStateCount_, uXIndex_, u8Depth_>;
+
+    StaticStateMachine() { SetStates(astStates_, uXStateCount_); }
+
+    /**
+     * @brief Begin
+     *
+     * Initialize the state machine by resetting the stack and entering the
+     * first state in the table.
+     *
+     * @return true if successfully initialized, false otherwise
+     */
+    bool Begin() { return RunBegin(StaticStateTable<uXStateCount_, astStates_>()); }
+
+    /**
+     * @brief HandleEvent
+     *
+     * Pass an object containing stimulus to the state machine for processing.
+     *
+     * @param pvEvent_ Stimulus object, which the state machine interprets
+     * and processes.
+     * @return Result of the event handling
+     */
+    StateReturn HandleEvent(const void* pvEvent_)
+    {
+        return RunEvent(StaticStateTable<uXStateCount_, astStates_>(), pvEvent_);
+    }
+
+#if STATE_MACHINE_TYPED_EVENTS
+    /**
+     * @brief HandleEvent
+     *
+     * Pass a typed event to the state machine for processing.  Without
+     * event maps or a transition table, the event is passed to the states'
+     * pfRun handlers, which are called directly.
+     *
+     * @sa StateMachine::HandleEvent(uint16_t, const void*)
+     */
+    StateReturn HandleEvent(uint16_t u16EventId_, const void* pvEvent_)
+    {
+        if ((m_pstEventMaps != nullptr) || (m_pclTransitionTable != nullptr)) {
+            return StateMachine::HandleEvent(u16EventId_, pvEvent_);
+        }
+        return HandleEvent(pvEvent_);
+    }
+#endif
+
+#if STATE_MACHINE_EVENT_CLASSES
+    /**
+     * @brief HandleClassEvent
+     *
+     * Pass an event belonging to an event class to the state machine for
+     * processing, skipping states that do not handle the class.
+     *
+     * @sa StateMachine::HandleClassEvent
+     */
+    StateReturn HandleClassEvent(uint8_t u8EventClass_, const void* pvEvent_)
+    {
+        if (m_pu32ClassMasks == nullptr) {
+            return HandleEvent(pvEvent_);
+        }
+        return RunEvent(StaticStateEventClassTable<uXStateCount_, astStates_>(m_pu32ClassMasks, u8EventClass_),
+                        pvEvent_);
+    }
+#endif
+
+    /**
+     * @brief HandleEventBatch
+     *
+     * Pass a sequence of events to the state machine for processing.
+     *
+     * @sa StateMachine::HandleEventBatch
+     */
+    uint32_t HandleEventBatch(const void* const* ppvEvents_,
+                              uint32_t           u32Count_,
+                              StateReturn*       peResults_  = nullptr,
+                              uint8_t            u8StopMask_ = 0)
+    {
+        return RunEventBatch(StaticStateTable<uXStateCount_, astStates_>(),
+                             ppvEvents_,
+                             u32Count_,
+                             peResults_,
+                             u8StopMask_);
+    }
+};
+} // namespace Mark3
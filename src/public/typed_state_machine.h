@@ -0,0 +1,189 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file typed_state_machine.h
+    @brief State machine with handlers bound to a typed context and event
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "state_machine.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+/**
+ * @brief The TypedState class
+ *
+ * Binds member functions of a context type to the entries of a state table.
+ * Each handler is bound as a template argument, to a thunk that recovers the
+ * machine's context and event types and calls it - no handler pointers are
+ * stored, beyond the thunks themselves.  When the table is bound at
+ * compile-time (see StaticStateMachine), the thunk and handler can both be
+ * inlined into the VM.
+ *
+ * Handlers have the form:
+ *
+ * @code
+ * StateReturn Context::Run(StateMachine* pclSM_, const Event& clEvent_);
+ * void Context::Entry(StateMachine* pclSM_);
+ * void Context::Exit(StateMachine* pclSM_);
+ * @endcode
+ *
+ * Run handlers can also be bound to free functions taking the context by
+ * reference, as Context&, StateMachine*, const Event&.  Lambdas without
+ * captures convert to such functions, but cannot be used as template
+ * arguments before C++17 - define them as named functions instead.
+ */
+template <typename Context, typename Event>
+class TypedState
+{
+public:
+    typedef StateReturn (Context::*RunMember_t)(StateMachine* pclSM_, const Event& clEvent_);
+    typedef void (Context::*ChangeMember_t)(StateMachine* pclSM_);
+    typedef StateReturn (*RunFunction_t)(Context& clContext_, StateMachine* pclSM_, const Event& clEvent_);
+
+    template <RunMember_t pfRun_>
+    static StateReturn Run(StateMachine* pclSM_, const void* pvEvent_)
+    {
+        return (GetContext(pclSM_)->*pfRun_)(pclSM_, *static_cast<const Event*>(pvEvent_));
+    }
+
+    template <RunFunction_t pfRun_>
+    static StateReturn RunFunction(StateMachine* pclSM_, const void* pvEvent_)
+    {
+        return pfRun_(*GetContext(pclSM_), pclSM_, *static_cast<const Event*>(pvEvent_));
+    }
+
+    template <ChangeMember_t pfChange_>
+    static void Change(StateMachine* pclSM_)
+    {
+        (GetContext(pclSM_)->*pfChange_)(pclSM_);
+    }
+
+    /**
+     * @brief Bind
+     *
+     * @return State with a context member function as its run handler
+     */
+    template <RunMember_t pfRun_>
+    static constexpr State_t Bind()
+    {
+        return {nullptr, Run<pfRun_>, nullptr};
+    }
+
+    /**
+     * @brief Bind
+     *
+     * @return State with context member functions as its handlers - entry
+     * and exit handlers are optional, and may be nullptr
+     */
+    template <ChangeMember_t pfEntry_, RunMember_t pfRun_, ChangeMember_t pfExit_>
+    static constexpr State_t Bind()
+    {
+        return {IsSet(pfEntry_) ? Change<pfEntry_> : nullptr,
+                Run<pfRun_>,
+                IsSet(pfExit_) ? Change<pfExit_> : nullptr};
+    }
+
+    /**
+     * @brief BindFunction
+     *
+     * @return State with a free function as its run handler
+     */
+    template <RunFunction_t pfRun_>
+    static constexpr State_t BindFunction()
+    {
+        return {nullptr, RunFunction<pfRun_>, nullptr};
+    }
+
+private:
+    static constexpr bool IsSet(ChangeMember_t pfChange_) { return pfChange_ != nullptr; }
+
+    static Context* GetContext(StateMachine* pclSM_) { return static_cast<Context*>(pclSM_->GetContext()); }
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief The TypedStateMachine class
+ *
+ * State machine whose context and events have fixed types, with handlers
+ * bound through TypedState.  Events are passed by reference rather than as
+ * untyped pointers.  The base class determines how the state table is
+ * held - a table set at runtime (StateMachine, the default), or one bound at
+ * compile-time (StaticStateMachine):
+ *
+ * @code
+ * typedef TypedState<Door, DoorEvent> DoorState;
+ * static constexpr State_t astDoorStates[] = {
+ *     DoorState::Bind<&Door::ClosedRun>(),
+ *     DoorState::Bind<&Door::OpenEntry, &Door::OpenRun, nullptr>(),
+ * };
+ * TypedStateMachine<Door, DoorEvent, StaticStateMachine<2, astDoorStates>> clSM;
+ * @endcode
+ *
+ * Events that are tagged unions can pass their tag as an event ID, which
+ * indexes the dense table of each state's event map directly (see
+ * StateMachine::SetEventMaps()); map entries are bound with
+ * TypedState::Run<>().
+ */
+template <typename Context, typename Event, typename Base = StateMachine>
+class TypedStateMachine : public Base
+{
+public:
+    typedef TypedState<Context, Event> State;
+
+    /**
+     * @brief SetContext
+     *
+     * @param pclContext_ Context object passed to the state handlers
+     */
+    void SetContext(Context* pclContext_) { Base::SetContext(pclContext_); }
+
+    /**
+     * @brief GetContext
+     *
+     * @return Context object passed to the state handlers
+     */
+    Context* GetContext() { return static_cast<Context*>(Base::GetContext()); }
+
+    /**
+     * @brief HandleEvent
+     *
+     * Pass an event to the state machine for processing.
+     *
+     * @param clEvent_ Event to process
+     * @return Result of the event handling
+     */
+    StateReturn HandleEvent(const Event& clEvent_) { return Base::HandleEvent(&clEvent_); }
+
+#if STATE_MACHINE_TYPED_EVENTS
+    /**
+     * @brief HandleEvent
+     *
+     * Pass an event to the state machine for processing, dispatched by ID
+     * through the states' event maps.
+     *
+     * @param u16EventId_ ID of the event - i.e. the tag of a tagged union
+     * @param clEvent_ Event to process
+     * @return Result of the event handling
+     */
+    StateReturn HandleEvent(uint16_t u16EventId_, const Event& clEvent_)
+    {
+        return Base::HandleEvent(u16EventId_, &clEvent_);
+    }
+#endif
+};
+} // namespace Mark3
@@ -0,0 +1,118 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_coroutine.cpp
+    @brief Resumable states, written as a sequence awaiting successive events
+*/
+#include "state_coroutine.h"
+
+#include <string.h>
+
+#if STATE_MACHINE_COROUTINES
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+StateCoroutinePool::StateCoroutinePool() : m_pclFree{nullptr}, m_u16FrameSize{0}, m_u16FreeCount{0} {}
+
+//---------------------------------------------------------------------------
+bool StateCoroutinePool::SetStorage(void* pvStorage_, uint16_t u16FrameSize_, uint16_t u16FrameCount_)
+{
+    if ((!pvStorage_) || (u16FrameSize_ < sizeof(StateCoroutineFrame)) || (u16FrameCount_ == 0)) {
+        return false;
+    }
+
+    // Keep every frame aligned to the same boundary as the first
+    auto u32Stride = (static_cast<uint32_t>(u16FrameSize_) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+
+    m_pclFree      = nullptr;
+    m_u16FrameSize = u16FrameSize_;
+    m_u16FreeCount = 0;
+
+    // Build the free list back to front, so frames are handed out in order
+    auto pu8Storage = static_cast<uint8_t*>(pvStorage_);
+    for (uint16_t i = u16FrameCount_; i > 0; i--) {
+        Free(reinterpret_cast<StateCoroutineFrame*>(&pu8Storage[(i - 1) * u32Stride]));
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+StateCoroutineFrame* StateCoroutinePool::Allocate(StateMachine* pclSM_, StateHandler_t pfRun_, uint16_t u16Size_)
+{
+    // An event passed down from a state higher up the stack
+    for (auto pclFrame = pclSM_->m_pclCoroutineFrames; pclFrame != nullptr; pclFrame = pclFrame->m_pclNext) {
+        if (pclFrame->m_pfRun == pfRun_) {
+            return pclFrame;
+        }
+    }
+
+    // First event delivered to the state since it was entered
+    auto pclPool = pclSM_->m_pclCoroutinePool;
+    if ((pclPool == nullptr) || (pclPool->m_pclFree == nullptr) || (u16Size_ > pclPool->m_u16FrameSize)) {
+        if (pclSM_->m_pfErrorHandler != nullptr) {
+            StateErrorData_t stError;
+            stError.eType = StateErrorType::coroutine_frame_unavailable;
+            pclSM_->m_pfErrorHandler(pclSM_, &stError);
+        }
+        return nullptr;
+    }
+
+    auto pclFrame      = pclPool->m_pclFree;
+    pclPool->m_pclFree = pclFrame->m_pclNext;
+    pclPool->m_u16FreeCount--;
+
+    memset(static_cast<void*>(pclFrame), 0, u16Size_);
+    pclFrame->m_pfRun            = pfRun_;
+    pclFrame->m_pclNext          = pclSM_->m_pclCoroutineFrames;
+    pclSM_->m_pclCoroutineFrames = pclFrame;
+    return pclFrame;
+}
+
+//---------------------------------------------------------------------------
+void StateCoroutinePool::Release(StateMachine* pclSM_, StateHandler_t pfRun_)
+{
+    // States exit innermost first, so the frame is normally at the head
+    auto ppclLink = &pclSM_->m_pclCoroutineFrames;
+    while (*ppclLink != nullptr) {
+        auto pclFrame = *ppclLink;
+        if (pclFrame->m_pfRun == pfRun_) {
+            *ppclLink = pclFrame->m_pclNext;
+            pclSM_->m_pclCoroutinePool->Free(pclFrame);
+            return;
+        }
+        ppclLink = &pclFrame->m_pclNext;
+    }
+}
+
+//---------------------------------------------------------------------------
+void StateCoroutinePool::ReleaseAll(StateMachine* pclSM_)
+{
+    while (pclSM_->m_pclCoroutineFrames != nullptr) {
+        auto pclFrame                = pclSM_->m_pclCoroutineFrames;
+        pclSM_->m_pclCoroutineFrames = pclFrame->m_pclNext;
+        pclSM_->m_pclCoroutinePool->Free(pclFrame);
+    }
+}
+
+//---------------------------------------------------------------------------
+void StateCoroutinePool::Free(StateCoroutineFrame* pclFrame_)
+{
+    pclFrame_->m_pclNext = m_pclFree;
+    m_pclFree            = pclFrame_;
+    m_u16FreeCount++;
+}
+} // namespace Mark3
+
+#endif // STATE_MACHINE_COROUTINES
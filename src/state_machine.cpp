@@ -16,30 +16,85 @@ See license.txt for more information
     @brief Implements a generic and extensible state-machine framework
 */
 #include "state_machine.h"
+#include "state_timer.h"
+#include "state_coroutine.h"
+#include "state_transition_table.h"
 
 namespace Mark3
 {
 StateMachine::StateMachine()
-    : m_bStatesSet{false}
-    , m_bOpcodeSet{false}
-    , m_u16NextState{0}
+    : m_pvContext{nullptr}
     , m_pstStateList{nullptr}
     , m_pfErrorHandler{nullptr}
+#if STATE_MACHINE_TYPED_EVENTS
+    , m_pstEventMaps{nullptr}
+    , m_pclTransitionTable{nullptr}
+#endif
+#if STATE_MACHINE_EVENT_CLASSES
+    , m_pu32ClassMasks{nullptr}
+#endif
+#if STATE_MACHINE_TIMERS
+    , m_pclTimers{nullptr}
+#endif
+#if STATE_MACHINE_COROUTINES
+    , m_pclCoroutinePool{nullptr}
+    , m_pclCoroutineFrames{nullptr}
+#endif
+#if STATE_MACHINE_HISTORY
+    , m_puXHistory{nullptr}
+#endif
+#if STATE_MACHINE_TRACE
+    , m_pclTrace{nullptr}
+#endif
+#if STATE_MACHINE_PROFILE
+    , m_pclProfile{nullptr}
+#endif
+#if STATE_MACHINE_STATS
+    , m_u32UnhandledCount{0}
+    , m_u32SkippedFrameCount{0}
+#endif
+    , m_au32ExitFrames{}
+    , m_uXStateCount{0}
+    , m_uXNextState{0}
+    , m_uXOpSetState{0}
+    , m_auXStateStack{}
+    , m_u8StackDepth{0}
+    , m_eOpcode{StateOpcode::returned}
+#if STATE_MACHINE_HISTORY
+    , m_eHistory{StateHistory::none}
+#endif
+    , m_bOpcodeSet{false}
+    , m_bStatesSet{false}
+    , m_bExitHandlers{false}
+    , m_bCursor{false}
 {
 }
 //---------------------------------------------------------------------------
-bool StateMachine::SetStates(const State_t* pstStates_, uint16_t u16StateCount_)
+bool StateMachine::SetStates(const State_t* pstStates_, StateIndex_t uXStateCount_)
 {
-    if (m_bStatesSet || (!pstStates_) || (0 == u16StateCount_)) {
+    if (m_bStatesSet || (!pstStates_) || (0 == uXStateCount_)) {
         return false;
     }
 
-    m_bStatesSet = true;
-    m_u16StateCount = u16StateCount_;
-    m_pstStateList  = pstStates_;
+    BindStates(pstStates_, uXStateCount_);
     return true;
 }
 
+//---------------------------------------------------------------------------
+void StateMachine::BindStates(const State_t* pstStates_, StateIndex_t uXStateCount_)
+{
+    m_bStatesSet    = true;
+    m_uXStateCount  = uXStateCount_;
+    m_pstStateList  = pstStates_;
+    m_bExitHandlers = false;
+    for (StateIndex_t i = 0; i < uXStateCount_; i++) {
+        if (pstStates_[i].pfExit != nullptr) {
+            m_bExitHandlers = true;
+            break;
+        }
+    }
+}
+
 //---------------------------------------------------------------------------
 void StateMachine::SetContext(void* pvContext_)
 {
@@ -55,54 +110,39 @@ void* StateMachine::GetContext()
 //---------------------------------------------------------------------------
 bool StateMachine::Begin()
 {
-    if (!m_bStatesSet) {
-        return false;
-    }
-
-    m_u16StackDepth     = 1;
-    m_bOpcodeSet        = false;
-    m_au16StateStack[0] = 0;
-
-    if (m_pstStateList[0].pfEntry) {
-        m_pstStateList[0].pfEntry(this);
-    }
-    return true;
+    return RunBegin(StateTableRef(m_pstStateList));
 }
 
 //---------------------------------------------------------------------------
-bool StateMachine::PushState(uint16_t u16StateIdx_)
+bool StateMachine::PushState(StateIndex_t uXStateIdx_)
 {
-    if (u16StateIdx_ >= m_u16StateCount) {
+    if (uXStateIdx_ >= m_uXStateCount) {
         if (m_pfErrorHandler != nullptr) {
             StateErrorData_t stError;
             stError.eType = StateErrorType::invalid_state;
-            stError.invalidState.u16InvalidState = u16StateIdx_;
+            stError.invalidState.uXInvalidState = uXStateIdx_;
             m_pfErrorHandler(this, &stError);
         }
         return false;
     }
 
-    if (m_u16StackDepth >= MAX_STATE_STACK_DEPTH) {
+    if (m_u8StackDepth >= MAX_STATE_STACK_DEPTH) {
         if (m_pfErrorHandler != nullptr) {
             StateErrorData_t stError;
             stError.eType = StateErrorType::state_stack_overflow;
-            stError.stateStackOverflow.u16FailedState = u16StateIdx_;
+            stError.stateStackOverflow.uXFailedState = uXStateIdx_;
             m_pfErrorHandler(this, &stError);
         }
         return false;
     }
 
-    if (SetOpcode(StateOpcode::push)) {
-        m_u16NextState = u16StateIdx_;
-        return true;
-    }
-    return false;
+    return SetNextState(StateOpcode::push, uXStateIdx_);
 }
 
 //---------------------------------------------------------------------------
 bool StateMachine::PopState()
 {
-    if (m_u16StackDepth <= 1) {
+    if (m_u8StackDepth <= 1) {
         if (m_pfErrorHandler != nullptr) {
             StateErrorData_t stError;
             stError.eType = StateErrorType::state_stack_underflow;
@@ -114,25 +154,54 @@ bool StateMachine::PopState()
 }
 
 //---------------------------------------------------------------------------
-bool StateMachine::TransitionState(uint16_t u16StateIdx_)
+bool StateMachine::TransitionState(StateIndex_t uXStateIdx_)
 {
-    if (u16StateIdx_ >= m_u16StateCount) {
+    if (uXStateIdx_ >= m_uXStateCount) {
         if (m_pfErrorHandler != nullptr) {
             StateErrorData_t stError;
             stError.eType = StateErrorType::invalid_state;
-            stError.invalidState.u16InvalidState = u16StateIdx_;
+            stError.invalidState.uXInvalidState = uXStateIdx_;
             m_pfErrorHandler(this, &stError);
         }
         return false;
     }
 
-    if (SetOpcode(StateOpcode::transition)) {
-        m_u16NextState = u16StateIdx_;
-        return true;
+    return SetNextState(StateOpcode::transition, uXStateIdx_);
+}
+
+#if STATE_MACHINE_HISTORY
+//---------------------------------------------------------------------------
+bool StateMachine::PushState(StateIndex_t uXStateIdx_, StateHistory eHistory_)
+{
+    if (!PushState(uXStateIdx_)) {
+        return false;
     }
-    return false;
+    m_eHistory = eHistory_;
+    return true;
 }
 
+//---------------------------------------------------------------------------
+bool StateMachine::TransitionState(StateIndex_t uXStateIdx_, StateHistory eHistory_)
+{
+    if (!TransitionState(uXStateIdx_)) {
+        return false;
+    }
+    m_eHistory = eHistory_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void StateMachine::SetHistory(StateIndex_t* puXHistory_)
+{
+    m_puXHistory = puXHistory_;
+    if (m_puXHistory != nullptr) {
+        for (StateIndex_t i = 0; i < m_uXStateCount; i++) {
+            m_puXHistory[i] = STATE_INDEX_NONE;
+        }
+    }
+}
+#endif
+
 //---------------------------------------------------------------------------
 void StateMachine::SetErrorHandler(StateErrorHandler_t pfHandler_)
 {
@@ -151,14 +220,14 @@ bool StateMachine::SetOpcode(StateOpcode eOpcode_)
             stError.eType = StateErrorType::ambiguous_operation;
             stError.ambiguousOperation.eAmbiguousOp = eOpcode_;
             stError.ambiguousOperation.eInitialOp = m_eOpcode;
-            stError.ambiguousOperation.u16CurrentState = GetCurrentState();
+            stError.ambiguousOperation.uXCurrentState = GetCurrentState();
             m_pfErrorHandler(this, &stError);
         }
         return false;
     }
     m_bOpcodeSet = true;
     m_eOpcode    = eOpcode_;
-    m_u16OpSetState = GetCurrentState();
+    m_uXOpSetState = GetCurrentState();
     return true;
 }
 
@@ -174,118 +243,240 @@ bool StateMachine::GetOpcode(StateOpcode* peOpcode_)
 }
 
 //---------------------------------------------------------------------------
-uint16_t StateMachine::GetCurrentState()
+StateIndex_t StateMachine::GetCurrentState()
 {
-    return m_au16StateStack[m_u16StackDepth - 1];
+    return m_auXStateStack[m_u8StackDepth - 1];
 }
 
 //---------------------------------------------------------------------------
 uint16_t StateMachine::GetStackDepth()
 {
-    return m_u16StackDepth;
+    return m_u8StackDepth;
 }
 
 //---------------------------------------------------------------------------
 StateReturn StateMachine::HandleEvent(const void* pvEvent_)
 {
-    auto u16StackPtr = m_u16StackDepth;
-    auto bDone       = false;
-    SetOpcode(StateOpcode::run);
-    auto eReturnCode = StateReturn::ok;
-
-    while (!bDone) {
-        uint16_t u16State = m_au16StateStack[u16StackPtr - 1];
-
-        // Handle the individual statemachine opcodes.
-        StateOpcode eOpcode;
-        GetOpcode(&eOpcode);
-        switch (eOpcode) {
-            case StateOpcode::returned: {
-                // Done processing the event
-                bDone = true;
-            } break;
-            case StateOpcode::unhandled: {
-                eReturnCode = StateReturn::unhandled;
-                bDone = true;
-            } break;
-            case StateOpcode::run: {
-                // Must have a run handler...
-                auto eResult = m_pstStateList[u16State].pfRun(this, pvEvent_);
-                if (eResult == StateReturn::unhandled) {
-                    if (u16StackPtr > 1) {
-                        u16StackPtr--;
-                        SetOpcode(StateOpcode::run);
-                    } else {
-                        SetOpcode(StateOpcode::unhandled);
-                    }
-                } else if (eResult == StateReturn::ok) {
-                    SetOpcode(StateOpcode::returned);
-                }
-                // Implicit - if eResult == STATE_RETURN_TRANSITION, then
-                // the m_eOpcode value will have been set before the handler returned, and the
-                // m_u16NextState variable also set.
-
-            } break;
-            case StateOpcode::push: {
-                SetOpcode(StateOpcode::returned);
-                eReturnCode = StateReturn::ok;
-
-                while (m_u16StackDepth != u16StackPtr) {
-                    uint16_t u16TempState = m_au16StateStack[m_u16StackDepth - 1];
-                    m_u16StackDepth--;
-                    if (m_pstStateList[u16TempState].pfExit) {
-                        m_pstStateList[u16TempState].pfExit(this);
-                    }
-                }
-
-                if (m_pstStateList[m_u16NextState].pfEntry) {
-                    m_pstStateList[m_u16NextState].pfEntry(this);
-                }
-                m_au16StateStack[m_u16StackDepth] = m_u16NextState;
-                m_u16StackDepth++;                
-            } break;
-            case StateOpcode::pop: {
-                SetOpcode(StateOpcode::returned);
-                eReturnCode = StateReturn::ok;
-
-                while (m_u16StackDepth != u16StackPtr) {
-                    uint16_t u16TempState = m_au16StateStack[m_u16StackDepth - 1];
-                    m_u16StackDepth--;
-                    if (m_pstStateList[u16TempState].pfExit) {
-                        m_pstStateList[u16TempState].pfExit(this);
-                    }
-                }
-
-                uint16_t u16TempState = m_au16StateStack[m_u16StackDepth - 1];
-                m_u16StackDepth--;
-                if (m_pstStateList[u16TempState].pfExit) {
-                    m_pstStateList[u16TempState].pfExit(this);
-                }
-
-            } break;
-            case StateOpcode::transition: {
-                while (m_u16StackDepth != u16StackPtr) {
-                    uint16_t u16TempState = m_au16StateStack[m_u16StackDepth - 1];
-                    m_u16StackDepth--;
-                    if (m_pstStateList[u16TempState].pfExit) {
-                        m_pstStateList[u16TempState].pfExit(this);
-                    }
-                }
-
-                if (m_pstStateList[u16State].pfExit) {
-                    m_pstStateList[u16State].pfExit(this);
-                }
-                if (m_pstStateList[m_u16NextState].pfEntry) {
-                    m_pstStateList[m_u16NextState].pfEntry(this);
-                }                
-                m_au16StateStack[m_u16StackDepth - 1] = m_u16NextState;
-
-                bDone = true;
-                eReturnCode = StateReturn::transition;
-            } break;
-            default: break;
+    return RunEvent(StateTableRef(m_pstStateList), pvEvent_);
+}
+
+//---------------------------------------------------------------------------
+uint32_t StateMachine::HandleEventBatch(const void* const* ppvEvents_,
+                                        uint32_t           u32Count_,
+                                        StateReturn*       peResults_,
+                                        uint8_t            u8StopMask_)
+{
+    return RunEventBatch(StateTableRef(m_pstStateList), ppvEvents_, u32Count_, peResults_, u8StopMask_);
+}
+
+//---------------------------------------------------------------------------
+uint32_t StateMachine::HandleEventPairs(const StateEventPair_t* pastPairs_, uint32_t u32Count_, StateReturn* peResults_)
+{
+    if (pastPairs_ == nullptr) {
+        return 0;
+    }
+
+    // Machines (and their events) are fetched first, and their state table
+    // entries once the machines' stacks are in cache.
+    const uint32_t u32StateAhead   = STATE_MACHINE_PREFETCH_DISTANCE;
+    const uint32_t u32MachineAhead = u32StateAhead * 2;
+    if (u32StateAhead != 0) {
+        for (uint32_t i = 0; (i < u32MachineAhead) && (i < u32Count_); i++) {
+            pastPairs_[i].pclSM->PrefetchMachine();
+            STATE_MACHINE_PREFETCH(pastPairs_[i].pvEvent, 0);
+        }
+        for (uint32_t i = 0; (i < u32StateAhead) && (i < u32Count_); i++) {
+            pastPairs_[i].pclSM->PrefetchState();
+        }
+    }
+
+    for (uint32_t i = 0; i < u32Count_; i++) {
+        if (u32StateAhead != 0) {
+            if ((u32Count_ - i) > u32MachineAhead) {
+                pastPairs_[i + u32MachineAhead].pclSM->PrefetchMachine();
+                STATE_MACHINE_PREFETCH(pastPairs_[i + u32MachineAhead].pvEvent, 0);
+            }
+            if ((u32Count_ - i) > u32StateAhead) {
+                pastPairs_[i + u32StateAhead].pclSM->PrefetchState();
+            }
+        }
+
+        auto pclSM   = pastPairs_[i].pclSM;
+        auto eReturn = StateReturn::unhandled;
+        if (pclSM->m_u8StackDepth != 0) {
+            eReturn = pclSM->HandleEvent(pastPairs_[i].pvEvent);
+        }
+        if (peResults_ != nullptr) {
+            peResults_[i] = eReturn;
         }
     }
-    return eReturnCode;
+    return u32Count_;
+}
+
+#if STATE_MACHINE_TYPED_EVENTS
+//---------------------------------------------------------------------------
+void StateMachine::SetEventMaps(const StateEventMap_t* pstMaps_)
+{
+    m_pstEventMaps = pstMaps_;
+}
+
+//---------------------------------------------------------------------------
+void StateMachine::SetTransitionTable(const StateTransitionTable* pclTable_)
+{
+    m_pclTransitionTable = pclTable_;
 }
+
+//---------------------------------------------------------------------------
+StateReturn StateMachine::HandleEvent(uint16_t u16EventId_, const void* pvEvent_)
+{
+    if (m_pclTransitionTable != nullptr) {
+        return RunEvent(StateTransitionTableRef(m_pstStateList, m_pclTransitionTable, u16EventId_), pvEvent_);
+    }
+    if (m_pstEventMaps == nullptr) {
+        return RunEvent(StateTableRef(m_pstStateList), pvEvent_);
+    }
+    return RunEvent(StateEventMapRef(m_pstStateList, m_pstEventMaps, u16EventId_), pvEvent_);
+}
+#endif
+
+#if STATE_MACHINE_EVENT_CLASSES
+//---------------------------------------------------------------------------
+void StateMachine::SetEventClasses(const uint32_t* pu32ClassMasks_)
+{
+    m_pu32ClassMasks = pu32ClassMasks_;
+}
+
+//---------------------------------------------------------------------------
+StateReturn StateMachine::HandleClassEvent(uint8_t u8EventClass_, const void* pvEvent_)
+{
+    if (m_pu32ClassMasks == nullptr) {
+        return RunEvent(StateTableRef(m_pstStateList), pvEvent_);
+    }
+    return RunEvent(StateEventClassRef(m_pstStateList, m_pu32ClassMasks, u8EventClass_), pvEvent_);
+}
+#endif
+
+#if STATE_MACHINE_STATS
+//---------------------------------------------------------------------------
+void StateMachine::ResetStats()
+{
+    m_u32UnhandledCount    = 0;
+    m_u32SkippedFrameCount = 0;
+}
+#endif
+
+#if STATE_MACHINE_TIMERS
+//---------------------------------------------------------------------------
+void StateMachine::CancelTimers(StateIndex_t uXState_)
+{
+    auto pclTimer = m_pclTimers;
+    while (pclTimer != nullptr) {
+        auto pclNext = pclTimer->m_pclMachineNext;
+        if (pclTimer->m_uXState == uXState_) {
+            pclTimer->Cancel();
+        }
+        pclTimer = pclNext;
+    }
+}
+#endif
+
+#if STATE_MACHINE_COROUTINES
+//---------------------------------------------------------------------------
+void StateMachine::ReleaseCoroutines()
+{
+    StateCoroutinePool::ReleaseAll(this);
+}
+#endif
+
+//---------------------------------------------------------------------------
+uint32_t StateMachine::Snapshot(uint8_t* pu8Buffer_, uint32_t u32Size_, StateContextSaver_t pfSaver_)
+{
+    auto u32StackSize = static_cast<uint32_t>(m_u8StackDepth) * sizeof(StateIndex_t);
+    auto u32Offset    = STATE_SNAPSHOT_HEADER_SIZE + u32StackSize;
+    if ((!pu8Buffer_) || (!m_bStatesSet) || (m_u8StackDepth == 0) || (u32Size_ < u32Offset)) {
+        return 0;
+    }
+
+    uint16_t u16ContextSize = 0;
+    if (pfSaver_ != nullptr) {
+        auto u32Space = u32Size_ - u32Offset;
+        if (u32Space > 0xFFFF) {
+            u32Space = 0xFFFF;
+        }
+        if (!pfSaver_(m_pvContext, &pu8Buffer_[u32Offset], static_cast<uint16_t>(u32Space), &u16ContextSize)
+            || (u16ContextSize > u32Space)) {
+            return 0;
+        }
+    }
+
+    pu8Buffer_[0] = STATE_SNAPSHOT_VERSION;
+    pu8Buffer_[1] = sizeof(StateIndex_t);
+    pu8Buffer_[2] = m_u8StackDepth;
+    pu8Buffer_[3] = 0;
+    pu8Buffer_[4] = static_cast<uint8_t>(u16ContextSize);
+    pu8Buffer_[5] = static_cast<uint8_t>(u16ContextSize >> 8);
+
+    auto pu8Stack = &pu8Buffer_[STATE_SNAPSHOT_HEADER_SIZE];
+    for (uint8_t i = 0; i < m_u8StackDepth; i++) {
+        auto uXState = m_auXStateStack[i];
+        for (uint8_t j = 0; j < sizeof(StateIndex_t); j++) {
+            *pu8Stack++ = static_cast<uint8_t>(uXState >> (8 * j));
+        }
+    }
+    return u32Offset + u16ContextSize;
+}
+
+//---------------------------------------------------------------------------
+bool StateMachine::Restore(const uint8_t* pu8Buffer_, uint32_t u32Size_, StateContextLoader_t pfLoader_)
+{
+    if ((!pu8Buffer_) || (!m_bStatesSet) || (u32Size_ < STATE_SNAPSHOT_HEADER_SIZE)
+        || (pu8Buffer_[0] != STATE_SNAPSHOT_VERSION) || (pu8Buffer_[1] != sizeof(StateIndex_t))) {
+        return false;
+    }
+
+    auto u8Depth        = pu8Buffer_[2];
+    auto u16ContextSize = static_cast<uint16_t>(pu8Buffer_[4] | (pu8Buffer_[5] << 8));
+    auto u32Offset      = STATE_SNAPSHOT_HEADER_SIZE + (static_cast<uint32_t>(u8Depth) * sizeof(StateIndex_t));
+    if ((u8Depth == 0) || (u8Depth > MAX_STATE_STACK_DEPTH) || (u32Size_ < (u32Offset + u16ContextSize))) {
+        return false;
+    }
+
+    // Decode and validate the whole stack before touching the machine
+    StateIndex_t auXStack[MAX_STATE_STACK_DEPTH];
+    auto         pu8Stack = &pu8Buffer_[STATE_SNAPSHOT_HEADER_SIZE];
+    for (uint8_t i = 0; i < u8Depth; i++) {
+        StateIndex_t uXState = 0;
+        for (uint8_t j = 0; j < sizeof(StateIndex_t); j++) {
+            uXState |= static_cast<StateIndex_t>(static_cast<StateIndex_t>(*pu8Stack++) << (8 * j));
+        }
+        if (uXState >= m_uXStateCount) {
+            return false;
+        }
+        auXStack[i] = uXState;
+    }
+
+#if STATE_MACHINE_TIMERS
+    while (m_pclTimers != nullptr) {
+        m_pclTimers->Cancel();
+    }
+#endif
+#if STATE_MACHINE_COROUTINES
+    if (m_pclCoroutineFrames != nullptr) {
+        ReleaseCoroutines();
+    }
+#endif
+
+    for (uint8_t i = 0; i < u8Depth; i++) {
+        m_auXStateStack[i] = auXStack[i];
+        MarkExitFrame(i, auXStack[i]);
+    }
+    m_u8StackDepth = u8Depth;
+    m_bOpcodeSet   = false;
+
+    if (pfLoader_ != nullptr) {
+        return pfLoader_(m_pvContext, &pu8Buffer_[u32Offset], u16ContextSize);
+    }
+    return true;
+}
+
 } // namespace Mark3
@@ -0,0 +1,265 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_machine_fleet.cpp
+    @brief Dense storage for large numbers of machines sharing a state table
+*/
+#include "state_machine_fleet.h"
+
+#include <stddef.h>
+
+namespace Mark3
+{
+namespace
+{
+// Largest block passed to a snapshot writer or reader in a single call
+const uint32_t u32SnapshotBlockSize = 0x40000000;
+
+//---------------------------------------------------------------------------
+bool WriteBlocks(StateSnapshotWriter_t pfWriter_, void* pvArg_, const void* pvData_, size_t uSize_)
+{
+    auto pu8Data = static_cast<const uint8_t*>(pvData_);
+    while (uSize_ != 0) {
+        auto u32Block = (uSize_ > u32SnapshotBlockSize) ? u32SnapshotBlockSize : static_cast<uint32_t>(uSize_);
+        if (!pfWriter_(pvArg_, pu8Data, u32Block)) {
+            return false;
+        }
+        pu8Data += u32Block;
+        uSize_ -= u32Block;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool ReadBlocks(StateSnapshotReader_t pfReader_, void* pvArg_, void* pvData_, size_t uSize_)
+{
+    auto pu8Data = static_cast<uint8_t*>(pvData_);
+    while (uSize_ != 0) {
+        auto u32Block = (uSize_ > u32SnapshotBlockSize) ? u32SnapshotBlockSize : static_cast<uint32_t>(uSize_);
+        if (!pfReader_(pvArg_, pu8Data, u32Block)) {
+            return false;
+        }
+        pu8Data += u32Block;
+        uSize_ -= u32Block;
+    }
+    return true;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+void StateMachineFleet::Cursor::Load(const StateIndex_t* pauXStack_, uint8_t u8Depth_, void* pvContext_)
+{
+    for (uint8_t i = 0; i < u8Depth_; i++) {
+        m_auXStateStack[i] = pauXStack_[i];
+    }
+    m_u8StackDepth = u8Depth_;
+    m_bOpcodeSet   = false;
+    m_pvContext    = pvContext_;
+    ResetExitFrames();
+}
+
+//---------------------------------------------------------------------------
+void StateMachineFleet::Cursor::Store(StateIndex_t* pauXStack_, uint8_t* pu8Depth_)
+{
+    // An operation left pending by an entry/exit handler would be lost when
+    // the next machine is loaded - as on a plain machine, it's reported as
+    // ambiguous and run in place of an event, until the machine settles.
+    while (m_bOpcodeSet) {
+        HandleEvent(nullptr);
+    }
+
+    for (uint8_t i = 0; i < m_u8StackDepth; i++) {
+        pauXStack_[i] = m_auXStateStack[i];
+    }
+    *pu8Depth_ = m_u8StackDepth;
+}
+
+//---------------------------------------------------------------------------
+StateMachineFleet::StateMachineFleet()
+    : m_u32MachineCount{0}
+    , m_u32ActiveMachine{0}
+    , m_pu8StackDepths{nullptr}
+    , m_pauXStacks{nullptr}
+    , m_ppvContexts{nullptr}
+    , m_pvContext{nullptr}
+{
+}
+
+//---------------------------------------------------------------------------
+bool StateMachineFleet::SetStates(const State_t* pstStates_, StateIndex_t uXStateCount_)
+{
+    return m_clCursor.SetStates(pstStates_, uXStateCount_);
+}
+
+//---------------------------------------------------------------------------
+bool StateMachineFleet::SetStorage(uint32_t      u32MachineCount_,
+                                   uint8_t*      pu8StackDepths_,
+                                   StateIndex_t* pauXStacks_,
+                                   void**        ppvContexts_)
+{
+    if ((0 == u32MachineCount_) || (!pu8StackDepths_) || (!pauXStacks_)) {
+        return false;
+    }
+
+    m_u32MachineCount = u32MachineCount_;
+    m_pu8StackDepths  = pu8StackDepths_;
+    m_pauXStacks      = pauXStacks_;
+    m_ppvContexts     = ppvContexts_;
+
+    // Machines that have not been started have an empty stack
+    for (uint32_t i = 0; i < m_u32MachineCount; i++) {
+        m_pu8StackDepths[i] = 0;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void StateMachineFleet::SetErrorHandler(StateErrorHandler_t pfHandler_)
+{
+    m_clCursor.SetErrorHandler(pfHandler_);
+}
+
+//---------------------------------------------------------------------------
+void StateMachineFleet::SetContext(uint32_t u32MachineId_, void* pvContext_)
+{
+    if (m_ppvContexts != nullptr) {
+        m_ppvContexts[u32MachineId_] = pvContext_;
+    }
+}
+
+//---------------------------------------------------------------------------
+void StateMachineFleet::SetContext(void* pvContext_)
+{
+    m_pvContext = pvContext_;
+}
+
+//---------------------------------------------------------------------------
+void* StateMachineFleet::GetContext(uint32_t u32MachineId_)
+{
+    if (m_ppvContexts != nullptr) {
+        return m_ppvContexts[u32MachineId_];
+    }
+    return m_pvContext;
+}
+
+//---------------------------------------------------------------------------
+bool StateMachineFleet::Begin(uint32_t u32MachineId_)
+{
+    if (u32MachineId_ >= m_u32MachineCount) {
+        return false;
+    }
+
+    auto pauXStack = &m_pauXStacks[u32MachineId_ * MAX_STATE_STACK_DEPTH];
+    m_u32ActiveMachine = u32MachineId_;
+    m_clCursor.Load(pauXStack, 0, GetContext(u32MachineId_));
+    if (!m_clCursor.Begin()) {
+        return false;
+    }
+    m_clCursor.Store(pauXStack, &m_pu8StackDepths[u32MachineId_]);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+StateReturn StateMachineFleet::HandleEvent(uint32_t u32MachineId_, const void* pvEvent_)
+{
+    if ((u32MachineId_ >= m_u32MachineCount) || (m_pu8StackDepths[u32MachineId_] == 0)) {
+        return StateReturn::unhandled;
+    }
+
+    auto pauXStack = &m_pauXStacks[u32MachineId_ * MAX_STATE_STACK_DEPTH];
+    m_u32ActiveMachine = u32MachineId_;
+    m_clCursor.Load(pauXStack, m_pu8StackDepths[u32MachineId_], GetContext(u32MachineId_));
+    auto eReturn = m_clCursor.HandleEvent(pvEvent_);
+    m_clCursor.Store(pauXStack, &m_pu8StackDepths[u32MachineId_]);
+    return eReturn;
+}
+
+//---------------------------------------------------------------------------
+StateIndex_t StateMachineFleet::GetCurrentState(uint32_t u32MachineId_)
+{
+    return m_pauXStacks[(u32MachineId_ * MAX_STATE_STACK_DEPTH) + m_pu8StackDepths[u32MachineId_] - 1];
+}
+
+//---------------------------------------------------------------------------
+uint16_t StateMachineFleet::GetStackDepth(uint32_t u32MachineId_)
+{
+    return m_pu8StackDepths[u32MachineId_];
+}
+
+//---------------------------------------------------------------------------
+bool StateMachineFleet::Snapshot(StateSnapshotWriter_t pfWriter_, void* pvArg_)
+{
+    if ((!pfWriter_) || (m_u32MachineCount == 0)) {
+        return false;
+    }
+
+    StateFleetSnapshotHeader_t stHeader;
+    stHeader.u32Magic        = STATE_FLEET_SNAPSHOT_MAGIC;
+    stHeader.u8Version       = STATE_SNAPSHOT_VERSION;
+    stHeader.u8IndexSize     = sizeof(StateIndex_t);
+    stHeader.u8MaxDepth      = MAX_STATE_STACK_DEPTH;
+    stHeader.u8Reserved      = 0;
+    stHeader.u32MachineCount = m_u32MachineCount;
+
+    return pfWriter_(pvArg_, &stHeader, sizeof(stHeader))
+           && WriteBlocks(pfWriter_, pvArg_, m_pu8StackDepths, m_u32MachineCount)
+           && WriteBlocks(pfWriter_,
+                          pvArg_,
+                          m_pauXStacks,
+                          static_cast<size_t>(m_u32MachineCount) * MAX_STATE_STACK_DEPTH * sizeof(StateIndex_t));
+}
+
+//---------------------------------------------------------------------------
+bool StateMachineFleet::Restore(StateSnapshotReader_t pfReader_, void* pvArg_)
+{
+    if ((!pfReader_) || (m_u32MachineCount == 0)) {
+        return false;
+    }
+
+    StateFleetSnapshotHeader_t stHeader;
+    if (!pfReader_(pvArg_, &stHeader, sizeof(stHeader)) || (stHeader.u32Magic != STATE_FLEET_SNAPSHOT_MAGIC)
+        || (stHeader.u8Version != STATE_SNAPSHOT_VERSION) || (stHeader.u8IndexSize != sizeof(StateIndex_t))
+        || (stHeader.u8MaxDepth != MAX_STATE_STACK_DEPTH) || (stHeader.u32MachineCount != m_u32MachineCount)) {
+        return false;
+    }
+
+    auto bValid = ReadBlocks(pfReader_, pvArg_, m_pu8StackDepths, m_u32MachineCount)
+                  && ReadBlocks(pfReader_,
+                                pvArg_,
+                                m_pauXStacks,
+                                static_cast<size_t>(m_u32MachineCount) * MAX_STATE_STACK_DEPTH * sizeof(StateIndex_t));
+
+    // Check that every machine's stack refers to valid states
+    auto uXStateCount = m_clCursor.GetStateCount();
+    for (uint32_t i = 0; bValid && (i < m_u32MachineCount); i++) {
+        auto u8Depth   = m_pu8StackDepths[i];
+        auto pauXStack = &m_pauXStacks[i * MAX_STATE_STACK_DEPTH];
+        if (u8Depth > MAX_STATE_STACK_DEPTH) {
+            bValid = false;
+        }
+        for (uint8_t j = 0; bValid && (j < u8Depth); j++) {
+            if (pauXStack[j] >= uXStateCount) {
+                bValid = false;
+            }
+        }
+    }
+
+    if (!bValid) {
+        for (uint32_t i = 0; i < m_u32MachineCount; i++) {
+            m_pu8StackDepths[i] = 0;
+        }
+    }
+    return bValid;
+}
+} // namespace Mark3
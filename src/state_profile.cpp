@@ -0,0 +1,95 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_profile.cpp
+    @brief Per-state latency histograms for state handler profiling
+*/
+#include "state_profile.h"
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+StateLatencyHistogram::StateLatencyHistogram()
+{
+    Reset();
+}
+
+//---------------------------------------------------------------------------
+void StateLatencyHistogram::Snapshot(StateLatencySnapshot_t* pstSnapshot_, bool bReset_)
+{
+    pstSnapshot_->u32Count = 0;
+    for (uint16_t i = 0; i < STATE_PROFILE_BUCKETS; i++) {
+        uint32_t u32Samples;
+        if (bReset_) {
+            u32Samples = __atomic_exchange_n(&m_au32Buckets[i], 0, __ATOMIC_RELAXED);
+        } else {
+            u32Samples = __atomic_load_n(&m_au32Buckets[i], __ATOMIC_RELAXED);
+        }
+        pstSnapshot_->au32Buckets[i] = u32Samples;
+        pstSnapshot_->u32Count += u32Samples;
+    }
+}
+
+//---------------------------------------------------------------------------
+void StateLatencyHistogram::Reset()
+{
+    for (uint16_t i = 0; i < STATE_PROFILE_BUCKETS; i++) {
+        __atomic_store_n(&m_au32Buckets[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+//---------------------------------------------------------------------------
+uint32_t StateLatencyHistogram::BucketLowerBound(uint16_t u16Bucket_)
+{
+    if (u16Bucket_ < STATE_PROFILE_SUB_BUCKETS) {
+        return u16Bucket_;
+    }
+    auto u8Shift = static_cast<uint8_t>((u16Bucket_ / STATE_PROFILE_SUB_BUCKETS) - 1);
+    auto u32Sub  = static_cast<uint32_t>(u16Bucket_ % STATE_PROFILE_SUB_BUCKETS);
+    return (STATE_PROFILE_SUB_BUCKETS + u32Sub) << u8Shift;
+}
+
+//---------------------------------------------------------------------------
+uint32_t StateLatencyHistogram::BucketUpperBound(uint16_t u16Bucket_)
+{
+    if (u16Bucket_ < STATE_PROFILE_SUB_BUCKETS) {
+        return u16Bucket_;
+    }
+    auto u8Shift = static_cast<uint8_t>((u16Bucket_ / STATE_PROFILE_SUB_BUCKETS) - 1);
+    return BucketLowerBound(u16Bucket_) + ((static_cast<uint32_t>(1) << u8Shift) - 1);
+}
+
+//---------------------------------------------------------------------------
+uint32_t StateLatencyHistogram::GetPercentile(const StateLatencySnapshot_t* pstSnapshot_, uint16_t u16Permille_)
+{
+    if (pstSnapshot_->u32Count == 0) {
+        return 0;
+    }
+
+    // Rank of the sample at the requested percentile, rounded up
+    auto u64Rank = ((static_cast<uint64_t>(pstSnapshot_->u32Count) * u16Permille_) + 999) / 1000;
+    if (u64Rank == 0) {
+        u64Rank = 1;
+    }
+
+    uint64_t u64Seen = 0;
+    for (uint16_t i = 0; i < STATE_PROFILE_BUCKETS; i++) {
+        u64Seen += pstSnapshot_->au32Buckets[i];
+        if (u64Seen >= u64Rank) {
+            return BucketUpperBound(i);
+        }
+    }
+    return BucketUpperBound(STATE_PROFILE_BUCKETS - 1);
+}
+} // namespace Mark3
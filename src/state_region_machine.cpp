@@ -0,0 +1,323 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_region_machine.cpp
+    @brief State machine composed of orthogonal regions sharing a state table
+*/
+#include "state_region_machine.h"
+
+namespace Mark3
+{
+namespace
+{
+//---------------------------------------------------------------------------
+// Join the results of two regions - a transition outranks handling the
+// event, which outranks leaving it unhandled.
+StateReturn JoinResult(StateReturn eA_, StateReturn eB_)
+{
+    if ((eA_ == StateReturn::transition) || (eB_ == StateReturn::transition)) {
+        return StateReturn::transition;
+    }
+    if ((eA_ == StateReturn::ok) || (eB_ == StateReturn::ok)) {
+        return StateReturn::ok;
+    }
+    return StateReturn::unhandled;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+void StateRegionWorker::Cursor::Configure(const State_t*      pstStates_,
+                                          StateIndex_t        uXStateCount_,
+                                          const uint32_t*     pu32ClassMasks_,
+                                          StateErrorHandler_t pfErrorHandler_,
+                                          void*               pvContext_)
+{
+    BindStates(pstStates_, uXStateCount_);
+#if STATE_MACHINE_EVENT_CLASSES
+    m_pu32ClassMasks = pu32ClassMasks_;
+#else
+    (void)pu32ClassMasks_;
+#endif
+    m_pfErrorHandler = pfErrorHandler_;
+    m_pvContext      = pvContext_;
+}
+
+//---------------------------------------------------------------------------
+void StateRegionWorker::Cursor::Load(const StateIndex_t* pauXStack_, uint8_t u8Depth_, uint16_t u16Region_)
+{
+    for (uint8_t i = 0; i < u8Depth_; i++) {
+        m_auXStateStack[i] = pauXStack_[i];
+    }
+    m_u8StackDepth = u8Depth_;
+    m_bOpcodeSet   = false;
+    m_u16Region    = u16Region_;
+    ResetExitFrames();
+}
+
+//---------------------------------------------------------------------------
+void StateRegionWorker::Cursor::Store(StateIndex_t* pauXStack_, uint8_t* pu8Depth_)
+{
+    // An operation left pending by an entry/exit handler would be lost when
+    // the next region is loaded - as on a plain machine, it's reported as
+    // ambiguous and run in place of an event, until the region settles.
+    while (m_bOpcodeSet) {
+        HandleEvent(nullptr);
+    }
+
+    for (uint8_t i = 0; i < m_u8StackDepth; i++) {
+        pauXStack_[i] = m_auXStateStack[i];
+    }
+    *pu8Depth_ = m_u8StackDepth;
+}
+
+//---------------------------------------------------------------------------
+void StateRegionWorker::Cursor::Enter(StateIndex_t uXState_)
+{
+    m_u8StackDepth     = 1;
+    m_bOpcodeSet       = false;
+    m_auXStateStack[0] = uXState_;
+    MarkExitFrame(0, uXState_);
+    StateTableRef(m_pstStateList).Entry(this, uXState_);
+}
+
+//---------------------------------------------------------------------------
+StateRegionWorker::StateRegionWorker()
+    : m_u32Generation{0}
+    , m_u32Events{0}
+    , m_u32Skips{0}
+    , m_eResult{StateReturn::unhandled}
+{
+}
+
+//---------------------------------------------------------------------------
+StateRegionMachine::StateRegionMachine()
+    : m_paclWorkers{&m_clLocalWorker}
+    , m_u16WorkerCount{1}
+    , m_pfIdle{nullptr}
+    , m_pstStates{nullptr}
+    , m_uXStateCount{0}
+    , m_pu32ClassMasks{nullptr}
+    , m_pfErrorHandler{nullptr}
+    , m_pvContext{nullptr}
+    , m_u16RegionCount{0}
+    , m_puXInitialStates{nullptr}
+    , m_pu8StackDepths{nullptr}
+    , m_pauXStacks{nullptr}
+    , m_pvJobEvent{nullptr}
+    , m_u32JobMask{0}
+    , m_u8JobClass{STATE_REGIONS_NO_CLASS}
+    , m_peJobResults{nullptr}
+    , m_u32Generation{0}
+    , m_u16JobPending{0}
+{
+}
+
+//---------------------------------------------------------------------------
+bool StateRegionMachine::SetStates(const State_t* pstStates_, StateIndex_t uXStateCount_)
+{
+    if ((m_pstStates != nullptr) || (!pstStates_) || (0 == uXStateCount_)) {
+        return false;
+    }
+    m_pstStates    = pstStates_;
+    m_uXStateCount = uXStateCount_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool StateRegionMachine::SetStorage(uint16_t            u16RegionCount_,
+                                    const StateIndex_t* puXInitialStates_,
+                                    uint8_t*            pu8StackDepths_,
+                                    StateIndex_t*       pauXStacks_)
+{
+    if ((0 == u16RegionCount_) || (!puXInitialStates_) || (!pu8StackDepths_) || (!pauXStacks_)) {
+        return false;
+    }
+
+    m_u16RegionCount   = u16RegionCount_;
+    m_puXInitialStates = puXInitialStates_;
+    m_pu8StackDepths   = pu8StackDepths_;
+    m_pauXStacks       = pauXStacks_;
+
+    // Regions that have not been started have an empty stack
+    for (uint16_t i = 0; i < m_u16RegionCount; i++) {
+        m_pu8StackDepths[i] = 0;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool StateRegionMachine::SetWorkers(StateRegionWorker* paclWorkers_, uint16_t u16WorkerCount_)
+{
+    if ((paclWorkers_ == nullptr) || (u16WorkerCount_ == 0)) {
+        return false;
+    }
+    m_paclWorkers    = paclWorkers_;
+    m_u16WorkerCount = u16WorkerCount_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool StateRegionMachine::Begin()
+{
+    if ((m_pstStates == nullptr) || (m_u16RegionCount == 0)) {
+        return false;
+    }
+    for (uint16_t i = 0; i < m_u16RegionCount; i++) {
+        if (m_puXInitialStates[i] >= m_uXStateCount) {
+            return false;
+        }
+    }
+
+    for (uint16_t i = 0; i < m_u16WorkerCount; i++) {
+        m_paclWorkers[i].m_clCursor.Configure(
+            m_pstStates, m_uXStateCount, m_pu32ClassMasks, m_pfErrorHandler, m_pvContext);
+    }
+
+    auto pclCursor = &m_paclWorkers[0].m_clCursor;
+    for (uint16_t i = 0; i < m_u16RegionCount; i++) {
+        auto pauXStack = &m_pauXStacks[i * MAX_STATE_STACK_DEPTH];
+        pclCursor->Load(pauXStack, 0, i);
+        pclCursor->Enter(m_puXInitialStates[i]);
+        pclCursor->Store(pauXStack, &m_pu8StackDepths[i]);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool StateRegionMachine::Handles(const StateIndex_t* pauXStack_, uint8_t u8Depth_, uint32_t u32ClassMask_) const
+{
+    for (uint8_t i = 0; i < u8Depth_; i++) {
+        if ((m_pu32ClassMasks[pauXStack_[i]] & u32ClassMask_) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+uint16_t StateRegionMachine::GetSliceStart(uint16_t u16WorkerId_) const
+{
+    // Workers always handle the same slice of regions, keeping each region's
+    // state in the same worker's cache
+    return static_cast<uint16_t>((static_cast<uint32_t>(m_u16RegionCount) * u16WorkerId_) / m_u16WorkerCount);
+}
+
+//---------------------------------------------------------------------------
+void StateRegionMachine::RunRegions(StateRegionWorker* pclWorker_, uint16_t u16First_, uint16_t u16Last_)
+{
+    auto pclCursor = &pclWorker_->m_clCursor;
+    auto eJoined   = StateReturn::unhandled;
+
+    for (auto i = u16First_; i < u16Last_; i++) {
+        auto pauXStack = &m_pauXStacks[i * MAX_STATE_STACK_DEPTH];
+        auto eResult   = StateReturn::unhandled;
+
+        if ((m_u32JobMask != 0) && !Handles(pauXStack, m_pu8StackDepths[i], m_u32JobMask)) {
+            pclWorker_->m_u32Skips++;
+        } else {
+            pclCursor->Load(pauXStack, m_pu8StackDepths[i], i);
+#if STATE_MACHINE_EVENT_CLASSES
+            if (m_u32JobMask != 0) {
+                eResult = pclCursor->HandleClassEvent(m_u8JobClass, m_pvJobEvent);
+            } else {
+                eResult = pclCursor->HandleEvent(m_pvJobEvent);
+            }
+#else
+            eResult = pclCursor->HandleEvent(m_pvJobEvent);
+#endif
+            pclCursor->Store(pauXStack, &m_pu8StackDepths[i]);
+            pclWorker_->m_u32Events++;
+        }
+
+        if (m_peJobResults != nullptr) {
+            m_peJobResults[i] = eResult;
+        }
+        eJoined = JoinResult(eJoined, eResult);
+    }
+    pclWorker_->m_eResult = eJoined;
+}
+
+//---------------------------------------------------------------------------
+StateReturn StateRegionMachine::Dispatch(uint8_t u8EventClass_, const void* pvEvent_, StateReturn* peResults_)
+{
+    // Events without a class (or with no class masks set) go to every region
+    m_pvJobEvent   = pvEvent_;
+    m_u8JobClass   = u8EventClass_;
+    m_peJobResults = peResults_;
+    m_u32JobMask   = 0;
+    if ((u8EventClass_ < 32) && (m_pu32ClassMasks != nullptr)) {
+        m_u32JobMask = static_cast<uint32_t>(1) << u8EventClass_;
+    }
+
+    if ((m_u16WorkerCount == 1) || (m_u16RegionCount < STATE_REGIONS_PARALLEL_MIN)) {
+        RunRegions(&m_paclWorkers[0], 0, m_u16RegionCount);
+        return m_paclWorkers[0].m_eResult;
+    }
+
+    // Publish the event to the other workers, and handle our own slice
+    __atomic_store_n(&m_u16JobPending, static_cast<uint16_t>(m_u16WorkerCount - 1), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&m_u32Generation, 1, __ATOMIC_RELEASE);
+    RunRegions(&m_paclWorkers[0], 0, GetSliceStart(1));
+
+    // Join - every worker's regions are complete before results are read
+    uint32_t u32IdleRounds = 0;
+    while (__atomic_load_n(&m_u16JobPending, __ATOMIC_ACQUIRE) != 0) {
+        u32IdleRounds++;
+        if (m_pfIdle != nullptr) {
+            m_pfIdle(0, u32IdleRounds);
+        }
+    }
+
+    auto eJoined = StateReturn::unhandled;
+    for (uint16_t i = 0; i < m_u16WorkerCount; i++) {
+        eJoined = JoinResult(eJoined, m_paclWorkers[i].m_eResult);
+    }
+    return eJoined;
+}
+
+//---------------------------------------------------------------------------
+bool StateRegionMachine::RunOnce(uint16_t u16WorkerId_)
+{
+    if ((u16WorkerId_ == 0) || (u16WorkerId_ >= m_u16WorkerCount)) {
+        return false;
+    }
+
+    auto pclWorker     = &m_paclWorkers[u16WorkerId_];
+    auto u32Generation = __atomic_load_n(&m_u32Generation, __ATOMIC_ACQUIRE);
+    if (u32Generation == pclWorker->m_u32Generation) {
+        return false;
+    }
+
+    pclWorker->m_u32Generation = u32Generation;
+    RunRegions(pclWorker, GetSliceStart(u16WorkerId_), GetSliceStart(u16WorkerId_ + 1));
+    __atomic_fetch_sub(&m_u16JobPending, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void StateRegionMachine::Run(uint16_t u16WorkerId_, const bool* pbStop_)
+{
+    uint32_t u32IdleRounds = 0;
+    while (!__atomic_load_n(pbStop_, __ATOMIC_ACQUIRE)) {
+        if (RunOnce(u16WorkerId_)) {
+            u32IdleRounds = 0;
+        } else {
+            u32IdleRounds++;
+            if (m_pfIdle != nullptr) {
+                m_pfIdle(u16WorkerId_, u32IdleRounds);
+            }
+        }
+    }
+}
+} // namespace Mark3
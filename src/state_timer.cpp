@@ -0,0 +1,214 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_timer.cpp
+    @brief Hierarchical timing wheel delivering state timeouts as events
+*/
+#include "state_timer.h"
+
+#if STATE_MACHINE_TIMERS
+
+namespace Mark3
+{
+namespace
+{
+const uint32_t u32WheelRange = static_cast<uint32_t>(1) << (STATE_TIMER_WHEEL_SLOT_BITS * STATE_TIMER_WHEEL_LEVELS);
+const uint32_t u32SlotMask   = STATE_TIMER_WHEEL_SLOTS - 1;
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+StateTimer::StateTimer()
+    : m_pclWheel{nullptr}
+    , m_pclSM{nullptr}
+    , m_pvEvent{nullptr}
+    , m_pclMachineNext{nullptr}
+    , m_ppclMachinePrev{nullptr}
+    , m_u32Expiry{0}
+    , m_uXState{0}
+{
+}
+
+//---------------------------------------------------------------------------
+bool StateTimer::Cancel()
+{
+    if (m_pclWheel == nullptr) {
+        return false;
+    }
+    m_pclWheel->Remove(this);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+StateTimerWheel::StateTimerWheel() : m_pfHandler{nullptr}, m_u32Now{0}, m_u32Count{0} {}
+
+//---------------------------------------------------------------------------
+bool StateTimerWheel::Arm(
+    StateTimer* pclTimer_, StateMachine* pclSM_, StateIndex_t uXState_, uint32_t u32Ticks_, const void* pvEvent_)
+{
+    if ((!pclTimer_) || (!pclSM_) || pclSM_->m_bCursor || (u32Ticks_ > 0x7FFFFFFF)) {
+        return false;
+    }
+
+    pclTimer_->Cancel();
+
+    if (u32Ticks_ == 0) {
+        u32Ticks_ = 1;
+    }
+
+    pclTimer_->m_pclWheel  = this;
+    pclTimer_->m_pclSM     = pclSM_;
+    pclTimer_->m_pvEvent   = pvEvent_;
+    pclTimer_->m_uXState   = uXState_;
+    pclTimer_->m_u32Expiry = m_u32Now + u32Ticks_;
+
+    // Link into the machine's list, so the timer is found when its state exits
+    pclTimer_->m_pclMachineNext  = pclSM_->m_pclTimers;
+    pclTimer_->m_ppclMachinePrev = &pclSM_->m_pclTimers;
+    if (pclSM_->m_pclTimers != nullptr) {
+        pclSM_->m_pclTimers->m_ppclMachinePrev = &pclTimer_->m_pclMachineNext;
+    }
+    pclSM_->m_pclTimers = pclTimer_;
+
+    Insert(pclTimer_);
+    m_u32Count++;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+uint32_t StateTimerWheel::Advance(uint32_t u32Ticks_)
+{
+    uint32_t u32Fired = 0;
+
+    while (u32Ticks_ != 0) {
+        if (m_u32Count == 0) {
+            // Nothing to expire or re-file - skip straight to the end
+            m_u32Now += u32Ticks_;
+            break;
+        }
+        u32Ticks_--;
+        m_u32Now++;
+
+        // Re-file timers from the higher levels whose slots come due on
+        // this tick, highest level first so that timers moving down land
+        // in slots that are yet to be processed.
+        uint8_t u8Top = 0;
+        while ((u8Top + 1 < STATE_TIMER_WHEEL_LEVELS)
+               && ((m_u32Now & ((static_cast<uint32_t>(1) << (STATE_TIMER_WHEEL_SLOT_BITS * (u8Top + 1))) - 1)) == 0)) {
+            u8Top++;
+        }
+        for (uint8_t u8Level = u8Top; u8Level > 0; u8Level--) {
+            Cascade(u8Level);
+        }
+
+        // Detach everything due on this tick, then deliver it.  Timers
+        // cancelled by an earlier delivery are unlinked from the expiring
+        // list, and are not delivered.
+        Splice(&m_clExpiring, &m_aclSlots[0][m_u32Now & u32SlotMask]);
+        while (m_clExpiring.m_pclNext != &m_clExpiring) {
+            auto pclTimer = static_cast<StateTimer*>(m_clExpiring.m_pclNext);
+            Remove(pclTimer);
+            if (m_pfHandler != nullptr) {
+                m_pfHandler(pclTimer);
+            } else {
+                pclTimer->m_pclSM->HandleEvent(pclTimer->m_pvEvent);
+            }
+            u32Fired++;
+        }
+    }
+    return u32Fired;
+}
+
+//---------------------------------------------------------------------------
+void StateTimerWheel::Insert(StateTimer* pclTimer_)
+{
+    auto u32Expiry = pclTimer_->m_u32Expiry;
+    auto u32Delta  = u32Expiry - m_u32Now;
+
+    // Timers beyond the wheel's range are filed in the furthest slot, and
+    // re-filed when that slot comes due.
+    if (u32Delta >= u32WheelRange) {
+        u32Delta  = u32WheelRange - 1;
+        u32Expiry = m_u32Now + u32Delta;
+    }
+
+    uint8_t u8Level = 0;
+    while ((u8Level + 1 < STATE_TIMER_WHEEL_LEVELS)
+           && (u32Delta >= (static_cast<uint32_t>(1) << (STATE_TIMER_WHEEL_SLOT_BITS * (u8Level + 1))))) {
+        u8Level++;
+    }
+
+    auto u32Slot = (u32Expiry >> (STATE_TIMER_WHEEL_SLOT_BITS * u8Level)) & u32SlotMask;
+    Append(&m_aclSlots[u8Level][u32Slot], pclTimer_);
+}
+
+//---------------------------------------------------------------------------
+void StateTimerWheel::Remove(StateTimer* pclTimer_)
+{
+    pclTimer_->m_pclPrev->m_pclNext = pclTimer_->m_pclNext;
+    pclTimer_->m_pclNext->m_pclPrev = pclTimer_->m_pclPrev;
+    pclTimer_->m_pclNext            = pclTimer_;
+    pclTimer_->m_pclPrev            = pclTimer_;
+
+    *pclTimer_->m_ppclMachinePrev = pclTimer_->m_pclMachineNext;
+    if (pclTimer_->m_pclMachineNext != nullptr) {
+        pclTimer_->m_pclMachineNext->m_ppclMachinePrev = pclTimer_->m_ppclMachinePrev;
+    }
+    pclTimer_->m_pclMachineNext  = nullptr;
+    pclTimer_->m_ppclMachinePrev = nullptr;
+
+    pclTimer_->m_pclWheel = nullptr;
+    m_u32Count--;
+}
+
+//---------------------------------------------------------------------------
+void StateTimerWheel::Cascade(uint8_t u8Level_)
+{
+    auto u32Slot = (m_u32Now >> (STATE_TIMER_WHEEL_SLOT_BITS * u8Level_)) & u32SlotMask;
+
+    StateTimerNode clPending;
+    Splice(&clPending, &m_aclSlots[u8Level_][u32Slot]);
+    while (clPending.m_pclNext != &clPending) {
+        auto pclTimer = static_cast<StateTimer*>(clPending.m_pclNext);
+        clPending.m_pclNext            = pclTimer->m_pclNext;
+        pclTimer->m_pclNext->m_pclPrev = &clPending;
+        Insert(pclTimer);
+    }
+}
+
+//---------------------------------------------------------------------------
+void StateTimerWheel::Append(StateTimerNode* pclList_, StateTimerNode* pclNode_)
+{
+    pclNode_->m_pclNext            = pclList_;
+    pclNode_->m_pclPrev            = pclList_->m_pclPrev;
+    pclList_->m_pclPrev->m_pclNext = pclNode_;
+    pclList_->m_pclPrev            = pclNode_;
+}
+
+//---------------------------------------------------------------------------
+void StateTimerWheel::Splice(StateTimerNode* pclDst_, StateTimerNode* pclSrc_)
+{
+    // Move all of the source list's nodes to the end of the destination list
+    if (pclSrc_->m_pclNext == pclSrc_) {
+        return;
+    }
+    pclSrc_->m_pclNext->m_pclPrev = pclDst_->m_pclPrev;
+    pclDst_->m_pclPrev->m_pclNext = pclSrc_->m_pclNext;
+    pclSrc_->m_pclPrev->m_pclNext = pclDst_;
+    pclDst_->m_pclPrev            = pclSrc_->m_pclPrev;
+    pclSrc_->m_pclNext            = pclSrc_;
+    pclSrc_->m_pclPrev            = pclSrc_;
+}
+} // namespace Mark3
+
+#endif // STATE_MACHINE_TIMERS
@@ -0,0 +1,88 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_trace.cpp
+    @brief Binary ring-buffer trace of state machine operations
+*/
+#include "state_trace.h"
+
+namespace Mark3
+{
+static_assert(sizeof(StateTraceRecord_t) == 16, "Trace records must be packed into 16 bytes");
+
+//---------------------------------------------------------------------------
+StateTraceBuffer::StateTraceBuffer()
+    : m_pastRecords{nullptr}
+    , m_u32Capacity{0}
+    , m_u32Head{0}
+{
+}
+
+//---------------------------------------------------------------------------
+bool StateTraceBuffer::Init(StateTraceRecord_t* pastRecords_, uint32_t u32Capacity_)
+{
+    if ((!pastRecords_) || (0 == u32Capacity_) || ((u32Capacity_ & (u32Capacity_ - 1)) != 0)) {
+        return false;
+    }
+    m_pastRecords = pastRecords_;
+    m_u32Capacity = u32Capacity_;
+    m_u32Head     = 0;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+const StateTraceRecord_t* StateTraceBuffer::GetDump(StateTraceHeader_t* pstHeader_) const
+{
+    pstHeader_->u32Magic      = STATE_TRACE_MAGIC;
+    pstHeader_->u16Version    = STATE_TRACE_VERSION;
+    pstHeader_->u16RecordSize = sizeof(StateTraceRecord_t);
+    pstHeader_->u32Capacity   = m_u32Capacity;
+    pstHeader_->u32Head       = __atomic_load_n(&m_u32Head, __ATOMIC_ACQUIRE);
+    return m_pastRecords;
+}
+
+//---------------------------------------------------------------------------
+uint32_t StateTraceBuffer::Decode(StateTraceCallback_t pfCallback_, void* pvArg_) const
+{
+    StateTraceHeader_t stHeader;
+    auto               pastRecords = GetDump(&stHeader);
+    return Decode(&stHeader, pastRecords, pfCallback_, pvArg_);
+}
+
+//---------------------------------------------------------------------------
+uint32_t StateTraceBuffer::Decode(const StateTraceHeader_t* pstHeader_,
+                                  const StateTraceRecord_t* pastRecords_,
+                                  StateTraceCallback_t      pfCallback_,
+                                  void*                     pvArg_)
+{
+    auto u32Capacity = pstHeader_->u32Capacity;
+    if ((pstHeader_->u32Magic != STATE_TRACE_MAGIC) || (pstHeader_->u16Version != STATE_TRACE_VERSION)
+        || (pstHeader_->u16RecordSize != sizeof(StateTraceRecord_t)) || (0 == u32Capacity)
+        || ((u32Capacity & (u32Capacity - 1)) != 0)) {
+        return 0;
+    }
+
+    // Once the buffer has filled, the oldest record is the one following
+    // the most recently written.  The head never drops back below the
+    // capacity once reached, so the arithmetic holds across its wrap.
+    auto u32Head  = pstHeader_->u32Head;
+    auto u32Count = (u32Head < u32Capacity) ? u32Head : u32Capacity;
+    auto u32Start = u32Head - u32Count;
+
+    for (uint32_t i = 0; i < u32Count; i++) {
+        pfCallback_(pvArg_, &pastRecords_[(u32Start + i) & (u32Capacity - 1)]);
+    }
+    return u32Count;
+}
+} // namespace Mark3
@@ -0,0 +1,129 @@
+/*===========================================================================
+     _____        _____        _____        _____
+ ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+|    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+|     \/   | ||     \     ||     \     ||     \     ||___   |
+|__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+    |_____|      |_____|      |_____|      |_____|
+
+--[Mark3 Realtime Platform]--------------------------------------------------
+
+Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+See license.txt for more information
+===========================================================================*/
+/**
+    @file state_transition_table.cpp
+    @brief Data-driven state transitions, compiled into a dense lookup table
+*/
+#include "state_transition_table.h"
+
+#if STATE_MACHINE_TYPED_EVENTS
+
+namespace Mark3
+{
+//---------------------------------------------------------------------------
+StateTransitionTable::StateTransitionTable()
+    : m_pstRows{nullptr}, m_pu16Cells{nullptr}, m_pu16Next{nullptr}, m_u16EventCount{0}
+{
+}
+
+//---------------------------------------------------------------------------
+bool StateTransitionTable::Compile(const StateTransitionRow_t* pstRows_,
+                                   uint16_t                    u16RowCount_,
+                                   StateIndex_t                uXStateCount_,
+                                   uint16_t                    u16EventCount_,
+                                   uint16_t*                   pu16Storage_,
+                                   uint32_t                    u32StorageSize_)
+{
+    if ((!pstRows_) || (!pu16Storage_) || (u16RowCount_ == 0) || (u16RowCount_ == 0xFFFF) || (uXStateCount_ == 0)
+        || (u16EventCount_ == 0xFFFF)) {
+        return false;
+    }
+
+    auto u32Columns = static_cast<uint32_t>(u16EventCount_) + 1;
+    auto u32Cells   = static_cast<uint32_t>(uXStateCount_) * u32Columns;
+    if ((u32Cells / u32Columns != uXStateCount_) || (u32StorageSize_ < u32Cells)
+        || ((u32StorageSize_ - u32Cells) < u16RowCount_)) {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < u16RowCount_; i++) {
+        auto pstRow = &pstRows_[i];
+        if (pstRow->uXSource >= uXStateCount_) {
+            return false;
+        }
+        if (((pstRow->eKind == StateTransitionKind::transition) || (pstRow->eKind == StateTransitionKind::push))
+            && (pstRow->uXTarget >= uXStateCount_)) {
+            return false;
+        }
+        if (pstRow->eKind > StateTransitionKind::internal) {
+            return false;
+        }
+    }
+
+    auto pu16Cells = pu16Storage_;
+    auto pu16Next  = &pu16Storage_[u32Cells];
+    for (uint32_t i = 0; i < u32Cells; i++) {
+        pu16Cells[i] = 0;
+    }
+
+    // Prepend each row to its cell's chain, last row first, so that rows
+    // are tried in the order they were declared
+    for (uint16_t i = u16RowCount_; i > 0; i--) {
+        auto pstRow    = &pstRows_[i - 1];
+        auto u16Column = (pstRow->u16EventId < u16EventCount_) ? pstRow->u16EventId : u16EventCount_;
+        auto pu16Cell  = &pu16Cells[(static_cast<uint32_t>(pstRow->uXSource) * u32Columns) + u16Column];
+        pu16Next[i - 1] = *pu16Cell;
+        *pu16Cell       = i;
+    }
+
+    m_pstRows       = pstRows_;
+    m_pu16Cells     = pu16Cells;
+    m_pu16Next      = pu16Next;
+    m_u16EventCount = u16EventCount_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+StateReturn StateTransitionTable::Apply(StateMachine*               pclSM_,
+                                        const StateTransitionRow_t* pstRow_,
+                                        const void*                 pvEvent_)
+{
+    if (pstRow_->pfAction != nullptr) {
+        pstRow_->pfAction(pclSM_, pvEvent_);
+
+        // An operation requested by the action conflicts with the row's own -
+        // report it once, and discard it in favor of the row's
+        if ((pstRow_->eKind != StateTransitionKind::internal) && pclSM_->m_bOpcodeSet) {
+            static const StateOpcode aeRowOps[] = {StateOpcode::transition, StateOpcode::push, StateOpcode::pop};
+            pclSM_->SetOpcode(aeRowOps[static_cast<uint8_t>(pstRow_->eKind)]);
+            pclSM_->m_bOpcodeSet = false;
+#if STATE_MACHINE_HISTORY
+            pclSM_->m_eHistory = StateHistory::none;
+#endif
+        }
+    }
+
+    // If the operation is rejected, it has already been reported to the
+    // machine's error handler - treat the event as consumed
+    auto bChanged = false;
+    switch (pstRow_->eKind) {
+        case StateTransitionKind::transition: {
+            bChanged = pclSM_->TransitionState(pstRow_->uXTarget);
+        } break;
+        case StateTransitionKind::push: {
+            bChanged = pclSM_->PushState(pstRow_->uXTarget);
+        } break;
+        case StateTransitionKind::pop: {
+            bChanged = pclSM_->PopState();
+        } break;
+        default: {
+            // An internal row's action may change state itself
+            bChanged = pclSM_->m_bOpcodeSet;
+        } break;
+    }
+    return bChanged ? StateReturn::transition : StateReturn::ok;
+}
+} // namespace Mark3
+
+#endif // STATE_MACHINE_TYPED_EVENTS
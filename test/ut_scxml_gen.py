@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# ===========================================================================
+#      _____        _____        _____        _____
+#  ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+# |    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+# |     \/   | ||     \     ||     \     ||     \     ||___   |
+# |__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+#     |_____|      |_____|      |_____|      |_____|
+#
+# --[Mark3 Realtime Platform]--------------------------------------------------
+#
+# Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+# See license.txt for more information
+# ===========================================================================
+"""Tests for tools/scxml_gen.py.
+
+Usage: ut_scxml_gen.py
+
+Checks that ut_scxml_model.h is up to date with ut_scxml_model.scxml, and
+that the generator rejects malformed models and options without writing
+any output.
+"""
+
+import contextlib
+import io
+import os
+import shutil
+import sys
+import tempfile
+import unittest
+
+TEST_DIR = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(TEST_DIR, "..", "tools"))
+
+import scxml_gen  # noqa: E402
+
+MODEL = """<?xml version="1.0" encoding="UTF-8"?>
+<scxml xmlns="http://www.w3.org/2005/07/scxml" version="1.0" name="UtGen" initial="idle">
+    <state id="idle">
+        <transition event="go" target="%s"/>
+    </state>
+    <state id="busy" initial="working">
+        <state id="working">
+            <transition event="stop" target="idle"/>
+        </state>
+    </state>
+    %s
+</scxml>
+"""
+
+
+class ScxmlGenTest(unittest.TestCase):
+    def setUp(self):
+        self.directory = tempfile.mkdtemp()
+        self.output = os.path.join(self.directory, "model.h")
+
+    def tearDown(self):
+        shutil.rmtree(self.directory)
+
+    def run_generator(self, model, *options):
+        path = os.path.join(self.directory, "model.scxml")
+        with open(path, "w") as scxml:
+            scxml.write(model)
+        stderr = io.StringIO()
+        with contextlib.redirect_stderr(stderr):
+            try:
+                result = scxml_gen.main([path, "-o", self.output] + list(options))
+            except SystemExit as error:
+                result = error.code
+        return result, stderr.getvalue()
+
+    def expect_error(self, model, message, *options):
+        result, stderr = self.run_generator(model, *options)
+        self.assertNotEqual(0, result)
+        self.assertIn(message, stderr)
+        self.assertFalse(os.path.exists(self.output))
+
+    def test_checked_in_header(self):
+        # Must match the options listed in ut_scxml_model.scxml
+        result = scxml_gen.main([os.path.join(TEST_DIR, "ut_scxml_model.scxml"), "-o", self.output,
+                                 "--hot", "online", "--dense", "5"])
+        self.assertEqual(0, result)
+        with open(self.output) as generated, open(os.path.join(TEST_DIR, "ut_scxml_model.h")) as checked_in:
+            self.assertEqual(checked_in.read(), generated.read(),
+                             "ut_scxml_model.h is stale; regenerate it with tools/scxml_gen.py")
+
+    def test_valid_model(self):
+        result, stderr = self.run_generator(MODEL % ("busy", ""), "--hot", "working", "--dense", "1")
+        self.assertEqual(0, result, stderr)
+        self.assertTrue(os.path.exists(self.output))
+
+    def test_unknown_target(self):
+        self.expect_error(MODEL % ("missing", ""), "Unknown state 'missing'")
+
+    def test_duplicate_id(self):
+        self.expect_error(MODEL % ("busy", '<state id="working"/>'), "Duplicate state 'working'")
+
+    def test_unknown_hot_state(self):
+        self.expect_error(MODEL % ("busy", ""), "Unknown hot state 'missing'", "--hot", "working,missing")
+
+    def test_compound_hot_state(self):
+        self.expect_error(MODEL % ("busy", ""), "Hot state 'busy' is compound", "--hot", "busy")
+
+    def test_negative_dense(self):
+        self.expect_error(MODEL % ("busy", ""), "--dense must not be negative", "--dense", "-1")
+
+    def test_non_integer_dense(self):
+        self.expect_error(MODEL % ("busy", ""), "invalid int value", "--dense", "all")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,136 @@
+// Generated by tools/scxml_gen.py from ut_scxml_model.scxml - do not edit.
+#pragma once
+
+#include "state_machine.h"
+
+namespace UtScxml
+{
+enum StateId : Mark3::StateIndex_t {
+    offline,
+    online,
+    dialing,
+    authenticating,
+    closed,
+    state_count
+};
+
+enum EventId : uint16_t {
+    hangup,
+    login,
+    dial,
+    data,
+    error_link,
+    shutdown,
+    carrier,
+    event_count
+};
+
+// Events with IDs below this are dispatched by direct lookup
+const uint16_t u16DenseEvents = 5;
+
+// Defined by the application
+bool scxmlLoginValid(Mark3::StateMachine* pclSM_, const void* pvEvent_);
+void scxmlData(Mark3::StateMachine* pclSM_, const void* pvEvent_);
+void scxmlLoginRetry(Mark3::StateMachine* pclSM_, const void* pvEvent_);
+void scxmlDialEntry(Mark3::StateMachine* pclSM_);
+void scxmlOnlineExit(Mark3::StateMachine* pclSM_);
+
+namespace Handlers
+{
+inline Mark3::StateReturn Unhandled(Mark3::StateMachine* /*pclSM_*/, const void* /*pvEvent_*/)
+{
+    return Mark3::StateReturn::unhandled;
+}
+
+inline Mark3::StateReturn offline_dial(Mark3::StateMachine* pclSM_, const void* /*pvEvent_*/)
+{
+    return pclSM_->TransitionState(dialing) ? Mark3::StateReturn::transition : Mark3::StateReturn::ok;
+}
+
+inline Mark3::StateReturn online_data(Mark3::StateMachine* pclSM_, const void* pvEvent_)
+{
+    scxmlData(pclSM_, pvEvent_);
+    return Mark3::StateReturn::ok;
+}
+
+inline Mark3::StateReturn online_hangup(Mark3::StateMachine* pclSM_, const void* /*pvEvent_*/)
+{
+    return pclSM_->TransitionState(offline) ? Mark3::StateReturn::transition : Mark3::StateReturn::ok;
+}
+
+inline Mark3::StateReturn online_shutdown(Mark3::StateMachine* pclSM_, const void* /*pvEvent_*/)
+{
+    return pclSM_->TransitionState(closed) ? Mark3::StateReturn::transition : Mark3::StateReturn::ok;
+}
+
+inline Mark3::StateReturn dialing_carrier(Mark3::StateMachine* pclSM_, const void* /*pvEvent_*/)
+{
+    return pclSM_->TransitionState(authenticating) ? Mark3::StateReturn::transition : Mark3::StateReturn::ok;
+}
+
+inline Mark3::StateReturn authenticating_login(Mark3::StateMachine* pclSM_, const void* pvEvent_)
+{
+    if (scxmlLoginValid(pclSM_, pvEvent_)) {
+        return pclSM_->TransitionState(online) ? Mark3::StateReturn::transition : Mark3::StateReturn::ok;
+    }
+    scxmlLoginRetry(pclSM_, pvEvent_);
+    return pclSM_->TransitionState(authenticating) ? Mark3::StateReturn::transition : Mark3::StateReturn::ok;
+}
+
+constexpr Mark3::StateHandler_t apf_offline[3] = {
+    nullptr,
+    nullptr,
+    &offline_dial,
+};
+
+constexpr Mark3::StateHandler_t apf_online[5] = {
+    &online_hangup,
+    nullptr,
+    nullptr,
+    &online_data,
+    &online_hangup,
+};
+constexpr Mark3::StateEventHandler_t ast_online[1] = {
+    {shutdown, &online_shutdown},
+};
+
+constexpr Mark3::StateHandler_t apf_dialing[1] = {
+    &online_hangup,
+};
+constexpr Mark3::StateEventHandler_t ast_dialing[1] = {
+    {carrier, &dialing_carrier},
+};
+
+constexpr Mark3::StateHandler_t apf_authenticating[2] = {
+    &online_hangup,
+    &authenticating_login,
+};
+
+} // namespace Handlers
+
+constexpr Mark3::State_t astStates[state_count] = {
+    {nullptr, &Handlers::Unhandled, nullptr}, // offline
+    {nullptr, &Handlers::Unhandled, &scxmlOnlineExit}, // online
+    {&scxmlDialEntry, &Handlers::Unhandled, nullptr}, // dialing
+    {nullptr, &Handlers::Unhandled, nullptr}, // authenticating
+    {nullptr, &Handlers::Unhandled, nullptr}, // closed
+};
+
+constexpr Mark3::StateEventMap_t astEventMaps[state_count] = {
+    {Handlers::apf_offline, 3, nullptr, 0, nullptr}, // offline
+    {Handlers::apf_online, 5, Handlers::ast_online, 1, nullptr}, // online
+    {Handlers::apf_dialing, 1, Handlers::ast_dialing, 1, nullptr}, // dialing
+    {Handlers::apf_authenticating, 2, nullptr, 0, nullptr}, // authenticating
+    {nullptr, 0, nullptr, 0, nullptr}, // closed
+};
+
+// Attach the tables to a machine
+inline bool Bind(Mark3::StateMachine* pclSM_)
+{
+    if (!pclSM_->SetStates(astStates, state_count)) {
+        return false;
+    }
+    pclSM_->SetEventMaps(astEventMaps);
+    return true;
+}
+} // namespace UtScxml
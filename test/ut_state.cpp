@@ -1,7 +1,27 @@
 #include "state_machine.h"
+#include "event_queue.h"
+#include "fleet_executor.h"
+#include "fleet_dispatcher.h"
+#include "static_state_machine.h"
+#include "state_machine_fleet.h"
+#include "state_trace.h"
+#include "state_profile.h"
+#include "state_timer.h"
+#include "state_coroutine.h"
+#include "state_transition_table.h"
+#include "state_region_machine.h"
+#include "typed_state_machine.h"
+#if STATE_MACHINE_TYPED_EVENTS
+#include "ut_scxml_model.h"
+#endif
 #include "mark3.h"
 #include "unit_test.h"
 #include "ut_platform.h"
+#include <string.h>
+#include <new>
+#if defined(__linux__)
+#include <unistd.h>
+#endif
 
 namespace
 {
@@ -449,7 +469,40 @@ void eExit(StateMachine* pclSM_) {
 
 } // anonymous namespace
 
+#if STATE_MACHINE_TYPED_EVENTS
 //---------------------------------------------------------------------------
+// Functions referenced by ut_scxml_model.scxml, declared in the generated
+// header's namespace
+namespace UtScxml
+{
+bool g_bScxmlLoginValid;
+int  g_iScxmlDialEntries;
+int  g_iScxmlOnlineExits;
+int  g_iScxmlRetries;
+int  g_iScxmlData;
+
+bool scxmlLoginValid(Mark3::StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    return g_bScxmlLoginValid;
+}
+
+void scxmlData(Mark3::StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    g_iScxmlData++;
+}
+
+void scxmlLoginRetry(Mark3::StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    g_iScxmlRetries++;
+}
+
+void scxmlDialEntry(Mark3::StateMachine* /*pclSM_*/) {
+    g_iScxmlDialEntries++;
+}
+
+void scxmlOnlineExit(Mark3::StateMachine* /*pclSM_*/) {
+    g_iScxmlOnlineExits++;
+}
+} // namespace UtScxml
+#endif
+
 namespace Mark3 {
 static const State_t testStates[] =
 {
@@ -883,6 +936,2622 @@ TEST(ut_state_invalid_transition)
     EXPECT_TRUE(invalidCalled);
 }
 
+//---------------------------------------------------------------------------
+TEST(ut_state_index_width)
+{
+    StateMachine sm;
+
+    static StateIndex_t invalidState = 0;
+
+    auto errorHandler = [](StateMachine* sm, const StateErrorData_t* err) {
+        if (err->eType == StateErrorType::invalid_state) {
+            invalidState = err->invalidState.uXInvalidState;
+        }
+    };
+
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(sm.Begin());
+    sm.SetErrorHandler(errorHandler);
+
+    // Out-of-range indices are reported at the full configured width
+    auto uXMaxState = static_cast<StateIndex_t>(-1);
+    EXPECT_FALSE(sm.TransitionState(uXMaxState));
+    EXPECT_EQUALS(uXMaxState, invalidState);
+    EXPECT_FALSE(sm.PushState(uXMaxState - 1));
+    EXPECT_EQUALS(uXMaxState - 1, invalidState);
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+
+    // The stack holds exactly MAX_STATE_STACK_DEPTH states
+    StateIndex_t auXStack[MAX_STATE_STACK_DEPTH];
+    EXPECT_EQUALS(sizeof(StateIndex_t) * MAX_STATE_STACK_DEPTH, sizeof(auXStack));
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_static_state_machine)
+{
+    StaticStateMachine<sizeof(testStates)/sizeof(State_t), testStates> sm;
+
+    EXPECT_TRUE(sm.Begin());
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+
+    // Verify that the statically-dispatched machine follows the same
+    // semantics as the runtime version for jumps, push/pop and nested events
+    TestEvent_t event;
+    event.eEventCode = TestEventCode::jump_to_d;
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&event));
+    EXPECT_EQUALS(3, sm.GetCurrentState());
+
+    event.eEventCode = TestEventCode::next_state;
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&event));
+    EXPECT_EQUALS(4, sm.GetCurrentState());
+
+    event.eEventCode = TestEventCode::push_to_c;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&event));
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+
+    event.eEventCode = TestEventCode::handle_in_e;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&event));
+
+    event.eEventCode = TestEventCode::handle_in_a;
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(&event));
+
+    event.eEventCode = TestEventCode::nested_jump;
+    event.eJumpSource = TestStateIndex::e;
+    event.eJumpDest = TestStateIndex::a;
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&event));
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+
+    event.eEventCode = TestEventCode::push_to_b;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&event));
+    event.eEventCode = TestEventCode::pop;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&event));
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+
+    // Typed events without event maps, and class events, also go through
+    // the bound table
+#if STATE_MACHINE_TYPED_EVENTS
+    event.eEventCode = TestEventCode::push_to_b;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(7, &event));
+    EXPECT_EQUALS(1, sm.GetCurrentState());
+#else
+    event.eEventCode = TestEventCode::push_to_b;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&event));
+    EXPECT_EQUALS(1, sm.GetCurrentState());
+#endif
+
+#if STATE_MACHINE_EVENT_CLASSES
+    static const uint32_t au32ClassMasks[] = { 0x3, 0x2, 0x0, 0x1, 0x1 };
+    sm.SetEventClasses(au32ClassMasks);
+    event.eEventCode = TestEventCode::handle_in_a;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleClassEvent(0, &event));
+#if STATE_MACHINE_STATS
+    EXPECT_EQUALS(1, sm.GetSkippedFrameCount());
+#endif
+    event.eEventCode = TestEventCode::handle_in_b;
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleClassEvent(0, &event));
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleClassEvent(1, &event));
+#endif
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_spsc_queue)
+{
+    SpscEventQueue<4> clQueue;
+    TestEvent_t       astEvents[5];
+    const void*       pvEvent;
+
+    EXPECT_TRUE(clQueue.IsEmpty());
+    EXPECT_FALSE(clQueue.Pop(&pvEvent));
+
+    // Fill the queue to capacity, verify that overflow is rejected
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(clQueue.Post(&astEvents[i]));
+    }
+    EXPECT_FALSE(clQueue.Post(&astEvents[4]));
+
+    // Verify FIFO order, and that the indices wrap correctly
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < 4; i++) {
+            EXPECT_TRUE(clQueue.Pop(&pvEvent));
+            EXPECT_EQUALS(&astEvents[i], pvEvent);
+            EXPECT_TRUE(clQueue.Post(&astEvents[i]));
+        }
+    }
+    EXPECT_FALSE(clQueue.IsEmpty());
+
+    // Positions run on past the range of a 16-bit counter
+    uint32_t u32Errors = 0;
+    for (uint32_t i = 0; i < 0x20000; i++) {
+        if (!clQueue.Pop(&pvEvent) || (pvEvent != &astEvents[i & 3]) || !clQueue.Post(&astEvents[i & 3])) {
+            u32Errors++;
+        }
+    }
+    EXPECT_EQUALS(0, u32Errors);
+    EXPECT_FALSE(clQueue.Post(&astEvents[4]));
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_mpsc_queue)
+{
+    MpscEventQueue<4> clQueue;
+    TestEvent_t       astEvents[5];
+    const void*       pvEvent;
+
+    EXPECT_TRUE(clQueue.IsEmpty());
+    EXPECT_FALSE(clQueue.Pop(&pvEvent));
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(clQueue.Post(&astEvents[i]));
+    }
+    EXPECT_FALSE(clQueue.Post(&astEvents[4]));
+
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < 4; i++) {
+            EXPECT_TRUE(clQueue.Pop(&pvEvent));
+            EXPECT_EQUALS(&astEvents[i], pvEvent);
+            EXPECT_TRUE(clQueue.Post(&astEvents[i]));
+        }
+    }
+    EXPECT_FALSE(clQueue.IsEmpty());
+
+    // Positions and sequences run on past the range of a 16-bit counter
+    uint32_t u32Errors = 0;
+    for (uint32_t i = 0; i < 0x20000; i++) {
+        if (!clQueue.Pop(&pvEvent) || (pvEvent != &astEvents[i & 3]) || !clQueue.Post(&astEvents[i & 3])) {
+            u32Errors++;
+        }
+    }
+    EXPECT_EQUALS(0, u32Errors);
+    EXPECT_FALSE(clQueue.Post(&astEvents[4]));
+
+    // The largest queue fills to exactly its capacity, and no further
+    static MpscEventQueue<32768> clLargeQueue;
+    for (uint32_t i = 0; i < 32768; i++) {
+        if (!clLargeQueue.Post(&astEvents[0])) {
+            u32Errors++;
+        }
+    }
+    EXPECT_EQUALS(0, u32Errors);
+    EXPECT_FALSE(clLargeQueue.Post(&astEvents[0]));
+    EXPECT_TRUE(clLargeQueue.Pop(&pvEvent));
+    EXPECT_TRUE(clLargeQueue.Post(&astEvents[0]));
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_queued_state_machine)
+{
+    QueuedStateMachine<MpscEventQueue<8>> sm;
+
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(sm.Begin());
+    EXPECT_FALSE(sm.HasPendingEvents());
+
+    // Events are not processed until the owner drains the queue
+    TestEvent_t astEvents[3];
+    astEvents[0].eEventCode = TestEventCode::push_to_c;
+    astEvents[1].eEventCode = TestEventCode::next_state;
+    astEvents[2].eEventCode = TestEventCode::handle_in_a;
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(sm.Post(&astEvents[i]));
+    }
+    EXPECT_TRUE(sm.HasPendingEvents());
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+
+    // Bounded drain only processes the requested number of events
+    EXPECT_EQUALS(1, sm.Drain(1));
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+
+    EXPECT_EQUALS(2, sm.Drain());
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(3, sm.GetCurrentState());
+    EXPECT_FALSE(sm.HasPendingEvents());
+    EXPECT_EQUALS(0, sm.Drain());
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_priority_queue)
+{
+    PriorityEventQueue<SpscEventQueue<4>, 3> clQueue;
+    TestEvent_t                              astEvents[6];
+    const void*                              pvEvent;
+    uint8_t                                  u8Priority;
+
+    EXPECT_TRUE(clQueue.IsEmpty());
+    EXPECT_FALSE(clQueue.Pop(&pvEvent));
+    EXPECT_FALSE(clQueue.Post(3, &astEvents[0]));
+
+    // Higher levels are popped first, FIFO within a level
+    EXPECT_TRUE(clQueue.Post(0, &astEvents[0]));
+    EXPECT_TRUE(clQueue.Post(0, &astEvents[1]));
+    EXPECT_TRUE(clQueue.Post(2, &astEvents[2]));
+    EXPECT_TRUE(clQueue.Post(1, &astEvents[3]));
+    EXPECT_TRUE(clQueue.Post(2, &astEvents[4]));
+    EXPECT_FALSE(clQueue.IsEmpty());
+
+    const int aiOrder[] = {2, 4, 3, 0, 1};
+    const int aiLevels[] = {2, 2, 1, 0, 0};
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(clQueue.Pop(&pvEvent, &u8Priority));
+        EXPECT_EQUALS(&astEvents[aiOrder[i]], pvEvent);
+        EXPECT_EQUALS(aiLevels[i], u8Priority);
+    }
+    EXPECT_FALSE(clQueue.Pop(&pvEvent));
+    EXPECT_TRUE(clQueue.IsEmpty());
+
+    // Each level has its own capacity, optionally limited further
+    EXPECT_FALSE(clQueue.SetLimit(3, 1));
+    EXPECT_TRUE(clQueue.SetLimit(0, 2));
+    EXPECT_TRUE(clQueue.Post(0, &astEvents[0]));
+    EXPECT_TRUE(clQueue.Post(0, &astEvents[1]));
+    EXPECT_FALSE(clQueue.Post(0, &astEvents[2]));
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(clQueue.Post(1, &astEvents[i]));
+    }
+    EXPECT_FALSE(clQueue.Post(1, &astEvents[4]));
+    EXPECT_TRUE(clQueue.Post(2, &astEvents[5]));
+
+    EXPECT_TRUE(clQueue.Pop(&pvEvent));
+    EXPECT_EQUALS(&astEvents[5], pvEvent);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(clQueue.Pop(&pvEvent));
+    }
+    EXPECT_TRUE(clQueue.Pop(&pvEvent, &u8Priority));
+    EXPECT_EQUALS(0, u8Priority);
+    EXPECT_TRUE(clQueue.Post(0, &astEvents[2]));
+    EXPECT_FALSE(clQueue.Post(0, &astEvents[3]));
+
+    // Control events overtake queued data events in a machine's queue
+    QueuedStateMachine<PriorityEventQueue<MpscEventQueue<8>, 2>> sm;
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(sm.Begin());
+    astEvents[0].eEventCode = TestEventCode::next_state;
+    astEvents[1].eEventCode = TestEventCode::push_to_c;
+    EXPECT_TRUE(sm.Post(&astEvents[0]));
+    EXPECT_TRUE(sm.Post(1, &astEvents[1]));
+    EXPECT_EQUALS(1, sm.Drain(1));
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+    EXPECT_EQUALS(1, sm.Drain());
+    EXPECT_EQUALS(3, sm.GetCurrentState());
+    EXPECT_FALSE(sm.HasPendingEvents());
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_state_event_batch)
+{
+    StateMachine sm;
+
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(sm.Begin());
+
+    TestEvent_t astEvents[5];
+    astEvents[0].eEventCode = TestEventCode::push_to_b;
+    astEvents[1].eEventCode = TestEventCode::handle_in_a;
+    astEvents[2].eEventCode = TestEventCode::handle_in_c;
+    astEvents[3].eEventCode = TestEventCode::next_state;
+    astEvents[4].eEventCode = TestEventCode::handle_in_c;
+
+    const void* apvEvents[5];
+    for (int i = 0; i < 5; i++) {
+        apvEvents[i] = &astEvents[i];
+    }
+
+    // Stop on the first unhandled event - the remaining events are left
+    // unprocessed.
+    StateReturn aeResults[5];
+    EXPECT_EQUALS(3, sm.HandleEventBatch(apvEvents, 5, aeResults, StateReturnMask(StateReturn::unhandled)));
+    EXPECT_EQUALS(StateReturn::ok, aeResults[0]);
+    EXPECT_EQUALS(StateReturn::ok, aeResults[1]);
+    EXPECT_EQUALS(StateReturn::unhandled, aeResults[2]);
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(1, sm.GetCurrentState());
+
+    // Process the rest of the batch without stopping
+    EXPECT_EQUALS(2, sm.HandleEventBatch(&apvEvents[3], 2, aeResults));
+    EXPECT_EQUALS(StateReturn::transition, aeResults[0]);
+    EXPECT_EQUALS(StateReturn::ok, aeResults[1]);
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+
+    // Results are optional
+    EXPECT_EQUALS(1, sm.HandleEventBatch(&apvEvents[3], 1));
+    EXPECT_EQUALS(3, sm.GetCurrentState());
+
+    // Counts beyond 16 bits aren't truncated (this batch stops after its
+    // first event, so only that one needs to exist)
+    EXPECT_EQUALS(1, sm.HandleEventBatch(&apvEvents[3], 0x10000u, nullptr, StateReturnMask(StateReturn::transition)));
+    EXPECT_EQUALS(4, sm.GetCurrentState());
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_fleet_executor)
+{
+    FleetExecutor clExecutor;
+    FleetWorker   aclWorkers[2];
+
+    EXPECT_FALSE(clExecutor.Init(nullptr, 2));
+    EXPECT_FALSE(clExecutor.Init(aclWorkers, 0));
+    EXPECT_TRUE(clExecutor.Init(aclWorkers, 2));
+    clExecutor.SetBudget(2);
+
+    FleetStateMachine<MpscEventQueue<8>> aclSM[3];
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(aclSM[i].SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+        EXPECT_TRUE(aclSM[i].Begin());
+        aclSM[i].SetExecutor(&clExecutor);
+    }
+
+    // No work yet
+    EXPECT_FALSE(clExecutor.RunOnce(0));
+
+    // Each machine advances one state per event
+    TestEvent_t stEvent;
+    stEvent.eEventCode = TestEventCode::next_state;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j <= i; j++) {
+            EXPECT_TRUE(aclSM[i].Post(&stEvent));
+        }
+    }
+
+    // Run everything on worker 0 - machine 2 exceeds the budget, and is
+    // rescheduled on the worker's own deque
+    EXPECT_TRUE(clExecutor.RunOnce(0));
+    EXPECT_TRUE(clExecutor.RunOnce(0));
+    EXPECT_TRUE(clExecutor.RunOnce(0));
+    EXPECT_EQUALS(1, aclSM[0].GetCurrentState());
+    EXPECT_EQUALS(2, aclSM[1].GetCurrentState());
+    EXPECT_EQUALS(2, aclSM[2].GetCurrentState());
+
+    // Worker 1 has no work of its own, and steals the remainder
+    EXPECT_TRUE(clExecutor.RunOnce(1));
+    EXPECT_EQUALS(3, aclSM[2].GetCurrentState());
+    EXPECT_EQUALS(1, clExecutor.GetWorker(1)->GetStealCount());
+    EXPECT_FALSE(clExecutor.RunOnce(0));
+    EXPECT_FALSE(clExecutor.RunOnce(1));
+
+    EXPECT_EQUALS(3, clExecutor.GetWorker(0)->GetRunCount());
+    EXPECT_EQUALS(5, clExecutor.GetWorker(0)->GetEventCount());
+    EXPECT_EQUALS(1, clExecutor.GetWorker(1)->GetEventCount());
+
+    // Machines go idle once drained, and are rescheduled on the next post
+    EXPECT_TRUE(aclSM[0].Post(&stEvent));
+    EXPECT_TRUE(clExecutor.RunOnce(1));
+    EXPECT_EQUALS(2, aclSM[0].GetCurrentState());
+    EXPECT_FALSE(clExecutor.RunOnce(1));
+}
+
+#if FLEET_WORKER_LOCAL_SCHEDULE
+namespace {
+FleetStateMachine<MpscEventQueue<8>>* g_pclForwardTarget;
+int                                   g_iForwarded;
+
+// Forwards 'f' events to the target machine, and counts the ones it receives
+StateReturn forwardRun(StateMachine* /*pclSM_*/, const void* pvEvent_) {
+    static const char cForwarded = 'x';
+    if (*static_cast<const char*>(pvEvent_) == 'f') {
+        g_pclForwardTarget->Post(&cForwarded);
+    } else {
+        g_iForwarded++;
+    }
+    return StateReturn::ok;
+}
+
+const State_t forwardStates[] = {{nullptr, forwardRun, nullptr}};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_fleet_executor_local)
+{
+    FleetExecutor clExecutor;
+    FleetWorker   aclWorkers[2];
+    EXPECT_TRUE(clExecutor.Init(aclWorkers, 2));
+
+    FleetStateMachine<MpscEventQueue<8>> aclSM[2];
+    for (int i = 0; i < 2; i++) {
+        EXPECT_TRUE(aclSM[i].SetStates(forwardStates, 1));
+        EXPECT_TRUE(aclSM[i].Begin());
+        aclSM[i].SetExecutor(&clExecutor);
+    }
+    g_pclForwardTarget = &aclSM[1];
+    g_iForwarded       = 0;
+
+    // A machine posted to by a handler lands in the running worker's own
+    // deque, so another worker can only get it by stealing
+    const char cEvent = 'f';
+    EXPECT_TRUE(aclSM[0].Post(&cEvent));
+    EXPECT_TRUE(clExecutor.RunOnce(0));
+    EXPECT_EQUALS(0, g_iForwarded);
+    EXPECT_TRUE(clExecutor.RunOnce(1));
+    EXPECT_EQUALS(1, g_iForwarded);
+    EXPECT_EQUALS(1, clExecutor.GetWorker(1)->GetStealCount());
+
+    // ... while the owning worker takes it straight from its deque
+    EXPECT_TRUE(aclSM[0].Post(&cEvent));
+    EXPECT_TRUE(clExecutor.RunOnce(0));
+    EXPECT_TRUE(clExecutor.RunOnce(0));
+    EXPECT_EQUALS(2, g_iForwarded);
+    EXPECT_EQUALS(0, clExecutor.GetWorker(0)->GetStealCount());
+    EXPECT_FALSE(clExecutor.RunOnce(0));
+    EXPECT_FALSE(clExecutor.RunOnce(1));
+}
+#endif
+
+#if defined(__linux__)
+namespace {
+uint32_t g_u32DispatchedEvents;
+
+StateReturn dispatchedRun(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    __atomic_fetch_add(&g_u32DispatchedEvents, 1, __ATOMIC_RELAXED);
+    return StateReturn::ok;
+}
+
+const State_t g_astDispatchedStates[] = {{nullptr, dispatchedRun, nullptr}};
+
+// Poll for a condition set by the dispatcher threads, for up to 5s
+template <typename Condition>
+bool waitFor(Condition fnCondition_) {
+    for (int i = 0; i < 5000; i++) {
+        if (fnCondition_()) {
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_fleet_dispatcher)
+{
+    FleetExecutor         clExecutor;
+    FleetWorker           aclWorkers[2];
+    FleetDispatcherThread aclThreads[2];
+    FleetDispatcher       clDispatcher;
+
+    EXPECT_FALSE(clDispatcher.Start(&clExecutor, aclThreads));
+    EXPECT_TRUE(clExecutor.Init(aclWorkers, 2));
+    EXPECT_FALSE(clDispatcher.Start(&clExecutor, nullptr));
+
+    FleetStateMachine<MpscEventQueue<8>> aclSM[4];
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(aclSM[i].SetStates(g_astDispatchedStates, 1));
+        EXPECT_TRUE(aclSM[i].Begin());
+        aclSM[i].SetExecutor(&clExecutor);
+    }
+
+    // Idle threads spin briefly, then block
+    g_u32DispatchedEvents = 0;
+    clDispatcher.SetSpinRounds(100);
+    EXPECT_TRUE(clDispatcher.Start(&clExecutor, aclThreads));
+    EXPECT_TRUE(waitFor([&]() { return clDispatcher.GetParkedCount() == 2; }));
+    EXPECT_EQUALS(0, clDispatcher.GetWakeCallCount());
+
+    // A burst of posts is handled, without a wakeup per post
+    int iEvent;
+    for (int j = 0; j < 8; j++) {
+        for (int i = 0; i < 4; i++) {
+            EXPECT_TRUE(aclSM[i].Post(&iEvent));
+        }
+    }
+    EXPECT_TRUE(waitFor([]() { return __atomic_load_n(&g_u32DispatchedEvents, __ATOMIC_RELAXED) == 32; }));
+    EXPECT_TRUE(clDispatcher.GetWakeCallCount() >= 1);
+    EXPECT_TRUE(clDispatcher.GetWakeCallCount() < 32);
+    EXPECT_TRUE((aclThreads[0].GetWakeCount() + aclThreads[1].GetWakeCount()) >= 1);
+
+    // Threads block again once the work is done, and stop when blocked
+    EXPECT_TRUE(waitFor([&]() { return clDispatcher.GetParkedCount() == 2; }));
+    clDispatcher.Stop();
+    EXPECT_EQUALS(0, clDispatcher.GetParkedCount());
+
+    // Events posted while stopped are run once restarted
+    EXPECT_TRUE(aclSM[0].Post(&iEvent));
+    EXPECT_TRUE(clDispatcher.Start(&clExecutor, aclThreads));
+    EXPECT_TRUE(waitFor([]() { return __atomic_load_n(&g_u32DispatchedEvents, __ATOMIC_RELAXED) == 33; }));
+    clDispatcher.Stop();
+}
+#endif
+
+//---------------------------------------------------------------------------
+TEST(ut_state_machine_fleet)
+{
+    StateMachineFleet clFleet;
+
+    uint8_t      au8Depths[3];
+    StateIndex_t auXStacks[3 * MAX_STATE_STACK_DEPTH];
+    void*        apvContexts[3];
+
+    EXPECT_FALSE(clFleet.Begin(0));
+    EXPECT_FALSE(clFleet.SetStorage(0, au8Depths, auXStacks, apvContexts));
+    EXPECT_FALSE(clFleet.SetStorage(3, nullptr, auXStacks, apvContexts));
+    EXPECT_TRUE(clFleet.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(clFleet.SetStorage(3, au8Depths, auXStacks, apvContexts));
+    EXPECT_EQUALS(3, clFleet.GetMachineCount());
+
+    // Machines that don't exist, or haven't been started, handle nothing
+    TestEvent_t stEvent;
+    stEvent.eEventCode = TestEventCode::push_to_c;
+    EXPECT_EQUALS(StateReturn::unhandled, clFleet.HandleEvent(0, &stEvent));
+    EXPECT_EQUALS(0, clFleet.GetStackDepth(0));
+    EXPECT_EQUALS(StateReturn::unhandled, clFleet.HandleEvent(3, &stEvent));
+
+    for (uint32_t i = 0; i < 3; i++) {
+        clFleet.SetContext(i, &au8Depths[i]);
+        EXPECT_TRUE(clFleet.Begin(i));
+        EXPECT_EQUALS(1, clFleet.GetStackDepth(i));
+        EXPECT_EQUALS(0, clFleet.GetCurrentState(i));
+    }
+    EXPECT_FALSE(clFleet.Begin(3));
+    EXPECT_EQUALS(&au8Depths[1], clFleet.GetContext(1));
+
+    // Each machine keeps its own stack
+    TestEvent_t event;
+    event.eEventCode = TestEventCode::push_to_c;
+    EXPECT_EQUALS(StateReturn::ok, clFleet.HandleEvent(1, &event));
+    event.eEventCode = TestEventCode::jump_to_e;
+    EXPECT_EQUALS(StateReturn::transition, clFleet.HandleEvent(2, &event));
+    event.eEventCode = TestEventCode::push_to_d;
+    EXPECT_EQUALS(StateReturn::ok, clFleet.HandleEvent(1, &event));
+
+    EXPECT_EQUALS(1, clFleet.GetStackDepth(0));
+    EXPECT_EQUALS(0, clFleet.GetCurrentState(0));
+    EXPECT_EQUALS(3, clFleet.GetStackDepth(1));
+    EXPECT_EQUALS(3, clFleet.GetCurrentState(1));
+    EXPECT_EQUALS(1, clFleet.GetStackDepth(2));
+    EXPECT_EQUALS(4, clFleet.GetCurrentState(2));
+    EXPECT_EQUALS(1, clFleet.GetActiveMachine());
+
+    // Events bubble through the machine's own stack
+    event.eEventCode = TestEventCode::handle_in_c;
+    EXPECT_EQUALS(StateReturn::ok, clFleet.HandleEvent(1, &event));
+    EXPECT_EQUALS(StateReturn::unhandled, clFleet.HandleEvent(0, &event));
+
+    event.eEventCode = TestEventCode::nested_jump;
+    event.eJumpSource = TestStateIndex::a;
+    event.eJumpDest = TestStateIndex::b;
+    EXPECT_EQUALS(StateReturn::transition, clFleet.HandleEvent(1, &event));
+    EXPECT_EQUALS(1, clFleet.GetStackDepth(1));
+    EXPECT_EQUALS(1, clFleet.GetCurrentState(1));
+}
+
+namespace {
+enum FleetEntryStateIndex : StateIndex_t { feBoot, feIdle, feGo, feDone, feStateCount };
+
+int g_iFleetEntryErrors;
+
+void fleetEntryErrorHandler(StateMachine* /*pclSM_*/, const StateErrorData_t* pstError_) {
+    if (pstError_->eType == StateErrorType::ambiguous_operation) {
+        g_iFleetEntryErrors++;
+    }
+}
+
+// Entering these states immediately moves on to the next one
+void feBootEntry(StateMachine* pclSM_) {
+    pclSM_->TransitionState(feIdle);
+}
+
+void feGoEntry(StateMachine* pclSM_) {
+    pclSM_->TransitionState(feDone);
+}
+
+StateReturn feIdleRun(StateMachine* pclSM_, const void* pvEvent_) {
+    if (*static_cast<const char*>(pvEvent_) == 'g') {
+        pclSM_->TransitionState(feGo);
+        return StateReturn::transition;
+    }
+    return StateReturn::unhandled;
+}
+
+const State_t fleetEntryStates[] = {
+    {feBootEntry, nullptr, nullptr},
+    {nullptr, feIdleRun, nullptr},
+    {feGoEntry, nullptr, nullptr},
+    {nullptr, nullptr, nullptr},
+};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_fleet_entry_ops)
+{
+    StateMachineFleet clFleet;
+    uint8_t           au8Depths[2];
+    StateIndex_t      auXStacks[2 * MAX_STATE_STACK_DEPTH];
+
+    EXPECT_TRUE(clFleet.SetStates(fleetEntryStates, feStateCount));
+    EXPECT_TRUE(clFleet.SetStorage(2, au8Depths, auXStacks, nullptr));
+    clFleet.SetErrorHandler(fleetEntryErrorHandler);
+    g_iFleetEntryErrors = 0;
+
+    // Operations requested by entry handlers in Begin() and in a transition
+    // run before the machine is stored, and are reported as ambiguous
+    EXPECT_TRUE(clFleet.Begin(0));
+    EXPECT_TRUE(clFleet.Begin(1));
+    EXPECT_EQUALS(2, g_iFleetEntryErrors);
+    EXPECT_EQUALS(feIdle, clFleet.GetCurrentState(0));
+    EXPECT_EQUALS(feIdle, clFleet.GetCurrentState(1));
+
+    char cEvent = 'g';
+    EXPECT_EQUALS(StateReturn::transition, clFleet.HandleEvent(0, &cEvent));
+    EXPECT_EQUALS(3, g_iFleetEntryErrors);
+    EXPECT_EQUALS(feDone, clFleet.GetCurrentState(0));
+    EXPECT_EQUALS(1, clFleet.GetStackDepth(0));
+
+    // ... and don't leak into the next machine loaded
+    EXPECT_EQUALS(StateReturn::transition, clFleet.HandleEvent(1, &cEvent));
+    EXPECT_EQUALS(4, g_iFleetEntryErrors);
+    EXPECT_EQUALS(feDone, clFleet.GetCurrentState(1));
+}
+
+#if STATE_MACHINE_TYPED_EVENTS
+//---------------------------------------------------------------------------
+namespace {
+int g_iTypedCalls;
+
+StateReturn typedHandled(StateMachine* pclSM_, const void* pvEvent_) {
+    g_iTypedCalls++;
+    return StateReturn::ok;
+}
+StateReturn typedPushC(StateMachine* pclSM_, const void* pvEvent_) {
+    g_iTypedCalls++;
+    pclSM_->PushState((uint16_t)TestStateIndex::c);
+    return StateReturn::transition;
+}
+StateReturn typedJump(StateMachine* pclSM_, const void* pvEvent_) {
+    g_iTypedCalls++;
+    pclSM_->TransitionState(*reinterpret_cast<const uint16_t*>(pvEvent_));
+    return StateReturn::transition;
+}
+
+const StateEventHandler_t aTypedSparse[] = { { 2, typedJump }, { 7, typedHandled }, { 300, typedHandled } };
+const StateHandler_t bTypedDense[] = { nullptr, typedPushC, nullptr, typedHandled };
+
+const StateEventMap_t testEventMaps[] = {
+    { nullptr, 0, aTypedSparse, 3, nullptr },
+    { bTypedDense, 4, nullptr, 0, nullptr },
+    { nullptr, 0, nullptr, 0, typedHandled },
+    { nullptr, 0, nullptr, 0, nullptr },
+    { nullptr, 0, nullptr, 0, nullptr },
+};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_typed_events)
+{
+    StateMachine sm;
+
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(sm.Begin());
+
+    // Without event maps, typed events go to the pfRun handlers
+    TestEvent_t event;
+    event.eEventCode = TestEventCode::push_to_b;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(99, &event));
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(1, sm.GetCurrentState());
+
+    sm.SetEventMaps(testEventMaps);
+    g_iTypedCalls = 0;
+
+    // Sparse IDs handled in "a", reached without calling into "b"
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(7, nullptr));
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(300, nullptr));
+    EXPECT_EQUALS(2, g_iTypedCalls);
+
+    // Dense ID handled in "b"
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(3, nullptr));
+    EXPECT_EQUALS(3, g_iTypedCalls);
+
+    // IDs not handled anywhere make no calls
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(5, nullptr));
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(1000, nullptr));
+    EXPECT_EQUALS(3, g_iTypedCalls);
+
+    // A transition handled in "a" unwinds the stack as usual
+    uint16_t u16Dest = (uint16_t)TestStateIndex::b;
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(2, &u16Dest));
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+    EXPECT_EQUALS(1, sm.GetCurrentState());
+    EXPECT_EQUALS(4, g_iTypedCalls);
+
+    // Push "c" from "b" - "c" handles all IDs using its default handler,
+    // shadowing the handlers registered below it.
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(1, nullptr));
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(1000, nullptr));
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(2, &u16Dest));
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+    EXPECT_EQUALS(7, g_iTypedCalls);
+}
+#endif
+
+#if STATE_MACHINE_EVENT_CLASSES && STATE_MACHINE_STATS
+//---------------------------------------------------------------------------
+TEST(ut_state_class_events)
+{
+    StateMachine sm;
+
+    // "a" handles classes 0 and 1, "b" handles class 1, "c" handles none
+    static const uint32_t au32ClassMasks[] = { 0x3, 0x2, 0x0, 0x1, 0x1 };
+
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(sm.Begin());
+    sm.SetEventClasses(au32ClassMasks);
+
+    TestEvent_t event;
+    event.eEventCode = TestEventCode::push_to_b;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleClassEvent(0, &event));
+    event.eEventCode = TestEventCode::push_to_c;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleClassEvent(1, &event));
+    EXPECT_EQUALS(3, sm.GetStackDepth());
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+    EXPECT_EQUALS(0, sm.GetSkippedFrameCount());
+
+    // Class 0 is passed straight to "a", skipping "c" and "b"
+    event.eEventCode = TestEventCode::handle_in_a;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleClassEvent(0, &event));
+    EXPECT_EQUALS(2, sm.GetSkippedFrameCount());
+
+    // "b" would handle this event, but doesn't handle class 0
+    event.eEventCode = TestEventCode::handle_in_b;
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleClassEvent(0, &event));
+    EXPECT_EQUALS(4, sm.GetSkippedFrameCount());
+    EXPECT_EQUALS(1, sm.GetUnhandledCount());
+
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleClassEvent(1, &event));
+    EXPECT_EQUALS(5, sm.GetSkippedFrameCount());
+
+    // Nothing handles class 2
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleClassEvent(2, &event));
+    EXPECT_EQUALS(8, sm.GetSkippedFrameCount());
+    EXPECT_EQUALS(2, sm.GetUnhandledCount());
+
+    // Unhandled events are counted for all dispatch methods
+    event.eEventCode = TestEventCode::handle_in_e;
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(&event));
+    EXPECT_EQUALS(3, sm.GetUnhandledCount());
+    EXPECT_EQUALS(8, sm.GetSkippedFrameCount());
+
+    sm.ResetStats();
+    EXPECT_EQUALS(0, sm.GetUnhandledCount());
+    EXPECT_EQUALS(0, sm.GetSkippedFrameCount());
+}
+#endif
+
+//---------------------------------------------------------------------------
+namespace {
+uint64_t g_u64TestClock;
+uint64_t testClock() {
+    return g_u64TestClock++;
+}
+
+void collectTrace(void* pvArg_, const StateTraceRecord_t* pstRecord_) {
+    auto ppstNext = reinterpret_cast<StateTraceRecord_t**>(pvArg_);
+    **ppstNext = *pstRecord_;
+    (*ppstNext)++;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_trace_buffer)
+{
+    StateTraceBuffer   clTrace;
+    StateTraceRecord_t astRecords[4];
+    StateTraceRecord_t astDecoded[4];
+    StateTraceRecord_t* pstNext;
+
+    StateClock::SetSource(testClock);
+    g_u64TestClock = 100;
+
+    // Nothing is recorded before the buffer is initialized
+    clTrace.Record(StateTraceOp::push, 0, 1, 2);
+    pstNext = astDecoded;
+    EXPECT_EQUALS(0, clTrace.Decode(collectTrace, &pstNext));
+
+    EXPECT_FALSE(clTrace.Init(nullptr, 4));
+    EXPECT_FALSE(clTrace.Init(astRecords, 3));
+    EXPECT_TRUE(clTrace.Init(astRecords, 4));
+
+    pstNext = astDecoded;
+    EXPECT_EQUALS(0, clTrace.Decode(collectTrace, &pstNext));
+
+    // Overfill the buffer - only the newest records are kept, and are
+    // decoded oldest-first.
+    for (uint16_t i = 0; i < 6; i++) {
+        clTrace.Record(StateTraceOp::push, i, i + 1, i + 2);
+    }
+    pstNext = astDecoded;
+    EXPECT_EQUALS(4, clTrace.Decode(collectTrace, &pstNext));
+    for (uint16_t i = 0; i < 4; i++) {
+        EXPECT_EQUALS((uint64_t)(102 + i), astDecoded[i].u64Timestamp);
+        EXPECT_EQUALS(2 + i, astDecoded[i].u16From);
+        EXPECT_EQUALS(3 + i, astDecoded[i].u16To);
+        EXPECT_EQUALS(4 + i, astDecoded[i].u8Depth);
+        EXPECT_EQUALS((uint8_t)StateTraceOp::push, astDecoded[i].u8Op);
+    }
+
+    // Binary dumps decode the same way, and are validated
+    StateTraceHeader_t stHeader;
+    auto pastDump = clTrace.GetDump(&stHeader);
+    EXPECT_EQUALS(astRecords, pastDump);
+    EXPECT_EQUALS(6, stHeader.u32Head);
+    pstNext = astDecoded;
+    EXPECT_EQUALS(4, StateTraceBuffer::Decode(&stHeader, pastDump, collectTrace, &pstNext));
+    stHeader.u16Version++;
+    EXPECT_EQUALS(0, StateTraceBuffer::Decode(&stHeader, pastDump, collectTrace, &pstNext));
+    stHeader.u16Version--;
+
+    // Heads close to, and past, the 32-bit wrap still decode the newest
+    // records oldest-first
+    stHeader.u32Head = 0xFFFFFFFE;
+    pstNext          = astDecoded;
+    EXPECT_EQUALS(4, StateTraceBuffer::Decode(&stHeader, pastDump, collectTrace, &pstNext));
+    EXPECT_EQUALS(astRecords[2].u64Timestamp, astDecoded[0].u64Timestamp);
+    EXPECT_EQUALS(astRecords[1].u64Timestamp, astDecoded[3].u64Timestamp);
+    stHeader.u32Head = 5;
+    pstNext          = astDecoded;
+    EXPECT_EQUALS(4, StateTraceBuffer::Decode(&stHeader, pastDump, collectTrace, &pstNext));
+    EXPECT_EQUALS(astRecords[1].u64Timestamp, astDecoded[0].u64Timestamp);
+    stHeader.u32Capacity = 3;
+    EXPECT_EQUALS(0, StateTraceBuffer::Decode(&stHeader, pastDump, collectTrace, &pstNext));
+
+    clTrace.Reset();
+    pstNext = astDecoded;
+    EXPECT_EQUALS(0, clTrace.Decode(collectTrace, &pstNext));
+    StateClock::SetSource(nullptr);
+}
+
+#if STATE_MACHINE_TRACE
+//---------------------------------------------------------------------------
+TEST(ut_state_trace_machine)
+{
+    StateMachine       sm;
+    StateTraceBuffer   clTrace;
+    StateTraceRecord_t astRecords[8];
+    StateTraceRecord_t astDecoded[8];
+    StateTraceRecord_t* pstNext = astDecoded;
+
+    EXPECT_TRUE(clTrace.Init(astRecords, 8));
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(sm.Begin());
+    sm.SetTraceBuffer(&clTrace);
+
+    TestEvent_t event;
+    event.eEventCode = TestEventCode::push_to_c;
+    sm.HandleEvent(&event);
+    event.eEventCode = TestEventCode::handle_in_b;
+    sm.HandleEvent(&event);
+    event.eEventCode = TestEventCode::pop;
+    sm.HandleEvent(&event);
+    event.eEventCode = TestEventCode::jump_to_d;
+    sm.HandleEvent(&event);
+
+    EXPECT_EQUALS(4, clTrace.Decode(collectTrace, &pstNext));
+    EXPECT_EQUALS((uint8_t)StateTraceOp::push, astDecoded[0].u8Op);
+    EXPECT_EQUALS(0, astDecoded[0].u16From);
+    EXPECT_EQUALS(2, astDecoded[0].u16To);
+    EXPECT_EQUALS(2, astDecoded[0].u8Depth);
+    EXPECT_EQUALS((uint8_t)StateTraceOp::unhandled, astDecoded[1].u8Op);
+    EXPECT_EQUALS(2, astDecoded[1].u16From);
+    EXPECT_EQUALS((uint8_t)StateTraceOp::pop, astDecoded[2].u8Op);
+    EXPECT_EQUALS(2, astDecoded[2].u16From);
+    EXPECT_EQUALS(0, astDecoded[2].u16To);
+    EXPECT_EQUALS(1, astDecoded[2].u8Depth);
+    EXPECT_EQUALS((uint8_t)StateTraceOp::transition, astDecoded[3].u8Op);
+    EXPECT_EQUALS(0, astDecoded[3].u16From);
+    EXPECT_EQUALS(3, astDecoded[3].u16To);
+}
+#endif
+
+//---------------------------------------------------------------------------
+TEST(ut_state_latency_histogram)
+{
+    StateLatencyHistogram  clHistogram;
+    StateLatencySnapshot_t stSnapshot;
+
+    // Buckets are exact below the sub-bucket count, then log-linear
+    for (uint32_t i = 0; i < STATE_PROFILE_SUB_BUCKETS; i++) {
+        EXPECT_EQUALS(i, StateLatencyHistogram::BucketIndex(i));
+    }
+    for (uint16_t i = 0; i < STATE_PROFILE_BUCKETS; i++) {
+        auto u32Low  = StateLatencyHistogram::BucketLowerBound(i);
+        auto u32High = StateLatencyHistogram::BucketUpperBound(i);
+        EXPECT_EQUALS(i, StateLatencyHistogram::BucketIndex(u32Low));
+        EXPECT_EQUALS(i, StateLatencyHistogram::BucketIndex(u32High));
+        if (i != 0) {
+            EXPECT_EQUALS(StateLatencyHistogram::BucketUpperBound(i - 1) + 1, u32Low);
+        }
+    }
+    EXPECT_EQUALS(0xFFFFFFFF, StateLatencyHistogram::BucketUpperBound(STATE_PROFILE_BUCKETS - 1));
+
+    clHistogram.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(0, stSnapshot.u32Count);
+    EXPECT_EQUALS(0, StateLatencyHistogram::GetPercentile(&stSnapshot, 500));
+
+    // 90 fast samples, 10 slow ones, and one that overflows 32 bits
+    for (uint16_t i = 0; i < 90; i++) {
+        clHistogram.Record(3);
+    }
+    for (uint16_t i = 0; i < 10; i++) {
+        clHistogram.Record(1000);
+    }
+    clHistogram.Record(0x100000000ULL);
+
+    clHistogram.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(101, stSnapshot.u32Count);
+    EXPECT_EQUALS(3, StateLatencyHistogram::GetPercentile(&stSnapshot, 500));
+    auto u32P95 = StateLatencyHistogram::GetPercentile(&stSnapshot, 950);
+    EXPECT_TRUE((u32P95 >= 1000) && (u32P95 < 1000 + (1000 / STATE_PROFILE_SUB_BUCKETS)));
+    EXPECT_EQUALS(0xFFFFFFFF, StateLatencyHistogram::GetPercentile(&stSnapshot, 1000));
+
+    // Snapshot-and-reset hands over every sample exactly once
+    clHistogram.Snapshot(&stSnapshot, true);
+    EXPECT_EQUALS(101, stSnapshot.u32Count);
+    clHistogram.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(0, stSnapshot.u32Count);
+
+    clHistogram.Record(5);
+    clHistogram.Reset();
+    clHistogram.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(0, stSnapshot.u32Count);
+}
+
+#if STATE_MACHINE_PROFILE
+//---------------------------------------------------------------------------
+TEST(ut_state_profile_machine)
+{
+    StateMachine           sm;
+    StateProfile           aclProfile[5];
+    StateLatencySnapshot_t stSnapshot;
+
+    // Each reading of the test clock advances it by one tick
+    StateClock::SetSource(testClock);
+
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    sm.SetProfile(aclProfile);
+    EXPECT_TRUE(sm.Begin());
+
+    TestEvent_t event;
+    event.eEventCode = TestEventCode::push_to_c;
+    sm.HandleEvent(&event);
+    event.eEventCode = TestEventCode::pop;
+    sm.HandleEvent(&event);
+    event.eEventCode = TestEventCode::jump_to_d;
+    sm.HandleEvent(&event);
+
+    aclProfile[0].clEntry.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(1, stSnapshot.u32Count);
+    EXPECT_EQUALS(1, StateLatencyHistogram::GetPercentile(&stSnapshot, 1000));
+    aclProfile[0].clRun.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(2, stSnapshot.u32Count);
+    aclProfile[0].clExit.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(1, stSnapshot.u32Count);
+
+    aclProfile[2].clEntry.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(1, stSnapshot.u32Count);
+    aclProfile[2].clRun.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(1, stSnapshot.u32Count);
+    aclProfile[2].clExit.Snapshot(&stSnapshot, true);
+    EXPECT_EQUALS(1, stSnapshot.u32Count);
+    aclProfile[2].clExit.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(0, stSnapshot.u32Count);
+
+    aclProfile[3].clEntry.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(1, stSnapshot.u32Count);
+
+    // Detached profiles record nothing further
+    sm.SetProfile(nullptr);
+    event.eEventCode = TestEventCode::jump_to_e;
+    sm.HandleEvent(&event);
+    aclProfile[3].clRun.Snapshot(&stSnapshot, false);
+    EXPECT_EQUALS(0, stSnapshot.u32Count);
+
+    StateClock::SetSource(nullptr);
+}
+#endif
+
+#if STATE_MACHINE_TIMERS
+//---------------------------------------------------------------------------
+TEST(ut_state_timer_wheel)
+{
+    StateTimerWheel clWheel;
+    StateMachine    sm;
+    StateTimer      clTimerA;
+    StateTimer      clTimerD;
+
+    TestEvent_t stJumpToD;
+    stJumpToD.eEventCode = TestEventCode::jump_to_d;
+    TestEvent_t stNext;
+    stNext.eEventCode = TestEventCode::next_state;
+
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(sm.Begin());
+
+    EXPECT_FALSE(clWheel.Arm(nullptr, &sm, (uint16_t)TestStateIndex::a, 5, &stJumpToD));
+    EXPECT_FALSE(clWheel.Arm(&clTimerA, nullptr, (uint16_t)TestStateIndex::a, 5, &stJumpToD));
+
+    // Expiry is delivered to the machine as an event, on the exact tick
+    EXPECT_TRUE(clWheel.Arm(&clTimerA, &sm, (uint16_t)TestStateIndex::a, 5, &stJumpToD));
+    EXPECT_TRUE(clTimerA.IsArmed());
+    EXPECT_EQUALS(1, clWheel.GetArmedCount());
+    EXPECT_EQUALS(0, clWheel.Advance(4));
+    EXPECT_EQUALS((uint16_t)TestStateIndex::a, sm.GetCurrentState());
+    EXPECT_EQUALS(1, clWheel.Advance(1));
+    EXPECT_EQUALS((uint16_t)TestStateIndex::d, sm.GetCurrentState());
+    EXPECT_FALSE(clTimerA.IsArmed());
+    EXPECT_EQUALS(0, clWheel.GetArmedCount());
+    EXPECT_EQUALS(5, clWheel.GetTime());
+
+    // Timers are cancelled when their owning state exits...
+    EXPECT_TRUE(clWheel.Arm(&clTimerD, &sm, (uint16_t)TestStateIndex::d, 10, &stJumpToD));
+    EXPECT_TRUE(clWheel.Arm(&clTimerA, &sm, (uint16_t)TestStateIndex::a, 10, &stNext));
+    sm.HandleEvent(&stNext);
+    EXPECT_EQUALS((uint16_t)TestStateIndex::e, sm.GetCurrentState());
+    EXPECT_FALSE(clTimerD.IsArmed());
+
+    // ... but not when other states exit
+    EXPECT_TRUE(clTimerA.IsArmed());
+    EXPECT_EQUALS(1, clWheel.GetArmedCount());
+
+    // Explicit cancellation, and re-arming an armed timer
+    EXPECT_TRUE(clWheel.Arm(&clTimerA, &sm, (uint16_t)TestStateIndex::a, 20, &stNext));
+    EXPECT_EQUALS(1, clWheel.GetArmedCount());
+    EXPECT_TRUE(clTimerA.Cancel());
+    EXPECT_FALSE(clTimerA.Cancel());
+    EXPECT_EQUALS(0, clWheel.Advance(100));
+    EXPECT_EQUALS((uint16_t)TestStateIndex::e, sm.GetCurrentState());
+    EXPECT_EQUALS(105, clWheel.GetTime());
+}
+
+//---------------------------------------------------------------------------
+namespace {
+StateTimerWheel g_clCursorWheel;
+StateTimer      g_clCursorTimer;
+int             g_iCursorArms;
+
+void cursorTimerEntry(StateMachine* pclSM_) {
+    if (g_clCursorWheel.Arm(&g_clCursorTimer, pclSM_, 0, 5, nullptr)) {
+        g_iCursorArms++;
+    }
+}
+StateReturn cursorTimerRun(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    return StateReturn::ok;
+}
+
+const State_t cursorTimerStates[] = {{cursorTimerEntry, cursorTimerRun, nullptr}};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_timer_cursor)
+{
+    // Timers can't be armed for the working machine that a fleet shares
+    // between all of its machines
+    StateMachineFleet clFleet;
+    uint8_t           au8Depths[2];
+    StateIndex_t      auXStacks[2 * MAX_STATE_STACK_DEPTH];
+    EXPECT_TRUE(clFleet.SetStates(cursorTimerStates, 1));
+    EXPECT_TRUE(clFleet.SetStorage(2, au8Depths, auXStacks, nullptr));
+
+    g_iCursorArms = 0;
+    EXPECT_TRUE(clFleet.Begin(0));
+    EXPECT_TRUE(clFleet.Begin(1));
+    EXPECT_EQUALS(0, g_iCursorArms);
+
+    // ... or that a region machine shares between its regions
+    StateRegionMachine clRegions;
+    StateIndex_t       auXInitial[2] = {0, 0};
+    EXPECT_TRUE(clRegions.SetStates(cursorTimerStates, 1));
+    EXPECT_TRUE(clRegions.SetStorage(2, auXInitial, au8Depths, auXStacks));
+    EXPECT_TRUE(clRegions.Begin());
+    EXPECT_EQUALS(0, g_iCursorArms);
+    EXPECT_EQUALS(0, g_clCursorWheel.GetArmedCount());
+
+    // ... but can for a machine of its own
+    StateMachine sm;
+    EXPECT_TRUE(sm.SetStates(cursorTimerStates, 1));
+    EXPECT_TRUE(sm.Begin());
+    EXPECT_EQUALS(1, g_iCursorArms);
+    EXPECT_TRUE(g_clCursorTimer.Cancel());
+}
+
+//---------------------------------------------------------------------------
+namespace {
+StateTimerWheel* g_pclTestWheel;
+uint32_t         g_u32TimersFired;
+uint32_t         g_u32TimerErrors;
+
+void checkTimer(StateTimer* pclTimer_) {
+    auto pu32Expiry = static_cast<const uint32_t*>(pclTimer_->GetEvent());
+    if (*pu32Expiry != g_pclTestWheel->GetTime()) {
+        g_u32TimerErrors++;
+    }
+    g_u32TimersFired++;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_timer_wheel_many)
+{
+    static const uint16_t u16TimerCount = 4096;
+    static StateTimerWheel clWheel;
+    static StateTimer      aclTimers[u16TimerCount];
+    static uint32_t        au32Expiry[u16TimerCount];
+    StateMachine           sm;
+
+    EXPECT_TRUE(sm.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(sm.Begin());
+
+    g_pclTestWheel   = &clWheel;
+    g_u32TimersFired = 0;
+    g_u32TimerErrors = 0;
+    clWheel.SetHandler(checkTimer);
+
+    // Delays at each level boundary, plus pseudo-random ones spread out
+    // beyond the range of the wheel.
+    static const uint32_t au32Edges[]
+        = {1, 2, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 262145, 16777215, 16777216, 16777217};
+    uint32_t u32Seed = 12345;
+    for (uint16_t i = 0; i < u16TimerCount; i++) {
+        uint32_t u32Delay;
+        if (i < sizeof(au32Edges) / sizeof(au32Edges[0])) {
+            u32Delay = au32Edges[i];
+        } else {
+            u32Seed  = (u32Seed * 1103515245) + 12345;
+            u32Delay = ((u32Seed >> 4) % 20000000) + 1;
+        }
+        au32Expiry[i] = clWheel.GetTime() + u32Delay;
+        EXPECT_TRUE(clWheel.Arm(&aclTimers[i], &sm, 0, u32Delay, &au32Expiry[i]));
+    }
+    EXPECT_EQUALS(u16TimerCount, clWheel.GetArmedCount());
+
+    // Cancel every fourth timer, then run the wheel past the last expiry
+    for (uint16_t i = 0; i < u16TimerCount; i += 4) {
+        EXPECT_TRUE(aclTimers[i].Cancel());
+    }
+    auto u32Fired = clWheel.Advance(1000);
+    u32Fired += clWheel.Advance(20000000);
+
+    EXPECT_EQUALS(u16TimerCount - (u16TimerCount / 4), u32Fired);
+    EXPECT_EQUALS(u32Fired, g_u32TimersFired);
+    EXPECT_EQUALS(0, g_u32TimerErrors);
+    EXPECT_EQUALS(0, clWheel.GetArmedCount());
+}
+#endif
+
+//---------------------------------------------------------------------------
+namespace {
+int g_iSnapshotEntries;
+
+void snapshotEntry(StateMachine* pclSM_) {
+    g_iSnapshotEntries++;
+}
+
+StateReturn snapshotRun(StateMachine* pclSM_, const void* pvEvent_) {
+    pclSM_->PushState(*static_cast<const StateIndex_t*>(pvEvent_));
+    return StateReturn::transition;
+}
+
+const State_t snapshotStates[] = {
+    {snapshotEntry, snapshotRun, nullptr},
+    {snapshotEntry, snapshotRun, nullptr},
+    {snapshotEntry, snapshotRun, nullptr},
+};
+
+bool saveContext(const void* pvContext_, uint8_t* pu8Buffer_, uint16_t u16Size_, uint16_t* pu16Written_) {
+    if (u16Size_ < 1) {
+        return false;
+    }
+    pu8Buffer_[0] = *static_cast<const uint8_t*>(pvContext_);
+    *pu16Written_ = 1;
+    return true;
+}
+
+bool loadContext(void* pvContext_, const uint8_t* pu8Buffer_, uint16_t u16Size_) {
+    if (u16Size_ != 1) {
+        return false;
+    }
+    *static_cast<uint8_t*>(pvContext_) = pu8Buffer_[0];
+    return true;
+}
+
+typedef struct {
+    uint8_t* pu8Data;
+    uint32_t u32Size;
+    uint32_t u32Offset;
+} SnapshotStream_t;
+
+bool writeStream(void* pvArg_, const void* pvData_, uint32_t u32Size_) {
+    auto pstStream = static_cast<SnapshotStream_t*>(pvArg_);
+    if ((pstStream->u32Offset + u32Size_) > pstStream->u32Size) {
+        return false;
+    }
+    memcpy(&pstStream->pu8Data[pstStream->u32Offset], pvData_, u32Size_);
+    pstStream->u32Offset += u32Size_;
+    return true;
+}
+
+bool readStream(void* pvArg_, void* pvData_, uint32_t u32Size_) {
+    auto pstStream = static_cast<SnapshotStream_t*>(pvArg_);
+    if ((pstStream->u32Offset + u32Size_) > pstStream->u32Size) {
+        return false;
+    }
+    memcpy(pvData_, &pstStream->pu8Data[pstStream->u32Offset], u32Size_);
+    pstStream->u32Offset += u32Size_;
+    return true;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_snapshot)
+{
+    StateMachine sm;
+    StateMachine smRestored;
+    uint8_t      u8Context         = 42;
+    uint8_t      u8RestoredContext = 0;
+    uint8_t      au8Buffer[STATE_SNAPSHOT_HEADER_SIZE + (MAX_STATE_STACK_DEPTH * sizeof(StateIndex_t)) + 1];
+
+    EXPECT_EQUALS(0, sm.Snapshot(au8Buffer, sizeof(au8Buffer)));
+    EXPECT_TRUE(sm.SetStates(snapshotStates, sizeof(snapshotStates)/sizeof(State_t)));
+    EXPECT_EQUALS(0, sm.Snapshot(au8Buffer, sizeof(au8Buffer)));
+    sm.SetContext(&u8Context);
+    EXPECT_TRUE(sm.Begin());
+
+    StateIndex_t uXNext = 2;
+    sm.HandleEvent(&uXNext);
+    uXNext = 1;
+    sm.HandleEvent(&uXNext);
+    EXPECT_EQUALS(3, sm.GetStackDepth());
+
+    // Stack plus context, or stack alone
+    auto u32Size = sm.Snapshot(au8Buffer, sizeof(au8Buffer), saveContext);
+    EXPECT_EQUALS(STATE_SNAPSHOT_HEADER_SIZE + (3 * sizeof(StateIndex_t)) + 1, u32Size);
+    EXPECT_EQUALS(STATE_SNAPSHOT_VERSION, au8Buffer[0]);
+    EXPECT_EQUALS(0, sm.Snapshot(au8Buffer, u32Size - 2, saveContext));
+    EXPECT_EQUALS(u32Size - 1, sm.Snapshot(au8Buffer, u32Size - 1));
+    EXPECT_EQUALS(u32Size, sm.Snapshot(au8Buffer, sizeof(au8Buffer), saveContext));
+
+    // Restore resumes in the saved state without re-entering it
+    EXPECT_FALSE(smRestored.Restore(au8Buffer, u32Size));
+    EXPECT_TRUE(smRestored.SetStates(snapshotStates, sizeof(snapshotStates)/sizeof(State_t)));
+    smRestored.SetContext(&u8RestoredContext);
+    EXPECT_FALSE(smRestored.Restore(au8Buffer, u32Size - 1, loadContext));
+
+    g_iSnapshotEntries = 0;
+    EXPECT_TRUE(smRestored.Restore(au8Buffer, u32Size, loadContext));
+    EXPECT_EQUALS(0, g_iSnapshotEntries);
+    EXPECT_EQUALS(3, smRestored.GetStackDepth());
+    EXPECT_EQUALS(1, smRestored.GetCurrentState());
+    EXPECT_EQUALS(42, u8RestoredContext);
+
+    // ... and carries on from there
+    uXNext = 0;
+    smRestored.HandleEvent(&uXNext);
+    EXPECT_EQUALS(4, smRestored.GetStackDepth());
+    EXPECT_EQUALS(1, g_iSnapshotEntries);
+
+    // Snapshots that don't match the machine are rejected, untouched
+    au8Buffer[STATE_SNAPSHOT_HEADER_SIZE] = 3;
+    EXPECT_FALSE(smRestored.Restore(au8Buffer, u32Size));
+    au8Buffer[STATE_SNAPSHOT_HEADER_SIZE] = 0;
+    au8Buffer[0]++;
+    EXPECT_FALSE(smRestored.Restore(au8Buffer, u32Size));
+    au8Buffer[0]--;
+    au8Buffer[2] = MAX_STATE_STACK_DEPTH + 1;
+    EXPECT_FALSE(smRestored.Restore(au8Buffer, sizeof(au8Buffer)));
+    EXPECT_EQUALS(4, smRestored.GetStackDepth());
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_state_snapshot_dirty_storage)
+{
+    // A machine constructed over storage holding garbage is not started, and
+    // has nothing to snapshot, whatever the storage held beforehand
+    alignas(StateMachine) uint8_t au8Storage[sizeof(StateMachine)];
+    uint8_t                       au8Buffer[STATE_SNAPSHOT_HEADER_SIZE + (MAX_STATE_STACK_DEPTH * sizeof(StateIndex_t))];
+    memset(au8Storage, 0x03, sizeof(au8Storage));
+
+    auto pclSM = new (au8Storage) StateMachine();
+    EXPECT_EQUALS(0, pclSM->GetStackDepth());
+    EXPECT_EQUALS(0, pclSM->Snapshot(au8Buffer, sizeof(au8Buffer)));
+    EXPECT_TRUE(pclSM->SetStates(snapshotStates, sizeof(snapshotStates)/sizeof(State_t)));
+    EXPECT_EQUALS(0, pclSM->Snapshot(au8Buffer, sizeof(au8Buffer)));
+    EXPECT_TRUE(pclSM->GetContext() == nullptr);
+    EXPECT_TRUE(pclSM->Begin());
+    EXPECT_EQUALS(STATE_SNAPSHOT_HEADER_SIZE + sizeof(StateIndex_t), pclSM->Snapshot(au8Buffer, sizeof(au8Buffer)));
+    pclSM->~StateMachine();
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_state_fleet_snapshot)
+{
+    StateMachineFleet clFleet;
+    StateMachineFleet clRestored;
+    uint8_t           au8Depths[3];
+    StateIndex_t      auXStacks[3 * MAX_STATE_STACK_DEPTH];
+    uint8_t           au8RestoredDepths[3];
+    StateIndex_t      auXRestoredStacks[3 * MAX_STATE_STACK_DEPTH];
+    uint8_t           au8Data[sizeof(StateFleetSnapshotHeader_t) + sizeof(au8Depths) + sizeof(auXStacks)];
+    SnapshotStream_t  stStream = {au8Data, sizeof(au8Data), 0};
+
+    EXPECT_TRUE(clFleet.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_FALSE(clFleet.Snapshot(writeStream, &stStream));
+    EXPECT_TRUE(clFleet.SetStorage(3, au8Depths, auXStacks, nullptr));
+    for (uint32_t i = 0; i < 3; i++) {
+        EXPECT_TRUE(clFleet.Begin(i));
+    }
+
+    TestEvent_t event;
+    event.eEventCode = TestEventCode::push_to_c;
+    clFleet.HandleEvent(1, &event);
+    event.eEventCode = TestEventCode::jump_to_e;
+    clFleet.HandleEvent(2, &event);
+
+    EXPECT_TRUE(clFleet.Snapshot(writeStream, &stStream));
+    EXPECT_EQUALS(sizeof(au8Data), stStream.u32Offset);
+
+    // Restore into a fleet with its own storage
+    EXPECT_TRUE(clRestored.SetStates(testStates, sizeof(testStates)/sizeof(State_t)));
+    EXPECT_TRUE(clRestored.SetStorage(3, au8RestoredDepths, auXRestoredStacks, nullptr));
+    stStream.u32Offset = 0;
+    EXPECT_TRUE(clRestored.Restore(readStream, &stStream));
+    for (uint32_t i = 0; i < 3; i++) {
+        EXPECT_EQUALS(clFleet.GetStackDepth(i), clRestored.GetStackDepth(i));
+        EXPECT_EQUALS(clFleet.GetCurrentState(i), clRestored.GetCurrentState(i));
+    }
+    EXPECT_EQUALS(2, clRestored.GetStackDepth(1));
+    EXPECT_EQUALS(2, clRestored.GetCurrentState(1));
+    EXPECT_EQUALS(4, clRestored.GetCurrentState(2));
+
+    // Truncated or corrupt snapshots are rejected
+    stStream.u32Offset = 0;
+    stStream.u32Size   = sizeof(au8Data) - 1;
+    EXPECT_FALSE(clRestored.Restore(readStream, &stStream));
+    stStream.u32Offset = 0;
+    stStream.u32Size   = sizeof(au8Data);
+    auXStacks[0]       = 5;
+    EXPECT_TRUE(clFleet.Snapshot(writeStream, &stStream));
+    stStream.u32Offset = 0;
+    EXPECT_FALSE(clRestored.Restore(readStream, &stStream));
+    EXPECT_EQUALS(0, clRestored.GetStackDepth(1));
+}
+
+#if STATE_MACHINE_COROUTINES
+namespace
+{
+struct HandshakeFrame_t : StateCoroutineFrame {
+    uint8_t u8Steps;
+};
+
+int g_iCoIdleEvents;
+int g_iCoErrors;
+uint8_t g_u8CoSteps;
+
+StateReturn coIdleRun(StateMachine* pclSM_, const void* pvEvent_) {
+    if (*static_cast<const char*>(pvEvent_) == 'h') {
+        pclSM_->PushState(1);
+        return StateReturn::transition;
+    }
+    g_iCoIdleEvents++;
+    return StateReturn::ok;
+}
+
+StateReturn coHandshake(StateMachine* pclSM_, HandshakeFrame_t* pclFrame_, const void* pvEvent_) {
+    auto cEvent = *static_cast<const char*>(pvEvent_);
+    STATE_CO_BEGIN(pclFrame_);
+    g_u8CoSteps = ++pclFrame_->u8Steps;
+    STATE_CO_AWAIT_UNTIL(pclFrame_, cEvent == 'a');
+    g_u8CoSteps = ++pclFrame_->u8Steps;
+    STATE_CO_AWAIT_UNTIL(pclFrame_, cEvent == 'b');
+    g_u8CoSteps = ++pclFrame_->u8Steps;
+    STATE_CO_AWAIT(pclFrame_);
+    if (cEvent == 'x') {
+        pclSM_->TransitionState(2);
+        return StateReturn::transition;
+    }
+    g_u8CoSteps = ++pclFrame_->u8Steps;
+    STATE_CO_END(pclFrame_);
+}
+
+typedef StateCoroutine<HandshakeFrame_t, coHandshake> HandshakeState;
+
+StateReturn coDoneRun(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    return StateReturn::ok;
+}
+
+const State_t coroutineStates[] = {
+    {nullptr, coIdleRun, nullptr},
+    {nullptr, HandshakeState::Run, HandshakeState::Exit},
+    {nullptr, coDoneRun, nullptr},
+};
+
+void coErrorHandler(StateMachine* /*pclSM_*/, const StateErrorData_t* pstError_) {
+    if (pstError_->eType == StateErrorType::coroutine_frame_unavailable) {
+        g_iCoErrors++;
+    }
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_coroutine)
+{
+    StateCoroutinePool clPool;
+    uint64_t           au64Storage[2][(sizeof(HandshakeFrame_t) + 7) / 8];
+    StateMachine       aclSM[3];
+
+    EXPECT_FALSE(clPool.SetStorage(nullptr, sizeof(HandshakeFrame_t), 2));
+    EXPECT_FALSE(clPool.SetStorage(au64Storage, sizeof(StateCoroutineFrame) - 1, 2));
+    EXPECT_TRUE(clPool.SetStorage(au64Storage, sizeof(HandshakeFrame_t), 2));
+    EXPECT_EQUALS(2, clPool.GetFreeCount());
+
+    for (auto& clSM : aclSM) {
+        EXPECT_TRUE(clSM.SetStates(coroutineStates, sizeof(coroutineStates)/sizeof(State_t)));
+        clSM.SetCoroutinePool(&clPool);
+        clSM.SetErrorHandler(coErrorHandler);
+        EXPECT_TRUE(clSM.Begin());
+    }
+    g_iCoIdleEvents = 0;
+    g_iCoErrors     = 0;
+
+    // The frame is allocated when the coroutine first runs
+    char cEvent = 'h';
+    aclSM[0].HandleEvent(&cEvent);
+    EXPECT_EQUALS(1, aclSM[0].GetCurrentState());
+    EXPECT_EQUALS(2, clPool.GetFreeCount());
+    cEvent = 'z';
+    EXPECT_EQUALS(StateReturn::ok, aclSM[0].HandleEvent(&cEvent));
+    EXPECT_EQUALS(1, g_u8CoSteps);
+    EXPECT_EQUALS(1, clPool.GetFreeCount());
+
+    // Events not awaited fall through to the state below
+    EXPECT_EQUALS(StateReturn::ok, aclSM[0].HandleEvent(&cEvent));
+    EXPECT_EQUALS(1, g_iCoIdleEvents);
+    EXPECT_EQUALS(1, g_u8CoSteps);
+    cEvent = 'a';
+    aclSM[0].HandleEvent(&cEvent);
+    EXPECT_EQUALS(2, g_u8CoSteps);
+    cEvent = 'b';
+    aclSM[0].HandleEvent(&cEvent);
+    EXPECT_EQUALS(3, g_u8CoSteps);
+
+    // Once finished, the coroutine stops handling events
+    cEvent = 'q';
+    aclSM[0].HandleEvent(&cEvent);
+    EXPECT_EQUALS(4, g_u8CoSteps);
+    EXPECT_EQUALS(1, g_iCoIdleEvents);
+    aclSM[0].HandleEvent(&cEvent);
+    EXPECT_EQUALS(4, g_u8CoSteps);
+    EXPECT_EQUALS(2, g_iCoIdleEvents);
+
+    // Each machine gets its own frame, until the pool runs dry
+    cEvent = 'h';
+    aclSM[1].HandleEvent(&cEvent);
+    aclSM[2].HandleEvent(&cEvent);
+    cEvent = 'z';
+    aclSM[1].HandleEvent(&cEvent);
+    EXPECT_EQUALS(1, g_u8CoSteps);
+    EXPECT_EQUALS(0, clPool.GetFreeCount());
+    EXPECT_EQUALS(0, g_iCoErrors);
+    aclSM[2].HandleEvent(&cEvent);
+    EXPECT_EQUALS(1, g_iCoErrors);
+    EXPECT_EQUALS(3, g_iCoIdleEvents);
+
+    // Exiting the state returns its frame
+    const char acEvents[] = {'a', 'b', 'x'};
+    for (auto& cNext : acEvents) {
+        aclSM[1].HandleEvent(&cNext);
+    }
+    EXPECT_EQUALS(2, aclSM[1].GetCurrentState());
+    EXPECT_EQUALS(1, clPool.GetFreeCount());
+    aclSM[2].HandleEvent(&cEvent);
+    EXPECT_EQUALS(1, g_u8CoSteps);
+    EXPECT_EQUALS(0, clPool.GetFreeCount());
+
+    // ... as does restarting the machine
+    EXPECT_TRUE(aclSM[0].Begin());
+    EXPECT_TRUE(aclSM[2].Begin());
+    EXPECT_EQUALS(2, clPool.GetFreeCount());
+}
+#endif
+
+#if STATE_MACHINE_TYPED_EVENTS
+namespace
+{
+enum TableEventId : uint16_t {
+    table_start,
+    table_stop,
+    table_enter_sub,
+    table_leave_sub,
+    table_tick,
+    table_conflict,
+    table_events,
+    table_reset = 1000,
+};
+
+bool g_bTableAllowed;
+int  g_iTableStarts;
+int  g_iTableDenied;
+int  g_iTableTicks;
+int  g_iTableFallbacks;
+int  g_iTableErrors;
+
+bool tableGuard(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    return g_bTableAllowed;
+}
+
+void tableStart(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    g_iTableStarts++;
+}
+
+void tableDenied(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    g_iTableDenied++;
+}
+
+void tableTick(StateMachine* /*pclSM_*/, const void* pvEvent_) {
+    g_iTableTicks += *static_cast<const int*>(pvEvent_);
+}
+
+// Requests an operation of its own, which conflicts with a non-internal row's
+void tableConflict(StateMachine* pclSM_, const void* /*pvEvent_*/) {
+    pclSM_->TransitionState(0);
+}
+
+void tableErrorHandler(StateMachine* /*pclSM_*/, const StateErrorData_t* pstError_) {
+    if (pstError_->eType == StateErrorType::ambiguous_operation) {
+        g_iTableErrors++;
+    }
+}
+
+StateReturn tableFallback(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    g_iTableFallbacks++;
+    return StateReturn::ok;
+}
+
+const State_t tableStates[] = {
+    {nullptr, tableFallback, nullptr}, // Idle
+    {nullptr, nullptr, nullptr},       // Active
+    {nullptr, nullptr, nullptr},       // Sub
+};
+
+const StateTransitionRow_t tableRows[] = {
+    {0, table_start, tableGuard, tableStart, 1, StateTransitionKind::transition},
+    {0, table_start, nullptr, tableDenied, 0, StateTransitionKind::internal},
+    {1, table_stop, nullptr, nullptr, 0, StateTransitionKind::transition},
+    {1, table_enter_sub, nullptr, nullptr, 2, StateTransitionKind::push},
+    {1, table_reset, nullptr, nullptr, 0, StateTransitionKind::transition},
+    {2, table_leave_sub, nullptr, nullptr, 0, StateTransitionKind::pop},
+    {2, table_tick, nullptr, tableTick, 0, StateTransitionKind::internal},
+    {2, table_reset + 1, nullptr, tableTick, 0, StateTransitionKind::internal},
+    {1, table_conflict, nullptr, tableConflict, 2, StateTransitionKind::push},
+    {2, table_conflict, nullptr, tableConflict, 0, StateTransitionKind::internal},
+};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_transition_table)
+{
+    const uint16_t u16Rows = sizeof(tableRows) / sizeof(StateTransitionRow_t);
+    uint16_t       au16Storage[STATE_TRANSITION_TABLE_STORAGE(3, table_events, u16Rows)];
+
+    StateTransitionTable clTable;
+    EXPECT_FALSE(clTable.Compile(tableRows, u16Rows, 3, table_events, au16Storage, sizeof(au16Storage)/sizeof(uint16_t) - 1));
+    EXPECT_FALSE(clTable.Compile(tableRows, u16Rows, 2, table_events, au16Storage, sizeof(au16Storage)/sizeof(uint16_t)));
+    EXPECT_TRUE(clTable.Compile(tableRows, u16Rows, 3, table_events, au16Storage, sizeof(au16Storage)/sizeof(uint16_t)));
+
+    StateMachine sm;
+    EXPECT_TRUE(sm.SetStates(tableStates, sizeof(tableStates)/sizeof(State_t)));
+    sm.SetTransitionTable(&clTable);
+    EXPECT_TRUE(sm.Begin());
+    g_iTableStarts    = 0;
+    g_iTableDenied    = 0;
+    g_iTableTicks     = 0;
+    g_iTableFallbacks = 0;
+
+    // Guards are tried in the order rows are declared
+    int iTicks = 1;
+    g_bTableAllowed = false;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(table_start, &iTicks));
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+    EXPECT_EQUALS(1, g_iTableDenied);
+    g_bTableAllowed = true;
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(table_start, &iTicks));
+    EXPECT_EQUALS(1, sm.GetCurrentState());
+    EXPECT_EQUALS(1, g_iTableStarts);
+    EXPECT_EQUALS(1, g_iTableDenied);
+
+    // Push, internal actions, and pop
+    sm.HandleEvent(table_enter_sub, &iTicks);
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    iTicks = 3;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(table_tick, &iTicks));
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(table_reset + 1, &iTicks));
+    EXPECT_EQUALS(6, g_iTableTicks);
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+    sm.HandleEvent(table_leave_sub, &iTicks);
+    EXPECT_EQUALS(1, sm.GetCurrentState());
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+
+    // Events with no row in the current state go down the stack, both from
+    // the dense and sparse ranges
+    sm.HandleEvent(table_enter_sub, &iTicks);
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(table_stop, &iTicks));
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+    sm.HandleEvent(table_start, &iTicks);
+    sm.HandleEvent(table_enter_sub, &iTicks);
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(table_reset, &iTicks));
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+
+    // ... and states with no matching row fall back to their run handler
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(table_tick, &iTicks));
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(table_reset, &iTicks));
+    EXPECT_EQUALS(2, g_iTableFallbacks);
+    sm.HandleEvent(table_start, &iTicks);
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(table_tick, &iTicks));
+#if STATE_MACHINE_STATS
+    EXPECT_EQUALS(1, sm.GetUnhandledCount());
+#endif
+
+    // An action's own operation is reported once, and gives way to the
+    // row's; on internal rows, it runs as requested
+    sm.SetErrorHandler(tableErrorHandler);
+    g_iTableErrors = 0;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(table_conflict, &iTicks));
+    EXPECT_EQUALS(1, g_iTableErrors);
+    EXPECT_EQUALS(2, sm.GetCurrentState());
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(table_conflict, &iTicks));
+    EXPECT_EQUALS(1, g_iTableErrors);
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_state_scxml)
+{
+    using namespace UtScxml;
+
+    // Unreachable states are pruned, and hot states follow the initial state
+    EXPECT_EQUALS(5, state_count);
+    EXPECT_EQUALS(0, offline);
+    EXPECT_EQUALS(1, online);
+
+    // Transitions inherited from a common ancestor share a handler, and
+    // events beyond the dense range are looked up by ID
+    EXPECT_TRUE(StateEventMapLookup(&astEventMaps[dialing], hangup) == StateEventMapLookup(&astEventMaps[authenticating], hangup));
+    EXPECT_EQUALS(u16DenseEvents, astEventMaps[online].u16DenseCount);
+    EXPECT_EQUALS(1, astEventMaps[online].u16SparseCount);
+    EXPECT_EQUALS(1, astEventMaps[dialing].u16SparseCount);
+
+    StateMachine sm;
+    EXPECT_TRUE(Bind(&sm));
+    EXPECT_TRUE(sm.Begin());
+    g_iScxmlDialEntries = 0;
+    g_iScxmlOnlineExits = 0;
+    g_iScxmlRetries     = 0;
+    g_iScxmlData        = 0;
+
+    // Entering a compound state enters its initial child, and its
+    // transitions are inherited by its children
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(dial, nullptr));
+    EXPECT_EQUALS(dialing, sm.GetCurrentState());
+    EXPECT_EQUALS(1, g_iScxmlDialEntries);
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(hangup, nullptr));
+    EXPECT_EQUALS(offline, sm.GetCurrentState());
+
+    sm.HandleEvent(dial, nullptr);
+    sm.HandleEvent(carrier, nullptr);
+    EXPECT_EQUALS(authenticating, sm.GetCurrentState());
+
+    // Guarded transitions are tried in document order
+    g_bScxmlLoginValid = false;
+    sm.HandleEvent(login, nullptr);
+    EXPECT_EQUALS(authenticating, sm.GetCurrentState());
+    EXPECT_EQUALS(1, g_iScxmlRetries);
+    g_bScxmlLoginValid = true;
+    sm.HandleEvent(login, nullptr);
+    EXPECT_EQUALS(online, sm.GetCurrentState());
+    EXPECT_EQUALS(1, g_iScxmlRetries);
+
+    // Targetless transitions only run their action
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(data, nullptr));
+    EXPECT_EQUALS(1, g_iScxmlData);
+    EXPECT_EQUALS(online, sm.GetCurrentState());
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(carrier, nullptr));
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(static_cast<const void*>(nullptr)));
+
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(error_link, nullptr));
+    EXPECT_EQUALS(offline, sm.GetCurrentState());
+    EXPECT_EQUALS(1, g_iScxmlOnlineExits);
+}
+#endif
+
+namespace {
+enum HandleStateIndex : StateIndex_t { hIdle, hMenu, hSub, hStateCount };
+
+typedef StateHandle<hStateCount, hIdle, 1> HandleIdle;
+typedef StateHandle<hStateCount, hMenu, 2> HandleMenu;
+typedef StateHandle<hStateCount, hSub, 3>  HandleSub;
+typedef StateHandle<hStateCount, hSub>     HandleAnySub;
+
+int  g_iHandleOverflows = 0;
+bool g_bHandleAmbiguous = false;
+
+StateReturn handleIdleRun(StateMachine* pclSM_, const void* pvEvent_) {
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 'p': pclSM_->PushState<HandleIdle, HandleMenu>(); return StateReturn::transition;
+        case 'a': {
+            // A second operation from the same handler is still ambiguous
+            pclSM_->TransitionState<HandleMenu>();
+            g_bHandleAmbiguous = !pclSM_->TransitionState<HandleIdle>();
+            return StateReturn::transition;
+        }
+        default: return StateReturn::unhandled;
+    }
+}
+
+StateReturn handleMenuRun(StateMachine* pclSM_, const void* pvEvent_) {
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 'p': pclSM_->PushState<HandleMenu, HandleSub>(); return StateReturn::transition;
+        case 'b': pclSM_->PopState<HandleMenu>(); return StateReturn::transition;
+        default: return StateReturn::unhandled;
+    }
+}
+
+StateReturn handleSubRun(StateMachine* pclSM_, const void* pvEvent_) {
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 'x': return pclSM_->PushState<HandleAnySub>() ? StateReturn::ok : StateReturn::unhandled;
+        case 'i': pclSM_->TransitionState<HandleIdle>(); return StateReturn::transition;
+        default: return StateReturn::unhandled;
+    }
+}
+
+const State_t handleStates[] = {
+    {nullptr, handleIdleRun, nullptr},
+    {nullptr, handleMenuRun, nullptr},
+    {nullptr, handleSubRun, nullptr},
+};
+static_assert(sizeof(handleStates) / sizeof(State_t) == hStateCount, "State handles must match the table");
+
+void handleErrorHandler(StateMachine* /*pclSM_*/, const StateErrorData_t* pstError_) {
+    if (pstError_->eType == StateErrorType::state_stack_overflow) {
+        g_iHandleOverflows++;
+    }
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_handle)
+{
+    StateMachine sm;
+    EXPECT_TRUE(sm.SetStates(handleStates, hStateCount));
+    sm.SetErrorHandler(handleErrorHandler);
+    EXPECT_TRUE(sm.Begin());
+
+    // Statically-checked operations follow the same semantics as the
+    // index-based API
+    char cEvent = 'p';
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(hMenu, sm.GetCurrentState());
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(hSub, sm.GetCurrentState());
+    EXPECT_EQUALS(3, sm.GetStackDepth());
+
+    // Events passed down the stack pop from the level of the handling state
+    cEvent = 'b';
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(hIdle, sm.GetCurrentState());
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+
+    cEvent = 'a';
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&cEvent));
+    EXPECT_TRUE(g_bHandleAmbiguous);
+    EXPECT_EQUALS(hMenu, sm.GetCurrentState());
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+
+    // Pushes by states without a fixed depth are still checked for overflow
+    EXPECT_TRUE(sm.Begin());
+    cEvent = 'p';
+    sm.HandleEvent(&cEvent);
+    sm.HandleEvent(&cEvent);
+    cEvent = 'x';
+    g_iHandleOverflows = 0;
+    for (int i = 3; i < MAX_STATE_STACK_DEPTH; i++) {
+        EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&cEvent));
+    }
+    EXPECT_EQUALS(MAX_STATE_STACK_DEPTH, sm.GetStackDepth());
+    EXPECT_EQUALS(0, g_iHandleOverflows);
+    // ...with the failure reported by each pushing state the event reaches
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(MAX_STATE_STACK_DEPTH - 2, g_iHandleOverflows);
+
+    cEvent = 'i';
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(hIdle, sm.GetCurrentState());
+    EXPECT_EQUALS(MAX_STATE_STACK_DEPTH, sm.GetStackDepth());
+
+    // Handles may also be declared against a statically-bound table
+    typedef StaticStateMachine<hStateCount, handleStates> HandleMachine;
+    EXPECT_EQUALS(hSub, (HandleMachine::State<hSub>::uXIndex));
+    EXPECT_EQUALS(hStateCount, (HandleMachine::State<hIdle, 1>::uXStateCount));
+}
+
+#if STATE_MACHINE_EVENT_CLASSES
+namespace {
+enum RegionStateIndex : StateIndex_t { rIdle, rActive, rSensor, rStateCount };
+
+const uint16_t u16TestRegions = 20;
+
+int                 g_aiRegionHits[u16TestRegions];
+StateRegionMachine* g_pclParallelRegions = nullptr;
+
+StateReturn regionIdleRun(StateMachine* pclSM_, const void* pvEvent_) {
+    g_aiRegionHits[StateRegionMachine::GetRegion(pclSM_)]++;
+    if (*static_cast<const char*>(pvEvent_) == 'g') {
+        pclSM_->TransitionState(rActive);
+        return StateReturn::transition;
+    }
+    return StateReturn::unhandled;
+}
+
+StateReturn regionActiveRun(StateMachine* pclSM_, const void* pvEvent_) {
+    if (*static_cast<const char*>(pvEvent_) == 's') {
+        pclSM_->TransitionState(rIdle);
+        return StateReturn::transition;
+    }
+    return StateReturn::unhandled;
+}
+
+StateReturn regionSensorRun(StateMachine* pclSM_, const void* pvEvent_) {
+    g_aiRegionHits[StateRegionMachine::GetRegion(pclSM_)]++;
+    return (*static_cast<const char*>(pvEvent_) == 'r') ? StateReturn::ok : StateReturn::unhandled;
+}
+
+const State_t regionStates[] = {
+    {nullptr, regionIdleRun, nullptr},
+    {nullptr, regionActiveRun, nullptr},
+    {nullptr, regionSensorRun, nullptr},
+};
+
+const uint32_t au32RegionClasses[] = {0x1, 0x1, 0x2};
+
+// Stands in for the other workers' threads while the dispatcher waits
+void regionIdleHandler(uint16_t /*u16WorkerId_*/, uint32_t /*u32IdleRounds_*/) {
+    g_pclParallelRegions->RunOnce(2);
+    g_pclParallelRegions->RunOnce(1);
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_regions)
+{
+    StateIndex_t auXInitial[u16TestRegions];
+    for (uint16_t i = 0; i < u16TestRegions; i++) {
+        auXInitial[i] = (i & 1) ? rSensor : rIdle;
+    }
+
+    // Identical machines, dispatched serially and across three workers
+    StateRegionMachine clSerial;
+    StateRegionMachine clParallel;
+    StateRegionWorker  aclWorkers[3];
+    uint8_t            au8Depths[2][u16TestRegions];
+    StateIndex_t       auXStacks[2][u16TestRegions * MAX_STATE_STACK_DEPTH];
+
+    EXPECT_FALSE(clSerial.Begin());
+    EXPECT_FALSE(clSerial.SetStorage(0, auXInitial, au8Depths[0], auXStacks[0]));
+    EXPECT_FALSE(clParallel.SetWorkers(aclWorkers, 0));
+
+    StateRegionMachine* apclMachines[2] = {&clSerial, &clParallel};
+    for (int i = 0; i < 2; i++) {
+        EXPECT_TRUE(apclMachines[i]->SetStates(regionStates, rStateCount));
+        EXPECT_FALSE(apclMachines[i]->SetStates(regionStates, rStateCount));
+        EXPECT_TRUE(apclMachines[i]->SetStorage(u16TestRegions, auXInitial, au8Depths[i], auXStacks[i]));
+        apclMachines[i]->SetEventClasses(au32RegionClasses);
+    }
+    EXPECT_TRUE(clParallel.SetWorkers(aclWorkers, 3));
+    clParallel.SetIdleHandler(regionIdleHandler);
+    g_pclParallelRegions = &clParallel;
+
+    // Each region enters its own initial state
+    EXPECT_TRUE(clSerial.Begin());
+    EXPECT_TRUE(clParallel.Begin());
+    EXPECT_EQUALS(u16TestRegions, clSerial.GetRegionCount());
+    EXPECT_EQUALS(rIdle, clSerial.GetCurrentState(0));
+    EXPECT_EQUALS(rSensor, clSerial.GetCurrentState(1));
+    EXPECT_EQUALS(1, clSerial.GetStackDepth(1));
+
+    // One call delivers the event to every region; handlers see their own
+    // region, and results are joined
+    memset(g_aiRegionHits, 0, sizeof(g_aiRegionHits));
+    char        cEvent = 'g';
+    StateReturn aeResults[2][u16TestRegions];
+    EXPECT_EQUALS(StateReturn::transition, clSerial.HandleEvent(&cEvent, aeResults[0]));
+    for (uint16_t i = 0; i < u16TestRegions; i++) {
+        EXPECT_EQUALS(1, g_aiRegionHits[i]);
+        EXPECT_EQUALS((i & 1) ? StateReturn::unhandled : StateReturn::transition, aeResults[0][i]);
+        EXPECT_EQUALS((i & 1) ? rSensor : rActive, clSerial.GetCurrentState(i));
+    }
+
+    // Regions with no state handling the event's class are skipped
+    memset(g_aiRegionHits, 0, sizeof(g_aiRegionHits));
+    cEvent = 'r';
+    EXPECT_EQUALS(StateReturn::ok, clSerial.HandleClassEvent(1, &cEvent, aeResults[0]));
+    for (uint16_t i = 0; i < u16TestRegions; i++) {
+        EXPECT_EQUALS((i & 1) ? 1 : 0, g_aiRegionHits[i]);
+        EXPECT_EQUALS((i & 1) ? StateReturn::ok : StateReturn::unhandled, aeResults[0][i]);
+    }
+    EXPECT_EQUALS(u16TestRegions / 2, clSerial.GetWorker(0)->GetSkipCount());
+    cEvent = 's';
+    EXPECT_EQUALS(StateReturn::unhandled, clSerial.HandleClassEvent(2, &cEvent));
+
+    // Parallel dispatch joins to the same states and results
+    EXPECT_TRUE(clSerial.Begin());
+    const char acEvents[] = {'g', 'r', 's', 'g'};
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQUALS(clSerial.HandleClassEvent(0, &acEvents[i], aeResults[0]),
+                      clParallel.HandleClassEvent(0, &acEvents[i], aeResults[1]));
+        EXPECT_EQUALS(0, memcmp(aeResults[0], aeResults[1], sizeof(aeResults[0])));
+    }
+    for (uint16_t i = 0; i < u16TestRegions; i++) {
+        EXPECT_EQUALS(clSerial.GetCurrentState(i), clParallel.GetCurrentState(i));
+    }
+
+    // Each worker handled its own slice of the regions
+    EXPECT_FALSE(clParallel.RunOnce(0));
+    EXPECT_FALSE(clParallel.RunOnce(1));
+    EXPECT_FALSE(clParallel.RunOnce(3));
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(aclWorkers[i].GetEventCount() > 0);
+    }
+    EXPECT_EQUALS(4 * (u16TestRegions / 2),
+                  aclWorkers[0].GetEventCount() + aclWorkers[1].GetEventCount() + aclWorkers[2].GetEventCount());
+}
+#endif
+
+namespace {
+enum RegionEntryStateIndex : StateIndex_t { reBoot, reWait, reRun, reStateCount };
+
+int g_iRegionEntryErrors;
+
+void regionBootEntry(StateMachine* pclSM_) {
+    pclSM_->PushState(reRun);
+}
+
+void regionWaitEntry(StateMachine* pclSM_) {
+    pclSM_->TransitionState(reRun);
+}
+
+void regionEntryErrorHandler(StateMachine* /*pclSM_*/, const StateErrorData_t* pstError_) {
+    if (pstError_->eType == StateErrorType::ambiguous_operation) {
+        g_iRegionEntryErrors++;
+    }
+}
+
+StateReturn regionRunRun(StateMachine* pclSM_, const void* pvEvent_) {
+    if (*static_cast<const char*>(pvEvent_) == 'w') {
+        pclSM_->TransitionState(reWait);
+        return StateReturn::transition;
+    }
+    return StateReturn::unhandled;
+}
+
+const State_t regionEntryStates[] = {
+    {regionBootEntry, nullptr, nullptr},
+    {regionWaitEntry, nullptr, nullptr},
+    {nullptr, regionRunRun, nullptr},
+};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_regions_entry_ops)
+{
+    // Operations requested by initial entry handlers are reported, and run
+    // before the next region is entered - not dropped
+    const StateIndex_t auXInitial[] = {reBoot, reWait, reRun};
+    uint8_t            au8Depths[3];
+    StateIndex_t       auXStacks[3 * MAX_STATE_STACK_DEPTH];
+    StateRegionMachine clRegions;
+
+    EXPECT_TRUE(clRegions.SetStates(regionEntryStates, reStateCount));
+    EXPECT_TRUE(clRegions.SetStorage(3, auXInitial, au8Depths, auXStacks));
+    clRegions.SetErrorHandler(regionEntryErrorHandler);
+
+    g_iRegionEntryErrors = 0;
+    EXPECT_TRUE(clRegions.Begin());
+    EXPECT_EQUALS(2, g_iRegionEntryErrors);
+    EXPECT_EQUALS(2, clRegions.GetStackDepth(0));
+    EXPECT_EQUALS(reRun, clRegions.GetCurrentState(0));
+    EXPECT_EQUALS(1, clRegions.GetStackDepth(1));
+    EXPECT_EQUALS(reRun, clRegions.GetCurrentState(1));
+    EXPECT_EQUALS(1, clRegions.GetStackDepth(2));
+    EXPECT_EQUALS(reRun, clRegions.GetCurrentState(2));
+
+    // ... as are those requested by entry handlers while handling an event
+    char        cEvent = 'w';
+    StateReturn aeResults[3];
+    EXPECT_EQUALS(StateReturn::transition, clRegions.HandleEvent(&cEvent, aeResults));
+    EXPECT_EQUALS(5, g_iRegionEntryErrors);
+    for (uint16_t i = 0; i < 3; i++) {
+        EXPECT_EQUALS(StateReturn::transition, aeResults[i]);
+        EXPECT_EQUALS(reRun, clRegions.GetCurrentState(i));
+    }
+    EXPECT_EQUALS(2, clRegions.GetStackDepth(0));
+    EXPECT_EQUALS(1, clRegions.GetStackDepth(1));
+}
+
+#if STATE_MACHINE_HISTORY
+namespace {
+enum HistoryStateIndex : StateIndex_t { hsOther, hsMenu, hsSub, hsDetail, hsStateCount };
+
+int g_aiHistoryEntries[hsStateCount];
+
+template <HistoryStateIndex eState_>
+void historyEntry(StateMachine* /*pclSM_*/) {
+    g_aiHistoryEntries[eState_]++;
+}
+
+StateReturn historyOtherRun(StateMachine* pclSM_, const void* pvEvent_) {
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 'd': pclSM_->TransitionState(hsMenu, StateHistory::deep); return StateReturn::transition;
+        case 's': pclSM_->TransitionState(hsMenu, StateHistory::shallow); return StateReturn::transition;
+        case 'n': pclSM_->TransitionState(hsMenu, StateHistory::none); return StateReturn::transition;
+        case 'P': pclSM_->PushState(hsMenu, StateHistory::deep); return StateReturn::ok;
+        default: return StateReturn::unhandled;
+    }
+}
+
+StateReturn historyMenuRun(StateMachine* pclSM_, const void* pvEvent_) {
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 'p': pclSM_->PushState(hsSub); return StateReturn::ok;
+        case 'x': pclSM_->TransitionState(hsOther); return StateReturn::transition;
+        default: return StateReturn::unhandled;
+    }
+}
+
+StateReturn historySubRun(StateMachine* pclSM_, const void* pvEvent_) {
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 'p': pclSM_->PushState(hsDetail); return StateReturn::ok;
+        case 'b': pclSM_->PopState(); return StateReturn::ok;
+        default: return StateReturn::unhandled;
+    }
+}
+
+StateReturn historyDetailRun(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/) {
+    return StateReturn::unhandled;
+}
+
+const State_t historyStates[] = {
+    {historyEntry<hsOther>, historyOtherRun, nullptr},
+    {historyEntry<hsMenu>, historyMenuRun, nullptr},
+    {historyEntry<hsSub>, historySubRun, nullptr},
+    {historyEntry<hsDetail>, historyDetailRun, nullptr},
+};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_history)
+{
+    StateMachine sm;
+    StateIndex_t auXHistory[hsStateCount];
+    EXPECT_TRUE(sm.SetStates(historyStates, hsStateCount));
+
+    // Without history storage, history operations are plain transitions
+    char cEvent = 'd';
+    EXPECT_TRUE(sm.Begin());
+    EXPECT_EQUALS(STATE_INDEX_NONE, sm.GetHistory(hsMenu));
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(hsMenu, sm.GetCurrentState());
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+
+    sm.SetHistory(auXHistory);
+    EXPECT_TRUE(sm.Begin());
+    cEvent = 'n';
+    sm.HandleEvent(&cEvent);
+    cEvent = 'p';
+    sm.HandleEvent(&cEvent);
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(hsDetail, sm.GetCurrentState());
+
+    // Exiting a state records the state that was directly above it
+    cEvent = 'x';
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(hsOther, sm.GetCurrentState());
+    EXPECT_EQUALS(hsSub, sm.GetHistory(hsMenu));
+    EXPECT_EQUALS(hsDetail, sm.GetHistory(hsSub));
+    EXPECT_EQUALS(STATE_INDEX_NONE, sm.GetHistory(hsDetail));
+
+    // Deep history re-enters the whole chain within a single event
+    memset(g_aiHistoryEntries, 0, sizeof(g_aiHistoryEntries));
+    cEvent = 'd';
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(3, sm.GetStackDepth());
+    EXPECT_EQUALS(hsDetail, sm.GetCurrentState());
+    EXPECT_EQUALS(1, g_aiHistoryEntries[hsMenu]);
+    EXPECT_EQUALS(1, g_aiHistoryEntries[hsSub]);
+    EXPECT_EQUALS(1, g_aiHistoryEntries[hsDetail]);
+
+    // Shallow history re-enters only the state directly above
+    cEvent = 'x';
+    sm.HandleEvent(&cEvent);
+    cEvent = 's';
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(hsSub, sm.GetCurrentState());
+
+    // A state popped from the top of the stack has no history
+    cEvent = 'b';
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(STATE_INDEX_NONE, sm.GetHistory(hsSub));
+    cEvent = 'p';
+    sm.HandleEvent(&cEvent);
+    cEvent = 'x';
+    sm.HandleEvent(&cEvent);
+    cEvent = 'd';
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(hsSub, sm.GetCurrentState());
+
+    // History is also restored on push
+    cEvent = 'x';
+    sm.HandleEvent(&cEvent);
+    cEvent = 'P';
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(3, sm.GetStackDepth());
+    EXPECT_EQUALS(hsSub, sm.GetCurrentState());
+
+    // History without a recorded state enters the target only
+    EXPECT_TRUE(sm.Begin());
+    cEvent = 'n';
+    sm.HandleEvent(&cEvent);
+    cEvent = 'x';
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(STATE_INDEX_NONE, sm.GetHistory(hsMenu));
+    cEvent = 'd';
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+    EXPECT_EQUALS(hsMenu, sm.GetCurrentState());
+}
+#endif
+
+namespace {
+enum VmStateIndex : StateIndex_t { vmBase, vmTop, vmStateCount };
+
+int              g_iVmErrors;
+StateErrorData_t g_stVmError;
+bool             g_bVmEntryOp;
+
+void vmErrorHandler(StateMachine* /*pclSM_*/, const StateErrorData_t* pstError_) {
+    g_iVmErrors++;
+    g_stVmError = *pstError_;
+}
+
+void vmTopEntry(StateMachine* pclSM_) {
+    if (g_bVmEntryOp) {
+        pclSM_->TransitionState(vmBase);
+    }
+}
+
+StateReturn vmBaseRun(StateMachine* pclSM_, const void* pvEvent_) {
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 'p': pclSM_->PushState(vmTop); return StateReturn::ok;
+        case 'u': pclSM_->PushState(vmTop); return StateReturn::unhandled;
+        default: return StateReturn::unhandled;
+    }
+}
+
+StateReturn vmTopRun(StateMachine* pclSM_, const void* pvEvent_) {
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 't': pclSM_->TransitionState(vmBase); return StateReturn::transition;
+        case 'b': pclSM_->PopState(); return StateReturn::transition;
+        default: return StateReturn::unhandled;
+    }
+}
+
+const State_t g_astVmStates[] = {{nullptr, vmBaseRun, nullptr}, {vmTopEntry, vmTopRun, nullptr}};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_vm_ambiguity)
+{
+    StateMachine sm;
+    char         cEvent;
+
+    EXPECT_TRUE(sm.SetStates(g_astVmStates, vmStateCount));
+    sm.SetErrorHandler(vmErrorHandler);
+    EXPECT_TRUE(sm.Begin());
+    g_iVmErrors  = 0;
+    g_bVmEntryOp = false;
+
+    // Operations paired with a transition result are not ambiguous
+    cEvent = 'p';
+    sm.HandleEvent(&cEvent);
+    g_iVmErrors = 0;
+    cEvent      = 'b';
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(0, g_iVmErrors);
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+
+    // An operation paired with any other result is reported, then run
+    cEvent = 'p';
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(1, g_iVmErrors);
+    EXPECT_TRUE(StateErrorType::ambiguous_operation == g_stVmError.eType);
+    EXPECT_TRUE(StateOpcode::push == g_stVmError.ambiguousOperation.eInitialOp);
+    EXPECT_TRUE(StateOpcode::returned == g_stVmError.ambiguousOperation.eAmbiguousOp);
+    EXPECT_EQUALS(vmBase, g_stVmError.ambiguousOperation.uXCurrentState);
+    EXPECT_EQUALS(vmTop, sm.GetCurrentState());
+
+    cEvent = 't';
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(1, g_iVmErrors);
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(vmBase, sm.GetCurrentState());
+
+    EXPECT_TRUE(sm.Begin());
+    cEvent = 'u';
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(2, g_iVmErrors);
+    EXPECT_TRUE(StateOpcode::push == g_stVmError.ambiguousOperation.eInitialOp);
+    EXPECT_TRUE(StateOpcode::unhandled == g_stVmError.ambiguousOperation.eAmbiguousOp);
+    EXPECT_EQUALS(vmTop, sm.GetCurrentState());
+
+    // Operations requested while entering a pushed state are reported, and
+    // dropped
+    EXPECT_TRUE(sm.Begin());
+    g_bVmEntryOp = true;
+    g_iVmErrors  = 0;
+    cEvent       = 'u';
+    sm.HandleEvent(&cEvent);
+    EXPECT_EQUALS(2, g_iVmErrors);
+    EXPECT_TRUE(StateOpcode::returned == g_stVmError.ambiguousOperation.eInitialOp);
+    EXPECT_TRUE(StateOpcode::transition == g_stVmError.ambiguousOperation.eAmbiguousOp);
+    EXPECT_EQUALS(2, sm.GetStackDepth());
+    EXPECT_EQUALS(vmTop, sm.GetCurrentState());
+    g_bVmEntryOp = false;
+    cEvent       = 'x';
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(2, g_iVmErrors);
+}
+
+namespace {
+// The root, A and C have exit handlers; B and D do not
+enum ExitFrameStateIndex : StateIndex_t { xfRoot, xfA, xfB, xfC, xfD, xfStateCount };
+
+StateIndex_t g_auXExitOrder[MAX_STATE_STACK_DEPTH + 1];
+uint16_t     g_u16Exits;
+
+template <ExitFrameStateIndex eState_>
+void exitFrameExit(StateMachine* /*pclSM_*/) {
+    if (g_u16Exits < (MAX_STATE_STACK_DEPTH + 1)) {
+        g_auXExitOrder[g_u16Exits] = eState_;
+    }
+    g_u16Exits++;
+}
+
+StateReturn exitFrameRootRun(StateMachine* pclSM_, const void* pvEvent_) {
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 'p': pclSM_->PushState(xfA); return StateReturn::ok;
+        case 't': pclSM_->TransitionState(xfB); return StateReturn::transition;
+        default: return StateReturn::unhandled;
+    }
+}
+
+StateReturn exitFrameRun(StateMachine* pclSM_, const void* pvEvent_) {
+    auto uXState = pclSM_->GetCurrentState();
+    auto uXNext  = (uXState == xfD) ? static_cast<StateIndex_t>(xfA) : static_cast<StateIndex_t>(uXState + 1);
+    switch (*static_cast<const char*>(pvEvent_)) {
+        case 'p': pclSM_->PushState(uXNext); return StateReturn::ok;
+        case 'q': pclSM_->PopState(); return StateReturn::ok;
+        default: return StateReturn::unhandled;
+    }
+}
+
+const State_t g_astExitFrameStates[] = {
+    {nullptr, exitFrameRootRun, exitFrameExit<xfRoot>},
+    {nullptr, exitFrameRun, exitFrameExit<xfA>},
+    {nullptr, exitFrameRun, nullptr},
+    {nullptr, exitFrameRun, exitFrameExit<xfC>},
+    {nullptr, exitFrameRun, nullptr},
+};
+
+// Exits expected when the root transitions from under a full stack
+uint16_t ExpectedExits(StateIndex_t* puXExits_) {
+    uint16_t u16Exits = 0;
+    for (int i = MAX_STATE_STACK_DEPTH - 1; i >= 1; i--) {
+        if (((i - 1) % 2) == 0) {
+            puXExits_[u16Exits++] = static_cast<StateIndex_t>(xfA + ((i - 1) % 4));
+        }
+    }
+    puXExits_[u16Exits++] = xfRoot;
+    return u16Exits;
+}
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_bits)
+{
+    // Every bit, alone and with all of the bits below it set
+    for (uint8_t i = 0; i < 32; i++) {
+        auto u32Bit = static_cast<uint32_t>(1u) << i;
+        EXPECT_EQUALS(i, StateBits::HighestSet(u32Bit));
+        EXPECT_EQUALS(i, StateBits::HighestSetPortable(u32Bit));
+        EXPECT_EQUALS(i, StateBits::HighestSet(u32Bit | (u32Bit - 1)));
+        EXPECT_EQUALS(i, StateBits::HighestSetPortable(u32Bit | (u32Bit - 1)));
+    }
+    EXPECT_EQUALS(3, StateBits::HighestSet(0x9u));
+    EXPECT_EQUALS(3, StateBits::HighestSetPortable(0x9u));
+    EXPECT_EQUALS(31, StateBits::HighestSetPortable(0xFFFFFFFFu));
+}
+
+//---------------------------------------------------------------------------
+TEST(ut_state_exit_frames)
+{
+    StateIndex_t auXExpected[MAX_STATE_STACK_DEPTH + 1];
+    auto         u16Expected = ExpectedExits(auXExpected);
+    char         cEvent      = 'p';
+
+    // Only the frames holding a state with an exit handler are exited, in
+    // order from the top of the stack down
+    StateMachine sm;
+    EXPECT_TRUE(sm.SetStates(g_astExitFrameStates, xfStateCount));
+    EXPECT_TRUE(sm.Begin());
+    for (int i = 1; i < MAX_STATE_STACK_DEPTH; i++) {
+        EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&cEvent));
+    }
+    EXPECT_EQUALS(MAX_STATE_STACK_DEPTH, sm.GetStackDepth());
+    g_u16Exits = 0;
+    cEvent     = 't';
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(u16Expected, g_u16Exits);
+    EXPECT_EQUALS(0, memcmp(auXExpected, g_auXExitOrder, u16Expected * sizeof(StateIndex_t)));
+    EXPECT_EQUALS(1, sm.GetStackDepth());
+    EXPECT_EQUALS(xfB, sm.GetCurrentState());
+
+    // Frames re-entered after a transition are marked for their new state
+    cEvent = 'p';
+    sm.HandleEvent(&cEvent);
+    sm.HandleEvent(&cEvent);
+    g_u16Exits = 0;
+    cEvent     = 'q';
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(0, g_u16Exits);
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(&cEvent));
+    EXPECT_EQUALS(1, g_u16Exits);
+    EXPECT_EQUALS(xfC, g_auXExitOrder[0]);
+    EXPECT_EQUALS(xfB, sm.GetCurrentState());
+
+    // Fleet machines, whose stacks are loaded as a whole, exit the same way
+    StateMachineFleet clFleet;
+    uint8_t           au8Depths[2];
+    StateIndex_t      auXStacks[2 * MAX_STATE_STACK_DEPTH];
+    EXPECT_TRUE(clFleet.SetStates(g_astExitFrameStates, xfStateCount));
+    EXPECT_TRUE(clFleet.SetStorage(2, au8Depths, auXStacks, nullptr));
+    EXPECT_TRUE(clFleet.Begin(0));
+    EXPECT_TRUE(clFleet.Begin(1));
+    cEvent = 'p';
+    for (int i = 1; i < MAX_STATE_STACK_DEPTH; i++) {
+        clFleet.HandleEvent(0, &cEvent);
+        clFleet.HandleEvent(1, &cEvent);
+    }
+    g_u16Exits = 0;
+    cEvent     = 't';
+    EXPECT_EQUALS(StateReturn::transition, clFleet.HandleEvent(1, &cEvent));
+    EXPECT_EQUALS(u16Expected, g_u16Exits);
+    EXPECT_EQUALS(0, memcmp(auXExpected, g_auXExitOrder, u16Expected * sizeof(StateIndex_t)));
+    EXPECT_EQUALS(MAX_STATE_STACK_DEPTH, clFleet.GetStackDepth(0));
+}
+
+namespace {
+enum class TypedOp : uint16_t { add, reset, start, stop };
+
+typedef struct {
+    TypedOp eOp;
+    int32_t i32Value;
+} TypedEvent_t;
+
+class TypedCounter
+{
+public:
+    StateReturn IdleRun(StateMachine* pclSM_, const TypedEvent_t& stEvent_) {
+        if (stEvent_.eOp == TypedOp::start) {
+            pclSM_->TransitionState(1);
+            return StateReturn::transition;
+        }
+        return StateReturn::unhandled;
+    }
+
+    void CountingEntry(StateMachine* /*pclSM_*/) { m_iEntries++; }
+
+    StateReturn CountingRun(StateMachine* pclSM_, const TypedEvent_t& stEvent_) {
+        switch (stEvent_.eOp) {
+            case TypedOp::add: return Add(pclSM_, stEvent_);
+            case TypedOp::reset: return Reset(pclSM_, stEvent_);
+            case TypedOp::stop: pclSM_->TransitionState(0); return StateReturn::transition;
+            default: return StateReturn::unhandled;
+        }
+    }
+
+    void CountingExit(StateMachine* /*pclSM_*/) { m_iExits++; }
+
+    StateReturn Add(StateMachine* /*pclSM_*/, const TypedEvent_t& stEvent_) {
+        m_i32Total += stEvent_.i32Value;
+        return StateReturn::ok;
+    }
+
+    StateReturn Reset(StateMachine* /*pclSM_*/, const TypedEvent_t& /*stEvent_*/) {
+        m_i32Total = 0;
+        return StateReturn::ok;
+    }
+
+    int32_t m_i32Total = 0;
+    int     m_iEntries = 0;
+    int     m_iExits   = 0;
+};
+
+StateReturn typedIdleFunction(TypedCounter& clCounter_, StateMachine* pclSM_, const TypedEvent_t& stEvent_) {
+    return clCounter_.IdleRun(pclSM_, stEvent_);
+}
+
+typedef TypedState<TypedCounter, TypedEvent_t> TypedCounterState;
+
+constexpr State_t g_astTypedStates[] = {
+    TypedCounterState::Bind<&TypedCounter::IdleRun>(),
+    TypedCounterState::Bind<&TypedCounter::CountingEntry, &TypedCounter::CountingRun, &TypedCounter::CountingExit>(),
+};
+
+constexpr State_t g_astTypedStaticStates[] = {
+    TypedCounterState::BindFunction<typedIdleFunction>(),
+    TypedCounterState::Bind<nullptr, &TypedCounter::CountingRun, &TypedCounter::CountingExit>(),
+};
+
+#if STATE_MACHINE_TYPED_EVENTS
+const StateHandler_t g_apfTypedDense[] = {TypedCounterState::Run<&TypedCounter::Add>,
+                                          TypedCounterState::Run<&TypedCounter::Reset>};
+
+const StateEventMap_t g_astTypedMaps[] = {{nullptr, 0, nullptr, 0, nullptr}, {g_apfTypedDense, 2, nullptr, 0, nullptr}};
+#endif
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_typed)
+{
+    TypedCounter                                    clCounter;
+    TypedStateMachine<TypedCounter, TypedEvent_t> sm;
+
+    EXPECT_TRUE(sm.SetStates(g_astTypedStates, 2));
+    sm.SetContext(&clCounter);
+    EXPECT_TRUE(&clCounter == sm.GetContext());
+    EXPECT_TRUE(sm.Begin());
+
+    // Member function handlers receive the typed context and event
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent({TypedOp::add, 5}));
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent({TypedOp::start, 0}));
+    EXPECT_EQUALS(1, clCounter.m_iEntries);
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent({TypedOp::add, 5}));
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent({TypedOp::add, -2}));
+    EXPECT_EQUALS(3, clCounter.m_i32Total);
+
+#if STATE_MACHINE_TYPED_EVENTS
+    // The event's tag indexes the event maps directly
+    sm.SetEventMaps(g_astTypedMaps);
+    TypedEvent_t stEvent = {TypedOp::add, 10};
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(static_cast<uint16_t>(stEvent.eOp), stEvent));
+    EXPECT_EQUALS(13, clCounter.m_i32Total);
+    stEvent.eOp = TypedOp::reset;
+    EXPECT_EQUALS(StateReturn::ok, sm.HandleEvent(static_cast<uint16_t>(stEvent.eOp), stEvent));
+    EXPECT_EQUALS(0, clCounter.m_i32Total);
+    stEvent.eOp = TypedOp::stop;
+    EXPECT_EQUALS(StateReturn::unhandled, sm.HandleEvent(static_cast<uint16_t>(stEvent.eOp), stEvent));
+#else
+    TypedEvent_t stEvent = {TypedOp::stop, 0};
+#endif
+    EXPECT_EQUALS(StateReturn::transition, sm.HandleEvent(stEvent));
+    EXPECT_EQUALS(1, clCounter.m_iExits);
+    EXPECT_EQUALS(0, sm.GetCurrentState());
+
+    // The same handlers, bound at compile-time, with optional entry/exit
+    TypedCounter clStaticCounter;
+    TypedStateMachine<TypedCounter, TypedEvent_t, StaticStateMachine<2, g_astTypedStaticStates>> clStatic;
+    clStatic.SetContext(&clStaticCounter);
+    EXPECT_TRUE(clStatic.Begin());
+    EXPECT_EQUALS(StateReturn::transition, clStatic.HandleEvent({TypedOp::start, 0}));
+    EXPECT_EQUALS(StateReturn::ok, clStatic.HandleEvent({TypedOp::add, 7}));
+    stEvent = {TypedOp::add, 3};
+#if STATE_MACHINE_TYPED_EVENTS
+    clStatic.SetEventMaps(g_astTypedMaps);
+    EXPECT_EQUALS(StateReturn::ok, clStatic.HandleEvent(static_cast<uint16_t>(stEvent.eOp), stEvent));
+#else
+    EXPECT_EQUALS(StateReturn::ok, clStatic.HandleEvent(stEvent));
+#endif
+    EXPECT_EQUALS(10, clStaticCounter.m_i32Total);
+    stEvent = {TypedOp::add, -3};
+    EXPECT_EQUALS(StateReturn::ok, clStatic.HandleEvent(stEvent));
+    EXPECT_EQUALS(StateReturn::transition, clStatic.HandleEvent({TypedOp::stop, 0}));
+    EXPECT_EQUALS(7, clStaticCounter.m_i32Total);
+    EXPECT_EQUALS(0, clStaticCounter.m_iEntries);
+    EXPECT_EQUALS(1, clStaticCounter.m_iExits);
+}
+
+namespace
+{
+StateReturn pairsSumRun(StateMachine* pclSM_, const void* pvEvent_)
+{
+    auto iValue = *static_cast<const int*>(pvEvent_);
+    if (iValue < 0) {
+        pclSM_->TransitionState(1);
+        return StateReturn::transition;
+    }
+    *static_cast<int*>(pclSM_->GetContext()) += iValue;
+    return StateReturn::ok;
+}
+
+StateReturn pairsStoppedRun(StateMachine* /*pclSM_*/, const void* /*pvEvent_*/)
+{
+    return StateReturn::unhandled;
+}
+
+const State_t g_astPairsStates[] = {{nullptr, pairsSumRun, nullptr}, {nullptr, pairsStoppedRun, nullptr}};
+} // anonymous namespace
+
+//---------------------------------------------------------------------------
+TEST(ut_state_event_pairs)
+{
+    StateMachine aclSM[3];
+    int          aiTotals[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(aclSM[i].SetStates(g_astPairsStates, 2));
+        aclSM[i].SetContext(&aiTotals[i]);
+        EXPECT_TRUE(aclSM[i].Begin());
+    }
+
+    // Enough pairs to run past the prefetch distance, with machines repeated
+    // and changing state part-way through the batch
+    const int        aiValues[]   = {1, 2, 4, -1, 8, 16, 32, 64, 128, 256, 512, 1024};
+    const uint8_t    au8Machine[] = {0, 1, 2, 1, 0, 1, 2, 2, 0, 1, 2, 0};
+    const uint32_t   u32Count     = sizeof(aiValues) / sizeof(aiValues[0]);
+    StateEventPair_t astPairs[u32Count];
+    StateReturn      aeResults[u32Count];
+    for (uint32_t i = 0; i < u32Count; i++) {
+        astPairs[i] = {&aclSM[au8Machine[i]], &aiValues[i]};
+    }
+
+    EXPECT_EQUALS(u32Count, StateMachine::HandleEventPairs(astPairs, u32Count, aeResults));
+    EXPECT_EQUALS(1 + 8 + 128 + 1024, aiTotals[0]);
+    EXPECT_EQUALS(2, aiTotals[1]);
+    EXPECT_EQUALS(4 + 32 + 64 + 512, aiTotals[2]);
+    EXPECT_EQUALS(0, aclSM[0].GetCurrentState());
+    EXPECT_EQUALS(1, aclSM[1].GetCurrentState());
+    EXPECT_EQUALS(StateReturn::ok, aeResults[0]);
+    EXPECT_EQUALS(StateReturn::transition, aeResults[3]);
+    EXPECT_EQUALS(StateReturn::unhandled, aeResults[5]);
+    EXPECT_EQUALS(StateReturn::unhandled, aeResults[9]);
+    EXPECT_EQUALS(StateReturn::ok, aeResults[11]);
+
+    // Results are optional
+    EXPECT_EQUALS(2, StateMachine::HandleEventPairs(astPairs, 2));
+    EXPECT_EQUALS(1 + 8 + 128 + 1024 + 1, aiTotals[0]);
+    EXPECT_EQUALS(0, StateMachine::HandleEventPairs(nullptr, 2));
+    EXPECT_EQUALS(0, StateMachine::HandleEventPairs(astPairs, 0));
+
+    // Machines that have not been started are skipped, and are not read
+    // past their stack when prefetched
+    StateMachine clIdle;
+    EXPECT_TRUE(clIdle.SetStates(g_astPairsStates, 2));
+    for (uint32_t i = 0; i < u32Count; i += 3) {
+        astPairs[i].pclSM = &clIdle;
+    }
+    EXPECT_EQUALS(u32Count, StateMachine::HandleEventPairs(astPairs, u32Count, aeResults));
+    EXPECT_EQUALS(StateReturn::unhandled, aeResults[0]);
+    EXPECT_EQUALS(StateReturn::unhandled, aeResults[9]);
+    EXPECT_EQUALS(0, clIdle.GetStackDepth());
+    EXPECT_EQUALS(1 + 8 + 128 + 1024 + 1 + 8 + 128 + 1024, aiTotals[0]);
+}
+
 //---------------------------------------------------------------------------
 //===========================================================================
 // Test Whitelist Goes Here
@@ -903,5 +3572,63 @@ TEST_CASE(ut_state_ambiguous_jump),
 TEST_CASE(ut_state_stack_overflow),
 TEST_CASE(ut_state_underflow),
 TEST_CASE(ut_state_invalid_transition),
+TEST_CASE(ut_state_index_width),
+TEST_CASE(ut_static_state_machine),
+TEST_CASE(ut_spsc_queue),
+TEST_CASE(ut_mpsc_queue),
+TEST_CASE(ut_queued_state_machine),
+TEST_CASE(ut_priority_queue),
+TEST_CASE(ut_state_event_batch),
+TEST_CASE(ut_fleet_executor),
+#if FLEET_WORKER_LOCAL_SCHEDULE
+TEST_CASE(ut_fleet_executor_local),
+#endif
+#if defined(__linux__)
+TEST_CASE(ut_fleet_dispatcher),
+#endif
+TEST_CASE(ut_state_machine_fleet),
+TEST_CASE(ut_state_fleet_entry_ops),
+#if STATE_MACHINE_TYPED_EVENTS
+TEST_CASE(ut_state_typed_events),
+#endif
+#if STATE_MACHINE_EVENT_CLASSES && STATE_MACHINE_STATS
+TEST_CASE(ut_state_class_events),
+#endif
+TEST_CASE(ut_state_trace_buffer),
+#if STATE_MACHINE_TRACE
+TEST_CASE(ut_state_trace_machine),
+#endif
+TEST_CASE(ut_state_latency_histogram),
+#if STATE_MACHINE_TIMERS
+TEST_CASE(ut_state_timer_wheel),
+TEST_CASE(ut_state_timer_cursor),
+TEST_CASE(ut_state_timer_wheel_many),
+#endif
+TEST_CASE(ut_state_snapshot),
+TEST_CASE(ut_state_snapshot_dirty_storage),
+TEST_CASE(ut_state_fleet_snapshot),
+#if STATE_MACHINE_COROUTINES
+TEST_CASE(ut_state_coroutine),
+#endif
+#if STATE_MACHINE_TYPED_EVENTS
+TEST_CASE(ut_state_transition_table),
+TEST_CASE(ut_state_scxml),
+#endif
+TEST_CASE(ut_state_handle),
+#if STATE_MACHINE_EVENT_CLASSES
+TEST_CASE(ut_state_regions),
+#endif
+TEST_CASE(ut_state_regions_entry_ops),
+#if STATE_MACHINE_HISTORY
+TEST_CASE(ut_state_history),
+#endif
+TEST_CASE(ut_state_vm_ambiguity),
+TEST_CASE(ut_state_bits),
+TEST_CASE(ut_state_exit_frames),
+TEST_CASE(ut_state_typed),
+TEST_CASE(ut_state_event_pairs),
+#if STATE_MACHINE_PROFILE
+TEST_CASE(ut_state_profile_machine),
+#endif
 TEST_CASE_END
 } // namespace Mark3
@@ -0,0 +1,423 @@
+#!/usr/bin/env python3
+# ===========================================================================
+#      _____        _____        _____        _____
+#  ___|    _|__  __|_    |__  __|__   |__  __| __  |__  ______
+# |    \  /  | ||    \      ||     |     ||  |/ /     ||___   |
+# |     \/   | ||     \     ||     \     ||     \     ||___   |
+# |__/\__/|__|_||__|\__\  __||__|\__\  __||__|\__\  __||______|
+#     |_____|      |_____|      |_____|      |_____|
+#
+# --[Mark3 Realtime Platform]--------------------------------------------------
+#
+# Copyright (c) 2017 - 2018 m0slevin, all rights reserved.
+# See license.txt for more information
+# ===========================================================================
+"""Generate Mark3::StateMachine tables from an SCXML model.
+
+Usage: scxml_gen.py [options] model.scxml -o model.h
+
+The generated header holds, in the model's namespace:
+
+  - StateId: enum of the machine's states, in table order
+  - EventId: enum of the events the machine handles
+  - declarations of the guard, action, entry and exit functions the model
+    refers to, which the application defines
+  - a handler for each state and event it handles, which tries the
+    state's transitions for the event in priority order, calling guards and
+    actions directly
+  - astStates: the State_t table
+  - astEventMaps: per-state event maps holding the handlers, indexed by
+    event ID (see StateEventMap_t)
+  - Bind(): attaches the tables to a StateMachine
+
+Events are then delivered with StateMachine::HandleEvent(EventId, pvEvent),
+costing one indexed load and call per state - the same as a hand-written
+pfRun switch.  Actions run before the source state's exit handler.  The
+library must be built with STATE_MACHINE_TYPED_EVENTS enabled.
+
+Supported SCXML:
+
+  - <state> and <final>, nested to any depth.  Compound states are
+    flattened: a transition into a compound state enters its initial leaf,
+    and leaves inherit the transitions of their ancestors, after their own.
+    Compound states may not have <onentry>/<onexit>.
+  - <transition event="a b" cond="guard" target="state">, with an optional
+    <script>action</script> child naming the action function.  A transition
+    without a target is internal (runs its action without changing state).
+    Events are matched exactly (no prefix or wildcard matching), and
+    eventless transitions are not supported.
+  - <onentry>/<onexit> holding <script>function</script>.
+
+The initial state is always placed first in the table (Begin() enters
+state 0), followed by the states listed with --hot, then the remaining
+states in breadth-first order from the initial state.  States that cannot
+be reached from the initial state are pruned.  Events are numbered from the
+most to the least frequently handled, so that --dense can keep the rarest
+events out of the dense table.
+"""
+
+import argparse
+import collections
+import os
+import re
+import sys
+import xml.etree.ElementTree as ElementTree
+
+SCXML_NS = "{http://www.w3.org/2005/07/scxml}"
+
+
+class ModelError(Exception):
+    pass
+
+
+def local_name(element):
+    tag = element.tag
+    if tag.startswith(SCXML_NS):
+        return tag[len(SCXML_NS):]
+    return tag
+
+
+def identifier(name, what):
+    ident = re.sub(r"[^0-9A-Za-z_]", "_", name)
+    if not ident or ident[0].isdigit():
+        raise ModelError("%s '%s' does not map to a C++ identifier" % (what, name))
+    return ident
+
+
+def script_name(element, what):
+    """Return the function named by an element's <script> child, if any."""
+    scripts = [child for child in element if local_name(child) == "script"]
+    if not scripts:
+        return None
+    if len(scripts) > 1:
+        raise ModelError("%s holds more than one <script>" % what)
+    text = (scripts[0].text or "").strip()
+    if not re.match(r"^[A-Za-z_][0-9A-Za-z_]*$", text):
+        raise ModelError("%s <script> must name a function, not '%s'" % (what, text))
+    return text
+
+
+class State(object):
+    def __init__(self, element, parent):
+        self.id = element.get("id")
+        if not self.id:
+            raise ModelError("<%s> without an id" % local_name(element))
+        self.name = identifier(self.id, "State")
+        self.parent = parent
+        self.children = []
+        self.initial = element.get("initial")
+        self.transitions = []
+        self.entry = None
+        self.exit = None
+
+
+class Transition(object):
+    def __init__(self, events, guard, action, target):
+        self.events = events
+        self.guard = guard
+        self.action = action
+        self.target = target
+
+
+class Model(object):
+    def __init__(self, root):
+        if local_name(root) != "scxml":
+            raise ModelError("Root element must be <scxml>")
+        self.name = root.get("name")
+        self.states = collections.OrderedDict()
+        self.top = []
+        for child in root:
+            if local_name(child) in ("state", "final"):
+                self.top.append(self.parse_state(child, None))
+            elif local_name(child) == "parallel":
+                raise ModelError("<parallel> states are not supported")
+        if not self.top:
+            raise ModelError("Model has no states")
+        initial = root.get("initial") or self.top[0].id
+        self.initial = self.leaf(initial)
+
+    def parse_state(self, element, parent):
+        state = State(element, parent)
+        if state.id in self.states:
+            raise ModelError("Duplicate state '%s'" % state.id)
+        self.states[state.id] = state
+        what = "State '%s'" % state.id
+        for child in element:
+            kind = local_name(child)
+            if kind in ("state", "final"):
+                state.children.append(self.parse_state(child, state))
+            elif kind == "parallel":
+                raise ModelError("<parallel> states are not supported")
+            elif kind == "onentry":
+                state.entry = script_name(child, what + " <onentry>")
+            elif kind == "onexit":
+                state.exit = script_name(child, what + " <onexit>")
+            elif kind == "transition":
+                state.transitions.append(self.parse_transition(child, what))
+        if state.children and (state.entry or state.exit):
+            raise ModelError("%s is compound, and may not have <onentry>/<onexit>" % what)
+        return state
+
+    @staticmethod
+    def parse_transition(element, what):
+        events = (element.get("event") or "").split()
+        if not events:
+            raise ModelError("%s has an eventless transition" % what)
+        for event in events:
+            if "*" in event:
+                raise ModelError("%s uses a wildcard event '%s'" % (what, event))
+        guard = element.get("cond")
+        if guard is not None and not re.match(r"^[A-Za-z_][0-9A-Za-z_]*$", guard):
+            raise ModelError("%s cond must name a function, not '%s'" % (what, guard))
+        target = element.get("target")
+        if target is not None and len(target.split()) != 1:
+            raise ModelError("%s transition must have a single target" % what)
+        return Transition(events, guard, script_name(element, what + " <transition>"), target)
+
+    def leaf(self, state_id):
+        """Resolve a state to the leaf entered when it is targeted."""
+        if state_id not in self.states:
+            raise ModelError("Unknown state '%s'" % state_id)
+        state = self.states[state_id]
+        while state.children:
+            initial = state.initial or state.children[0].id
+            if initial not in self.states or self.states[initial].parent is not state:
+                raise ModelError("State '%s' has invalid initial state '%s'" % (state.id, initial))
+            state = self.states[initial]
+        return state
+
+    def rows(self, state):
+        """Transitions of a leaf - its own first, then its ancestors'."""
+        rows = []
+        scope = state
+        while scope is not None:
+            for transition in scope.transitions:
+                target = self.leaf(transition.target) if transition.target is not None else None
+                for event in transition.events:
+                    rows.append((event, transition.guard, transition.action, target))
+            scope = scope.parent
+        return rows
+
+
+def generate(model, namespace, hot, dense, source):
+    # Reachable leaves, breadth-first from the initial state
+    order = [model.initial]
+    queue = collections.deque(order)
+    while queue:
+        state = queue.popleft()
+        for _, _, _, target in model.rows(state):
+            if target is not None and target not in order:
+                order.append(target)
+                queue.append(target)
+
+    # Hot states go straight after the initial state
+    for name in reversed(hot):
+        if name not in model.states:
+            raise ModelError("Unknown hot state '%s'" % name)
+        state = model.states[name]
+        if state.children:
+            raise ModelError("Hot state '%s' is compound" % name)
+        if state in order and state is not model.initial:
+            order.remove(state)
+            order.insert(1, state)
+    index = dict((state, i) for i, state in enumerate(order))
+
+    # Events, most frequently handled first
+    counts = collections.OrderedDict()
+    for state in order:
+        for event, _, _, _ in model.rows(state):
+            counts[event] = counts.get(event, 0) + 1
+    events = sorted(counts, key=lambda event: -counts[event])
+    event_names = [identifier(event, "Event") for event in events]
+    if len(set(event_names)) != len(event_names):
+        raise ModelError("Event names collide once mapped to C++ identifiers")
+    event_ids = dict((event, i) for i, event in enumerate(events))
+    if dense is None or dense > len(events):
+        dense = len(events)
+
+    # Each state's transitions, grouped by event in priority order
+    handlers = []
+    for state in order:
+        cells = collections.OrderedDict()
+        for event, guard, action, target in model.rows(state):
+            cells.setdefault(event, []).append((guard, action, target))
+        handlers.append(cells)
+
+    guards = sorted(set(g for cells in handlers for rows in cells.values() for g, _, _ in rows if g))
+    actions = sorted(set(a for cells in handlers for rows in cells.values() for _, a, _ in rows if a))
+    changes = sorted(set(f for state in order for f in (state.entry, state.exit) if f))
+    overlap = (set(guards) & set(actions)) | (set(guards) & set(changes)) | (set(actions) & set(changes))
+    if overlap:
+        raise ModelError("Functions used with different signatures: %s" % ", ".join(sorted(overlap)))
+    identifiers = [state.name for state in order] + event_names + guards + actions + changes
+    clashes = sorted(set(name for name in identifiers if identifiers.count(name) > 1))
+    if clashes:
+        raise ModelError("Names used for more than one state, event or function: %s" % ", ".join(clashes))
+
+    def function(name):
+        return "&" + name if name else "nullptr"
+
+    def handler(state, event):
+        return "%s_%s" % (state.name, event_names[event_ids[event]])
+
+    out = []
+    out.append("// Generated by tools/scxml_gen.py from %s - do not edit." % source)
+    out.append("#pragma once")
+    out.append("")
+    out.append('#include "state_machine.h"')
+    out.append("")
+    out.append("namespace %s" % namespace)
+    out.append("{")
+    out.append("enum StateId : Mark3::StateIndex_t {")
+    for state in order:
+        out.append("    %s," % state.name)
+    out.append("    state_count")
+    out.append("};")
+    out.append("")
+    out.append("enum EventId : uint16_t {")
+    for name in event_names:
+        out.append("    %s," % name)
+    out.append("    event_count")
+    out.append("};")
+    out.append("")
+    out.append("// Events with IDs below this are dispatched by direct lookup")
+    out.append("const uint16_t u16DenseEvents = %d;" % dense)
+    out.append("")
+    if guards or actions or changes:
+        out.append("// Defined by the application")
+        for name in guards:
+            out.append("bool %s(Mark3::StateMachine* pclSM_, const void* pvEvent_);" % name)
+        for name in actions:
+            out.append("void %s(Mark3::StateMachine* pclSM_, const void* pvEvent_);" % name)
+        for name in changes:
+            out.append("void %s(Mark3::StateMachine* pclSM_);" % name)
+        out.append("")
+
+    # One handler per state and event, trying each transition in turn.
+    # States sharing a response to an event (i.e. inherited from a common
+    # ancestor) share a handler.
+    out.append("namespace Handlers")
+    out.append("{")
+    out.append("inline Mark3::StateReturn Unhandled(Mark3::StateMachine* /*pclSM_*/, const void* /*pvEvent_*/)")
+    out.append("{")
+    out.append("    return Mark3::StateReturn::unhandled;")
+    out.append("}")
+    out.append("")
+    bodies = {}
+    names = {}
+    for state, cells in zip(order, handlers):
+        for event, rows in cells.items():
+            body = []
+            for guard, action, target in rows:
+                indent = "    "
+                if guard:
+                    body.append("    if (%s(pclSM_, pvEvent_)) {" % guard)
+                    indent = "        "
+                if action:
+                    body.append("%s%s(pclSM_, pvEvent_);" % (indent, action))
+                if target is not None:
+                    body.append("%sreturn pclSM_->TransitionState(%s) ? Mark3::StateReturn::transition"
+                                " : Mark3::StateReturn::ok;" % (indent, target.name))
+                else:
+                    body.append("%sreturn Mark3::StateReturn::ok;" % indent)
+                if not guard:
+                    break
+                body.append("    }")
+            else:
+                body.append("    return Mark3::StateReturn::unhandled;")
+            body = "\n".join(body)
+            if body in bodies:
+                names[(state, event)] = bodies[body]
+                continue
+            name = handler(state, event)
+            bodies[body] = name
+            names[(state, event)] = name
+            uses_sm = "pclSM_" in body
+            uses_event = "pvEvent_" in body
+            out.append("inline Mark3::StateReturn %s(Mark3::StateMachine* %s, const void* %s)"
+                       % (name, "pclSM_" if uses_sm else "/*pclSM_*/", "pvEvent_" if uses_event else "/*pvEvent_*/"))
+            out.append("{")
+            out.append(body)
+            out.append("}")
+            out.append("")
+
+    for state, cells in zip(order, handlers):
+        dense_events = [e for e in cells if event_ids[e] < dense]
+        sparse_events = sorted((e for e in cells if event_ids[e] >= dense), key=lambda e: event_ids[e])
+        if dense_events:
+            width = max(event_ids[e] for e in dense_events) + 1
+            slots = ["nullptr"] * width
+            for event in dense_events:
+                slots[event_ids[event]] = "&" + names[(state, event)]
+            out.append("constexpr Mark3::StateHandler_t apf_%s[%d] = {" % (state.name, width))
+            out.extend("    %s," % slot for slot in slots)
+            out.append("};")
+        if sparse_events:
+            out.append("constexpr Mark3::StateEventHandler_t ast_%s[%d] = {" % (state.name, len(sparse_events)))
+            for event in sparse_events:
+                out.append("    {%s, &%s}," % (event_names[event_ids[event]], names[(state, event)]))
+            out.append("};")
+        if dense_events or sparse_events:
+            out.append("")
+    out.append("} // namespace Handlers")
+    out.append("")
+
+    out.append("constexpr Mark3::State_t astStates[state_count] = {")
+    for state in order:
+        out.append("    {%s, &Handlers::Unhandled, %s}, // %s"
+                   % (function(state.entry), function(state.exit), state.id))
+    out.append("};")
+    out.append("")
+    out.append("constexpr Mark3::StateEventMap_t astEventMaps[state_count] = {")
+    for state, cells in zip(order, handlers):
+        dense_count = max([event_ids[e] + 1 for e in cells if event_ids[e] < dense] or [0])
+        sparse_count = len([e for e in cells if event_ids[e] >= dense])
+        out.append("    {%s, %d, %s, %d, nullptr}, // %s"
+                   % ("Handlers::apf_" + state.name if dense_count else "nullptr", dense_count,
+                      "Handlers::ast_" + state.name if sparse_count else "nullptr", sparse_count, state.id))
+    out.append("};")
+    out.append("")
+    out.append("// Attach the tables to a machine")
+    out.append("inline bool Bind(Mark3::StateMachine* pclSM_)")
+    out.append("{")
+    out.append("    if (!pclSM_->SetStates(astStates, state_count)) {")
+    out.append("        return false;")
+    out.append("    }")
+    out.append("    pclSM_->SetEventMaps(astEventMaps);")
+    out.append("    return true;")
+    out.append("}")
+    out.append("} // namespace %s" % namespace)
+    out.append("")
+    return "\n".join(out)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Generate Mark3::StateMachine tables from an SCXML model.")
+    parser.add_argument("model", help="SCXML model to read")
+    parser.add_argument("-o", "--output", required=True, help="C++ header to write")
+    parser.add_argument("-n", "--namespace", help="Namespace of the generated code (default: the model's name)")
+    parser.add_argument("--hot", default="", help="Comma-separated states to place first in the table")
+    parser.add_argument("--dense", type=int, help="Number of events held in the dense table (default: all)")
+    args = parser.parse_args(argv)
+
+    try:
+        model = Model(ElementTree.parse(args.model).getroot())
+        namespace = args.namespace or model.name
+        if not namespace:
+            raise ModelError("Model has no name; pass --namespace")
+        namespace = identifier(namespace, "Namespace")
+        hot = [name for name in args.hot.split(",") if name]
+        if args.dense is not None and args.dense < 0:
+            raise ModelError("--dense must not be negative")
+        header = generate(model, namespace, hot, args.dense, os.path.basename(args.model))
+    except (ModelError, ElementTree.ParseError) as error:
+        sys.stderr.write("%s: %s\n" % (args.model, error))
+        return 1
+
+    with open(args.output, "w") as output:
+        output.write(header)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))